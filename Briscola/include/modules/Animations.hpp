@@ -1,3 +1,8 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
 
 struct AnimFrame {
 	float time;
@@ -6,12 +11,60 @@ struct AnimFrame {
 	glm::vec3 S;
 };
 
+// Compressed tracks: the times of the keyframes are shared by all the tracks of
+// a clip, constant components are stored once, translations and scales are
+// quantized to 16 bits in the range of the track, and rotations use 48 bits
+// (the three smallest components). Keyframes that can be interpolated from
+// their neighbours within the tolerance are dropped: Keys lists the kept ones.
+enum AnimTrackConst {ANIM_CONST_T = 1, ANIM_CONST_Q = 2, ANIM_CONST_S = 4};
+
+// Largest error of the packed tracks, per channel: translation in the units of
+// the model, rotation in radians, scale as a factor. Negative: not packed
+struct AnimTolerance {
+	float T, Q, S;
+
+	AnimTolerance(float all = -1.0f) : T(all), Q(all), S(all) {}
+	AnimTolerance(float t, float q, float s) : T(t), Q(q), S(s) {}
+	bool packs() const {return (T >= 0.0f) && (Q >= 0.0f) && (S >= 0.0f);}
+	bool operator==(const AnimTolerance &o) const {return (T == o.T) && (Q == o.Q) && (S == o.S);}
+};
+
+// Position of the playback in a track: the keyframe found by the last sample,
+// and in a packed track the kept keyframe at or before it
+struct AnimCursor {
+	int frame = -1;
+	int key = 0;
+};
+
 struct AnimTrack {
 	int nKeyFrames;
 	std::vector<AnimFrame> Frames;
-	void getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float t, int sf, int ef, bool loop);
-	glm::mat4 Sample(float t, int sf, int ef, bool loop);
-	glm::mat4 Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B = nullptr);
+
+	bool packed = false;
+	const float *Times = nullptr;
+	int constMask = 0;
+	glm::vec3 Tmin, Trange, Smin, Srange;
+	glm::quat Qconst;
+	std::vector<uint16_t> Keys;         // kept keyframes, empty if all are kept
+	std::vector<uint16_t> Tq, Qq, Sq;   // three values per kept keyframe
+
+	// builds the compressed form from Frames, and releases them
+	void pack(const float *times, AnimTolerance tolerance);
+	size_t memoryBytes();
+	float keyTime(int i) {return packed ? Times[i] : Frames[i].time;}
+	// key, if given, is the kept keyframe found last: the search for the kept
+	// keyframes around i starts from it, and it is moved there
+	void keyTransforms(int i, glm::vec3 &T, glm::quat &Q, glm::vec3 &S, int *key = nullptr);
+	// the transforms stored for the kept keyframe k
+	void keptTransforms(int k, glm::vec3 &T, glm::quat &Q, glm::vec3 &S);
+	// start and end time of the loop over the keyframes from sf to ef (ef < 0
+	// counts from the end, and is returned resolved)
+	void loopRange(int sf, int &ef, float &firstT, float &lastT);
+	// cursor, if given, caches the last keyframe found: it is checked first, and
+	// then moved forward, so sampling at increasing times needs no search
+	void getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float t, int sf, int ef, bool loop, AnimCursor *cursor = nullptr);
+	glm::mat4 Sample(float t, int sf, int ef, bool loop, AnimCursor *cursor);
+	glm::mat4 Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B = nullptr, AnimCursor *cursorA = nullptr, AnimCursor *cursorB = nullptr);
 };
 
 struct AnimBlendSegment {
@@ -29,12 +82,17 @@ struct AnimBlender {
 	int prev;
 	float blendTime;
 	float blendPos;
+
+	// cached keyframe cursors of each track, for the current and previous segment
+	std::vector<AnimCursor> curCursors;
+	std::vector<AnimCursor> prevCursors;
 	
 	void init(std::vector<AnimBlendSegment> seg);
 	void Advance(float dt);
 	void Start(int seg, float blendT);
-	glm::mat4 Sample(AnimTrack *AT, AnimTrack *AT2 = nullptr);
-	glm::mat4 Sample(std::vector<AnimTrack *> *AT);
+	// track is the index of the track in the skeleton, used to keep its cursors (-1: none)
+	glm::mat4 Sample(AnimTrack *AT, AnimTrack *AT2 = nullptr, int track = -1);
+	glm::mat4 Sample(std::vector<AnimTrack *> *AT, int track = -1);
 };
 
 class SkeletalAnimation;
@@ -45,9 +103,20 @@ class Animations {
 	
 	AssetFile *AF;
 	std::unordered_map<std::string, AnimTrack *> GLTFanims;
+	std::vector<std::vector<float> *> TimeArrays;   // keyframe times of the packed clips
+
+	// hash of the animation data of the asset, stored in the packed file to
+	// detect that the asset changed after the file was written
+	uint64_t sourceHash();
+	bool loadPacked(std::string file, AnimTolerance tolerance);
+	void savePacked(std::string file, AnimTolerance tolerance);
 
 	public:
-	void init(AssetFile &A);
+	// a negative tolerance keeps the tracks uncompressed; a single value is
+	// used for all the channels. With a packedFile, the compressed tracks are
+	// loaded from it if it was built from the same animations with the same
+	// tolerances, or built and saved there
+	void init(AssetFile &A, AnimTolerance tolerance = AnimTolerance(), std::string packedFile = "");
 	void cleanup();
 	AnimTrack *getAnim(std::string N);
 };
@@ -64,46 +133,223 @@ class SkeletalAnimation {
 	std::vector<int> ATsNodeId;
 	int NTMs;
 	std::vector<glm::mat4> oTMs;
-	std::vector<glm::mat4> TMs;
 	std::vector<glm::mat4> BaseTMs;
 	std::vector<glm::mat4> IBMs;
 	std::unordered_map<int,int> NidDec;
 
+	// joints flattened in topological order (parents before children): node,
+	// position of the parent joint (-1 for the roots), position in oTMs, inverse
+	// bind matrix, and the local to model transform computed by Sample
+	std::vector<int> JointNode;
+	std::vector<int> JointParent;
+	std::vector<int> JointOut;
+	std::vector<glm::mat4> JointIBM;
+	std::vector<glm::mat4> JointModel;
+
+	// tracks of the detail joints (fingers, face, toes), skipped at low LOD
+	std::vector<char> TrackDetail;
+
 
 	public:
 	void init(Animations *_anims, int _NAnims, std::string BaseTrackName, int SkinId = 0);
 	void cleanup();
 	std::vector<glm::mat4> *getTransformMatrices();
-	void Sample(AnimBlender &AB);
+	// detail joints are the ones whose chain of descendants, in the bind pose,
+	// is shorter than fraction times the size of the skeleton
+	int setDetailJoints(float fraction);
+	// without detail, the tracks of the detail joints keep their last value
+	void Sample(AnimBlender &AB, bool detail = true);
+	int getNTMs();
+	// length of the loop of a segment, from its first track
+	float getLoopTime(const AnimBlendSegment &seg);
+};
+
+// A looping segment sampled in advance at a fixed rate. Frames holds the joint
+// matrices of every baked frame, contiguous, as three vec4 rows per joint in
+// model space. Playback runs on the CPU and interpolates between two baked
+// frames: the result goes through AnimCrowd to the palettes like a live pose.
+class BakedClip {
+	int NTMs = 0;
+	int NFrames = 0;
+	float Duration = 0.0f;
+	std::vector<glm::vec4> Frames;
+
+	public:
+	// samples seg with SA, whose pose is changed
+	void bake(SkeletalAnimation &SA, AnimBlendSegment seg, float rate);
+	// joint matrices at time t, from the start of the loop
+	void sample(float t, glm::mat4 *out);
+	float getDuration();
+	int getFrames();
+	size_t memoryBytes();
+};
+
+// Level of detail of the characters of an AnimCrowd, from a distance from the eye
+struct AnimLODLevel {
+	float distance;
+	int period;     // the pose is sampled every period frames, and interpolated in between
+	bool detail;    // whether the detail joints are sampled
+};
+
+// Poses of several characters playing the clips of the same Animations, each
+// with its own blender and placement. update() samples and blends them on a
+// pool of worker threads (the calling thread helps too), and every thread
+// writes the joint matrices of its characters straight into the destination
+// buffers: either a skinning palette of getNTMs() row-major 3x4 matrices
+// (World * joint, three vec4 rows each), or mvpMat, mMat and nMat arrays of
+// getNTMs() matrices at the given byte offsets.
+class AnimCrowd {
+	Animations *anims;
+	int NAnims;
+	std::string BaseTrackName;
+	int SkinId;
+
+	std::vector<AnimBlender> ABs;
+	std::vector<SkeletalAnimation> SAs;
+	std::vector<glm::mat4> Worlds;
+
+	// LOD: the levels sorted by distance, and for every character the time not
+	// yet given to its blender, the frames since it was sampled, and the two
+	// last sampled poses to interpolate
+	std::vector<AnimLODLevel> LODs;
+	float DetailFraction = 0.0f;
+	glm::vec3 Eye = glm::vec3(0);
+	std::vector<float> LODdt;
+	std::vector<int> LODphase;
+	std::vector<std::vector<glm::mat4>> PrevPoses, NextPoses;
+	std::vector<glm::mat4> Poses;
+
+	// characters playing a baked clip instead of their blender
+	std::vector<BakedClip *> Baked;
+	std::vector<float> BakedT;
+
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable startCV, doneCV;
+	int generation = 0;
+	int running = 0;
+	bool quit = false;
+	std::atomic<int> nextChar;
+	Profiler *Prof = nullptr;
+
+	// the frame being evaluated
+	float jobDt;
+	glm::mat4 jobViewPrj;
+	void * const *jobDst;
+	bool jobPalette;
+	size_t jobMvp, jobM, jobN;
+
+	const glm::mat4 *pose(int c);
+	void evaluate(int c);
+	void drain();
+	void run();
+	void workerLoop();
+
+	public:
+	// threads < 0 uses one thread per core, 0 evaluates on the calling thread only
+	void init(Animations *_anims, int _NAnims, std::string _BaseTrackName, int threads = -1, int _SkinId = 0);
+	void cleanup();
+	// returns the index of the new character
+	int add(std::vector<AnimBlendSegment> segments, glm::mat4 World = glm::mat4(1));
+	AnimBlender &getBlender(int c);
+	void setWorld(int c, const glm::mat4 &World);
+	int size();
 	int getNTMs();
+	// characters beyond levels[l].distance from eye use level l; with no levels,
+	// every character is sampled every frame with all its joints. A level with
+	// period p shows the pose p - 1 frames late (50 ms for p = 4 at 60 Hz):
+	// after each sample, the pose moves from the previous sample to the new one,
+	// which it reaches on the last frame before the next sample
+	void setLOD(std::vector<AnimLODLevel> levels, float detailFraction = 0.05f);
+	void setEye(const glm::vec3 &eye);
+	// plays clip from its start, in a loop, until it is set back to nullptr
+	void setBaked(int c, BakedClip *clip);
+	// the jobs of the threads are added to the traces recorded by P
+	void setProfiler(Profiler *P);
+	// advance the blenders by dt and write the pose of character c at dst[c]
+	void updatePalette(float dt, void * const *dst);
+	void update(float dt, const glm::mat4 &ViewPrj, void * const *dst, size_t mvpOffset, size_t mOffset, size_t nOffset);
 };
 
 
 #ifdef ANIMATIONS_IMPLEMENTATION
 
-AnimTrack *Animations::getAnim(std::string N) {return GLTFanims[N];}
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+  #include <emmintrin.h>
+#elif defined(__aarch64__)
+  #include <arm_neon.h>
+#endif
 
-void AnimTrack::getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float tin, int sf, int ef, bool loop) {
-	glm::vec3 T0, T1;
-	glm::quat Q0, Q1;
-	glm::vec3 S0, S1;
+// R = A * B, one column of R per combination of the columns of A. R must not
+// alias A or B. Products and sums are separate and in the order of glm's
+// operator*, so the result is the same as glm's unless the compiler contracts
+// them into FMAs (see -ffp-contract): then they differ by rounding only
+static inline void mulJointMat(const glm::mat4 &A, const glm::mat4 &B, glm::mat4 &R) {
+	const float *a = &A[0][0], *b = &B[0][0];
+	float *r = &R[0][0];
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+	__m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+	for(int j = 0; j < 4; j++) {
+		const float *bj = b + 4 * j;
+		__m128 c = _mm_add_ps(_mm_mul_ps(a0, _mm_set1_ps(bj[0])), _mm_mul_ps(a1, _mm_set1_ps(bj[1])));
+		c = _mm_add_ps(c, _mm_mul_ps(a2, _mm_set1_ps(bj[2])));
+		c = _mm_add_ps(c, _mm_mul_ps(a3, _mm_set1_ps(bj[3])));
+		_mm_storeu_ps(r + 4 * j, c);
+	}
+#elif defined(__aarch64__)
+	float32x4_t a0 = vld1q_f32(a), a1 = vld1q_f32(a + 4), a2 = vld1q_f32(a + 8), a3 = vld1q_f32(a + 12);
+	for(int j = 0; j < 4; j++) {
+		float32x4_t bj = vld1q_f32(b + 4 * j);
+		float32x4_t c = vaddq_f32(vmulq_laneq_f32(a0, bj, 0), vmulq_laneq_f32(a1, bj, 1));
+		c = vaddq_f32(c, vmulq_laneq_f32(a2, bj, 2));
+		c = vaddq_f32(c, vmulq_laneq_f32(a3, bj, 3));
+		vst1q_f32(r + 4 * j, c);
+	}
+#else
+	R = A * B;
+#endif
+}
 
+AnimTrack *Animations::getAnim(std::string N) {return GLTFanims[N];}
+
+void AnimTrack::loopRange(int sf, int &ef, float &firstT, float &lastT) {
 	if(ef < 0) {
 		ef = ef + nKeyFrames + 1;
 	}
 	ef = ((ef < nKeyFrames) ? ef : nKeyFrames);
 	
-	float firstT = Frames[sf].time;
-	float lastT = (ef >= nKeyFrames) ? 2 * Frames[nKeyFrames-1].time - Frames[nKeyFrames-2].time : Frames[ef].time;
+	firstT = keyTime(sf);
+	lastT = (ef >= nKeyFrames) ? 2 * keyTime(nKeyFrames-1) - keyTime(nKeyFrames-2) : keyTime(ef);
+}
+
+void AnimTrack::getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, float tin, int sf, int ef, bool loop, AnimCursor *cursor) {
+	glm::vec3 T0, T1;
+	glm::quat Q0, Q1;
+	glm::vec3 S0, S1;
+
+	float firstT, lastT;
+	loopRange(sf, ef, firstT, lastT);
 	float interT = lastT - firstT;
 	
 	float t = fmod(tin, interT) + firstT;
 	int srcl = sf, srcr = ef;
+	if(cursor != nullptr && cursor->frame >= sf && cursor->frame < ef) {
+		// playback moves forward: the cached keyframe, or one of the next few,
+		// usually contains t. After a wrap around the search restarts from sf
+		int c = (t < keyTime(cursor->frame)) ? sf : cursor->frame;
+		for(int steps = 0; steps < 4; steps++) {
+			if(t <= ((c + 1 < ef) ? keyTime(c + 1) : lastT)) {
+				srcl = srcr = c;
+				break;
+			}
+			c++;
+		}
+	}
 	while(srcl + 1 < srcr) {
 		int srctst = (srcr + srcl) >> 1;
 //std::cout << srcl << " " << srctst << " " << srcr << "\n";
-		if(t < Frames[srctst].time) {srcr = srctst;}
-		else if(t > ((srctst + 1 < ef) ? Frames[srctst + 1].time : lastT)) {srcl = srctst + 1;}
+		if(t < keyTime(srctst)) {srcr = srctst;}
+		else if(t > ((srctst + 1 < ef) ? keyTime(srctst + 1) : lastT)) {srcl = srctst + 1;}
 		else {srcl = srcr = srctst;}
 	}
 //std::cout << "Found: " << srcl << " " << srcr << " " << Frames[srcl].time << " " << t << " " << ((srcl + 1 < ef) ? Frames[srcl + 1].time : lastT) << "\n";
@@ -111,10 +357,17 @@ void AnimTrack::getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, fl
 
 	int fi0 = srcl;
 	int fi1 = (srcl + 1 < ef) ? (srcl + 1) : sf;
+	int *key = nullptr, key1 = 0;
+	if(cursor != nullptr) {
+		cursor->frame = fi0;
+		key = &cursor->key;
+	}
 	
-	AnimFrame F0 = Frames[fi0]; T0 = F0.T; Q0 = F0.Q; S0 = F0.S;
-	AnimFrame F1 = Frames[fi1]; T1 = F1.T; Q1 = F1.Q; S1 = F1.S;
-	float alpha = (t - F0.time) / (((fi0 + 1 < ef) ? F1.time : lastT) - F0.time);
+	keyTransforms(fi0, T0, Q0, S0, key);
+	// the kept keyframe of fi0 is also the one at or before fi1, unless it wraps around
+	key1 = (key != nullptr) ? *key : 0;
+	keyTransforms(fi1, T1, Q1, S1, (key != nullptr) ? &key1 : nullptr);
+	float alpha = (t - keyTime(fi0)) / (((fi0 + 1 < ef) ? keyTime(fi1) : lastT) - keyTime(fi0));
 	
 //	std::cout << "alpha: " << alpha << "\n";
 
@@ -124,13 +377,197 @@ void AnimTrack::getSampleTransforms(glm::vec3 &T, glm::quat &Q, glm::vec3 &S, fl
 	
 }
 
-glm::mat4 AnimTrack::Sample(float tin, int sf=0, int ef=-1, bool loop = false) {
+static void packQuat(glm::quat q, uint16_t *out) {
+	float c[4] = {q.x, q.y, q.z, q.w};
+	int big = 0;
+	for(int i = 1; i < 4; i++) {
+		if(fabs(c[i]) > fabs(c[big])) big = i;
+	}
+	float sgn = (c[big] < 0) ? -1.0f : 1.0f;
+	uint64_t bits = big;
+	int shift = 2;
+	for(int i = 0; i < 4; i++) {
+		if(i == big) continue;
+		// the other components are within +/- 1/sqrt(2)
+		float v = glm::clamp((sgn * c[i] * 1.41421356f + 1.0f) * 0.5f, 0.0f, 1.0f);
+		bits |= (uint64_t)(v * 32767.0f + 0.5f) << shift;
+		shift += 15;
+	}
+	out[0] = bits & 0xffff;
+	out[1] = (bits >> 16) & 0xffff;
+	out[2] = (bits >> 32) & 0xffff;
+}
+
+static glm::quat unpackQuat(const uint16_t *in) {
+	uint64_t bits = (uint64_t)in[0] | ((uint64_t)in[1] << 16) | ((uint64_t)in[2] << 32);
+	int big = bits & 3;
+	float c[4];
+	float sum = 0.0f;
+	int shift = 2;
+	for(int i = 0; i < 4; i++) {
+		if(i == big) continue;
+		c[i] = (((bits >> shift) & 0x7fff) / 32767.0f * 2.0f - 1.0f) * 0.70710678f;
+		sum += c[i] * c[i];
+		shift += 15;
+	}
+	c[big] = sqrt(std::max(0.0f, 1.0f - sum));
+	return glm::quat(c[3], c[0], c[1], c[2]);
+}
+
+// Angle between two rotations, from the chord between the unit quaternions:
+// unlike acos of their dot product, it stays accurate for small angles
+static float quatAngle(glm::quat a, glm::quat b) {
+	float sgn = (a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w < 0.0f) ? -1.0f : 1.0f;
+	float dx = a.x - sgn * b.x, dy = a.y - sgn * b.y, dz = a.z - sgn * b.z, dw = a.w - sgn * b.w;
+	return 4.0f * asin(std::min(1.0f, 0.5f * sqrt(dx * dx + dy * dy + dz * dz + dw * dw)));
+}
+
+void AnimTrack::keyTransforms(int i, glm::vec3 &T, glm::quat &Q, glm::vec3 &S, int *key) {
+	if(!packed) {
+		T = Frames[i].T; Q = Frames[i].Q; S = Frames[i].S;
+		return;
+	}
+	if(Keys.empty()) {
+		keptTransforms(i, T, Q, S);
+		return;
+	}
+	int nk = (int)Keys.size();
+	int k = -1;
+	if(key != nullptr && *key >= 0 && *key < nk && Keys[*key] <= i) {
+		// as for the frames, the kept keyframe found last, or one of the next few
+		for(int c = *key, steps = 0; steps < 4; steps++, c++) {
+			if((c + 1 >= nk) || (Keys[c + 1] > i)) {
+				k = c;
+				break;
+			}
+		}
+	}
+	if(k < 0) {
+		k = (int)(std::upper_bound(Keys.begin(), Keys.end(), (uint16_t)i) - Keys.begin()) - 1;
+	}
+	if(key != nullptr) {
+		*key = k;
+	}
+	if(Keys[k] != i) {
+		// dropped keyframe: interpolated from the kept ones around it
+		glm::vec3 T0, T1, S0, S1;
+		glm::quat Q0, Q1;
+		int k0 = Keys[k], k1 = Keys[k + 1];
+		keptTransforms(k, T0, Q0, S0);
+		keptTransforms(k + 1, T1, Q1, S1);
+		float alpha = (Times[i] - Times[k0]) / (Times[k1] - Times[k0]);
+		T = T0 * (1.0f - alpha) + T1 * alpha;
+		Q = slerp(Q0, Q1, alpha);
+		S = S0 * (1.0f - alpha) + S1 * alpha;
+		return;
+	}
+	keptTransforms(k, T, Q, S);
+}
+
+void AnimTrack::keptTransforms(int k, glm::vec3 &T, glm::quat &Q, glm::vec3 &S) {
+	T = (constMask & ANIM_CONST_T) ? Tmin :
+		Tmin + Trange * glm::vec3(Tq[3*k], Tq[3*k+1], Tq[3*k+2]) * (1.0f / 65535.0f);
+	Q = (constMask & ANIM_CONST_Q) ? Qconst : unpackQuat(&Qq[3*k]);
+	S = (constMask & ANIM_CONST_S) ? Smin :
+		Smin + Srange * glm::vec3(Sq[3*k], Sq[3*k+1], Sq[3*k+2]) * (1.0f / 65535.0f);
+}
+
+void AnimTrack::pack(const float *times, AnimTolerance tolerance) {
+	int n = nKeyFrames;
+	if((n < 2) || (n > 65535)) {
+		return;
+	}
+
+	// constant components (within the tolerance), and ranges of the others
+	float constT = std::max(tolerance.T, 1e-6f);
+	float constQ = std::max(tolerance.Q, 1e-6f);
+	float constS = std::max(tolerance.S, 1e-6f);
+	glm::vec3 Tmax = Frames[0].T, Smax = Frames[0].S;
+	Tmin = Frames[0].T; Smin = Frames[0].S; Qconst = Frames[0].Q;
+	constMask = ANIM_CONST_T | ANIM_CONST_Q | ANIM_CONST_S;
+	for(int i = 0; i < n; i++) {
+		Tmin = glm::min(Tmin, Frames[i].T); Tmax = glm::max(Tmax, Frames[i].T);
+		Smin = glm::min(Smin, Frames[i].S); Smax = glm::max(Smax, Frames[i].S);
+		if(quatAngle(Frames[i].Q, Qconst) > constQ) constMask &= ~ANIM_CONST_Q;
+	}
+	Trange = Tmax - Tmin;
+	Srange = Smax - Smin;
+	if(glm::length(Trange) > 2.0f * constT) constMask &= ~ANIM_CONST_T;
+	else Tmin += Trange * 0.5f;
+	if(glm::length(Srange) > 2.0f * constS) constMask &= ~ANIM_CONST_S;
+	else Smin += Srange * 0.5f;
+
+	// greedy keyframe reduction: each kept keyframe extends its segment as long
+	// as all the keyframes skipped are interpolated within the tolerance
+	std::vector<uint16_t> kept = {0};
+	if((tolerance.T > 0.0f) || (tolerance.Q > 0.0f) || (tolerance.S > 0.0f)) {
+		int a = 0;
+		while(a < n - 1) {
+			int b = a + 1;
+			while(b + 1 < n) {
+				int c = b + 1;
+				bool ok = true;
+				for(int i = a + 1; i < c && ok; i++) {
+					float alpha = (times[i] - times[a]) / (times[c] - times[a]);
+					glm::vec3 T = Frames[a].T * (1.0f - alpha) + Frames[c].T * alpha;
+					glm::vec3 S = Frames[a].S * (1.0f - alpha) + Frames[c].S * alpha;
+					glm::quat Q = slerp(Frames[a].Q, Frames[c].Q, alpha);
+					ok = (glm::length(T - Frames[i].T) <= tolerance.T) &&
+						 (glm::length(S - Frames[i].S) <= tolerance.S) &&
+						 (quatAngle(Q, Frames[i].Q) <= tolerance.Q);
+				}
+				if(!ok) break;
+				b = c;
+			}
+			kept.push_back(b);
+			a = b;
+		}
+	} else {
+		for(int i = 1; i < n; i++) kept.push_back(i);
+	}
+
+	Keys.clear(); Tq.clear(); Qq.clear(); Sq.clear();
+	for(uint16_t k : kept) {
+		if(!(constMask & ANIM_CONST_T)) {
+			for(int c = 0; c < 3; c++) {
+				float v = (Trange[c] > 0.0f) ? (Frames[k].T[c] - Tmin[c]) / Trange[c] : 0.0f;
+				Tq.push_back((uint16_t)(v * 65535.0f + 0.5f));
+			}
+		}
+		if(!(constMask & ANIM_CONST_Q)) {
+			uint16_t q[3];
+			packQuat(Frames[k].Q, q);
+			Qq.insert(Qq.end(), q, q + 3);
+		}
+		if(!(constMask & ANIM_CONST_S)) {
+			for(int c = 0; c < 3; c++) {
+				float v = (Srange[c] > 0.0f) ? (Frames[k].S[c] - Smin[c]) / Srange[c] : 0.0f;
+				Sq.push_back((uint16_t)(v * 65535.0f + 0.5f));
+			}
+		}
+	}
+	if((int)kept.size() < n) {
+		Keys = kept;
+	}
+
+	Times = times;
+	packed = true;
+	Frames.clear();
+	Frames.shrink_to_fit();
+}
+
+size_t AnimTrack::memoryBytes() {
+	return sizeof(AnimTrack) + Frames.capacity() * sizeof(AnimFrame) +
+		   (Keys.capacity() + Tq.capacity() + Qq.capacity() + Sq.capacity()) * sizeof(uint16_t);
+}
+
+glm::mat4 AnimTrack::Sample(float tin, int sf=0, int ef=-1, bool loop = false, AnimCursor *cursor = nullptr) {
 	glm::mat4 out = glm::mat4(1);
 	glm::vec3 T;
 	glm::quat Q;
 	glm::vec3 S;
 
-	getSampleTransforms(T, Q, S, tin, sf, ef, loop);
+	getSampleTransforms(T, Q, S, tin, sf, ef, loop, cursor);
 	
 
 //	std::cout << T.x << ", " << T.y << ", " << T.z << " || "
@@ -145,7 +582,7 @@ glm::mat4 AnimTrack::Sample(float tin, int sf=0, int ef=-1, bool loop = false) {
 	return out;
 }
 
-glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B) {
+glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, int sfB, int efB, AnimTrack *B, AnimCursor *cursorA, AnimCursor *cursorB) {
 	if(B == nullptr) {
 		B = this;
 	}
@@ -154,8 +591,8 @@ glm::mat4 AnimTrack::Blend(float bf, float tinA, int sfA, int efA, float tinB, i
 	glm::quat Q, QA, QB;
 	glm::vec3 S, SA, SB;
 
-	getSampleTransforms(TA, QA, SA, tinA, sfA, efA, true);
-	B->getSampleTransforms(TB, QB, SB, tinB, sfB, efB, true);
+	getSampleTransforms(TA, QA, SA, tinA, sfA, efA, true, cursorA);
+	B->getSampleTransforms(TB, QB, SB, tinB, sfB, efB, true, cursorB);
 
 	T = TA * (1.0f - bf) + TB * bf;
 	Q = slerp(QA, QB, bf);
@@ -194,6 +631,9 @@ void AnimBlender::Start(int seg, float blendT) {
 		prev = cur;
 		cur = seg;
 		segments[cur].t = 0;
+		// the cursors follow their segment
+		prevCursors.swap(curCursors);
+		curCursors.assign(prevCursors.size(), AnimCursor());
 		if(blendT > 0) {
 			blendPos = 0;
 			blendTime = blendT;
@@ -202,29 +642,43 @@ void AnimBlender::Start(int seg, float blendT) {
 	}
 }
 
-glm::mat4 AnimBlender::Sample(AnimTrack *AT, AnimTrack *AT2) {
+glm::mat4 AnimBlender::Sample(AnimTrack *AT, AnimTrack *AT2, int track) {
 	if(AT2 == nullptr) {
 		AT2 = AT;
 	}
+	AnimCursor *curC = nullptr, *prevC = nullptr;
+	if(track >= 0) {
+		if(track >= curCursors.size()) {
+			curCursors.resize(track + 1);
+			prevCursors.resize(track + 1);
+		}
+		curC = &curCursors[track];
+		prevC = &prevCursors[track];
+	}
 	if(blending) {
-		return AT->Blend(1.0f - blendPos / blendTime, segments[cur].t, segments[cur].st, segments[cur].en, segments[prev].t, segments[prev].st, segments[prev].en, AT2);
+		return AT->Blend(1.0f - blendPos / blendTime, segments[cur].t, segments[cur].st, segments[cur].en, segments[prev].t, segments[prev].st, segments[prev].en, AT2, curC, prevC);
 	} else {
-		return AT->Sample(segments[cur].t, segments[cur].st, segments[cur].en);
+		return AT->Sample(segments[cur].t, segments[cur].st, segments[cur].en, false, curC);
 	}
 }
 
-glm::mat4 AnimBlender::Sample(std::vector<AnimTrack *> *AT) {
-	return Sample((*AT)[segments[cur].clip], (*AT)[segments[prev].clip]);
+glm::mat4 AnimBlender::Sample(std::vector<AnimTrack *> *AT, int track) {
+	return Sample((*AT)[segments[cur].clip], (*AT)[segments[prev].clip], track);
 }
 
 
-void Animations::init(AssetFile &A) {
+void Animations::init(AssetFile &A, AnimTolerance tolerance, std::string packedFile) {
 	AF = &A;
 	
 	if(A.getType() != GLTF) {
 		std::cout << "Error: Animations supported only in GLTF assets\n";
 		exit(0);
 	}
+
+	if((packedFile != "") && tolerance.packs() && loadPacked(packedFile, tolerance)) {
+		std::cout << "Animations loaded from " << packedFile << ": " << GLTFanims.size() << " tracks\n";
+		return;
+	}
 	
 	tinygltf::Model *model = A.getGLTFmodel();
 	
@@ -246,8 +700,7 @@ void Animations::init(AssetFile &A) {
 			
 			if(Time == nullptr) {			
 				const tinygltf::Accessor &inAccessor = model->accessors[anim.samplers[chan.sampler].input];
-				const tinygltf::BufferView &inView = model->bufferViews[inAccessor.bufferView];
-				const float *inVals = reinterpret_cast<const float *>(&(model->buffers[inView.buffer].data[inAccessor.byteOffset + inView.byteOffset]));
+				const float *inVals = reinterpret_cast<const float *>(A.getGLTFaccessorData(anim.samplers[chan.sampler].input));
 				int cntIn = inAccessor.count;
 				
 				Time = inVals;
@@ -263,8 +716,7 @@ std::cout << "\n";*/
 			nodeIds[targetNode] = true;
 
 			const tinygltf::Accessor &outAccessor = model->accessors[anim.samplers[chan.sampler].output];
-			const tinygltf::BufferView &outView = model->bufferViews[outAccessor.bufferView];
-			const float *outVals = reinterpret_cast<const float *>(&(model->buffers[outView.buffer].data[outAccessor.byteOffset + outView.byteOffset]));
+			const float *outVals = reinterpret_cast<const float *>(A.getGLTFaccessorData(anim.samplers[chan.sampler].output));
 			int cntOut = outAccessor.count;
 						
 			if(chan.target_path == "translation") {
@@ -296,6 +748,12 @@ std::cout << "\n";*/
 		}
 		
 		std::cout << "There are " << nodeIds.size() << " animated nodes\n";
+		std::vector<float> *times = nullptr;
+		if(tolerance.packs()) {
+			times = new std::vector<float>(Time, Time + nKeyFrames);
+			TimeArrays.push_back(times);
+		}
+		size_t unpackedBytes = 0, packedBytes = 0;
 		for(auto tninf : nodeIds) {
 			targetNode = tninf.first;
 
@@ -332,15 +790,236 @@ std::cout << "\n";*/
 				AnimFrame A = {kfTm, T, Q, S};
 				AT->Frames.push_back(A);
 			}
+			if(times != nullptr) {
+				unpackedBytes += AT->memoryBytes();
+				AT->pack(times->data(), tolerance);
+				packedBytes += AT->memoryBytes();
+			}
 			GLTFanims[trackName.str()] = AT;
 		}
+		if(times != nullptr) {
+			std::cout << "Packed tracks: " << packedBytes << " bytes (" << unpackedBytes << " unpacked)\n";
+		}
+	}
+
+	if(tolerance.packs() && (packedFile != "")) {
+		savePacked(packedFile, tolerance);
+	}
+}
+
+// Packed file: header with the tolerances and the hash of the source, keyframe
+// time arrays, the tracks with their name, then the hash of all the bytes before
+static const char AnimPackedMagic[4] = {'B', 'A', 'N', '3'};
+static const uint64_t AnimHashSeed = 14695981039346656037ull;
+
+// FNV-1a
+static void animHash(uint64_t &h, const void *d, size_t n) {
+	const unsigned char *b = reinterpret_cast<const unsigned char *>(d);
+	for(size_t i = 0; i < n; i++) {
+		h = (h ^ b[i]) * 1099511628211ull;
+	}
+}
+
+// the channels of every animation, their keyframe data, and the transforms of
+// the nodes, which fill the components that are not animated
+uint64_t Animations::sourceHash() {
+	uint64_t h = AnimHashSeed;
+	auto add = [&h](const void *d, size_t n) {animHash(h, d, n);};
+	tinygltf::Model *model = AF->getGLTFmodel();
+	auto addAccessor = [&](int a) {
+		const tinygltf::Accessor &Acc = model->accessors[a];
+		add(&Acc.count, sizeof(Acc.count));
+		add(AF->getGLTFaccessorData(a), Acc.count *
+			tinygltf::GetNumComponentsInType(Acc.type) * tinygltf::GetComponentSizeInBytes(Acc.componentType));
+	};
+	for(const auto &anim : model->animations) {
+		add(anim.name.data(), anim.name.size());
+		for(const auto &chan : anim.channels) {
+			add(&chan.target_node, sizeof(chan.target_node));
+			add(chan.target_path.data(), chan.target_path.size());
+			addAccessor(anim.samplers[chan.sampler].input);
+			addAccessor(anim.samplers[chan.sampler].output);
+		}
 	}
+	for(const auto &node : model->nodes) {
+		add(node.translation.data(), node.translation.size() * sizeof(double));
+		add(node.rotation.data(), node.rotation.size() * sizeof(double));
+		add(node.scale.data(), node.scale.size() * sizeof(double));
+	}
+	return h;
+}
+
+void Animations::savePacked(std::string file, AnimTolerance tolerance) {
+	std::ofstream os(file, std::ios::binary);
+	if(!os.is_open()) {
+		std::cout << "Warning: cannot write packed animations to " << file << "\n";
+		return;
+	}
+	uint64_t check = AnimHashSeed;
+	auto put = [&os, &check](const void *d, size_t n) {
+		os.write(reinterpret_cast<const char *>(d), n);
+		animHash(check, d, n);
+	};
+	auto putU32 = [&put](uint32_t v) {put(&v, 4);};
+	auto putVec = [&put, &putU32](const std::vector<uint16_t> &v) {
+		putU32(v.size());
+		put(v.data(), v.size() * sizeof(uint16_t));
+	};
+
+	uint64_t hash = sourceHash();
+	put(AnimPackedMagic, 4);
+	put(&tolerance.T, sizeof(float));
+	put(&tolerance.Q, sizeof(float));
+	put(&tolerance.S, sizeof(float));
+	put(&hash, sizeof(uint64_t));
+	putU32(TimeArrays.size());
+	for(auto *ta : TimeArrays) {
+		putU32(ta->size());
+		put(ta->data(), ta->size() * sizeof(float));
+	}
+	putU32(GLTFanims.size());
+	for(auto &a : GLTFanims) {
+		AnimTrack *AT = a.second;
+		uint32_t ti = 0;
+		while((ti < TimeArrays.size()) && (TimeArrays[ti]->data() != AT->Times)) ti++;
+		if(!AT->packed || (ti == TimeArrays.size())) {
+			std::cout << "Warning: track " << a.first << " is not packed, " << file << " not written\n";
+			os.close();
+			std::remove(file.c_str());
+			return;
+		}
+		putU32(a.first.size());
+		put(a.first.data(), a.first.size());
+		putU32(ti);
+		putU32(AT->nKeyFrames);
+		putU32(AT->constMask);
+		put(&AT->Tmin, sizeof(glm::vec3)); put(&AT->Trange, sizeof(glm::vec3));
+		put(&AT->Smin, sizeof(glm::vec3)); put(&AT->Srange, sizeof(glm::vec3));
+		put(&AT->Qconst, sizeof(glm::quat));
+		putVec(AT->Keys); putVec(AT->Tq); putVec(AT->Qq); putVec(AT->Sq);
+	}
+	uint64_t sum = check;
+	put(&sum, sizeof(uint64_t));
+}
+
+bool Animations::loadPacked(std::string file, AnimTolerance tolerance) {
+	std::ifstream is(file, std::ios::binary | std::ios::ate);
+	if(!is.is_open()) {
+		return false;
+	}
+	std::streamoff fileSize = is.tellg();
+	is.seekg(0);
+	// every count read from the file is checked against the bytes left, so that
+	// a damaged file is rejected before anything is allocated for it, and the
+	// hash of the bytes read is checked at the end
+	auto left = [&is, fileSize]() {
+		std::streamoff p = is.tellg();
+		return (p < 0) ? (uint64_t)0 : (uint64_t)(fileSize - p);
+	};
+	uint64_t check = AnimHashSeed;
+	auto get = [&is, &check](void *d, size_t n) {
+		is.read(reinterpret_cast<char *>(d), n);
+		animHash(check, d, n);
+		return (bool)is;
+	};
+	auto getU32 = [&get]() {uint32_t v = 0; get(&v, 4); return v;};
+	auto getCount = [&is, &getU32, &left](uint32_t &n, size_t elemSize) {
+		n = getU32();
+		return (bool)is && ((uint64_t)n * elemSize <= left());
+	};
+	auto getVec = [&get, &getCount](std::vector<uint16_t> &v) {
+		uint32_t n;
+		if(!getCount(n, sizeof(uint16_t))) return false;
+		v.resize(n);
+		return get(v.data(), n * sizeof(uint16_t));
+	};
+
+	char magic[4];
+	AnimTolerance fileTolerance;
+	uint64_t fileHash;
+	if(!get(magic, 4) || memcmp(magic, AnimPackedMagic, 4) != 0 ||
+	   !get(&fileTolerance.T, sizeof(float)) || !get(&fileTolerance.Q, sizeof(float)) ||
+	   !get(&fileTolerance.S, sizeof(float)) || !get(&fileHash, sizeof(uint64_t))) {
+		std::cout << "Warning: " << file << " is not a packed animation file\n";
+		return false;
+	}
+	if(!(fileTolerance == tolerance)) {
+		return false;
+	}
+	if(fileHash != sourceHash()) {
+		std::cout << "Warning: " << file << " is out of date, the animations are rebuilt\n";
+		return false;
+	}
+	uint32_t nTimes, nTracks = 0;
+	bool ok = getCount(nTimes, sizeof(uint32_t));
+	std::vector<std::vector<float> *> times;
+	for(uint32_t i = 0; (i < nTimes) && ok; i++) {
+		uint32_t n;
+		ok = getCount(n, sizeof(float));
+		if(ok) {
+			times.push_back(new std::vector<float>(n));
+			ok = get(times.back()->data(), n * sizeof(float));
+		}
+	}
+	std::unordered_map<std::string, AnimTrack *> tracks;
+	ok = ok && getCount(nTracks, 4 * sizeof(uint32_t));
+	for(uint32_t i = 0; (i < nTracks) && ok; i++) {
+		uint32_t len;
+		ok = getCount(len, 1);
+		if(!ok) break;
+		std::string name(len, ' ');
+		get(&name[0], len);
+		if(tracks.count(name) > 0) {
+			ok = false;
+			break;
+		}
+		AnimTrack *AT = new AnimTrack();
+		tracks[name] = AT;
+		uint32_t ti = getU32();
+		AT->nKeyFrames = getU32();
+		AT->constMask = getU32();
+		get(&AT->Tmin, sizeof(glm::vec3)); get(&AT->Trange, sizeof(glm::vec3));
+		get(&AT->Smin, sizeof(glm::vec3)); get(&AT->Srange, sizeof(glm::vec3));
+		get(&AT->Qconst, sizeof(glm::quat));
+		ok = getVec(AT->Keys) && getVec(AT->Tq) && getVec(AT->Qq) && getVec(AT->Sq) &&
+			 (ti < times.size()) && (AT->nKeyFrames >= 2) && ((int)times[ti]->size() == AT->nKeyFrames) &&
+			 (AT->constMask >= 0) && (AT->constMask <= (ANIM_CONST_T | ANIM_CONST_Q | ANIM_CONST_S));
+		// kept keyframes: increasing, from the first to the last one
+		if(ok && !AT->Keys.empty()) {
+			ok = (AT->Keys.front() == 0) && (AT->Keys.back() == AT->nKeyFrames - 1);
+			for(size_t k = 1; (k < AT->Keys.size()) && ok; k++) {
+				ok = AT->Keys[k] > AT->Keys[k - 1];
+			}
+		}
+		size_t nk = AT->Keys.empty() ? AT->nKeyFrames : AT->Keys.size();
+		ok = ok && (AT->Tq.size() == ((AT->constMask & ANIM_CONST_T) ? 0 : 3 * nk)) &&
+				   (AT->Qq.size() == ((AT->constMask & ANIM_CONST_Q) ? 0 : 3 * nk)) &&
+				   (AT->Sq.size() == ((AT->constMask & ANIM_CONST_S) ? 0 : 3 * nk));
+		if(ok) {
+			AT->Times = times[ti]->data();
+			AT->packed = true;
+		}
+	}
+	uint64_t sum = check, fileSum = 0;
+	ok = ok && get(&fileSum, sizeof(uint64_t)) && (fileSum == sum) && (left() == 0);
+	if(!ok) {
+		std::cout << "Warning: " << file << " is corrupted, the animations are rebuilt\n";
+		for(auto &a : tracks) delete a.second;
+		for(auto *ta : times) delete ta;
+		return false;
+	}
+	GLTFanims = tracks;
+	TimeArrays = times;
+	return true;
 }
 
 void Animations::cleanup() {
 	for(auto &a : GLTFanims) {
 		delete a.second;
 	}
+	for(auto *ta : TimeArrays) {
+		delete ta;
+	}
 }
 
 void SkeletalAnimation::init(Animations *_anims, int _NAnims, std::string BaseTrackName, int SkinId) 
@@ -374,7 +1053,6 @@ void SkeletalAnimation::init(Animations *_anims, int _NAnims, std::string BaseTr
 	  }
 	}
 	oTMs.resize(skin->joints.size());
-	TMs.resize(skin->joints.size());
 	BaseTMs.resize(skin->joints.size());
 	IBMs.resize(skin->joints.size());
 
@@ -452,9 +1130,7 @@ std::cout << "Base animation track name: " << BaseTrackName << "\n";
 	NATs = ATs.size();
 	NTMs = skin->joints.size();	
 	
-	const tinygltf::Accessor &inAccessor = model->accessors[skin->inverseBindMatrices];
-	const tinygltf::BufferView &inView = model->bufferViews[inAccessor.bufferView];
-	const float *inVals = reinterpret_cast<const float *>(&(model->buffers[inView.buffer].data[inAccessor.byteOffset + inView.byteOffset]));
+	const float *inVals = reinterpret_cast<const float *>(anims[0].AF->getGLTFaccessorData(skin->inverseBindMatrices));
 	
 	for(int mel = 0; mel < NTMs; mel++) {
 		const float *s = &inVals[mel * 16];
@@ -464,21 +1140,91 @@ std::cout << "Base animation track name: " << BaseTrackName << "\n";
 				s[8], s[9],s[10],s[11],
 				s[12],s[13],s[14],s[15]);
 	}
+
+	// flattens the hierarchy: a joint is placed after its parent joint, by
+	// sorting on the number of joints above it
+	std::vector<int> parentNode(model->nodes.size(), -1);
+	for(int n = 0; n < model->nodes.size(); n++) {
+		for(int c : model->nodes[n].children) {
+			parentNode[c] = n;
+		}
+	}
+	std::vector<int> depth(NTMs, 0);
+	for(int i = 0; i < NTMs; i++) {
+		for(int p = parentNode[skin->joints[i]]; p >= 0 && NidDec.count(p) > 0; p = parentNode[p]) {
+			depth[i]++;
+		}
+	}
+	std::vector<int> order(NTMs);
+	for(int i = 0; i < NTMs; i++) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) {return depth[a] < depth[b];});
+
+	std::vector<int> pos(NTMs);
+	JointNode.resize(NTMs);
+	JointParent.resize(NTMs);
+	JointOut.resize(NTMs);
+	JointIBM.resize(NTMs);
+	JointModel.resize(NTMs);
+	for(int k = 0; k < NTMs; k++) {
+		pos[order[k]] = k;
+		JointNode[k] = skin->joints[order[k]];
+		JointOut[k] = NidDec[JointNode[k]];
+		JointIBM[k] = IBMs[JointNode[k]];
+	}
+	for(int k = 0; k < NTMs; k++) {
+		int p = parentNode[JointNode[k]];
+		JointParent[k] = (p >= 0 && NidDec.count(p) > 0) ? pos[NidDec[p]] : -1;
+	}
+	TrackDetail.assign(NATs, 0);
+}
+
+int SkeletalAnimation::setDetailJoints(float fraction) {
+	// bind pose positions, and the longest chain below each joint (children
+	// come after their parent, so they are done first going backwards)
+	std::vector<glm::vec3> P(NTMs);
+	glm::vec3 bmin(1e30f), bmax(-1e30f);
+	for(int k = 0; k < NTMs; k++) {
+		P[k] = glm::vec3(glm::inverse(JointIBM[k])[3]);
+		bmin = glm::min(bmin, P[k]);
+		bmax = glm::max(bmax, P[k]);
+	}
+	std::vector<float> chain(NTMs, 0.0f);
+	for(int k = NTMs - 1; k >= 0; k--) {
+		int p = JointParent[k];
+		if(p >= 0) {
+			chain[p] = std::max(chain[p], chain[k] + glm::length(P[k] - P[p]));
+		}
+	}
+	float limit = fraction * glm::length(bmax - bmin);
+
+	std::unordered_map<int, int> nodePos;
+	for(int k = 0; k < NTMs; k++) {
+		nodePos[JointNode[k]] = k;
+	}
+	int count = 0;
+	for(int i = 0; i < NATs; i++) {
+		auto it = nodePos.find(ATsNodeId[i]);
+		TrackDetail[i] = ((it != nodePos.end()) && (chain[it->second] < limit)) ? 1 : 0;
+		count += TrackDetail[i];
+	}
+	return count;
 }
 
 void SkeletalAnimation::cleanup() {
 }
 
 std::vector<glm::mat4> *SkeletalAnimation::getTransformMatrices() {
-	for(int i = 0; i < NTMs; i++) {
-		oTMs[NidDec[i]] = TMs[i];
-	}
 	return &oTMs;
 }
 
-void SkeletalAnimation::Sample(AnimBlender &AB) {
+void SkeletalAnimation::Sample(AnimBlender &AB, bool detail) {
 	for(int i = 0; i < NATs; i++) {
-		BaseTMs[ATsNodeId[i]] = AB.Sample(&ATs[i]);
+		if(!detail && TrackDetail[i]) {
+			continue;
+		}
+		BaseTMs[ATsNodeId[i]] = AB.Sample(&ATs[i], i);
 /*std::cout << ATs[i]->nKeyFrames << " = \n";
 std::cout << i << ": nd :" << ATsNodeId[i] << " = \n";
 for(int mi = 0; mi<16; mi++) {
@@ -503,38 +1249,328 @@ std::cout << ATT->Frames[frm].S.z << "\n";
 exit(0);
 }*/
 	}
-	
-	for(int i = 0; i < NTMs; i++) {
-		TMs[i] = BaseTMs[i];
+
+	// one pass in topological order: the parent is always done already, and
+	// the inverse bind matrix is applied as soon as the joint is known
+	for(int k = 0; k < NTMs; k++) {
+		const glm::mat4 &L = BaseTMs[JointNode[k]];
+		if(JointParent[k] < 0) {
+			JointModel[k] = L;
+		} else {
+			mulJointMat(JointModel[JointParent[k]], L, JointModel[k]);
+		}
+		mulJointMat(JointModel[k], JointIBM[k], oTMs[JointOut[k]]);
 	}
+}
 
-	tinygltf::Model *model = anims[0].AF->getGLTFmodel();
-	for(int i = 0; i < skin->joints.size(); i++) {
-		int targetNode;
-		targetNode = skin->joints[i];
-		
-/*std::cout << targetNode << " = \n";
-for(int mi = 0; mi<16; mi++) {
-std::cout << TMs[targetNode] [mi%4][mi/4] << ((mi%4 < 3) ? ", " : "\n");}
-*/
-		for(int icc = 0; icc < model->nodes[targetNode].children.size(); icc++) {
-			int childNode = model->nodes[targetNode].children[icc];
-			TMs[childNode] = TMs[targetNode] * TMs[childNode];
+int SkeletalAnimation::getNTMs() {
+	return NTMs;
+}
+
+float SkeletalAnimation::getLoopTime(const AnimBlendSegment &seg) {
+	float firstT, lastT;
+	int ef = seg.en;
+	ATs[0][seg.clip]->loopRange(seg.st, ef, firstT, lastT);
+	return lastT - firstT;
+}
+
+void BakedClip::bake(SkeletalAnimation &SA, AnimBlendSegment seg, float rate) {
+	NTMs = SA.getNTMs();
+	Duration = SA.getLoopTime(seg);
+	NFrames = std::max(1, (int)ceil(Duration * rate));
+	Frames.resize((size_t)NFrames * NTMs * 3);
+
+	// the frames are spread evenly on the loop: the one after the last is the first
+	AnimBlender AB;
+	AB.init({seg});
+	for(int f = 0; f < NFrames; f++) {
+		AB.segments[0].t = Duration * f / NFrames;
+		SA.Sample(AB);
+		std::vector<glm::mat4> *TMs = SA.getTransformMatrices();
+		glm::vec4 *rows = &Frames[(size_t)f * NTMs * 3];
+		for(int j = 0; j < NTMs; j++) {
+			const glm::mat4 &M = (*TMs)[j];
+			rows[3 * j + 0] = glm::vec4(M[0][0], M[1][0], M[2][0], M[3][0]);
+			rows[3 * j + 1] = glm::vec4(M[0][1], M[1][1], M[2][1], M[3][1]);
+			rows[3 * j + 2] = glm::vec4(M[0][2], M[1][2], M[2][2], M[3][2]);
 		}
 	}
+}
+
+void BakedClip::sample(float t, glm::mat4 *out) {
+	float ft = fmod(t, Duration) / Duration * NFrames;
+	if(ft < 0.0f) {
+		ft += NFrames;
+	}
+	int f0 = std::min((int)ft, NFrames - 1);
+	int f1 = (f0 + 1 < NFrames) ? f0 + 1 : 0;
+	float a = ft - f0;
 
-	for(int i = 0; i < NTMs; i++) {
-		TMs[i] = TMs[i] * IBMs[i];
-//std::cout << i << " <> " << model->nodes[i].name << ": " << (-IBMs[i][3][0]) << " " << (-IBMs[i][3][1]) << " " << (-IBMs[i][3][2]) << "\n";
-/*std::cout << i << " = \n";
-for(int mi = 0; mi<16; mi++) {
-std::cout << IBMs[i] [mi%4][mi/4] << ((mi%4 < 3) ? ", " : "\n");} */
+	const glm::vec4 *r0 = &Frames[(size_t)f0 * NTMs * 3];
+	const glm::vec4 *r1 = &Frames[(size_t)f1 * NTMs * 3];
+	for(int j = 0; j < NTMs; j++) {
+		glm::vec4 x = r0[3 * j + 0] + a * (r1[3 * j + 0] - r0[3 * j + 0]);
+		glm::vec4 y = r0[3 * j + 1] + a * (r1[3 * j + 1] - r0[3 * j + 1]);
+		glm::vec4 z = r0[3 * j + 2] + a * (r1[3 * j + 2] - r0[3 * j + 2]);
+		out[j] = glm::mat4(x.x, y.x, z.x, 0.0f,
+						   x.y, y.y, z.y, 0.0f,
+						   x.z, y.z, z.z, 0.0f,
+						   x.w, y.w, z.w, 1.0f);
 	}
-//	exit(0);
 }
 
-int SkeletalAnimation::getNTMs() {
-	return NTMs;
+float BakedClip::getDuration() {
+	return Duration;
+}
+
+int BakedClip::getFrames() {
+	return NFrames;
+}
+
+size_t BakedClip::memoryBytes() {
+	return Frames.size() * sizeof(glm::vec4);
+}
+
+void AnimCrowd::init(Animations *_anims, int _NAnims, std::string _BaseTrackName, int threads, int _SkinId) {
+	anims = _anims;
+	NAnims = _NAnims;
+	BaseTrackName = _BaseTrackName;
+	SkinId = _SkinId;
+	quit = false;
+
+	if(threads < 0) {
+		threads = (int)std::thread::hardware_concurrency() - 1;
+	}
+	for(int i = 0; i < threads; i++) {
+		workers.emplace_back(&AnimCrowd::workerLoop, this);
+	}
+}
+
+void AnimCrowd::cleanup() {
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		quit = true;
+	}
+	startCV.notify_all();
+	for(auto &w : workers) {
+		w.join();
+	}
+	workers.clear();
+	ABs.clear();
+	SAs.clear();
+	Worlds.clear();
+	LODdt.clear();
+	LODphase.clear();
+	PrevPoses.clear();
+	NextPoses.clear();
+	Poses.clear();
+	Baked.clear();
+	BakedT.clear();
+}
+
+int AnimCrowd::add(std::vector<AnimBlendSegment> segments, glm::mat4 World) {
+	ABs.emplace_back();
+	ABs.back().init(segments);
+	SAs.emplace_back();
+	SAs.back().init(anims, NAnims, BaseTrackName, SkinId);
+	SAs.back().setDetailJoints(DetailFraction);
+	Worlds.push_back(World);
+	LODdt.push_back(0.0f);
+	LODphase.push_back(0);
+	PrevPoses.emplace_back();
+	NextPoses.emplace_back();
+	Poses.resize(Poses.size() + getNTMs());
+	Baked.push_back(nullptr);
+	BakedT.push_back(0.0f);
+	return (int)SAs.size() - 1;
+}
+
+AnimBlender &AnimCrowd::getBlender(int c) {
+	return ABs[c];
+}
+
+void AnimCrowd::setWorld(int c, const glm::mat4 &World) {
+	Worlds[c] = World;
+}
+
+int AnimCrowd::size() {
+	return (int)SAs.size();
+}
+
+int AnimCrowd::getNTMs() {
+	return SAs.empty() ? 0 : SAs[0].getNTMs();
+}
+
+void AnimCrowd::setLOD(std::vector<AnimLODLevel> levels, float detailFraction) {
+	LODs = levels;
+	std::sort(LODs.begin(), LODs.end(), [](const AnimLODLevel &a, const AnimLODLevel &b) {return a.distance < b.distance;});
+	DetailFraction = detailFraction;
+	for(auto &SA : SAs) {
+		SA.setDetailJoints(DetailFraction);
+	}
+}
+
+void AnimCrowd::setEye(const glm::vec3 &eye) {
+	Eye = eye;
+}
+
+void AnimCrowd::setBaked(int c, BakedClip *clip) {
+	Baked[c] = clip;
+	BakedT[c] = 0.0f;
+}
+
+void AnimCrowd::setProfiler(Profiler *P) {
+	Prof = P;
+}
+
+// Samples character c at the rate of its LOD, and returns its joint matrices:
+// between two samples, they are interpolated from the previous sample to the
+// last one, so they are period - 1 frames late
+const glm::mat4 *AnimCrowd::pose(int c) {
+	if(Baked[c] != nullptr) {
+		BakedT[c] = fmod(BakedT[c] + jobDt, Baked[c]->getDuration());
+		Baked[c]->sample(BakedT[c], &Poses[c * getNTMs()]);
+		return &Poses[c * getNTMs()];
+	}
+
+	int period = 1;
+	bool detail = true;
+	float d = glm::length(glm::vec3(Worlds[c][3]) - Eye);
+	for(auto &L : LODs) {
+		if(d >= L.distance) {
+			period = std::max(L.period, 1);
+			detail = L.detail;
+		}
+	}
+
+	LODdt[c] += jobDt;
+	std::vector<glm::mat4> &Prev = PrevPoses[c], &Next = NextPoses[c];
+	if(period == 1) {
+		ABs[c].Advance(LODdt[c]);
+		LODdt[c] = 0.0f;
+		SAs[c].Sample(ABs[c], detail);
+		Next.clear();
+		return SAs[c].getTransformMatrices()->data();
+	}
+
+	if(Next.empty() || (++LODphase[c] >= period)) {
+		ABs[c].Advance(LODdt[c]);
+		LODdt[c] = 0.0f;
+		SAs[c].Sample(ABs[c], detail);
+		std::vector<glm::mat4> *TMs = SAs[c].getTransformMatrices();
+		if(Next.empty()) {
+			Next = *TMs;
+		}
+		Prev.swap(Next);
+		Next = *TMs;
+		LODphase[c] = 0;
+	}
+
+	int NT = getNTMs();
+	glm::mat4 *Out = &Poses[c * NT];
+	float a = (float)(LODphase[c] + 1) / (float)period;
+	for(int j = 0; j < NT; j++) {
+		for(int col = 0; col < 4; col++) {
+			Out[j][col] = Prev[j][col] + a * (Next[j][col] - Prev[j][col]);
+		}
+	}
+	return Out;
+}
+
+void AnimCrowd::evaluate(int c) {
+	const glm::mat4 *TMs = pose(c);
+	int NT = getNTMs();
+
+	if(jobPalette) {
+		glm::vec4 *rows = (glm::vec4 *)jobDst[c];
+		glm::mat4 M;
+		for(int j = 0; j < NT; j++) {
+			mulJointMat(Worlds[c], TMs[j], M);
+			rows[3 * j + 0] = glm::vec4(M[0][0], M[1][0], M[2][0], M[3][0]);
+			rows[3 * j + 1] = glm::vec4(M[0][1], M[1][1], M[2][1], M[3][1]);
+			rows[3 * j + 2] = glm::vec4(M[0][2], M[1][2], M[2][2], M[3][2]);
+		}
+		return;
+	}
+
+	uint8_t *base = (uint8_t *)jobDst[c];
+	glm::mat4 *mvp = (glm::mat4 *)(base + jobMvp);
+	glm::mat4 *m = (glm::mat4 *)(base + jobM);
+	glm::mat4 *n = (glm::mat4 *)(base + jobN);
+	glm::mat4 M, MVP;
+	for(int j = 0; j < NT; j++) {
+		mulJointMat(Worlds[c], TMs[j], M);
+		mulJointMat(jobViewPrj, M, MVP);
+		mvp[j] = MVP;
+		m[j] = M;
+		n[j] = glm::inverse(glm::transpose(M));
+	}
+}
+
+// takes characters until none is left
+void AnimCrowd::drain() {
+	Profiler::TraceScope ts(Prof, "AnimCrowd job");
+	int N = (int)SAs.size();
+	for(int c = nextChar.fetch_add(1); c < N; c = nextChar.fetch_add(1)) {
+		evaluate(c);
+	}
+}
+
+void AnimCrowd::workerLoop() {
+	int seen = 0;
+	for(;;) {
+		{
+			std::unique_lock<std::mutex> lk(lock);
+			startCV.wait(lk, [&] {return quit || (generation != seen);});
+			if(quit) {
+				return;
+			}
+			seen = generation;
+		}
+		drain();
+		{
+			std::lock_guard<std::mutex> lk(lock);
+			running--;
+		}
+		doneCV.notify_one();
+	}
+}
+
+void AnimCrowd::updatePalette(float dt, void * const *dst) {
+	jobDt = dt;
+	jobDst = dst;
+	jobPalette = true;
+	run();
+}
+
+void AnimCrowd::update(float dt, const glm::mat4 &ViewPrj, void * const *dst, size_t mvpOffset, size_t mOffset, size_t nOffset) {
+	jobDt = dt;
+	jobViewPrj = ViewPrj;
+	jobDst = dst;
+	jobPalette = false;
+	jobMvp = mvpOffset;
+	jobM = mOffset;
+	jobN = nOffset;
+	run();
+}
+
+void AnimCrowd::run() {
+	nextChar = 0;
+
+	// a single character is not worth waking the workers
+	if(workers.empty() || (SAs.size() < 2)) {
+		drain();
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lk(lock);
+		running = (int)workers.size();
+		generation++;
+	}
+	startCV.notify_all();
+	drain();
+	std::unique_lock<std::mutex> lk(lock);
+	doneCV.wait(lk, [&] {return running == 0;});
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,237 +1,779 @@
 #pragma once
 #include <vector>
-#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
 #include <functional>
+#include <memory>
+#include <string>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <json.hpp>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/quaternion.hpp>
 
+// 4-wide kernel for tick(); define CARDANIM_NO_SIMD to always use the scalar path
+#ifndef CARDANIM_NO_SIMD
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__)
+  #include <emmintrin.h>
+  #define CARDANIM_SIMD 1
+  typedef __m128 canim_f4;
+  #define canim_ld(p)        _mm_loadu_ps(p)
+  #define canim_st(p,v)      _mm_storeu_ps(p, v)
+  #define canim_set1(x)      _mm_set1_ps(x)
+  #define canim_add(a,b)     _mm_add_ps(a, b)
+  #define canim_sub(a,b)     _mm_sub_ps(a, b)
+  #define canim_mul(a,b)     _mm_mul_ps(a, b)
+  #define canim_div(a,b)     _mm_div_ps(a, b)
+  #define canim_min(a,b)     _mm_min_ps(a, b)
+  #define canim_max(a,b)     _mm_max_ps(a, b)
+  #define canim_sqrt(a)      _mm_sqrt_ps(a)
+  #define canim_neg_if_lt0(x,v) _mm_xor_ps(v, _mm_and_ps(_mm_cmplt_ps(x, _mm_setzero_ps()), _mm_set1_ps(-0.0f)))
+#elif defined(__aarch64__)
+  #include <arm_neon.h>
+  #define CARDANIM_SIMD 1
+  typedef float32x4_t canim_f4;
+  #define canim_ld(p)        vld1q_f32(p)
+  #define canim_st(p,v)      vst1q_f32(p, v)
+  #define canim_set1(x)      vdupq_n_f32(x)
+  #define canim_add(a,b)     vaddq_f32(a, b)
+  #define canim_sub(a,b)     vsubq_f32(a, b)
+  #define canim_mul(a,b)     vmulq_f32(a, b)
+  #define canim_div(a,b)     vdivq_f32(a, b)
+  #define canim_min(a,b)     vminq_f32(a, b)
+  #define canim_max(a,b)     vmaxq_f32(a, b)
+  #define canim_sqrt(a)      vsqrtq_f32(a)
+  #define canim_neg_if_lt0(x,v) vbslq_f32(vcltq_f32(x, vdupq_n_f32(0.0f)), vnegq_f32(v), v)
+#endif
+#endif
+
+// Declarative timelines. A timeline is a list of keys, each one a step (move
+// and/or rotate, or a plain wait) of a card slot: the slots are bound to card
+// ids when the timeline is played. A key starts at the absolute time "at", or
+// when the previous key of the same slot ends (plus "delay"). "repeat" expands
+// a key over several slots, offsetting slot, start time and target per copy.
+struct TimelineKeyDesc {
+  int slot{0};
+  bool hasAt{false};
+  float at{0.f};
+  float delay{0.f};
+  bool hasMove{false};
+  glm::vec3 move{0};
+  float moveTime{0.f};
+  bool hasRotate{false};
+  float angle{0.f};
+  glm::vec3 axis{0, 0, 1};
+  float rotTime{0.f};
+  bool local{false};
+  float wait{0.f};        // duration of a key with no move and no rotation
+  int repeat{1};
+  int slotStep{1};
+  float atStep{0.f};
+  glm::vec3 moveStep{0};
+};
+
+struct TimelineDesc {
+  std::vector<TimelineKeyDesc> keys;
+};
+
+// Compiled timeline: one key per step, sorted by absolute start time
+struct TimelineKey {
+  float at;
+  int slot;
+  uint8_t flags;
+  glm::vec3 to;
+  glm::quat delta;
+  float moveDur, rotDur, total;
+};
+
+struct Timeline {
+  std::vector<TimelineKey> keys;
+  int slots{0};
+  float duration{0.f};
+};
+
+// Card ids are dense (0..count-1): the per-card state is kept in parallel arrays
+// indexed by id, and the steps of each card are a FIFO ring buffer, all
+// allocated in a single arena and recycled in place. The rings share their
+// capacity, doubled when a card fills its ring.
+// Matrices are read and written in place through a strided pointer (e.g. the
+// Wm field of an array of scene instances).
 class CardAnimator {
 public:
-  CardAnimator(std::function<void(int, const glm::mat4&)> setWm, 
-    std::function<glm::mat4(int)> getWm)
-    : setMatrix(std::move(setWm)), 
-      getMatrix(std::move(getWm)) {}
+  CardAnimator(glm::mat4* wm, size_t strideBytes, int count, int queueCapacity = 16)
+    : wmBase(reinterpret_cast<unsigned char*>(wm)), wmStride(strideBytes),
+      capacity(queueCapacity),
+      pos(count, glm::vec3(0)), rot(count, glm::quat(1,0,0,0)), scl(count, glm::vec3(1)),
+      elapsed(count, 0.f), cursor(count, -1), tail(count, -1), pending(count, 0),
+      state(count, 0), activeSlot(count, -1), steps(static_cast<size_t>(count) * queueCapacity),
+      scheduledCount(count, 0), lastScheduled(count, -1) {
+    active.reserve(count);
+  }
 
   // API: enqueue per-card steps (executed sequentially per id)
   void addMove(int idx, const glm::mat4& curWm, glm::vec3 toPos, float seconds=0.0f) {
-    Track& t = getOrCreateTrack(idx, curWm);
-    Step s; s.type = Step::MOVE; s.move.to = toPos; s.move.dur = dur(seconds);
-    t.queue.push_back(s);
+    if (!getOrCreateTrack(idx, curWm)) return;
+    Step* s = newStep(idx, STEP_MOVE | STEP_WRITES);
+    s->to = toPos; s->moveDur = dur(seconds);
+    s->total = s->moveDur;
+    enqueue(idx, true);
   }
 
   // angleDeg in degrees. localAxis=true → rotate around card’s local axis.
   void addRotate(int idx, const glm::mat4& curWm, float angleDeg, glm::vec3 axis, float seconds, bool localAxis) {
-    Track& t = getOrCreateTrack(idx, curWm);
-    Step s; s.type = Step::ROTATE;
-    s.rot.delta = glm::angleAxis(glm::radians(angleDeg), glm::normalize(axis));
-    s.rot.dur   = dur(seconds);
-    s.rot.local = localAxis;
-    t.queue.push_back(s);
+    if (!getOrCreateTrack(idx, curWm)) return;
+    Step* s = newStep(idx, STEP_ROTATE | STEP_WRITES | (localAxis ? STEP_LOCAL : 0));
+    s->delta  = glm::angleAxis(glm::radians(angleDeg), glm::normalize(axis));
+    s->rotDur = dur(seconds);
+    s->total  = s->rotDur;
+    enqueue(idx, true);
   }
 
   void addMoveAndRotate(int idx, const glm::mat4& curWm,
                         glm::vec3 toPos, float moveSec,
                         float angleDeg, glm::vec3 axis, float rotSec,
                         bool localAxis) {
-    Track& t = getOrCreateTrack(idx, curWm);
-    Step s; s.type = Step::MOVE_ROTATE;
-    s.move.to     = toPos; s.move.dur = dur(moveSec);
-    s.rot.delta   = glm::angleAxis(glm::radians(angleDeg), glm::normalize(axis));
-    s.rot.dur     = dur(rotSec);
-    s.rot.local   = localAxis;
-    t.queue.push_back(s);
+    if (!getOrCreateTrack(idx, curWm)) return;
+    Step* s = newStep(idx, STEP_MOVE | STEP_ROTATE | STEP_WRITES | (localAxis ? STEP_LOCAL : 0));
+    s->to      = toPos; s->moveDur = dur(moveSec);
+    s->delta   = glm::angleAxis(glm::radians(angleDeg), glm::normalize(axis));
+    s->rotDur  = dur(rotSec);
+    s->total   = std::max(s->moveDur, s->rotDur);
+    enqueue(idx, true);
   }
 
+  // Consecutive waits are merged into a single step.
   void addWait(int idx, const glm::mat4& curWm, float seconds) {
-    Track& t = getOrCreateTrack(idx, curWm);
-    Step s; s.type = Step::WAIT; s.wait.dur = dur(seconds);
-    t.queue.push_back(s);
+    if (!getOrCreateTrack(idx, curWm)) return;
+    queueWait(idx, dur(seconds), true);
   }
 
+  // Appends a wait to every card that has ever been animated. Idle cards keep
+  // it queued, and serve it before the next steps added to them.
   void addGlobalWait(float seconds) {
     float duration = dur(seconds);
-    for (auto& kv : tracks) {
-      Track& t = kv.second;
-      // ensure the track is initialized so wait step makes sense
-      glm::mat4 cur = getMatrix(t.idx);
-      Step s; s.type = Step::WAIT; s.wait.dur = duration;
-      t.queue.push_back(s);
+    for (int idx = 0; idx < static_cast<int>(state.size()); idx++) {
+      if (!(state[idx] & TRACK_CREATED)) continue;
+      queueWait(idx, duration, false);
     }
   }
 
-    // True if the card has NO pending steps and is not mid-step.
+    // True if the card has NO pending steps, is not mid-step and has no scheduled keys.
   bool isFinished(int idx) const {
-    auto it = tracks.find(idx);
-    if (it == tracks.end()) return true;                  // no track → nothing queued
-    const Track& t = it->second;
-    // finished if not active or we've advanced past the last queued step
-    return !t.active || t.cur >= t.queue.size();
+    if (!valid(idx)) return true;                         // no track → nothing queued
+    return !(state[idx] & TRACK_ACTIVE) && scheduledCount[idx] == 0;
   }
 
   // Convenience: returns how many steps remain (0 means finished).
   size_t remainingSteps(int idx) const {
-    auto it = tracks.find(idx);
-    if (it == tracks.end()) return 0;
-    const Track& t = it->second;
-    if (t.cur >= t.queue.size()) return 0;
-    return t.queue.size() - t.cur - (t.stepStarted ? 0 : 0); // queued minus current index
+    if (!valid(idx)) return 0;
+    return pending[idx] + scheduledCount[idx];
   }
 
   // Any card still animating?
   bool anyAnimating() const {
-    for (const auto& kv : tracks) {
-      const Track& t = kv.second;
-      if (t.active && t.cur < t.queue.size()) return true;
+    return !active.empty() || scheduleHead < schedule.size();
+  }
+
+  // Steps each card can queue before the rings grow
+  int queueCapacity() const { return capacity; }
+
+  // Drops all the queued steps, the timeline keys not started yet and the
+  // pending callbacks, without running them: the cards stay where they are,
+  // and the steps added next start from there. Can be called from a callback.
+  void reset() {
+    for (size_t idx = 0; idx < state.size(); idx++) {
+      cursor[idx] = tail[idx] = activeSlot[idx] = -1;
+      pending[idx] = 0;
+      elapsed[idx] = 0.f;
+      state[idx] &= TRACK_CREATED;
+      scheduledCount[idx] = 0;
+      lastScheduled[idx] = -1;
     }
-    return false;
+    active.clear();
+    callbacks.clear();
+    fired.clear();
+    freeCallback = -1;
+    scheduled.clear();
+    schedule.clear();
+    scheduleHead = 0;
+    freeScheduled = -1;
+    clock = 0.0;
+  }
+
+  // Compiles a timeline description: resolves the start times and the repeats,
+  // and sorts the keys by start time
+  static Timeline compile(const TimelineDesc& desc) {
+    Timeline tl;
+    std::vector<float> slotEnd;
+    for (const TimelineKeyDesc& kd : desc.keys) {
+      for (int r = 0; r < kd.repeat; r++) {
+        int slot = kd.slot + r * kd.slotStep;
+        if (slot < 0) {
+          std::cout << "Timeline Error: key with negative slot " << slot << "\n";
+          exit(-1);
+        }
+        if (slot >= static_cast<int>(slotEnd.size())) slotEnd.resize(slot + 1, 0.f);
+
+        TimelineKey k;
+        k.slot = slot;
+        k.flags = (kd.hasMove ? STEP_MOVE | STEP_WRITES : 0) |
+                  (kd.hasRotate ? STEP_ROTATE | STEP_WRITES | (kd.local ? STEP_LOCAL : 0) : 0);
+        k.to = kd.move + static_cast<float>(r) * kd.moveStep;
+        k.delta = kd.hasRotate ? glm::angleAxis(glm::radians(kd.angle), glm::normalize(kd.axis))
+                               : glm::quat(1, 0, 0, 0);
+        k.moveDur = kd.hasMove ? kd.moveTime : 0.f;
+        k.rotDur = kd.hasRotate ? kd.rotTime : 0.f;
+        k.total = (kd.hasMove || kd.hasRotate) ? std::max(k.moveDur, k.rotDur) : kd.wait;
+        k.at = kd.hasAt ? kd.at + r * kd.atStep : slotEnd[slot] + kd.delay;
+        slotEnd[slot] = k.at + k.total;
+        tl.duration = std::max(tl.duration, slotEnd[slot]);
+        tl.keys.push_back(k);
+      }
+    }
+    std::stable_sort(tl.keys.begin(), tl.keys.end(),
+                     [](const TimelineKey& a, const TimelineKey& b) { return a.at < b.at; });
+    tl.slots = static_cast<int>(slotEnd.size());
+    return tl;
+  }
+
+  // Loads and compiles the timelines of a JSON file of the form
+  // { "timelines": { "name": [ key, ... ], ... } }, where a key is e.g.
+  // { "slot": 0, "at": 0.5, "move": [x,y,z], "moveTime": 0.8,
+  //   "rotate": [deg, ax,ay,az], "rotTime": 0.8, "local": false }
+  static std::map<std::string, Timeline> loadTimelines(const std::string& file) {
+    nlohmann::json js;
+    std::ifstream ifs(file);
+    if (!ifs.is_open()) {
+      std::cout << "Error! Timeline file >" << file << "< not found!";
+      exit(-1);
+    }
+    ifs >> js;
+    ifs.close();
+
+    std::map<std::string, Timeline> out;
+    for (auto& t : js["timelines"].items()) {
+      TimelineDesc desc;
+      for (const nlohmann::json& kj : t.value()) {
+        TimelineKeyDesc kd;
+        kd.slot = kj.value("slot", 0);
+        kd.hasAt = kj.contains("at");
+        kd.at = kj.value("at", 0.f);
+        kd.delay = kj.value("delay", 0.f);
+        kd.hasMove = kj.contains("move");
+        if (kd.hasMove) kd.move = glm::vec3(kj["move"][0], kj["move"][1], kj["move"][2]);
+        kd.moveTime = kj.value("moveTime", 0.f);
+        kd.hasRotate = kj.contains("rotate");
+        if (kd.hasRotate) {
+          kd.angle = kj["rotate"][0];
+          kd.axis = glm::vec3(kj["rotate"][1], kj["rotate"][2], kj["rotate"][3]);
+        }
+        kd.rotTime = kj.value("rotTime", 0.f);
+        kd.local = kj.value("local", false);
+        kd.wait = kj.value("wait", 0.f);
+        kd.repeat = kj.value("repeat", 1);
+        kd.slotStep = kj.value("slotStep", 1);
+        kd.atStep = kj.value("atStep", 0.f);
+        if (kj.contains("moveStep")) {
+          kd.moveStep = glm::vec3(kj["moveStep"][0], kj["moveStep"][1], kj["moveStep"][2]);
+        }
+        desc.keys.push_back(kd);
+      }
+      out[t.key()] = compile(desc);
+    }
+    return out;
+  }
+
+  // Schedules a compiled timeline, binding slot s to card ids[s]. Start times
+  // are offset by delay and, as the durations, multiplied by timeScale (0 snaps
+  // the cards to the end poses); origin is added to the move targets. Keys are
+  // turned into steps only when their start time is reached.
+  void play(const Timeline& tl, const std::vector<int>& ids, float delay = 0.f,
+            float timeScale = 1.f, glm::vec3 origin = glm::vec3(0)) {
+    schedule.erase(schedule.begin(), schedule.begin() + scheduleHead);
+    scheduleHead = 0;
+    size_t mid = schedule.size();
+    for (const TimelineKey& k : tl.keys) {
+      if (k.slot >= static_cast<int>(ids.size()) || !valid(ids[k.slot])) continue;
+      int idx = ids[k.slot];
+      int e;
+      if (freeScheduled >= 0) {
+        e = freeScheduled;
+        freeScheduled = scheduled[e].next;
+      } else {
+        e = static_cast<int>(scheduled.size());
+        scheduled.emplace_back();
+      }
+      Scheduled& sk = scheduled[e];
+      sk.key = k;
+      sk.key.at = static_cast<float>(clock + delay + k.at * timeScale);
+      if (k.flags & STEP_MOVE) sk.key.to += origin;
+      sk.key.moveDur *= timeScale;
+      sk.key.rotDur *= timeScale;
+      sk.key.total *= timeScale;
+      sk.id = idx;
+      sk.callback = -1;
+      schedule.push_back(e);
+      scheduledCount[idx]++;
+      if (lastScheduled[idx] < 0 || scheduled[lastScheduled[idx]].key.at <= sk.key.at) {
+        lastScheduled[idx] = e;
+      }
+    }
+    // keys are already sorted: merging keeps the whole schedule sorted
+    std::inplace_merge(schedule.begin(), schedule.begin() + mid, schedule.end(),
+                       [this](int a, int b) { return scheduled[a].key.at < scheduled[b].key.at; });
+  }
+
+  // Calls cb once all the steps queued so far on the card have completed: right
+  // after an add*() call, this is a completion callback for that step. If the
+  // card is already finished, cb is called immediately. Callbacks run at the end
+  // of tick(), so they can safely queue new steps.
+  // With scheduled timeline keys, the callback waits for the last of them.
+  void then(int idx, std::function<void()> cb) {
+    if (isFinished(idx)) { cb(); return; }
+    int c;
+    if (freeCallback >= 0) {
+      c = freeCallback;
+      freeCallback = callbacks[c].next;
+    } else {
+      c = static_cast<int>(callbacks.size());
+      callbacks.emplace_back();
+    }
+    callbacks[c].fn = std::move(cb);
+    callbacks[c].next = -1;
+    int* link = lastScheduled[idx] >= 0 ? &scheduled[lastScheduled[idx]].callback
+                                        : &steps[tail[idx]].callback;
+    while (*link >= 0) link = &callbacks[*link].next;   // appended: callbacks run in FIFO order
+    *link = c;
+  }
+
+  // Calls cb once all the given cards have completed the steps queued so far
+  void join(const std::vector<int>& ids, std::function<void()> cb) {
+    auto left = std::make_shared<int>(1);
+    auto fn = std::make_shared<std::function<void()>>(std::move(cb));
+    auto arrive = [left, fn]() { if (--(*left) == 0) (*fn)(); };
+    for (int idx : ids) {
+      if (isFinished(idx)) continue;
+      (*left)++;
+      then(idx, arrive);
+    }
+    arrive();   // releases the reference held while registering
   }
 
   // Optional: percent (0..1) of the current step for a card; -1 if idle/finished.
   float currentStepProgress(int idx) const {
-    auto it = tracks.find(idx);
-    if (it == tracks.end()) return -1.f;
-    const Track& t = it->second;
-    if (!t.active || t.cur >= t.queue.size()) return -1.f;
+    if (!valid(idx) || !(state[idx] & TRACK_ACTIVE)) return -1.f;
+    const Step& st = steps[cursor[idx]];
+    if (st.total <= 0.f) return 1.f;
+    return std::min(1.f, elapsed[idx] / st.total);
+  }
+
+  // Advance all the active tracks
+  void tick(float dt) {
+#ifdef CARDANIM_SIMD
+    tickBatch(dt);
+#else
+    tickScalar(dt);
+#endif
+  }
+
+  // Reference implementation. Each step type is a combination of the move
+  // and rotate components: missing components keep the base pose.
+  void tickScalar(float dt) {
+    dispatch(dt);
+    for (size_t a = 0; a < active.size(); ) {
+      int idx = active[a];
+      Step& st = steps[cursor[idx]];
+
+      if (!(state[idx] & TRACK_STARTED)) startStep(idx, st);
 
-    const Step& st = t.queue[t.cur];
-    float dur = 0.f;
-    switch (st.type) {
-      case Step::WAIT:        dur = st.wait.dur; break;
-      case Step::MOVE:        dur = st.move.dur; break;
-      case Step::ROTATE:      dur = st.rot.dur;  break;
-      case Step::MOVE_ROTATE: dur = std::max(st.move.dur, st.rot.dur); break;
+      float e = (elapsed[idx] += dt);
+      glm::vec3 p = glm::mix(pos[idx], st.to, ease01(e / st.moveDur));
+      glm::quat q = glm::slerp(rot[idx], st.target, ease01(e / st.rotDur));
+      bool done = e >= st.total;
+
+      if (done || (st.flags & STEP_WRITES)) write(idx, p, q, scl[idx]);
+      if (done && !advance(idx, p, q)) {
+        continue;   // the track was removed: the same slot now holds another one
+      }
+      a++;
     }
-    if (dur <= 0.f) return 1.f;
-    return std::min(1.f, t.elapsed / dur);
+    runCallbacks();
   }
 
-  // Advance all tracks
-  void tick(float dt) {
-    for (auto& kv : tracks) {
-      Track& t = kv.second;
-      if (!t.active || t.cur >= t.queue.size()) continue;
-
-      Step& st = t.queue[t.cur];
-
-      if (!t.stepStarted) { // freeze base pose once at step start
-        TRS base = decompose(getMatrix(t.idx));
-        t.baseP = base.p; t.baseQ = base.q; t.baseS = base.s;
-        if (st.type == Step::ROTATE || st.type == Step::MOVE_ROTATE) {
-          // Expand target q1 from frozen base
-          glm::quat target = st.rot.local ?
-              glm::normalize(t.baseQ * st.rot.delta) :
-              glm::normalize(st.rot.delta * t.baseQ);
-          st.rot.target = target;
-        }
-        t.elapsed = 0.f;
-        t.stepStarted = true;
+#ifdef CARDANIM_SIMD
+  // Same as tickScalar(), but the interpolation and the matrix composition
+  // run four cards at a time. Quaternions use an nlerp with a corrected
+  // parameter instead of the trigonometric slerp: components stay within
+  // ~4e-4 of slerp (under 0.1 degrees).
+  void tickBatch(float dt) {
+    dispatch(dt);
+    size_t n = active.size();
+    size_t padded = (n + 3) & ~size_t(3);
+    batchIdx.assign(active.begin(), active.end());
+    batch.resize(padded * B_COUNT);
+    float* L[B_COUNT];
+    for (int k = 0; k < B_COUNT; k++) L[k] = batch.data() + k * padded;
+
+    // gathers the state of the active tracks, starting the new steps
+    for (size_t l = 0; l < padded; l++) {
+      if (l >= n) {   // padding lanes: harmless values, never written back
+        for (int k = 0; k < B_COUNT; k++) L[k][l] = 0.f;
+        L[B_QW][l] = L[B_RW][l] = 1.f;
+        L[B_MD][l] = L[B_RD][l] = 1.f;
+        continue;
+      }
+      int idx = batchIdx[l];
+      Step& st = steps[cursor[idx]];
+      if (!(state[idx] & TRACK_STARTED)) startStep(idx, st);
+      float e = (elapsed[idx] += dt);
+      L[B_PX][l] = pos[idx].x;   L[B_PY][l] = pos[idx].y;   L[B_PZ][l] = pos[idx].z;
+      L[B_TX][l] = st.to.x;      L[B_TY][l] = st.to.y;      L[B_TZ][l] = st.to.z;
+      L[B_QX][l] = rot[idx].x;   L[B_QY][l] = rot[idx].y;   L[B_QZ][l] = rot[idx].z;   L[B_QW][l] = rot[idx].w;
+      L[B_RX][l] = st.target.x;  L[B_RY][l] = st.target.y;  L[B_RZ][l] = st.target.z;  L[B_RW][l] = st.target.w;
+      L[B_SX][l] = scl[idx].x;   L[B_SY][l] = scl[idx].y;   L[B_SZ][l] = scl[idx].z;
+      L[B_E][l]  = e;
+      L[B_MD][l] = st.moveDur;
+      L[B_RD][l] = st.rotDur;
+    }
+
+    const canim_f4 zero = canim_set1(0.f), one = canim_set1(1.f), two = canim_set1(2.f);
+    const canim_f4 three = canim_set1(3.f), half = canim_set1(0.5f);
+    for (size_t l = 0; l < padded; l += 4) {
+      canim_f4 e = canim_ld(L[B_E] + l);
+      canim_f4 um = canim_min(canim_max(canim_div(e, canim_ld(L[B_MD] + l)), zero), one);
+      canim_f4 ur = canim_min(canim_max(canim_div(e, canim_ld(L[B_RD] + l)), zero), one);
+      um = canim_mul(canim_mul(um, um), canim_sub(three, canim_mul(two, um)));
+      ur = canim_mul(canim_mul(ur, ur), canim_sub(three, canim_mul(two, ur)));
+
+      // position: mix(base, to, um)
+      for (int c = 0; c < 3; c++) {
+        canim_f4 b = canim_ld(L[B_PX + c] + l);
+        canim_f4 t = canim_ld(L[B_TX + c] + l);
+        canim_st(L[B_PX + c] + l, canim_add(b, canim_mul(canim_sub(t, b), um)));
       }
 
-      t.elapsed += dt;
-      glm::vec3 p = t.baseP;
-      glm::quat q = t.baseQ;
-      glm::vec3 s = t.baseS;
-
-      switch (st.type) {
-        case Step::WAIT: {
-          if (t.elapsed >= st.wait.dur) advance(t, p, q, s);
-        } break;
-
-        case Step::MOVE: {
-          float u = ease01(t.elapsed / st.move.dur);
-          p = glm::mix(t.baseP, st.move.to, u);
-          write(t.idx, p, q, s);
-          if (t.elapsed >= st.move.dur) advance(t, p, q, s);
-        } break;
-
-        case Step::ROTATE: {
-          float u = ease01(t.elapsed / st.rot.dur);
-          q = glm::slerp(t.baseQ, st.rot.target, u);
-          write(t.idx, p, q, s);
-          if (t.elapsed >= st.rot.dur) advance(t, p, q, s);
-        } break;
-
-        case Step::MOVE_ROTATE: {
-          float mu = ease01(t.elapsed / st.move.dur);
-          float ru = ease01(t.elapsed / st.rot.dur);
-          p = glm::mix(t.baseP, st.move.to, mu);
-          q = glm::slerp(t.baseQ, st.rot.target, ru);
-          write(t.idx, p, q, s);
-          if (t.elapsed >= std::max(st.move.dur, st.rot.dur)) advance(t, p, q, s);
-        } break;
+      // rotation: shortest path, then nlerp with a corrected parameter
+      canim_f4 q0[4], q1[4];
+      for (int c = 0; c < 4; c++) {
+        q0[c] = canim_ld(L[B_QX + c] + l);
+        q1[c] = canim_ld(L[B_RX + c] + l);
+      }
+      // summed in the order of glm::dot(quat, quat): with 180 degrees turns the
+      // dot is ~0, and its sign picks the direction of the rotation
+      canim_f4 d = canim_add(canim_add(canim_mul(q0[3], q1[3]), canim_mul(q0[0], q1[0])),
+                             canim_add(canim_mul(q0[1], q1[1]), canim_mul(q0[2], q1[2])));
+      for (int c = 0; c < 4; c++) q1[c] = canim_neg_if_lt0(d, q1[c]);
+      d = canim_neg_if_lt0(d, d);
+      canim_f4 A = canim_add(canim_set1(1.0904f), canim_mul(d, canim_add(canim_set1(-3.2452f),
+                   canim_mul(d, canim_sub(canim_set1(3.55645f), canim_mul(d, canim_set1(1.43519f)))))));
+      canim_f4 B = canim_add(canim_set1(0.848013f), canim_mul(d, canim_add(canim_set1(-1.06021f),
+                   canim_mul(d, canim_set1(0.215638f)))));
+      canim_f4 th = canim_sub(ur, half);
+      canim_f4 k = canim_add(canim_mul(A, canim_mul(th, th)), B);
+      canim_f4 ot = canim_add(ur, canim_mul(canim_mul(canim_mul(ur, th), canim_sub(ur, one)), k));
+      canim_f4 q[4];
+      for (int c = 0; c < 4; c++) q[c] = canim_add(q0[c], canim_mul(canim_sub(q1[c], q0[c]), ot));
+      canim_f4 len = canim_sqrt(canim_add(canim_add(canim_mul(q[0], q[0]), canim_mul(q[1], q[1])),
+                                          canim_add(canim_mul(q[2], q[2]), canim_mul(q[3], q[3]))));
+      for (int c = 0; c < 4; c++) {
+        q[c] = canim_div(q[c], len);
+        canim_st(L[B_QX + c] + l, q[c]);
       }
+
+      // rotation and scale part of the matrix, column major as in glm
+      canim_f4 xx = canim_mul(q[0], q[0]), yy = canim_mul(q[1], q[1]), zz = canim_mul(q[2], q[2]);
+      canim_f4 xy = canim_mul(q[0], q[1]), xz = canim_mul(q[0], q[2]), yz = canim_mul(q[1], q[2]);
+      canim_f4 wx = canim_mul(q[3], q[0]), wy = canim_mul(q[3], q[1]), wz = canim_mul(q[3], q[2]);
+      canim_f4 sx = canim_ld(L[B_SX] + l), sy = canim_ld(L[B_SY] + l), sz = canim_ld(L[B_SZ] + l);
+      canim_st(L[B_M00] + l, canim_mul(canim_sub(one, canim_mul(two, canim_add(yy, zz))), sx));
+      canim_st(L[B_M01] + l, canim_mul(canim_mul(two, canim_add(xy, wz)), sx));
+      canim_st(L[B_M02] + l, canim_mul(canim_mul(two, canim_sub(xz, wy)), sx));
+      canim_st(L[B_M10] + l, canim_mul(canim_mul(two, canim_sub(xy, wz)), sy));
+      canim_st(L[B_M11] + l, canim_mul(canim_sub(one, canim_mul(two, canim_add(xx, zz))), sy));
+      canim_st(L[B_M12] + l, canim_mul(canim_mul(two, canim_add(yz, wx)), sy));
+      canim_st(L[B_M20] + l, canim_mul(canim_mul(two, canim_add(xz, wy)), sz));
+      canim_st(L[B_M21] + l, canim_mul(canim_mul(two, canim_sub(yz, wx)), sz));
+      canim_st(L[B_M22] + l, canim_mul(canim_sub(one, canim_mul(two, canim_add(xx, yy))), sz));
     }
+
+    // scatters the matrices, and moves the finished tracks to their next step
+    for (size_t l = 0; l < n; l++) {
+      int idx = batchIdx[l];
+      const Step& st = steps[cursor[idx]];
+      bool done = L[B_E][l] >= st.total;
+      glm::vec3 p(L[B_PX][l], L[B_PY][l], L[B_PZ][l]);
+      if (done || (st.flags & STEP_WRITES)) {
+        glm::mat4& M = matrix(idx);
+        M[0] = glm::vec4(L[B_M00][l], L[B_M01][l], L[B_M02][l], 0.f);
+        M[1] = glm::vec4(L[B_M10][l], L[B_M11][l], L[B_M12][l], 0.f);
+        M[2] = glm::vec4(L[B_M20][l], L[B_M21][l], L[B_M22][l], 0.f);
+        M[3] = glm::vec4(p, 1.f);
+      }
+      if (done) {
+        advance(idx, p, glm::quat(L[B_QW][l], L[B_QX][l], L[B_QY][l], L[B_QZ][l]));
+      }
+    }
+    runCallbacks();
   }
+#endif
 
 private:
   static inline float dur(float sec) { return sec <= 0.f ? 1e-4f : sec; }
   static inline float clamp01(float x){ return x < 0.f ? 0.f : (x > 1.f ? 1.f : x); }
   static inline float ease01(float t) { t = clamp01(t); return t*t*(3.f - 2.f*t); }
 
-  struct TRS { glm::vec3 p{0}; glm::quat q{1,0,0,0}; glm::vec3 s{1}; };
-
-  static TRS decompose(const glm::mat4& M) {
-    TRS r;
-    r.p = glm::vec3(M[3]);
+  static void decompose(const glm::mat4& M, glm::vec3& p, glm::quat& q, glm::vec3& s) {
+    p = glm::vec3(M[3]);
     glm::vec3 X(M[0]), Y(M[1]), Z(M[2]);
-    r.s = { glm::length(X), glm::length(Y), glm::length(Z) };
+    s = { glm::length(X), glm::length(Y), glm::length(Z) };
     glm::mat3 R(
-      glm::vec3(M[0]) / (r.s.x == 0 ? 1.f : r.s.x),
-      glm::vec3(M[1]) / (r.s.y == 0 ? 1.f : r.s.y),
-      glm::vec3(M[2]) / (r.s.z == 0 ? 1.f : r.s.z)
+      X / (s.x == 0 ? 1.f : s.x),
+      Y / (s.y == 0 ? 1.f : s.y),
+      Z / (s.z == 0 ? 1.f : s.z)
     );
-    r.q = glm::normalize(glm::quat_cast(R));
-    return r;
+    q = glm::normalize(glm::quat_cast(R));
   }
 
+  enum StepFlags : uint8_t { STEP_MOVE = 1, STEP_ROTATE = 2, STEP_LOCAL = 4, STEP_WRITES = 8 };
+  enum TrackFlags : uint8_t { TRACK_CREATED = 1, TRACK_ACTIVE = 2, TRACK_STARTED = 4 };
+
   struct Step {
-    enum Type { MOVE, ROTATE, MOVE_ROTATE, WAIT } type{};
-    struct { glm::vec3 to{0}; float dur{0}; } move;
-    struct { glm::quat delta{1,0,0,0}; glm::quat target{1,0,0,0}; float dur{0}; bool local{true}; } rot;
-    struct { float dur{0}; } wait;
+    glm::quat delta{1,0,0,0};
+    glm::quat target{1,0,0,0};
+    glm::vec3 to{0};
+    float moveDur{1e-4f};
+    float rotDur{1e-4f};
+    float total{0};
+    int callback{-1};   // first completion callback, -1 if none
+    float lead{0};      // initial elapsed time of a step started by a timeline
+    uint8_t flags{0};
   };
 
-  struct Track {
-    int idx{-1};
-    std::vector<Step> queue;
-    size_t cur{0};
-    float elapsed{0};
-    bool active{false};
-    bool stepStarted{false};
-    glm::vec3 baseP{0}; glm::quat baseQ{1,0,0,0}; glm::vec3 baseS{1};
+  struct Scheduled {
+    TimelineKey key;    // with absolute start time on the animator clock
+    int id{-1};
+    int callback{-1};   // moved to the step when the key starts
+    int next{-1};       // next free entry
   };
 
-  Track& getOrCreateTrack(int idx, const glm::mat4& curWm) {
-    auto it = tracks.find(idx);
-    if (it == tracks.end()) {
-      Track t; t.idx = idx; t.active = true; t.stepStarted = false;
-      TRS base = decompose(curWm);
-      t.baseP = base.p; t.baseQ = base.q; t.baseS = base.s;
-      it = tracks.emplace(idx, std::move(t)).first;
-    } else {
-      it->second.active = true;
+  struct Callback {
+    std::function<void()> fn;
+    int next{-1};       // next callback of the same step, or next free one
+  };
+
+  // Freezes the base pose once at step start
+  void startStep(int idx, Step& st) {
+    decompose(matrix(idx), pos[idx], rot[idx], scl[idx]);
+    if (!(st.flags & STEP_MOVE)) st.to = pos[idx];
+    // Expand target q1 from frozen base
+    st.target = !(st.flags & STEP_ROTATE) ? rot[idx] :
+                ((st.flags & STEP_LOCAL) ? glm::normalize(rot[idx] * st.delta) :
+                                           glm::normalize(st.delta * rot[idx]));
+    elapsed[idx] = st.lead;
+    state[idx] |= TRACK_STARTED;
+  }
+
+  bool valid(int idx) const { return idx >= 0 && idx < static_cast<int>(state.size()); }
+
+  glm::mat4& matrix(int idx) {
+    return *reinterpret_cast<glm::mat4*>(wmBase + static_cast<size_t>(idx) * wmStride);
+  }
+
+  bool getOrCreateTrack(int idx, const glm::mat4& curWm) {
+    if (!valid(idx)) return false;
+    if (!(state[idx] & TRACK_CREATED)) {
+      decompose(curWm, pos[idx], rot[idx], scl[idx]);
+      state[idx] = TRACK_CREATED;
+    }
+    return true;
+  }
+
+  // Slot following s in the ring of the card
+  int nextSlot(int idx, int s) const {
+    int base = idx * capacity;
+    return base + (s - base + 1) % capacity;
+  }
+
+  // Resets the slot after the tail of the ring of the card, to be queued by
+  // enqueue(). The rings grow first if the one of the card is full.
+  Step* newStep(int idx, uint8_t flags) {
+    if (pending[idx] >= static_cast<uint32_t>(capacity)) grow();
+    int s = pending[idx] == 0 ? idx * capacity : nextSlot(idx, tail[idx]);
+    steps[s] = Step{};
+    steps[s].flags = flags;
+    lastStep = s;
+    return &steps[s];
+  }
+
+  // Doubles the capacity of all the rings: the queued steps of each card are
+  // moved to the start of its new ring, in order
+  void grow() {
+    int cap = capacity * 2;
+    std::vector<Step> grown(state.size() * static_cast<size_t>(cap));
+    for (int idx = 0; idx < static_cast<int>(state.size()); idx++) {
+      if (pending[idx] == 0) continue;
+      int s = cursor[idx];
+      for (uint32_t k = 0; k < pending[idx]; k++, s = nextSlot(idx, s)) {
+        grown[idx * cap + k] = steps[s];
+      }
+      cursor[idx] = idx * cap;
+      tail[idx] = idx * cap + static_cast<int>(pending[idx]) - 1;
+    }
+    steps.swap(grown);
+    capacity = cap;
+  }
+
+  // Queues a wait, or extends the last queued step if it is already a wait
+  // with no callbacks: repeated global waits on idle cards take one slot
+  void queueWait(int idx, float seconds, bool activate) {
+    if (pending[idx] > 0 && steps[tail[idx]].flags == 0 && steps[tail[idx]].callback < 0) {
+      steps[tail[idx]].total += seconds;
+      return;
+    }
+    Step* s = newStep(idx, 0);
+    s->total = seconds;
+    enqueue(idx, activate);
+  }
+
+  // Makes the step just created the tail of the queue of the card
+  void enqueue(int idx, bool activate) {
+    if (pending[idx] == 0) cursor[idx] = lastStep;
+    tail[idx] = lastStep;
+    pending[idx]++;
+    if (activate && !(state[idx] & TRACK_ACTIVE)) {
+      state[idx] |= TRACK_ACTIVE;
+      activeSlot[idx] = static_cast<int>(active.size());
+      active.push_back(idx);
+    }
+  }
+
+  // Carries the final pose of the finished step as the new base, and frees
+  // its slot in the ring. Returns false if the track has no more steps.
+  bool advance(int idx, const glm::vec3& p, const glm::quat& q) {
+    pos[idx] = p; rot[idx] = q;
+    int s = cursor[idx];
+    for (int c = steps[s].callback; c >= 0; c = callbacks[c].next) fired.push_back(c);
+    steps[s].callback = -1;
+    pending[idx]--;
+    elapsed[idx] = 0.f;
+    state[idx] &= ~TRACK_STARTED;
+    if (pending[idx] > 0) {
+      cursor[idx] = nextSlot(idx, s);
+      return true;
+    }
+
+    cursor[idx] = tail[idx] = -1;
+
+    state[idx] &= ~TRACK_ACTIVE;
+    int slot = activeSlot[idx];
+    int last = active.back();
+    active[slot] = last;
+    activeSlot[last] = slot;
+    active.pop_back();
+    activeSlot[idx] = -1;
+    return false;
+  }
+
+  // Turns the timeline keys starting within this tick into steps. A key that
+  // finds its card idle starts exactly at its time, by carrying the part of
+  // the tick already past it; otherwise it is queued after the current steps.
+  void dispatch(float dt) {
+    double now = clock + dt;
+    while (scheduleHead < schedule.size()) {
+      int e = schedule[scheduleHead];
+      const Scheduled& sk = scheduled[e];
+      if (sk.key.at > now) break;
+      scheduleHead++;
+
+      int idx = sk.id;
+      bool idle = !(state[idx] & TRACK_ACTIVE);
+      getOrCreateTrack(idx, matrix(idx));
+      Step* st = newStep(idx, sk.key.flags);
+      st->to = sk.key.to;
+      st->delta = sk.key.delta;
+      st->moveDur = dur(sk.key.moveDur);
+      st->rotDur = dur(sk.key.rotDur);
+      st->total = dur(sk.key.total);
+      st->lead = idle ? static_cast<float>(clock - sk.key.at) : 0.f;
+      st->callback = sk.callback;
+      enqueue(idx, true);
+
+      if (--scheduledCount[idx] == 0) lastScheduled[idx] = -1;
+      scheduled[e].next = freeScheduled;
+      freeScheduled = e;
+    }
+    clock = now;
+    if (scheduleHead == schedule.size()) {   // nothing left: restarts the clock
+      schedule.clear();
+      scheduleHead = 0;
+      clock = 0.0;
     }
-    return it->second;
   }
 
-  void advance(Track& t, const glm::vec3& p, const glm::quat& q, const glm::vec3& s) {
-    // carry the final pose of the finished step as the new base
-    write(t.idx, p, q, s);
-    t.baseP = p; t.baseQ = q; t.baseS = s;
-    t.cur++; t.elapsed = 0.f; t.stepStarted = false;
-    if (t.cur >= t.queue.size()) t.active = false;
+  // Runs the callbacks of the steps completed during the tick, and returns
+  // them to the pool. Callbacks may add steps and register new callbacks.
+  void runCallbacks() {
+    for (size_t i = 0; i < fired.size(); i++) {
+      int c = fired[i];
+      std::function<void()> fn = std::move(callbacks[c].fn);
+      callbacks[c].fn = nullptr;
+      callbacks[c].next = freeCallback;
+      freeCallback = c;
+      fn();
+    }
+    fired.clear();
   }
 
   void write(int idx, const glm::vec3& p, const glm::quat& q, const glm::vec3& s) {
-    glm::mat4 T = glm::translate(glm::mat4(1), p);
-    glm::mat4 R = glm::mat4_cast(glm::normalize(q));
-    glm::mat4 S = glm::scale(glm::mat4(1), s);
-    setMatrix(idx, T * R * S);
+    glm::mat3 R = glm::mat3_cast(glm::normalize(q));
+    glm::mat4& M = matrix(idx);
+    M[0] = glm::vec4(R[0] * s.x, 0.f);
+    M[1] = glm::vec4(R[1] * s.y, 0.f);
+    M[2] = glm::vec4(R[2] * s.z, 0.f);
+    M[3] = glm::vec4(p, 1.f);
   }
 
-public:
-  std::function<void(int, const glm::mat4&)> setMatrix;
-  std::function<glm::mat4(int)>              getMatrix;
-  std::unordered_map<int, Track>             tracks;
+  unsigned char* wmBase;
+  size_t wmStride;
+  int capacity;                      // steps per card
+
+  // per card state, indexed by id
+  std::vector<glm::vec3> pos;
+  std::vector<glm::quat> rot;
+  std::vector<glm::vec3> scl;
+  std::vector<float>     elapsed;
+  std::vector<int>       cursor;     // slot of the current step, -1 if none
+  std::vector<int>       tail;       // slot of the last queued step, -1 if none
+  std::vector<uint32_t>  pending;
+  std::vector<uint8_t>   state;
+  std::vector<int>       activeSlot; // position in active, -1 if idle
+
+  std::vector<int>  active;          // ids of the cards with steps to run
+  std::vector<Step> steps;           // rings of all the cards, capacity slots each
+  int lastStep{-1};
+
+  std::vector<Callback> callbacks;   // pooled completion callbacks
+  std::vector<int> fired;            // callbacks to run at the end of the tick
+  int freeCallback{-1};
+
+  // timeline keys not started yet, sorted by start time from scheduleHead on
+  std::vector<uint32_t>  scheduledCount;   // per card
+  std::vector<int>       lastScheduled;    // per card, latest key, -1 if none
+  std::vector<Scheduled> scheduled;        // pooled entries
+  std::vector<int>       schedule;
+  size_t scheduleHead{0};
+  int freeScheduled{-1};
+  double clock{0.0};                      // seconds, restarted when the schedule empties
+
+  // scratch streams of tickBatch(), one float per active card each
+  enum BatchStream { B_PX, B_PY, B_PZ, B_TX, B_TY, B_TZ,
+                     B_QX, B_QY, B_QZ, B_QW, B_RX, B_RY, B_RZ, B_RW,
+                     B_SX, B_SY, B_SZ, B_E, B_MD, B_RD,
+                     B_M00, B_M01, B_M02, B_M10, B_M11, B_M12, B_M20, B_M21, B_M22, B_COUNT };
+  std::vector<float> batch;
+  std::vector<int>   batchIdx;
 };
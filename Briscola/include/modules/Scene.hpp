@@ -31,8 +31,9 @@ struct TechniqueRef {
 	std::vector<PipelineAndTexturesDefs>PT;
 	int Ntextures;
 	VertexDescriptor *VD;
+	bool cull;
 
-	void init(const char *_id, std::vector<PipelineAndTexturesDefs> _PT, int _Ntextures, VertexDescriptor * _VD);
+	void init(const char *_id, std::vector<PipelineAndTexturesDefs> _PT, int _Ntextures, VertexDescriptor * _VD, bool _cull = true);
 } ;
 
 struct VertexDescriptorRef {
@@ -49,6 +50,47 @@ struct TechniqueInstances {
 	TechniqueRef *T;
 } ;
 
+// Node of the bounding volume hierarchy built over the instances world bounds.
+// Children always follow their parent in the node array, so the tree can be
+// refitted bottom-up by visiting the nodes in reverse order.
+struct BVHNode {
+	glm::vec3 bmin, bmax;
+	int left, right;	// child nodes, -1 for leaves
+	int first, count;	// range of BVHInstances covered by a leaf
+} ;
+
+// Per instance data read by the culling compute shader (std430 layout)
+struct GPUCullInstance {
+	alignas(16) glm::mat4 Wm;
+	alignas(16) glm::vec4 bMin;
+	alignas(16) glm::vec4 bMax;
+	uint32_t indexCount;
+	uint32_t cull;
+	uint32_t pad[2];
+} ;
+
+struct GPUCullParams {
+	alignas(16) glm::vec4 planes[6];
+	uint32_t instanceCount;
+} ;
+
+// Per instance parameters of the pre-skinning compute shader: dequantization of
+// the packed source vertices, and byte offsets of their components
+struct PreSkinParams {
+	alignas(16) glm::mat4 posDequant;
+	alignas(16) glm::vec4 uvDequant;
+	uint32_t vertexCount;
+	uint32_t stride;
+	uint32_t posOffset, normOffset, uvOffset, jointOffset, weightOffset;
+} ;
+
+// Vertices written by the pre-skinning compute shader, in world space
+struct PreSkinnedVertex {
+	float pos[3];
+	float norm[3];
+	float UV[2];
+} ;
+
 
 class Scene {
 	public:
@@ -86,6 +128,40 @@ class Scene {
 	std::unordered_map<std::string, VertexDescriptor *> VDIds;
 	int Npasses;
 
+	// Frustum culling
+	std::vector<glm::vec3> WorldMin, WorldMax;
+	std::vector<BVHNode> BVH;
+	std::vector<int> BVHInstances;
+	std::vector<char> Visible;
+	std::vector<char> PrevVisible;	// of the previous updateCulling(), swapped with Visible
+	int CullableCount = 0;
+	int VisibleCount = 0;
+	int CulledCount = 0;
+
+	// Optional GPU culling: a compute shader writes one indirect draw command per instance
+	bool GPUCullingReady = false;
+	bool GPUCulling = false;
+	DescriptorSetLayout CullDSL;
+	ComputePipeline CullP;
+	DescriptorSet CullDS;
+	std::vector<GPUCullInstance> CullInstances;
+	std::vector<VkDrawIndexedIndirectCommand> CullCommands;
+
+	// Optional compute pre-skinning of the instances of one technique: their
+	// vertices are skinned once per frame into a buffer drawn by PreSkinnedP,
+	// and the dispatch of an instance is emptied when its pose did not change
+	bool PreSkinningReady = false;
+	bool PreSkinning = false;
+	int PreSkinTechnique = -1;
+	Pipeline *PreSkinnedP;
+	DescriptorSetLayout SkinDSL;
+	ComputePipeline SkinP;
+	std::vector<DescriptorSet *> SkinDS;
+	std::vector<std::vector<glm::vec4>> SkinPalettes;
+	std::vector<int> SkinVersion;                   // changes of the palette of each instance
+	std::vector<std::vector<int>> SkinImageVersion; // version skinned in each swap chain image
+	int SkinnedCount = 0;
+
 
 	int init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef>  &VDRs, std::vector<TechniqueRef> &PRs, std::string file);
 
@@ -93,15 +169,33 @@ class Scene {
 	void pipelinesAndDescriptorSetsCleanup();
 	void localCleanup();
     void populateCommandBuffer(VkCommandBuffer commandBuffer, int passId, int currentImage);
+	bool updateCulling(const glm::mat4 &ViewPrj);
+	void initGPUCulling(std::string CompShader);
+	void updateGPUCulling(const glm::mat4 &ViewPrj, int currentImage);
+	void populateCullingCommandBuffer(VkCommandBuffer commandBuffer, int currentImage);
+	void initPreSkinning(std::string CompShader, std::string technique, Pipeline *SkinnedP, int jointCount);
+	void updatePreSkinning(int i, const glm::vec4 *palette, int currentImage);
+	float checkPreSkinning(int i, int currentImage);
+	void populatePreSkinningCommandBuffer(VkCommandBuffer commandBuffer, int currentImage);
+
+	private:
+	void extractFrustumPlanes(const glm::mat4 &ViewPrj, glm::vec4 *planes);
+	bool isCullable(int i);
+	void computeWorldBounds(int i);
+	int buildBVHNode(int first, int count);
+	void refitBVH();
+	void markVisible(int node);
+	void cullBVHNode(int node, const glm::vec4 *planes);
 };
 
 #ifdef SCENE_IMPLEMENTATION
 
-void TechniqueRef::init(const char *_id, std::vector<PipelineAndTexturesDefs> _PT, int _Ntextures, VertexDescriptor * _VD) {
+void TechniqueRef::init(const char *_id, std::vector<PipelineAndTexturesDefs> _PT, int _Ntextures, VertexDescriptor * _VD, bool _cull) {
 	id = new std::string(_id);
 	PT = _PT;
 	Ntextures = _Ntextures;
 	VD = _VD;
+	cull = _cull;
 }
 
 void VertexDescriptorRef::init(const char *_id, VertexDescriptor * _VD) {
@@ -114,6 +208,10 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 	BP = _BP;
 	Npasses = _Npasses;
 	
+	// loading phases, shown in the traces recorded by the profiler
+	Profiler::TraceScope load(&BP->Prof, "Scene::init");
+	Profiler::TraceScope phase(&BP->Prof, "Scene: parse");
+	
 	for(int i = 0; i < VDRs.size(); i++) {
 		VDIds[*VDRs[i].id] = VDRs[i].VD;
 	}
@@ -139,6 +237,7 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 		std::cout << "\nScene contains " << js.size() << " definitions sections\n\n";
 		
 		// ASSET FILES
+		phase.next("Scene: asset files");
 		nlohmann::json afs = js["assetfiles"];
 		AssetFileCount = afs.size();
 		std::cout << "Asset Files count: " << AssetFileCount << "\n";
@@ -152,37 +251,29 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 			As[k]->init(afs[k]["file"], (MT[0] == 'O') ? OBJ : ((MT[0] == 'G') ? GLTF : MGCG));
 			if (MT[0] == 'G') {
 				// Solo se è un GLTF
-				tinygltf::TinyGLTF loader;
-				tinygltf::Model model;
-				std::string warn, err;
+				tinygltf::Model &model = *As[k]->getGLTFmodel();
 				std::string path = afs[k]["file"];
-
-				bool ok = loader.LoadASCIIFromFile(&model, &warn, &err, path);
-				if (!ok) {
-					std::cerr << "Failed to load GLTF file for debug: " << path << "\n";
-					std::cerr << "Error: " << err << "\n";
-				} else {
-					std::cout << "\n=== DEBUG INFO FROM: " << path << " ===\n";
-					for (size_t m = 0; m < model.meshes.size(); ++m) {
-						const auto& mesh = model.meshes[m];
-						std::cout << "Mesh " << m << ": " << mesh.name << "\n";
-						for (size_t p = 0; p < mesh.primitives.size(); ++p) {
-							const auto& prim = mesh.primitives[p];
-							std::cout << "  Primitive " << p << ":\n";
-							for (const auto& attr : prim.attributes) {
-								std::cout << "    Attribute: " << attr.first << "\n";
-							}
+				std::cout << "\n=== DEBUG INFO FROM: " << path << " ===\n";
+				for (size_t m = 0; m < model.meshes.size(); ++m) {
+					const auto& mesh = model.meshes[m];
+					std::cout << "Mesh " << m << ": " << mesh.name << "\n";
+					for (size_t p = 0; p < mesh.primitives.size(); ++p) {
+						const auto& prim = mesh.primitives[p];
+						std::cout << "  Primitive " << p << ":\n";
+						for (const auto& attr : prim.attributes) {
+							std::cout << "    Attribute: " << attr.first << "\n";
 						}
 					}
-					std::cout << "Skins: " << model.skins.size() << "\n";
-					std::cout << "Animations: " << model.animations.size() << "\n";
-					std::cout << "===============================\n";
 				}
+				std::cout << "Skins: " << model.skins.size() << "\n";
+				std::cout << "Animations: " << model.animations.size() << "\n";
+				std::cout << "===============================\n";
 			}
 
 		}
 		
 		// MODELS
+		phase.next("Scene: models");
 		nlohmann::json ms = js["models"];
 		ModelCount = ms.size();
 		std::cout << "Models count: " << ModelCount << "\n";
@@ -207,6 +298,7 @@ int Scene::init(BaseProject *_BP,  int _Npasses, std::vector<VertexDescriptorRef
 		}
 		
 		// TEXTURES
+		phase.next("Scene: textures");
 		nlohmann::json ts = js["textures"];
 		TextureCount = ts.size();
 		std::cout << "Textures count: " << TextureCount << "\n";
@@ -228,6 +320,7 @@ std::cout << ts[k]["id"] << "(" << k << ") " << TT << "\n";
 		}
 
 		// INSTANCES TextureCount
+		phase.next("Scene: instances");
 		nlohmann::json pis = js["instances"];
 		TechniqueInstanceCount = pis.size();
 std::cout << "Technique Instances count: " << TechniqueInstanceCount << "\n";
@@ -340,6 +433,8 @@ std::cout << "\n";
 						for (int l = 0; l < DSLsize; l++) {
 							if(DSL->Bindings[l].type == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
 								BP->DPSZs.uniformBlocksInPool += 1;
+							} else if(DSL->Bindings[l].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+								BP->DPSZs.storageBlocksInPool += 1;
 							} else {
 								BP->DPSZs.texturesInPool += 1;
 							}
@@ -365,6 +460,28 @@ std::cout << "Creating instances\n";
 		}
 std::cout << i << " instances created\n";
 
+		// Builds the hierarchy for frustum culling over the cullable instances
+		phase.next("Scene: BVH");
+		WorldMin.resize(InstanceCount);
+		WorldMax.resize(InstanceCount);
+		Visible.assign(InstanceCount, 1);
+		PrevVisible.assign(InstanceCount, 1);
+		BVHInstances.clear();
+		BVH.clear();
+		for(i = 0; i < InstanceCount; i++) {
+			if(isCullable(i)) {
+				computeWorldBounds(i);
+				BVHInstances.push_back(i);
+			}
+		}
+		CullableCount = BVHInstances.size();
+		VisibleCount = InstanceCount;
+		CulledCount = 0;
+		if(CullableCount > 0) {
+			buildBVHNode(0, CullableCount);
+		}
+std::cout << "BVH: " << BVH.size() << " nodes over " << CullableCount << " cullable instances\n";
+
 
 /*		} catch (const nlohmann::json::exception& e) {
 		std::cout << "\n\n\nException while parsing JSON file: " << file << "\n";
@@ -413,6 +530,41 @@ void Scene::pipelinesAndDescriptorSetsInit() {
 			}
 		}
 	}
+	if(GPUCullingReady) {
+		CullP.create();
+		CullDS.init(BP, &CullDSL, {});
+	}
+	if(PreSkinningReady) {
+		SkinP.create();
+		// the packed source vertices never change: they are copied once, from
+		// the vertex buffer of the model, since its CPU copy is released
+		std::vector<unsigned char> Src(SkinDSL.Bindings[2].linkSize);
+		for(int i = 0; i < SkinDS.size(); i++) {
+			SkinDS[i] = new DescriptorSet();
+			SkinDS[i]->init(BP, &SkinDSL, {});
+
+			Instance *Ii = &TI[PreSkinTechnique].I[i];
+			Model *Mi = M[Ii->Mid];
+			VertexDescriptor *VD = TI[PreSkinTechnique].T->VD;
+			PreSkinParams params{};
+			params.posDequant = Mi->PosDequant;
+			params.uvDequant = Mi->UVDequant;
+			params.stride = VD->Bindings[0].stride;
+			params.vertexCount = Mi->vertexBytes / params.stride;
+			params.posOffset = VD->Position.offset;
+			params.normOffset = VD->Normal.offset;
+			params.uvOffset = VD->UV.offset;
+			params.jointOffset = VD->JointIndex.offset;
+			params.weightOffset = VD->JointWeight.offset;
+			memcpy(Src.data(), Mi->mapVertices(), Mi->vertexBytes);
+			for(int img = 0; img < BP->getSwapChainImageCount(); img++) {
+				SkinDS[i]->map(img, &params, 0);
+				SkinDS[i]->map(img, Src.data(), 2);
+			}
+			// the buffers have just been created: every image must be skinned again
+			SkinImageVersion[i].assign(BP->getSwapChainImageCount(), -1);
+		}
+	}
 std::cout << "Scene DS init Done\n";
 }
 
@@ -428,6 +580,17 @@ void Scene::pipelinesAndDescriptorSetsCleanup() {
 		}
 		free(I[i]->DS);
 	}
+	if(GPUCullingReady) {
+		CullDS.cleanup();
+		CullP.cleanup();
+	}
+	if(PreSkinningReady) {
+		for(int i = 0; i < SkinDS.size(); i++) {
+			SkinDS[i]->cleanup();
+			delete SkinDS[i];
+		}
+		SkinP.cleanup();
+	}
 }
 
 void Scene::localCleanup() {
@@ -445,6 +608,22 @@ void Scene::localCleanup() {
 	}
 	free(M);
 	
+	// Cleanup asset files
+	for(int i = 0; i < AssetFileCount; i++) {
+		As[i]->cleanup();
+		delete As[i];
+	}
+	free(As);
+	
+	if(GPUCullingReady) {
+		CullDSL.cleanup();
+		CullP.destroy();
+	}
+	if(PreSkinningReady) {
+		SkinDSL.cleanup();
+		SkinP.destroy();
+	}
+	
 	for(int i = 0; i < InstanceCount; i++) {
 		delete I[i]->id;
 		free(I[i]->Tid);
@@ -467,23 +646,429 @@ void Scene::populateCommandBuffer(VkCommandBuffer commandBuffer, int passId, int
 //std::cout << "Generating draw calls for pass " << passId << "\n";
 	for(int k = 0; k < TechniqueInstanceCount; k++) {
 //std::cout << "Considering technique " << k << "\n";
+		// pre-skinned instances are drawn from their skinned vertices, already in world space
+		bool preSkinned = PreSkinning && (k == PreSkinTechnique);
+		Profiler::GpuScope gs(BP->Prof, commandBuffer, currentImage, TI[k].T->id->c_str());
 		for(int i = 0; i < TI[k].InstanceCount; i++) {
-			Pipeline *P = TI[k].T->PT[passId].P;
-			if(P != nullptr) {
+			Pipeline *P = preSkinned ? PreSkinnedP : TI[k].T->PT[passId].P;
+			if((P != nullptr) && (GPUCulling || Visible[TI[k].I[i].Iid])) {
 				P->bind(commandBuffer);
 
 //std::cout << "Drawing Instance " << i << "\n";
-				M[TI[k].I[i].Mid]->bind(commandBuffer);
+				if(preSkinned) {
+					M[TI[k].I[i].Mid]->bind(commandBuffer, SkinDS[i]->uniformBuffers[3][currentImage]);
+				} else {
+					M[TI[k].I[i].Mid]->bind(commandBuffer);
+					if(TI[k].T->VD->isQuantized()) {
+						M[TI[k].I[i].Mid]->pushDequant(commandBuffer, *P);
+					}
+				}
 				for(int j = 0; j < TI[k].I[i].NDs[passId]; j++) {
 //std::cout << "Binding DS: set " << j << "\n";
 					TI[k].I[i].DS[passId][j]->bind(commandBuffer, *P, j, currentImage);
 				}
 //std::cout << "Draw Call\n";						
-				vkCmdDrawIndexed(commandBuffer,
-						static_cast<uint32_t>(M[TI[k].I[i].Mid]->indices.size()), 1, 0, 0, 0);
+				if(GPUCulling) {
+					// the compute shader sets the instance count to zero for culled instances
+					vkCmdDrawIndexedIndirect(commandBuffer, CullDS.uniformBuffers[2][currentImage],
+							TI[k].I[i].Iid * sizeof(VkDrawIndexedIndirectCommand), 1,
+							sizeof(VkDrawIndexedIndirectCommand));
+				} else {
+					vkCmdDrawIndexed(commandBuffer,
+							static_cast<uint32_t>(M[TI[k].I[i].Mid]->indices.size()), 1, 0, 0, 0);
+				}
+				BP->recordedDraws++;
 			}
 		}
 	}
 }
 
-#endif
\ No newline at end of file
+// Instances whose technique allows it, and whose model has a valid bounding box
+// (meshes built manually do not compute one), take part in frustum culling
+bool Scene::isCullable(int i) {
+	Model *Mi = M[I[i]->Mid];
+	return I[i]->TIp->T->cull && (Mi->AABBmin.x <= Mi->AABBmax.x);
+}
+
+// Transforms the local bounding box of the model into a world space one:
+// the center is transformed, and the extents are projected on the world axes
+void Scene::computeWorldBounds(int i) {
+	Model *Mi = M[I[i]->Mid];
+	const glm::mat4 &Wm = I[i]->Wm;
+	glm::vec3 c = (Mi->AABBmax + Mi->AABBmin) * 0.5f;
+	glm::vec3 e = (Mi->AABBmax - Mi->AABBmin) * 0.5f;
+	glm::vec3 wc = glm::vec3(Wm * glm::vec4(c, 1.0f));
+	glm::vec3 we = glm::abs(glm::vec3(Wm[0])) * e.x +
+				   glm::abs(glm::vec3(Wm[1])) * e.y +
+				   glm::abs(glm::vec3(Wm[2])) * e.z;
+	WorldMin[i] = wc - we;
+	WorldMax[i] = wc + we;
+}
+
+// Recursively splits the instances at the median of the longest axis of their centroids
+int Scene::buildBVHNode(int first, int count) {
+	const int BVH_LEAF_SIZE = 4;
+	int node = BVH.size();
+	BVH.push_back(BVHNode{});
+
+	glm::vec3 bmin = glm::vec3( std::numeric_limits<float>::max());
+	glm::vec3 bmax = glm::vec3(-std::numeric_limits<float>::max());
+	glm::vec3 cmin = bmin, cmax = bmax;
+	for(int j = first; j < first + count; j++) {
+		int i = BVHInstances[j];
+		bmin = glm::min(bmin, WorldMin[i]);
+		bmax = glm::max(bmax, WorldMax[i]);
+		glm::vec3 c = (WorldMin[i] + WorldMax[i]) * 0.5f;
+		cmin = glm::min(cmin, c);
+		cmax = glm::max(cmax, c);
+	}
+
+	int left = -1, right = -1;
+	if(count > BVH_LEAF_SIZE) {
+		glm::vec3 ext = cmax - cmin;
+		int axis = (ext.x > ext.y) ? ((ext.x > ext.z) ? 0 : 2) : ((ext.y > ext.z) ? 1 : 2);
+		int half = count / 2;
+		std::nth_element(BVHInstances.begin() + first, BVHInstances.begin() + first + half,
+						 BVHInstances.begin() + first + count, [&](int a, int b) {
+			return (WorldMin[a][axis] + WorldMax[a][axis]) < (WorldMin[b][axis] + WorldMax[b][axis]);
+		});
+		left  = buildBVHNode(first, half);
+		right = buildBVHNode(first + half, count - half);
+	}
+	BVH[node] = BVHNode{bmin, bmax, left, right, first, count};
+	return node;
+}
+
+// Instances can move every frame (e.g. the animated cards): the topology built
+// at load time is kept, and only the bounds of the nodes are updated
+void Scene::refitBVH() {
+	for(int n = BVH.size() - 1; n >= 0; n--) {
+		BVHNode &N = BVH[n];
+		if(N.left < 0) {
+			N.bmin = glm::vec3( std::numeric_limits<float>::max());
+			N.bmax = glm::vec3(-std::numeric_limits<float>::max());
+			for(int j = N.first; j < N.first + N.count; j++) {
+				int i = BVHInstances[j];
+				computeWorldBounds(i);
+				N.bmin = glm::min(N.bmin, WorldMin[i]);
+				N.bmax = glm::max(N.bmax, WorldMax[i]);
+			}
+		} else {
+			N.bmin = glm::min(BVH[N.left].bmin, BVH[N.right].bmin);
+			N.bmax = glm::max(BVH[N.left].bmax, BVH[N.right].bmax);
+		}
+	}
+}
+
+void Scene::markVisible(int node) {
+	const BVHNode &N = BVH[node];
+	for(int j = N.first; j < N.first + N.count; j++) {
+		Visible[BVHInstances[j]] = 1;
+	}
+}
+
+// A node completely outside one plane is skipped, and a node completely inside
+// all the planes makes its whole subtree visible without further tests
+void Scene::cullBVHNode(int node, const glm::vec4 *planes) {
+	const BVHNode &N = BVH[node];
+	bool inside = true;
+	for(int p = 0; p < 6; p++) {
+		glm::vec3 n = glm::vec3(planes[p]);
+		glm::vec3 pv = glm::vec3(n.x >= 0.0f ? N.bmax.x : N.bmin.x,
+								 n.y >= 0.0f ? N.bmax.y : N.bmin.y,
+								 n.z >= 0.0f ? N.bmax.z : N.bmin.z);
+		if(glm::dot(n, pv) + planes[p].w < 0.0f) {
+			return;
+		}
+		glm::vec3 nv = glm::vec3(n.x >= 0.0f ? N.bmin.x : N.bmax.x,
+								 n.y >= 0.0f ? N.bmin.y : N.bmax.y,
+								 n.z >= 0.0f ? N.bmin.z : N.bmax.z);
+		if(glm::dot(n, nv) + planes[p].w < 0.0f) {
+			inside = false;
+		}
+	}
+	if(inside || (N.left < 0)) {
+		markVisible(node);
+	} else {
+		cullBVHNode(N.left, planes);
+		cullBVHNode(N.right, planes);
+	}
+}
+
+// Extracts the planes from the rows of the matrix. Depth goes from 0 to 1,
+// so the near plane is given by the third row alone.
+void Scene::extractFrustumPlanes(const glm::mat4 &ViewPrj, glm::vec4 *planes) {
+	glm::vec4 r0 = glm::vec4(ViewPrj[0][0], ViewPrj[1][0], ViewPrj[2][0], ViewPrj[3][0]);
+	glm::vec4 r1 = glm::vec4(ViewPrj[0][1], ViewPrj[1][1], ViewPrj[2][1], ViewPrj[3][1]);
+	glm::vec4 r2 = glm::vec4(ViewPrj[0][2], ViewPrj[1][2], ViewPrj[2][2], ViewPrj[3][2]);
+	glm::vec4 r3 = glm::vec4(ViewPrj[0][3], ViewPrj[1][3], ViewPrj[2][3], ViewPrj[3][3]);
+	planes[0] = r3 + r0;
+	planes[1] = r3 - r0;
+	planes[2] = r3 + r1;
+	planes[3] = r3 - r1;
+	planes[4] = r2;
+	planes[5] = r3 - r2;
+}
+
+// Updates the visibility of the instances against the frustum of the given view-projection
+// matrix. Returns true if the set of visible instances has changed, meaning that the
+// command buffers must be recorded again.
+bool Scene::updateCulling(const glm::mat4 &ViewPrj) {
+	if(CullableCount == 0) {
+		return false;
+	}
+	// the instances that are not cullable are visible in both
+	Visible.swap(PrevVisible);
+	for(int j = 0; j < CullableCount; j++) {
+		Visible[BVHInstances[j]] = 0;
+	}
+	refitBVH();
+
+	glm::vec4 planes[6];
+	extractFrustumPlanes(ViewPrj, planes);
+	cullBVHNode(0, planes);
+
+	VisibleCount = InstanceCount;
+	bool changed = false;
+	for(int j = 0; j < CullableCount; j++) {
+		int i = BVHInstances[j];
+		if(!Visible[i]) {
+			VisibleCount--;
+		}
+		changed |= (Visible[i] != PrevVisible[i]);
+	}
+	CulledCount = InstanceCount - VisibleCount;
+	return changed;
+}
+
+// Prepares the optional GPU culling path. It must be called after init(), and
+// before the descriptor pool is created, since it adds its own sets to the pool.
+void Scene::initGPUCulling(std::string CompShader) {
+	if(InstanceCount == 0) {
+		return;
+	}
+	CullDSL.init(BP, {
+				{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(GPUCullParams), 1},
+				{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, (int)(InstanceCount * sizeof(GPUCullInstance)), 1},
+				{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, (int)(InstanceCount * sizeof(VkDrawIndexedIndirectCommand)), 1}
+			});
+	CullP.init(BP, CompShader, {&CullDSL});
+	BP->DPSZs.uniformBlocksInPool += 1;
+	BP->DPSZs.storageBlocksInPool += 2;
+	BP->DPSZs.setsInPool += 1;
+
+	// The bounds and index counts do not change: only the matrices are updated every frame
+	CullInstances.resize(InstanceCount);
+	CullCommands.resize(InstanceCount);
+	for(int i = 0; i < InstanceCount; i++) {
+		Model *Mi = M[I[i]->Mid];
+		CullInstances[i].bMin = glm::vec4(Mi->AABBmin, 0.0f);
+		CullInstances[i].bMax = glm::vec4(Mi->AABBmax, 0.0f);
+		CullInstances[i].indexCount = static_cast<uint32_t>(Mi->indices.size());
+		CullInstances[i].cull = isCullable(i) ? 1 : 0;
+	}
+	GPUCullingReady = true;
+}
+
+// Uploads the frustum and the instance matrices for the frame using currentImage.
+// The statistics are read back from the commands written the last time the same
+// image was used, which has already completed at this point.
+void Scene::updateGPUCulling(const glm::mat4 &ViewPrj, int currentImage) {
+	GPUCullParams params{};
+	extractFrustumPlanes(ViewPrj, params.planes);
+	params.instanceCount = InstanceCount;
+	for(int i = 0; i < InstanceCount; i++) {
+		CullInstances[i].Wm = I[i]->Wm;
+	}
+	CullDS.map(currentImage, &params, 0);
+	CullDS.map(currentImage, CullInstances.data(), 1);
+
+	CullDS.read(currentImage, CullCommands.data(), 2);
+	VisibleCount = 0;
+	for(int i = 0; i < InstanceCount; i++) {
+		VisibleCount += (CullCommands[i].instanceCount != 0) ? 1 : 0;
+	}
+	CulledCount = InstanceCount - VisibleCount;
+}
+
+// Records the culling dispatch: it must be placed before the render pass that draws the scene
+void Scene::populateCullingCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+	if(!GPUCulling) {
+		return;
+	}
+	CullP.bind(commandBuffer);
+	CullDS.bind(commandBuffer, CullP, 0, currentImage);
+	vkCmdDispatch(commandBuffer, (InstanceCount + 63) / 64, 1, 1);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+// Prepares the optional pre-skinning of the instances of technique, whose vertex
+// format must contain joints and weights. SkinnedP draws the PreSkinnedVertex
+// buffers with the same descriptor sets as the technique. As initGPUCulling(),
+// it must be called after init() and before the descriptor pool is created.
+void Scene::initPreSkinning(std::string CompShader, std::string technique, Pipeline *SkinnedP, int jointCount) {
+	for(int k = 0; k < TechniqueInstanceCount; k++) {
+		if(*TI[k].T->id == technique) {
+			PreSkinTechnique = k;
+		}
+	}
+	if((PreSkinTechnique < 0) || (TI[PreSkinTechnique].InstanceCount == 0)) {
+		return;
+	}
+	VertexDescriptor *VD = TI[PreSkinTechnique].T->VD;
+	if(!VD->JointIndex.hasIt || !VD->JointWeight.hasIt) {
+		std::cout << "Scene Error: technique " << technique << " cannot be pre-skinned, its vertices have no joints\n";
+		exit(0);
+	}
+	int n = TI[PreSkinTechnique].InstanceCount;
+	size_t maxVertexBytes = 0, maxVertices = 0;
+	for(int i = 0; i < n; i++) {
+		Model *Mi = M[TI[PreSkinTechnique].I[i].Mid];
+		maxVertexBytes = std::max(maxVertexBytes, Mi->vertexBytes);
+		maxVertices = std::max(maxVertices, Mi->vertexBytes / VD->Bindings[0].stride);
+	}
+
+	SkinDSL.init(BP, {
+				{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(PreSkinParams), 1},
+				{1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, (int)(jointCount * 3 * sizeof(glm::vec4)), 1},
+				{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, (int)maxVertexBytes, 1},
+				{3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, (int)(maxVertices * sizeof(PreSkinnedVertex)), 1},
+				{4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, sizeof(VkDispatchIndirectCommand), 1}
+			});
+	SkinP.init(BP, CompShader, {&SkinDSL});
+	BP->DPSZs.uniformBlocksInPool += n;
+	BP->DPSZs.storageBlocksInPool += 4 * n;
+	BP->DPSZs.setsInPool += n;
+
+	PreSkinnedP = SkinnedP;
+	SkinDS.resize(n);
+	SkinPalettes.assign(n, std::vector<glm::vec4>(jointCount * 3));
+	SkinVersion.assign(n, 0);
+	SkinImageVersion.assign(n, std::vector<int>());
+	PreSkinningReady = true;
+}
+
+// Sets the palette of instance i of the pre-skinned technique (jointCount
+// row-major 3x4 matrices, as written by AnimCrowd::updatePalette()) for the frame
+// using currentImage. The instance is dispatched only if it is visible, and its
+// palette changed since the skinned vertices of this image were last written.
+void Scene::updatePreSkinning(int i, const glm::vec4 *palette, int currentImage) {
+	std::vector<glm::vec4> &Last = SkinPalettes[i];
+	if(memcmp(Last.data(), palette, Last.size() * sizeof(glm::vec4)) != 0) {
+		memcpy(Last.data(), palette, Last.size() * sizeof(glm::vec4));
+		SkinVersion[i]++;
+	}
+
+	// with the pass off nothing is dispatched, so no image is marked as skinned
+	VkDispatchIndirectCommand dispatch{0, 1, 1};
+	bool visible = GPUCulling || Visible[TI[PreSkinTechnique].I[i].Iid];
+	if(PreSkinning && visible && (SkinImageVersion[i][currentImage] != SkinVersion[i])) {
+		uint32_t vertexCount = M[TI[PreSkinTechnique].I[i].Mid]->vertexBytes / TI[PreSkinTechnique].T->VD->Bindings[0].stride;
+		dispatch.x = (vertexCount + 63) / 64;
+		SkinDS[i]->map(currentImage, Last.data(), 1);
+		SkinImageVersion[i][currentImage] = SkinVersion[i];
+		SkinnedCount++;
+	}
+	SkinDS[i]->map(currentImage, &dispatch, 4);
+}
+
+// Vertex v of the packed vertices src, skinned with palette as
+// PosNormUvTanWeights.vert does it, in the layout of the compute shader output
+static PreSkinnedVertex preSkinVertex(const PreSkinParams &params, const uint8_t *src, const glm::vec4 *palette, uint32_t v) {
+	const uint8_t *base = src + (size_t)v * params.stride;
+	int16_t p[4], n[2];
+	uint16_t uv[2];
+	uint8_t j[4], w[4];
+	memcpy(p, base + params.posOffset, sizeof(p));
+	memcpy(n, base + params.normOffset, sizeof(n));
+	memcpy(uv, base + params.uvOffset, sizeof(uv));
+	memcpy(j, base + params.jointOffset, sizeof(j));
+	memcpy(w, base + params.weightOffset, sizeof(w));
+
+	auto snorm = [](int16_t x) {return std::max(x / 32767.0f, -1.0f);};
+	glm::vec4 pos = params.posDequant * glm::vec4(snorm(p[0]), snorm(p[1]), snorm(p[2]), snorm(p[3]));
+	// octahedral decoding
+	glm::vec3 norm = glm::vec3(snorm(n[0]), snorm(n[1]), 0.0f);
+	norm.z = 1.0f - fabs(norm.x) - fabs(norm.y);
+	float t = std::max(-norm.z, 0.0f);
+	norm.x += (norm.x >= 0.0f) ? -t : t;
+	norm.y += (norm.y >= 0.0f) ? -t : t;
+	norm = glm::normalize(norm);
+
+	glm::vec4 r[3];
+	for(int k = 0; k < 3; k++) {
+		r[k] = (w[0] / 255.0f) * palette[3 * j[0] + k] + (w[1] / 255.0f) * palette[3 * j[1] + k] +
+			   (w[2] / 255.0f) * palette[3 * j[2] + k] + (w[3] / 255.0f) * palette[3 * j[3] + k];
+	}
+	PreSkinnedVertex out;
+	for(int k = 0; k < 3; k++) {
+		out.pos[k] = glm::dot(r[k], pos);
+		out.norm[k] = glm::dot(glm::vec3(r[k]), norm);
+	}
+	out.UV[0] = params.uvDequant.x + uv[0] / 65535.0f * params.uvDequant.z;
+	out.UV[1] = params.uvDequant.y + uv[1] / 65535.0f * params.uvDequant.w;
+	return out;
+}
+
+// Reads back the vertices of instance i skinned by the compute shader in the
+// buffers of currentImage, and returns their largest difference from the same
+// vertices skinned on the CPU as the vertex shader does, with the parameters
+// and the palette of that dispatch (-1 if the image was never skinned). The
+// frame that last used currentImage must have completed.
+float Scene::checkPreSkinning(int i, int currentImage) {
+	if(!PreSkinningReady || (SkinImageVersion[i][currentImage] < 0)) {
+		return -1.0f;
+	}
+	PreSkinParams params;
+	std::vector<glm::vec4> palette(SkinDSL.Bindings[1].linkSize / sizeof(glm::vec4));
+	std::vector<uint8_t> src(SkinDSL.Bindings[2].linkSize);
+	std::vector<PreSkinnedVertex> dst(SkinDSL.Bindings[3].linkSize / sizeof(PreSkinnedVertex));
+	SkinDS[i]->read(currentImage, &params, 0);
+	SkinDS[i]->read(currentImage, palette.data(), 1);
+	SkinDS[i]->read(currentImage, src.data(), 2);
+	SkinDS[i]->read(currentImage, dst.data(), 3);
+
+	float maxDiff = 0.0f;
+	for(uint32_t v = 0; v < params.vertexCount; v++) {
+		PreSkinnedVertex ref = preSkinVertex(params, src.data(), palette.data(), v);
+		for(int k = 0; k < 3; k++) {
+			maxDiff = std::max(maxDiff, (float)fabs(ref.pos[k] - dst[v].pos[k]));
+			maxDiff = std::max(maxDiff, (float)fabs(ref.norm[k] - dst[v].norm[k]));
+		}
+		for(int k = 0; k < 2; k++) {
+			maxDiff = std::max(maxDiff, (float)fabs(ref.UV[k] - dst[v].UV[k]));
+		}
+	}
+	return maxDiff;
+}
+
+// Records the skinning dispatches: as the culling, it must be placed before the render pass
+void Scene::populatePreSkinningCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
+	if(!PreSkinning) {
+		return;
+	}
+	SkinP.bind(commandBuffer);
+	for(int i = 0; i < SkinDS.size(); i++) {
+		SkinDS[i]->bind(commandBuffer, SkinP, 0, currentImage);
+		vkCmdDispatchIndirect(commandBuffer, SkinDS[i]->uniformBuffers[4][currentImage], 0);
+	}
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+#endif
@@ -16,6 +16,10 @@
 #include <chrono>
 #include <unordered_map>
 #include <map>
+#include <limits>
+#include <mutex>
+#include <atomic>
+#include <thread>
 
 #ifdef STARTER_IMPLEMENTATION
 // to allow splitting header and implementation
@@ -24,6 +28,23 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define SINFL_IMPLEMENTATION
 #define TINYGLTF_IMPLEMENTATION
+
+// to memory map asset files
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
 #endif
 
 // GLM to support matrix operations
@@ -50,6 +71,9 @@
 // AES encription, to load MGCG files
 #include <plusaes.hpp>
 
+// to read the headless scripts and write their reports
+#include <json.hpp>
+
 // Unzip library, to load MGCG files
 #include <sinfl.h>
 
@@ -76,6 +100,9 @@
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// Build with -DSTARTER_LOAD_STATS to print the statistics of the assets as they
+// are loaded: vertex cache efficiency of the OBJ meshes, throughput of the MGCG files
+
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation"
 };
@@ -105,6 +132,20 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance,
 void PrintVkError( VkResult result );
 
 std::vector<char> readFile(const std::string& filename);
+std::vector<char> readMGCGFile(const std::string& filename);
+
+// Read-only memory mapping of a whole file
+struct MappedFile {
+	const unsigned char *data = nullptr;
+	size_t size = 0;
+
+	bool map(const std::string& filename);
+	void unmap();
+
+	private:
+	void *fileHandle = nullptr;
+	void *mapHandle = nullptr;
+};
 
 class BaseProject;
 
@@ -128,6 +169,21 @@ struct VertexDescriptorElement {
 struct VertexComponent {
 	bool hasIt;
 	uint32_t offset;
+	VkFormat format;
+};
+
+// Besides 32-bit floats, vertex components can use packed formats:
+//   POSITION    VK_FORMAT_R16G16B16A16_SNORM, normalized in the model bounding box (w = 1)
+//   NORMAL      VK_FORMAT_R16G16_SNORM, octahedral encoding
+//   UV          VK_FORMAT_R16G16_UNORM, normalized in the model UV range
+//   TANGENT     VK_FORMAT_R16G16B16A16_SNORM
+//   JOINTINDEX  VK_FORMAT_R8G8B8A8_UINT
+//   JOINTWEIGHT VK_FORMAT_R8G8B8A8_UNORM
+// Quantized positions and UVs must be restored in the vertex shader with the
+// per-model values contained in this push constant (see Model::pushDequant())
+struct VertexDequantPushConstant {
+	alignas(16) glm::mat4 PosDequant;
+	alignas(16) glm::vec4 UVDequant;	// xy = offset, zw = scale
 };
 
 struct VertexDescriptor {
@@ -147,6 +203,7 @@ struct VertexDescriptor {
  	
  	void init(BaseProject *bp, std::vector<VertexBindingDescriptorElement> B, std::vector<VertexDescriptorElement> E);
 	void cleanup();
+	bool isQuantized();
 
 	std::vector<VkVertexInputBindingDescription> getBindingDescription();
 	std::vector<VkVertexInputAttributeDescription>
@@ -156,6 +213,7 @@ struct VertexDescriptor {
 enum ModelType {OBJ, GLTF, MGCG};
 
 class AssetFile;
+struct Pipeline;
 
 class Model {
 	BaseProject *BP;
@@ -165,16 +223,42 @@ class Model {
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
 	VertexDescriptor *VD;
+	void *vertexMap = nullptr;
+
+	// Quantization of packed vertex formats
+	glm::vec3 QPosOffset, QPosScale;
+	glm::vec2 QUVOffset, QUVScale;
 
 	public:
 	glm::mat4 Wm;
 	std::vector<unsigned char> vertices{};
 	std::vector<uint32_t> indices{};
+	// size of the vertex buffer: vertices is released once it is uploaded
+	size_t vertexBytes = 0;
+	
+	// Local space bounding box and UV range of the loaded meshes
+	glm::vec3 AABBmin, AABBmax;
+	glm::vec2 UVmin, UVmax;
+	glm::mat4 PosDequant = glm::mat4(1);
+	glm::vec4 UVDequant = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	void resetBounds();
+	void growOBJBounds(const tinyobj::shape_t *M, const tinyobj::attrib_t *A);
+	void growGLTFBounds(tinygltf::Model *M, const tinygltf::Primitive *Prm, const std::vector<const unsigned char *> &BD);
+	void computeDequant();
+	void writePosition(unsigned char *vertex, glm::vec3 pos);
+	void writeNormal(unsigned char *vertex, glm::vec3 norm);
+	void writeUV(unsigned char *vertex, glm::vec2 uv);
+	void writeTangent(unsigned char *vertex, glm::vec4 tan);
+	void writeJointIndex(unsigned char *vertex, glm::uvec4 joints);
+	void writeJointWeight(unsigned char *vertex, glm::vec4 weights);
 	void loadModelOBJ(std::string file);
 	void makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A);
+	static void optimizeVertexCache(uint32_t *idx, size_t indexCount, size_t vertexCount);
+	static void optimizeVertexFetch(uint32_t *idx, size_t indexCount, unsigned char *vert, size_t vertexCount, int stride);
+	static float computeACMR(const uint32_t *idx, size_t indexCount, int cacheSize);
 	static void getGLTFnodeTransforms(const tinygltf::Node *N, glm::vec3 &T, glm::vec3 &S, glm::quat &Q);
 	void makeGLTFwm(const tinygltf::Node *N);
-	void makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm);
+	void makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm, const std::vector<const unsigned char *> &BD);
 	void loadModelGLTF(std::string file, bool encoded);
 	void createIndexBuffer();
 	void createVertexBuffer();
@@ -183,13 +267,21 @@ class Model {
 	void initFromAsset(BaseProject *bp, VertexDescriptor *VD, AssetFile *AF, std::string AN, int Mid = 0, std::string NN = "");
 	void initMesh(BaseProject *bp, VertexDescriptor *VD, bool printDebug = true);
 	void cleanup();
+	unsigned char *mapVertices();
   	void bind(VkCommandBuffer commandBuffer);
+  	// binds the indices of the model with vertices from another buffer
+  	void bind(VkCommandBuffer commandBuffer, VkBuffer vertices);
+	void pushDequant(VkCommandBuffer commandBuffer, Pipeline &P);
 };
 
 class AssetFile {
 	friend Model;
 	
 	tinygltf::Model model;
+	// Base address of the data of each GLTF buffer: external .bin files are
+	// memory mapped, and not copied in tinygltf::Buffer::data
+	std::vector<const unsigned char *> GLTFbufferData;
+	std::vector<MappedFile> GLTFmapped;
 	std::unordered_map<std::string, std::vector<const tinygltf::Primitive *>> GLTFmeshes;
 	std::unordered_map<std::string, const tinygltf::Node *> GLTFnodes;
 
@@ -207,7 +299,17 @@ class AssetFile {
 	void init(std::string file, ModelType MT);
 	ModelType getType() {return type;}
 	tinygltf::Model *getGLTFmodel() {return &model;}
+	const unsigned char *getGLTFaccessorData(int accessor) {
+		return GLTFaccessorData(&model, GLTFbufferData, accessor);
+	}
 	void cleanup();
+	
+	static void loadGLTF(tinygltf::Model *M, std::string file, std::vector<MappedFile> &MF, std::vector<const unsigned char *> &BD);
+	static const unsigned char *GLTFaccessorData(const tinygltf::Model *M, const std::vector<const unsigned char *> &BD, int accessor) {
+		const tinygltf::Accessor &A = M->accessors[accessor];
+		const tinygltf::BufferView &V = M->bufferViews[A.bufferView];
+		return BD[V.buffer] + V.byteOffset + A.byteOffset;
+	}
 };
 
 struct Texture {
@@ -221,6 +323,8 @@ struct Texture {
 	static const int maxImgs = 6;
 	
 	void createTextureImage(std::vector<std::string>files, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB);
+	void createTextureImage(std::vector<const unsigned char *>pixels, int texWidth, int texHeight,
+							int bytesPerPixel, VkFormat Fmt);
 	void createTextureImageView(VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB);
 	void createTextureSampler(VkFilter magFilter = VK_FILTER_LINEAR,
 							 VkFilter minFilter = VK_FILTER_LINEAR,
@@ -233,6 +337,8 @@ struct Texture {
 							);
 
 	void init(BaseProject *bp, std::string file, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB, bool initSampler = true);
+	void init(BaseProject *bp, const unsigned char *pixels, int texWidth, int texHeight,
+			  int bytesPerPixel, VkFormat Fmt, bool initSampler = true);
 	void initCubic(BaseProject *bp, std::vector<std::string>, VkFormat Fmt = VK_FORMAT_R8G8B8A8_SRGB);
 	VkDescriptorImageInfo getViewAndSampler();
 	void cleanup();
@@ -392,6 +498,24 @@ struct Pipeline {
 	void cleanup();
 };
 
+struct ComputePipeline {
+	BaseProject *BP;
+	VkPipeline computePipeline;
+  	VkPipelineLayout pipelineLayout;
+ 
+	VkShaderModule compShaderModule;
+	std::vector<DescriptorSetLayout *> D;
+	std::vector<VkPushConstantRange> PK;	
+  	
+  	void init(BaseProject *bp, const std::string& CompShader,
+  			  std::vector<DescriptorSetLayout *> d,
+			  std::vector<VkPushConstantRange> pk = {});
+  	void create();
+  	void destroy();
+  	void bind(VkCommandBuffer commandBuffer);
+	void cleanup();
+};
+
 struct DescriptorSet {
 	BaseProject *BP;
 
@@ -401,18 +525,25 @@ struct DescriptorSet {
 	DescriptorSetLayout *Layout;
 	
 	std::vector<bool> toFree;
+	std::vector<std::vector<void *>> persistentMaps;
 
 	void init(BaseProject *bp, DescriptorSetLayout *L,
 						 std::vector<VkDescriptorImageInfo>VaSs);
 	void cleanup();
   	void bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId, int currentImage);
+  	void bind(VkCommandBuffer commandBuffer, ComputePipeline &P, int setId, int currentImage);
   	void map(int currentImage, void *src, int slot);
+  	void read(int currentImage, void *dst, int slot);
+  	// keeps the buffer mapped until cleanup, to be written in place (do not
+  	// use map() or read() on the same slot)
+  	void *mapped(int currentImage, int slot);
 };
 
 
 struct PoolSizes {
 	int uniformBlocksInPool = 0;
 	int texturesInPool = 0;
+	int storageBlocksInPool = 0;
 	int setsInPool = 0;
 };
 
@@ -431,6 +562,7 @@ struct NamedCommandBuffer {
 
 	NamedCommandBuffersStates state;
 	std::vector<bool> inQueue;
+	std::vector<int> draws;		// draw calls recorded for each image
 };
 
 struct NamedCommandBufferVersions {
@@ -438,6 +570,122 @@ struct NamedCommandBufferVersions {
 	std::vector<NamedCommandBuffer *>old;
 };
 
+// Frame profiler: CPU scopes are timed with the high resolution clock, GPU scopes
+// with pairs of timestamp queries. Each track keeps its last ProfilerHistory
+// samples in a ring buffer, from which the rolling median and 99th percentile
+// are computed. Track names are not copied: use literals or persistent strings.
+const int ProfilerMaxTracks = 32;
+const int ProfilerHistory = 256;
+
+struct ProfilerTrack {
+	const char *name;
+	bool gpu;
+	float samples[ProfilerHistory];	// milliseconds
+	uint64_t count;		// samples written so far
+	double frameTime;	// CPU time accumulated in the current frame
+	bool active;		// CPU scope entered in the current frame
+	float p50, p99;
+};
+
+// Complete event of a Chrome trace, times in microseconds from the start of the trace
+struct ProfilerEvent {
+	const char *name;
+	int tid;
+	double start;
+	double duration;
+};
+
+class Profiler {
+	public:
+	// incremented each time the percentiles are recomputed
+	int statsVersion = 0;
+
+	// Times the code executed during its lifetime
+	struct Scope {
+		Profiler *P;
+		int id;
+		std::chrono::high_resolution_clock::time_point start;
+
+		Scope(Profiler &_P, const char *name);
+		~Scope();
+	};
+
+	// Writes a timestamp pair around the commands recorded during its lifetime
+	struct GpuScope {
+		Profiler *P;
+		VkCommandBuffer commandBuffer;
+		int currentImage;
+		int id;
+
+		GpuScope(Profiler &_P, VkCommandBuffer _commandBuffer, int _currentImage, const char *name);
+		~GpuScope();
+	};
+
+	// Adds an event to the trace, if one is being recorded, without updating the
+	// statistics: it can be used from any thread, and outside the frames.
+	// next() ends the current event and starts a new one.
+	struct TraceScope {
+		Profiler *P;
+		const char *name;
+		std::chrono::high_resolution_clock::time_point start;
+
+		TraceScope(Profiler *_P, const char *_name);
+		~TraceScope();
+		void next(const char *_name);
+	};
+
+	int track(const char *name, bool gpu = false);
+	void addSample(int id, float ms);
+	void beginFrame();
+	void endFrame();
+
+	bool initGPU(VkDevice _device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, int images);
+	void cleanupGPU();
+	static void populateResetAccess(VkCommandBuffer commandBuffer, int currentImage, void *Params);
+	int gpuBegin(VkCommandBuffer commandBuffer, int currentImage, const char *name);
+	void gpuEnd(VkCommandBuffer commandBuffer, int currentImage, int id);
+	void submittedGPU(int currentImage);
+	void collectGPU(int currentImage);
+
+	int trackCount() { return nTracks; }
+	const ProfilerTrack &getTrack(int id) { return T[id]; }
+	int report(char *buf, int size);
+
+	// Records the CPU scopes of the next frames (all of them if frames <= 0) to a
+	// Chrome trace JSON file, readable by chrome://tracing and ui.perfetto.dev
+	void startTrace(std::string file, int frames);
+	void stopTrace();
+	bool isTracing() { return tracing; }
+	void traceEvent(const char *name, std::chrono::high_resolution_clock::time_point start,
+					std::chrono::high_resolution_clock::time_point end);
+
+	private:
+	ProfilerTrack T[ProfilerMaxTracks];
+	int nTracks = 0;
+	uint64_t frames = 0;
+	int frameTrack = -1;
+	std::chrono::high_resolution_clock::time_point frameStart;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueryPool queryPool = VK_NULL_HANDLE;
+	int queryImages = 0;
+	float timestampPeriod = 1.0f;	// nanoseconds per tick
+	uint64_t timestampMask = ~0ull;
+	std::vector<bool> pending;		// queries of the image submitted and not read yet
+	std::vector<uint64_t> results;	// value and availability of each query
+
+	std::atomic<bool> tracing{false};
+	std::mutex traceLock;
+	std::vector<ProfilerEvent> events;
+	std::vector<std::thread::id> threads;	// position is the tid of the events
+	std::string traceFile;
+	int traceFrames = 0;
+	int tracedFrames = 0;
+	std::chrono::high_resolution_clock::time_point traceStart;
+
+	void computeStats();
+};
+
 // MAIN ! 
 class BaseProject {
 	friend class VertexDescriptor;
@@ -446,6 +694,7 @@ class BaseProject {
 	friend class FrameBufferAttachment;
 	friend class RenderPass;
 	friend class Pipeline;
+	friend class ComputePipeline;
 	friend class DescriptorSetLayout;
 	friend class DescriptorSet;
 
@@ -454,6 +703,30 @@ public:
     void run(); 
 
 	PoolSizes DPSZs;
+	
+	// number of frames submitted so far: resources retired at frame F are no
+	// longer used by the GPU once frameCount >= F + MAX_FRAMES_IN_FLIGHT
+	uint64_t frameCount = 0;
+	
+	int getSwapChainImageCount() { return swapChainImages.size(); }
+
+	// CPU and GPU timings of the frames
+	Profiler Prof;
+
+	// Headless mode, for automated benchmarks: no window and no surface, the frames
+	// are drawn into offscreen images and the keys are replayed from a script.
+	// After the given number of frames, a JSON report of the frame times, draw
+	// calls and memory is written. Must be called before run().
+	void setHeadless(int frames, std::string script, std::string report);
+	bool isHeadless() { return headless; }
+
+	// Input and time, replayed from the script in headless mode
+	int getKey(int key);
+	double getTime();
+	void closeWindow();
+
+	// to be incremented for each draw call written in the command buffer being recorded
+	int recordedDraws = 0;
 
 protected:
 	uint32_t windowWidth;
@@ -494,6 +767,30 @@ protected:
 	std::vector<VkFence> inFlightFences;
 	std::vector<VkFence> imagesInFlight;
 	
+	// headless mode
+	struct HeadlessKey {
+		int key;
+		int frame;		// first frame in which the key is pressed
+		int hold;		// number of frames it stays pressed
+	};
+	bool headless = false;
+	bool headlessQuit = false;
+	int headlessFrames = 0;
+	std::string headlessReport;
+	std::vector<HeadlessKey> headlessKeys;
+	std::vector<VkDeviceMemory> offscreenMemory;
+	// layout in which the render passes leave the images of the surface: the
+	// offscreen ones are never presented, and are left ready to be copied
+	VkImageLayout surfaceLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	
+	// statistics of the headless report
+	int frameDraws = 0;		// draw calls of the command buffers of the last frame
+	VkDeviceSize allocatedMemory = 0;
+	VkDeviceSize peakMemory = 0;
+	std::unordered_map<VkDeviceMemory, VkDeviceSize> memorySizes;
+	void trackDeviceMemory(VkDeviceMemory mem, VkDeviceSize size);
+	void freeDeviceMemory(VkDeviceMemory mem);
+	
     void initWindow();
 
 	virtual void onWindowResize(int w, int h) = 0;
@@ -538,6 +835,7 @@ protected:
 	VkSampleCountFlagBits getMaxUsableSampleCount();
 	void createLogicalDevice();
 	void createSwapChain();
+	void createOffscreenImages();
 	VkSurfaceFormatKHR chooseSwapSurfaceFormat(
 			const std::vector<VkSurfaceFormatKHR>& availableFormats);
 	VkPresentModeKHR chooseSwapPresentMode(
@@ -592,6 +890,8 @@ protected:
 	void createCommandBuffer(NamedCommandBuffer *ncb, int imageIndex);
 	void updateCommandBuffers(std::vector<VkCommandBuffer> &buffers, int imageIndex);
 	void drawFrame();
+	void headlessLoop();
+	void writeHeadlessReport(std::vector<float> &frameTimes, std::vector<int> &draws);
 	
 	virtual void updateUniformBuffer(uint32_t currentImage) = 0;
 	virtual void pipelinesAndDescriptorSetsCleanup() = 0;
@@ -767,15 +1067,347 @@ std::vector<char> readFile(const std::string& filename) {
 	return buffer;
 }
 
+// MGCG files are AES-CBC encrypted: the first 16 bytes of the plain text
+// contain the decompressed size in ASCII, followed by a raw deflate stream.
+// They are decrypted in chunks and inflated straight into the output buffer,
+// so the working memory is bounded by MGCG_CHUNK_SIZE.
+static const size_t MGCG_CHUNK_SIZE = 64 * 1024;
+// deflate cannot expand more than 1032:1, larger sizes in the header are corrupted
+static const size_t MGCG_MAX_RATIO = 1032;
+
+class MGCGReader {
+	std::ifstream file;
+	plusaes::detail::RoundKeys rkeys;
+	unsigned char prev[16];
+	std::vector<unsigned char> buf;
+	bool eof = false;
+
+	public:
+	const unsigned char *cur = nullptr;
+	const unsigned char *lim = nullptr;
+	size_t fileSize = 0;
+
+	MGCGReader(const std::string& filename, const unsigned char *key, int keySize, const unsigned char iv[16]) :
+				file(filename, std::ios::binary | std::ios::ate), buf(MGCG_CHUNK_SIZE + 16, 0) {
+		if (!file.is_open()) {
+			std::cout << "Failed to open: " << filename << "\n";
+			throw std::runtime_error("failed to open file!");
+		}
+		fileSize = (size_t)file.tellg();
+		file.seekg(0);
+		rkeys = plusaes::detail::expand_key(key, keySize);
+		memcpy(prev, iv, 16);
+		cur = lim = buf.data();
+	}
+
+	// Moves the unread bytes to the beginning of the buffer, and appends the
+	// next chunk of decrypted data. The 8 bytes after lim are always zero,
+	// since the bit reader of the inflater loads 64 bits at a time.
+	void refill() {
+		size_t left = lim - cur;
+		memmove(buf.data(), cur, left);
+		size_t want = (MGCG_CHUNK_SIZE - left) & ~(size_t)15;
+		unsigned char *dst = buf.data() + left;
+		size_t got = 0;
+		if(!eof && (want > 0)) {
+			file.read((char *)dst, want);
+			got = (size_t)file.gcount() & ~(size_t)15;
+			eof = (got < want);
+		}
+		for(size_t i = 0; i < got; i += 16) {
+			unsigned char c[16];
+			memcpy(c, dst + i, 16);
+			plusaes::detail::decrypt_state(rkeys, c, dst + i);
+			plusaes::detail::xor_data(dst + i, prev);
+			memcpy(prev, c, 16);
+		}
+		cur = buf.data();
+		lim = dst + got;
+		memset(buf.data() + left + got, 0, buf.size() - left - got);
+	}
+
+	void ensure(size_t n) {
+		if(((size_t)(lim - cur) < n) && !eof) {
+			refill();
+		}
+	}
+
+	bool finished() {
+		return eof && (cur >= lim);
+	}
+};
+
+// Inflates the deflate stream provided by R into out[0..cap), reusing the
+// Huffman decoder of sinfl.h with a bit reader refilled from the stream.
+// Returns the number of bytes written: a truncated or corrupted stream stops
+// early, without reading past the decrypted data or writing past out + cap.
+static size_t MGCGinflate(MGCGReader &R, unsigned char *out, size_t cap) {
+	static const unsigned char order[] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+	static const short dbase[30+2] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,
+		257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
+	static const unsigned char dbits[30+2] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,
+		10,10,11,11,12,12,13,13,0,0};
+	static const short lbase[29+2] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,
+		43,51,59,67,83,99,115,131,163,195,227,258,0,0};
+	static const unsigned char lbits[29+2] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,
+		4,4,4,5,5,5,5,0,0,0};
+
+	unsigned char *o = out;
+	unsigned char *oe = out + cap;
+	struct sinfl s = {0};
+	int last = 0;
+	bool truncated = false;
+
+	// refills the bit buffer, fetching a new chunk when less than 16 bytes are left.
+	// Once the bits consumed go past the end of the stream, the reader is parked on
+	// the zero padding after lim, so sinfl_read64() never leaves the chunk buffer.
+	auto refill = [&]() {
+		if(R.lim - s.bitptr < 16) {
+			R.cur = s.bitptr;
+			R.ensure(16);
+			s.bitptr = R.cur;
+		}
+		if(s.bitptr - (s.bitcnt >> 3) > R.lim) {
+			truncated = true;
+			s.bitptr = R.lim;
+		}
+		sinfl_refill(&s);
+	};
+
+	R.ensure(16);
+	s.bitptr = R.cur;
+	while(!last && !truncated) {
+		refill();
+		last = sinfl__get(&s, 1);
+		int type = sinfl__get(&s, 2);
+
+		if(type == 0) {
+			// stored block: bytes are copied from the stream
+			sinfl__get(&s, s.bitcnt & 7);
+			int len = sinfl__get(&s, 16);
+			int nlen = sinfl__get(&s, 16);
+			R.cur = s.bitptr - (s.bitcnt >> 3);
+			s.bitbuf = 0;
+			s.bitcnt = 0;
+			if((len != (~nlen & 0xffff)) || (len > oe - out) || (R.cur > R.lim)) {
+				break;
+			}
+			while(len > 0) {
+				R.ensure(1);
+				if(R.cur >= R.lim) {
+					return out - o;
+				}
+				int n = std::min(len, (int)(R.lim - R.cur));
+				memcpy(out, R.cur, n);
+				out += n;
+				R.cur += n;
+				len -= n;
+			}
+			s.bitptr = R.cur;
+			continue;
+		}
+
+		if(type == 1) {
+			int n; unsigned char lens[288+32];
+			for (n = 0; n <= 143; n++) lens[n] = 8;
+			for (n = 144; n <= 255; n++) lens[n] = 9;
+			for (n = 256; n <= 279; n++) lens[n] = 7;
+			for (n = 280; n <= 287; n++) lens[n] = 8;
+			for (n = 0; n < 32; n++) lens[288+n] = 5;
+			sinfl_build(s.lits, lens, 10, 15, 288);
+			sinfl_build(s.dsts, lens + 288, 8, 15, 32);
+		} else if(type == 2) {
+			unsigned hlens[SINFL_PRE_TBL_SIZE];
+			unsigned char nlens[19] = {0}, lens[288+32];
+			refill();
+			int nlit = 257 + sinfl__get(&s, 5);
+			int ndist = 1 + sinfl__get(&s, 5);
+			int nlen = 4 + sinfl__get(&s, 4);
+			for (int n = 0; n < nlen; n++) {
+				refill();
+				nlens[order[n]] = (unsigned char)sinfl__get(&s, 3);
+			}
+			sinfl_build(hlens, nlens, 7, 7, 19);
+			for (int n = 0; n < nlit + ndist;) {
+				refill();
+				int sym = sinfl_decode(&s, hlens, 7);
+				int i;
+				switch (sym) {default: lens[n++] = (unsigned char)sym; break;
+				case 16: i = 3 + sinfl__get(&s, 2);
+					if((n == 0) || (n + i > nlit + ndist)) return out - o;
+					for (; i; i--, n++) lens[n] = lens[n-1]; break;
+				case 17: i = 3 + sinfl__get(&s, 3);
+					if(n + i > nlit + ndist) return out - o;
+					for (; i; i--, n++) lens[n] = 0; break;
+				case 18: i = 11 + sinfl__get(&s, 7);
+					if(n + i > nlit + ndist) return out - o;
+					for (; i; i--, n++) lens[n] = 0; break;}
+			}
+			sinfl_build(s.lits, lens, 10, 15, nlit);
+			sinfl_build(s.dsts, lens + nlit, 8, 15, ndist);
+		} else {
+			break;
+		}
+
+		// Huffman coded block
+		while(!truncated) {
+			refill();
+			int sym = sinfl_decode(&s, s.lits, 10);
+			if(sym < 256) {
+				if(out >= oe) {
+					return out - o;
+				}
+				*out++ = (unsigned char)sym;
+				continue;
+			}
+			if(sym == 256) {
+				break;
+			}
+			if(sym >= 286) {
+				return out - o;
+			}
+			sym -= 257;
+			int len = sinfl__get(&s, lbits[sym]) + lbase[sym];
+			int dsym = sinfl_decode(&s, s.dsts, 8);
+			int offs = sinfl__get(&s, dbits[dsym]) + dbase[dsym];
+			if((offs == 0) || (offs > out - o) || (len > oe - out)) {
+				return out - o;
+			}
+			// overlapping matches are copied in runs of offs bytes
+			unsigned char *src = out - offs;
+			while(len > 0) {
+				int n = std::min(len, offs);
+				memcpy(out, src, n);
+				out += n;
+				src += n;
+				len -= n;
+			}
+		}
+	}
+	// the bits of a truncated stream are zeros, not data
+	return truncated ? 0 : out - o;
+}
+
+std::vector<char> readMGCGFile(const std::string& filename) {
+	const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
+	const unsigned char iv[16] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	};
+#ifdef STARTER_LOAD_STATS
+	auto startTime = std::chrono::high_resolution_clock::now();
+#endif
+
+	MGCGReader R(filename, &key[0], (int)key.size(), iv);
+	R.ensure(16);
+	if(R.lim - R.cur < 16) {
+		throw std::runtime_error("MGCG file too short!");
+	}
+	char header[17];
+	memcpy(header, R.cur, 16);
+	header[16] = 0;
+	R.cur += 16;
+	int size = 0;
+	sscanf(header, "%d", &size);
+	if((size <= 0) || ((size_t)size > R.fileSize * MGCG_MAX_RATIO)) {
+		throw std::runtime_error("Invalid MGCG header!");
+	}
+
+	std::vector<char> decomp(size);
+	size_t n = MGCGinflate(R, (unsigned char *)decomp.data(), size);
+	if(n != (size_t)size) {
+		std::cout << "MGCG: inflated " << n << " bytes instead of " << size << "\n";
+		throw std::runtime_error("Corrupted MGCG file!");
+	}
+
+#ifdef STARTER_LOAD_STATS
+	float dt = std::chrono::duration<float, std::chrono::seconds::period>
+					(std::chrono::high_resolution_clock::now() - startTime).count();
+	std::cout << "[MGCG] " << size << " B in " << (dt * 1000.0f) << " ms (" 
+			  << ((float)size / (1024.0f * 1024.0f) / std::max(dt, 1e-6f)) << " MB/s), working memory "
+			  << (MGCG_CHUNK_SIZE / 1024) << " KB\n";
+#endif
+	return decomp;
+}
+
+bool MappedFile::map(const std::string& filename) {
+	unmap();
+#if defined(_WIN32)
+	HANDLE f = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+						   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(f == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER fs;
+	GetFileSizeEx(f, &fs);
+	size = (size_t)fs.QuadPart;
+	HANDLE m = (size > 0) ? CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	void *p = (m != NULL) ? MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if(p == NULL) {
+		if(m != NULL) CloseHandle(m);
+		CloseHandle(f);
+		size = 0;
+		return false;
+	}
+	fileHandle = f;
+	mapHandle = m;
+	data = (const unsigned char *)p;
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+		close(fd);
+		return false;
+	}
+	void *p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	// buffers are read sequentially while building the meshes
+	madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+	size = (size_t)st.st_size;
+	mapHandle = p;
+	data = (const unsigned char *)p;
+#endif
+	return true;
+}
+
+void MappedFile::unmap() {
+	if(data == nullptr) {
+		return;
+	}
+#if defined(_WIN32)
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapHandle);
+	CloseHandle((HANDLE)fileHandle);
+#else
+	munmap(mapHandle, size);
+#endif
+	data = nullptr;
+	size = 0;
+	fileHandle = nullptr;
+	mapHandle = nullptr;
+}
+
 // BaseProject class members
 
 void BaseProject::run() {
 	windowResizable = GLFW_FALSE;
 
 	setWindowParameters();
-	initWindow();
+	if(!headless) {
+		initWindow();
+	}
 	initVulkan();
-	mainLoop();
+	if(headless) {
+		headlessLoop();
+	} else {
+		mainLoop();
+	}
 	cleanup();
 }
 
@@ -801,14 +1433,22 @@ void BaseProject::framebufferResizeCallback(GLFWwindow* window, int width, int h
 
 void BaseProject::initVulkan() {
 	createInstance();				
-	setupDebugMessenger();			
-	createSurface();				
+	if(!headless) {
+		setupDebugMessenger();			
+		createSurface();				
+	}
 	pickPhysicalDevice();			
 	createLogicalDevice();			
 	createSwapChain();				
 	createImageViews();				
 
 	createCommandPool();			
+
+	// resets the timestamp queries of the GPU scopes, before any other command buffer
+	if(Prof.initGPU(device, physicalDevice, findQueueFamilies(physicalDevice).graphicsFamily.value(),
+					swapChainImages.size())) {
+		submitCommandBuffer("profiler", -1, Profiler::populateResetAccess, &Prof);
+	}
 	localInit();
 
 	createDescriptorPool();			
@@ -832,13 +1472,6 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pApplicationInfo = &appInfo;
 
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-			
-//		createInfo.enabledExtensionCount = glfwExtensionCount;
-//		createInfo.ppEnabledExtensionNames = glfwExtensions;
-
 	createInfo.enabledLayerCount = 0;
 
 	auto extensions = getRequiredExtensions();
@@ -848,11 +1481,13 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 
 	createInfo.flags |= VK_INSTANCE_CREATE_ENUMERATE_PORTABILITY_BIT_KHR;
 	
-	if (!checkValidationLayerSupport()) {
-		throw std::runtime_error("validation layers requested, but not available!");
-	}
-
+	// the benchmarks run without the validation layers, that would distort the timings
 	VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo;
+	if(!headless) {
+		if (!checkValidationLayerSupport()) {
+			throw std::runtime_error("validation layers requested, but not available!");
+		}
+
 		createInfo.enabledLayerCount =
 			static_cast<uint32_t>(validationLayers.size());
 		createInfo.ppEnabledLayerNames = validationLayers.data();
@@ -860,6 +1495,7 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 		populateDebugMessengerCreateInfo(debugCreateInfo);
 		createInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*)
 								&debugCreateInfo;
+	}
 	
 	VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
 	
@@ -870,15 +1506,17 @@ std::cout << "Starting createInstance()\n"  << std::flush;
 }
 
 std::vector<const char*> BaseProject::getRequiredExtensions() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions =
-		glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	std::vector<const char*> extensions(glfwExtensions,
-		glfwExtensions + glfwExtensionCount);
-		
-	extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);		
+	std::vector<const char*> extensions;
+	if(!headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions =
+			glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+			
+		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);		
+	}
 	
 	if(checkIfItHasExtension(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME)) {
 		extensions.push_back(VK_KHR_PORTABILITY_ENUMERATION_EXTENSION_NAME);
@@ -1051,8 +1689,8 @@ bool BaseProject::isDeviceSuitable(VkPhysicalDevice device, deviceReport &devRep
 
 	devRep.extensionsSupported = checkDeviceExtensionSupport(device, devRep);
 
-	devRep.swapChainAdequate = false;
-	if (devRep.extensionsSupported) {
+	devRep.swapChainAdequate = headless;
+	if (devRep.extensionsSupported && !headless) {
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 		devRep.swapChainFormatSupport = swapChainSupport.formats.empty();
 		devRep.swapChainPresentModeSupport = swapChainSupport.presentModes.empty();
@@ -1087,8 +1725,13 @@ QueueFamilyIndices BaseProject::findQueueFamilies(VkPhysicalDevice device) {
 			indices.graphicsFamily = i;
 		}
 			
+		// without a surface, nothing is presented
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		if(headless) {
+			presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		} else {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		}
 		if (presentSupport) {
 			indices.presentFamily = i;
 		}
@@ -1203,9 +1846,11 @@ void BaseProject::createLogicalDevice() {
 			static_cast<uint32_t>(deviceExtensions.size());
 	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
+	if(!headless) {
 		createInfo.enabledLayerCount = 
 				static_cast<uint32_t>(validationLayers.size());
 		createInfo.ppEnabledLayerNames = validationLayers.data();
+	}
 	
 	VkResult result = vkCreateDevice(physicalDevice, &createInfo, nullptr, &device);
 	
@@ -1219,6 +1864,10 @@ void BaseProject::createLogicalDevice() {
 }
 
 void BaseProject::createSwapChain() {
+	if(headless) {
+		createOffscreenImages();
+		return;
+	}
 	SwapChainSupportDetails swapChainSupport =
 			querySwapChainSupport(physicalDevice);
 	VkSurfaceFormatKHR surfaceFormat =
@@ -1279,6 +1928,24 @@ void BaseProject::createSwapChain() {
 	swapChainExtent = extent;
 }
 
+// In headless mode, the images that would come from the swap chain are plain
+// color attachments, allocated like the ones of the render passes
+void BaseProject::createOffscreenImages() {
+	int imageCount = MAX_FRAMES_IN_FLIGHT + 1;
+	swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+	swapChainExtent = {windowWidth, windowHeight};
+	surfaceLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	swapChainImages.resize(imageCount);
+	offscreenMemory.resize(imageCount);
+	for(int i = 0; i < imageCount; i++) {
+		createImage(windowWidth, windowHeight, 1, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat,
+					VK_IMAGE_TILING_OPTIMAL,
+					VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, 0,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+					swapChainImages[i], offscreenMemory[i]);
+	}
+}
+
 VkSurfaceFormatKHR BaseProject::chooseSwapSurfaceFormat(
 			const std::vector<VkSurfaceFormatKHR>& availableFormats)
 {
@@ -1446,6 +2113,7 @@ void BaseProject::createImage(uint32_t width, uint32_t height,
 							VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate image memory!");
 	}
+	trackDeviceMemory(imageMemory, allocInfo.allocationSize);
 
 	vkBindImageMemory(device, image, imageMemory, 0);
 }
@@ -1682,10 +2350,26 @@ void BaseProject::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage,
 		PrintVkError(result);
 		throw std::runtime_error("failed to allocate vertex buffer memory!");
 	}
+	trackDeviceMemory(bufferMemory, allocInfo.allocationSize);
 	
 	vkBindBufferMemory(device, buffer, bufferMemory, 0);
 }
 
+void BaseProject::trackDeviceMemory(VkDeviceMemory mem, VkDeviceSize size) {
+	memorySizes[mem] = size;
+	allocatedMemory += size;
+	peakMemory = std::max(peakMemory, allocatedMemory);
+}
+
+void BaseProject::freeDeviceMemory(VkDeviceMemory mem) {
+	auto it = memorySizes.find(mem);
+	if(it != memorySizes.end()) {
+		allocatedMemory -= it->second;
+		memorySizes.erase(it);
+	}
+	vkFreeMemory(device, mem, nullptr);
+}
+
 uint32_t BaseProject::findMemoryType(uint32_t typeFilter,
 						VkMemoryPropertyFlags properties) {
 	 VkPhysicalDeviceMemoryProperties memProperties;
@@ -1703,11 +2387,18 @@ uint32_t BaseProject::findMemoryType(uint32_t typeFilter,
 }
 
 void BaseProject::createDescriptorPool() {
-	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	std::vector<VkDescriptorPoolSize> poolSizes(2);
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	poolSizes[0].descriptorCount = static_cast<uint32_t>(DPSZs.uniformBlocksInPool * swapChainImages.size());
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	poolSizes[1].descriptorCount = static_cast<uint32_t>(DPSZs.texturesInPool * swapChainImages.size());
+	// pool sizes cannot have a zero count: storage buffers are added only if used
+	if(DPSZs.storageBlocksInPool > 0) {
+		VkDescriptorPoolSize storagePool{};
+		storagePool.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		storagePool.descriptorCount = static_cast<uint32_t>(DPSZs.storageBlocksInPool * swapChainImages.size());
+		poolSizes.push_back(storagePool);
+	}
 														 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -1732,6 +2423,7 @@ void BaseProject::submitCommandBuffer(std::string name, int order, pNCBfunc popu
 	for(int i = 0; i < sz; i++) {
 		nncb->inQueue[i] = false;
 	}
+	nncb->draws.assign(sz, 0);
 
 	auto found = namedCommandBuffers.find(name);
 	if(found != namedCommandBuffers.end()) {
@@ -1850,11 +2542,192 @@ void BaseProject::createSyncObjects() {
 
 void BaseProject::mainLoop() {
 	while (!glfwWindowShouldClose(window)){
+		Prof.beginFrame();
 		glfwPollEvents();
 		drawFrame();
+		Prof.endFrame();
+	}
+	// a trace still recording is written with the frames drawn so far
+	Prof.stopTrace();
+	
+	vkDeviceWaitIdle(device);
+}
+
+// Headless mode
+const float HeadlessDeltaT = 1.0f / 60.0f;	// simulated time between two frames
+const int HeadlessWarmup = 10;				// first frames left out of the report
+
+// GLFW codes of letters and digits are their ASCII codes
+static int headlessKeyCode(const std::string &name) {
+	static const std::map<std::string, int> Named = {
+		{"SPACE", GLFW_KEY_SPACE}, {"ESCAPE", GLFW_KEY_ESCAPE}, {"ENTER", GLFW_KEY_ENTER},
+		{"LEFT", GLFW_KEY_LEFT}, {"RIGHT", GLFW_KEY_RIGHT}, {"UP", GLFW_KEY_UP}, {"DOWN", GLFW_KEY_DOWN}
+	};
+	if((name.size() == 1) && (isupper(name[0]) || isdigit(name[0]))) {
+		return name[0];
+	}
+	auto it = Named.find(name);
+	return (it != Named.end()) ? it->second : -1;
+}
+
+// The script lists the keys pressed during the run:
+//   {"frames": 1200, "keys": [{"key": "SPACE", "frame": 30, "hold": 2}, ...]}
+// frames is used when the number of frames is not given (frames <= 0)
+void BaseProject::setHeadless(int frames, std::string script, std::string report) {
+	headless = true;
+	headlessFrames = frames;
+	headlessReport = report;
+	headlessKeys.clear();
+	if(script.empty()) {
+		return;
+	}
+	
+	nlohmann::json js;
+	std::ifstream ifs(script);
+	if (!ifs.is_open()) {
+		std::cout << "Error! Headless script >" << script << "< not found!\n";
+		exit(-1);
+	}
+	ifs >> js;
+	if((headlessFrames <= 0) && js.contains("frames")) {
+		headlessFrames = js["frames"];
+	}
+	for(auto &k : js["keys"]) {
+		std::string name = k["key"];
+		HeadlessKey K;
+		K.key = headlessKeyCode(name);
+		K.frame = k["frame"];
+		K.hold = k.contains("hold") ? k["hold"].template get<int>() : 1;
+		if(K.key < 0) {
+			std::cout << "Error! Unknown key >" << name << "< in headless script " << script << "\n";
+			exit(-1);
+		}
+		headlessKeys.push_back(K);
+	}
+}
+
+int BaseProject::getKey(int key) {
+	if(!headless) {
+		return glfwGetKey(window, key);
+	}
+	for(auto &K : headlessKeys) {
+		if((K.key == key) && (frameCount >= K.frame) && (frameCount < K.frame + K.hold)) {
+			return GLFW_PRESS;
+		}
+	}
+	return GLFW_RELEASE;
+}
+
+double BaseProject::getTime() {
+	return headless ? frameCount * HeadlessDeltaT : glfwGetTime();
+}
+
+void BaseProject::closeWindow() {
+	if(headless) {
+		headlessQuit = true;
+	} else {
+		glfwSetWindowShouldClose(window, GL_TRUE);
+	}
+}
+
+void BaseProject::headlessLoop() {
+	if(headlessFrames <= 0) {
+		headlessFrames = 600;
+	}
+	std::cout << "Headless run of " << headlessFrames << " frames\n";
+	
+	std::vector<float> frameTimes;
+	std::vector<int> draws;
+	frameTimes.reserve(headlessFrames);
+	draws.reserve(headlessFrames);
+	while((frameCount < headlessFrames) && !headlessQuit) {
+		auto start = std::chrono::high_resolution_clock::now();
+		Prof.beginFrame();
+		drawFrame();
+		Prof.endFrame();
+		auto end = std::chrono::high_resolution_clock::now();
+		frameTimes.push_back(std::chrono::duration<float, std::milli>(end - start).count());
+		draws.push_back(frameDraws);
 	}
+	Prof.stopTrace();
 	
 	vkDeviceWaitIdle(device);
+	writeHeadlessReport(frameTimes, draws);
+}
+
+void BaseProject::writeHeadlessReport(std::vector<float> &frameTimes, std::vector<int> &draws) {
+	int first = std::min(HeadlessWarmup, (int)frameTimes.size() / 10);
+	std::vector<float> T(frameTimes.begin() + first, frameTimes.end());
+	std::vector<int> D(draws.begin() + first, draws.end());
+	std::sort(T.begin(), T.end());
+	std::sort(D.begin(), D.end());
+	
+	auto percentile = [&](float p) {
+		return T.empty() ? 0.0f : T[std::min((int)T.size() - 1, (int)(p * T.size()))];
+	};
+	double sumT = 0.0, sumD = 0.0;
+	for(float t : T) sumT += t;
+	for(int d : D) sumD += d;
+	
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	
+	long peakRSS = 0;
+#if !defined(_WIN32)
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+		peakRSS = usage.ru_maxrss;
+#else
+		peakRSS = usage.ru_maxrss * 1024L;
+#endif
+	}
+#endif
+
+	nlohmann::json js;
+	js["device"] = std::string(properties.deviceName);
+	js["width"] = swapChainExtent.width;
+	js["height"] = swapChainExtent.height;
+	js["frames"] = frameTimes.size();
+	js["warmupFrames"] = first;
+	js["frameTimeMs"] = {
+		{"mean", T.empty() ? 0.0 : sumT / T.size()},
+		{"p50", percentile(0.50f)},
+		{"p95", percentile(0.95f)},
+		{"p99", percentile(0.99f)},
+		{"max", T.empty() ? 0.0f : T.back()}
+	};
+	js["drawCalls"] = {
+		{"mean", D.empty() ? 0.0 : sumD / D.size()},
+		{"min", D.empty() ? 0 : D.front()},
+		{"max", D.empty() ? 0 : D.back()}
+	};
+	js["memory"] = {
+		{"deviceBytes", allocatedMemory},
+		{"devicePeakBytes", peakMemory},
+		{"deviceAllocations", memorySizes.size()},
+		{"peakRSSBytes", peakRSS}
+	};
+	// rolling percentiles of the last frames, from the profiler
+	for(int i = 0; i < Prof.trackCount(); i++) {
+		const ProfilerTrack &Tr = Prof.getTrack(i);
+		if(Tr.count > 0) {
+			js["profiler"][std::string(Tr.gpu ? "GPU " : "CPU ") + Tr.name] = {{"p50", Tr.p50}, {"p99", Tr.p99}};
+		}
+	}
+	
+	std::string out = js.dump(2);
+	if(headlessReport.empty()) {
+		std::cout << out << "\n";
+		return;
+	}
+	std::ofstream ofs(headlessReport);
+	if(!ofs.is_open()) {
+		std::cout << "Error! Cannot write the headless report to " << headlessReport << "\n";
+		return;
+	}
+	ofs << out << "\n";
+	std::cout << "Headless report written to " << headlessReport << "\n";
 }
 
 void BaseProject::createCommandBuffer(NamedCommandBuffer *ncb, int imageIndex) {
@@ -1889,7 +2762,9 @@ void BaseProject::createCommandBuffer(NamedCommandBuffer *ncb, int imageIndex) {
 	}
 	
 //std::cout << "Filling\n";
+	recordedDraws = 0;
 	ncb->filler(*cb, imageIndex, ncb->params);
+	ncb->draws[imageIndex] = recordedDraws;
 	
 //std::cout << "Finishing\n";
 	if (vkEndCommandBuffer(*cb) != VK_SUCCESS) {
@@ -1913,12 +2788,14 @@ void BaseProject::createCommandBuffer(NamedCommandBuffer *ncb, int imageIndex) {
 void BaseProject::updateCommandBuffers(std::vector<VkCommandBuffer> &buffers, int imageIndex) {
 	// Creation of newly submitted command buffers
 	std::map<int, VkCommandBuffer>sortedBuffer = {};
+	frameDraws = 0;
 	
 	for(auto &v : namedCommandBuffers) {
 //std::cout << "Considering buffer: " << v.first << "\n";
 		NamedCommandBuffer *ncb = v.second.current;
 		if(ncb->state == NCBS_IN_USE) {
 			sortedBuffer[ncb->order] = *ncb->cb[imageIndex];
+			frameDraws += ncb->draws[imageIndex];
 //			buffers.push_back(*ncb->cb[imageIndex]);
 		} else if((ncb->state == NCBS_SUBMITTED) || (ncb->state == NCBS_IN_CREATION)) {
 			if(!ncb->inQueue[imageIndex]) {
@@ -1926,6 +2803,7 @@ void BaseProject::updateCommandBuffers(std::vector<VkCommandBuffer> &buffers, in
 				createCommandBuffer(ncb, imageIndex);
 			}
 			sortedBuffer[ncb->order] = *ncb->cb[imageIndex];
+			frameDraws += ncb->draws[imageIndex];
 //			buffers.push_back(*ncb->cb[imageIndex]);
 		} else {
 			std::cout << "Error! state " << ncb->state << " not permitted here!\n";
@@ -1967,13 +2845,27 @@ void BaseProject::updateCommandBuffers(std::vector<VkCommandBuffer> &buffers, in
 }
 
 void BaseProject::drawFrame() {
-	vkWaitForFences(device, 1, &inFlightFences[currentFrame],
-					VK_TRUE, UINT64_MAX);
-	
 	uint32_t imageIndex;
+	VkResult result;
 	
-	VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
-			imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	{
+		Profiler::Scope ps(Prof, "Present wait");
+		{
+			Profiler::Scope pf(Prof, "vkWaitForFences");
+			vkWaitForFences(device, 1, &inFlightFences[currentFrame],
+							VK_TRUE, UINT64_MAX);
+		}
+		
+		Profiler::Scope pa(Prof, "vkAcquireNextImageKHR");
+		if(headless) {
+			// the offscreen images are used in turn
+			imageIndex = frameCount % swapChainImages.size();
+			result = VK_SUCCESS;
+		} else {
+			result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+					imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		}
+	}
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 		recreateSwapChain();
@@ -1983,15 +2875,26 @@ void BaseProject::drawFrame() {
 	}
 
 	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+		Profiler::Scope ps(Prof, "Present wait");
+		Profiler::Scope pf(Prof, "vkWaitForFences");
 		vkWaitForFences(device, 1, &imagesInFlight[imageIndex],
 						VK_TRUE, UINT64_MAX);
 	}
 	imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 	
-	updateUniformBuffer(imageIndex);
+	// the previous frame drawn on this image is complete: its timestamps can be read
+	Prof.collectGPU(imageIndex);
+	
+	{
+		Profiler::Scope ps(Prof, "updateUniformBuffer");
+		updateUniformBuffer(imageIndex);
+	}
 	
 	std::vector<VkCommandBuffer> buffers = {};
-	updateCommandBuffers(buffers, imageIndex);
+	{
+		Profiler::Scope ps(Prof, "Command recording");
+		updateCommandBuffers(buffers, imageIndex);
+	}
 	
 	VkSubmitInfo submitInfo{};
 	
@@ -1999,20 +2902,31 @@ void BaseProject::drawFrame() {
 	VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
 	VkPipelineStageFlags waitStages[] =
 		{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submitInfo.waitSemaphoreCount = 1;
+	// with no presentation engine, there is nothing to wait for or to signal
+	submitInfo.waitSemaphoreCount = headless ? 0 : 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = buffers.size();
 	submitInfo.pCommandBuffers = buffers.data();
 	VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.signalSemaphoreCount = headless ? 0 : 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 	
-	vkResetFences(device, 1, &inFlightFences[currentFrame]);
+	{
+		Profiler::Scope ps(Prof, "Submit");
+		vkResetFences(device, 1, &inFlightFences[currentFrame]);
 
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
-			inFlightFences[currentFrame]) != VK_SUCCESS) {
-		throw std::runtime_error("failed to submit draw command buffer!");
+		if (vkQueueSubmit(graphicsQueue, 1, &submitInfo,
+				inFlightFences[currentFrame]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit draw command buffer!");
+		}
+	}
+	Prof.submittedGPU(imageIndex);
+	frameCount++;
+	
+	if(headless) {
+		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+		return;
 	}
 	
 	VkPresentInfoKHR presentInfo{};
@@ -2026,7 +2940,10 @@ void BaseProject::drawFrame() {
 	presentInfo.pImageIndices = &imageIndex;
 	presentInfo.pResults = nullptr; // Optional
 	
-	result = vkQueuePresentKHR(presentQueue, &presentInfo);
+	{
+		Profiler::Scope ps(Prof, "Present");
+		result = vkQueuePresentKHR(presentQueue, &presentInfo);
+	}
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR ||
 		framebufferResized) {
@@ -2055,6 +2972,10 @@ void BaseProject::recreateSwapChain() {
 	createSwapChain();
 	createImageViews();
 
+	// the number of images may have changed
+	Prof.initGPU(device, physicalDevice, findQueueFamilies(physicalDevice).graphicsFamily.value(),
+				 swapChainImages.size());
+
 	createDescriptorPool();			
 	pipelinesAndDescriptorSetsInit();
 
@@ -2070,7 +2991,14 @@ void BaseProject::cleanupSwapChain() {
 		vkDestroyImageView(device, swapChainImageViews[i], nullptr);
 	}
 	
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
+	if(headless) {
+		for (size_t i = 0; i < swapChainImages.size(); i++){
+			vkDestroyImage(device, swapChainImages[i], nullptr);
+			freeDeviceMemory(offscreenMemory[i]);
+		}
+	} else {
+		vkDestroySwapchainKHR(device, swapChain, nullptr);
+	}
 
 	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 }
@@ -2088,8 +3016,15 @@ void BaseProject::cleanup() {
 	
 	vkDestroyCommandPool(device, commandPool, nullptr);
 	
+	Prof.cleanupGPU();
+	
 	vkDestroyDevice(device, nullptr);
 	
+	if(headless) {
+		vkDestroyInstance(instance, nullptr);
+		return;
+	}
+	
 	DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 	
 	vkDestroySurfaceKHR(instance, surface, nullptr);
@@ -2100,49 +3035,362 @@ void BaseProject::cleanup() {
 	glfwTerminate();
 }
 
-void BaseProject::RebuildPipeline() {
-	framebufferResized = true;
+// Profiler
+Profiler::Scope::Scope(Profiler &_P, const char *name) {
+	P = &_P;
+	id = P->track(name);
+	start = std::chrono::high_resolution_clock::now();
 }
 
-void BaseProject::handleGamePad(int id,  glm::vec3 &m, glm::vec3 &r, bool &fire) {
-	const float deadZone = 0.1f;
-	
-	if(glfwJoystickIsGamepad(id)) {
-		GLFWgamepadstate state;
-		if (glfwGetGamepadState(id, &state)) {
-			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_LEFT_X]) > deadZone) {
-				m.x += state.axes[GLFW_GAMEPAD_AXIS_LEFT_X];
-			}
-			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_LEFT_Y]) > deadZone) {
-				m.z += state.axes[GLFW_GAMEPAD_AXIS_LEFT_Y];
-			}
-			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_LEFT_TRIGGER]) > deadZone) {
-				m.y -= state.axes[GLFW_GAMEPAD_AXIS_LEFT_TRIGGER];
-			}
-			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_RIGHT_TRIGGER]) > deadZone) {
-				m.y += state.axes[GLFW_GAMEPAD_AXIS_RIGHT_TRIGGER];
-			}
-
-			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_RIGHT_X]) > deadZone) {
-				r.y += state.axes[GLFW_GAMEPAD_AXIS_RIGHT_X];
-			}
-			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_RIGHT_Y]) > deadZone) {
-				r.x += state.axes[GLFW_GAMEPAD_AXIS_RIGHT_Y];
-			}
-			r.z += state.buttons[GLFW_GAMEPAD_BUTTON_LEFT_BUMPER] ? 1.0f : 0.0f;
-			r.z -= state.buttons[GLFW_GAMEPAD_BUTTON_RIGHT_BUMPER] ? 1.0f : 0.0f;
-			fire = fire | (bool)state.buttons[GLFW_GAMEPAD_BUTTON_A] | (bool)state.buttons[GLFW_GAMEPAD_BUTTON_B];
+Profiler::Scope::~Scope() {
+	if(id >= 0) {
+		auto end = std::chrono::high_resolution_clock::now();
+		P->T[id].frameTime += std::chrono::duration<double, std::milli>(end - start).count();
+		P->T[id].active = true;
+		if(P->tracing) {
+			P->traceEvent(P->T[id].name, start, end);
 		}
 	}
 }
-	
-void BaseProject::getSixAxis(float &deltaT,
-				glm::vec3 &m,
-				glm::vec3 &r,
-				bool &fire) {
-					
-	static auto startTime = std::chrono::high_resolution_clock::now();
-	static float lastTime = 0.0f;
+
+Profiler::GpuScope::GpuScope(Profiler &_P, VkCommandBuffer _commandBuffer, int _currentImage, const char *name) {
+	P = &_P;
+	commandBuffer = _commandBuffer;
+	currentImage = _currentImage;
+	id = P->gpuBegin(commandBuffer, currentImage, name);
+}
+
+Profiler::GpuScope::~GpuScope() {
+	P->gpuEnd(commandBuffer, currentImage, id);
+}
+
+Profiler::TraceScope::TraceScope(Profiler *_P, const char *_name) {
+	P = _P;
+	name = _name;
+	start = std::chrono::high_resolution_clock::now();
+}
+
+Profiler::TraceScope::~TraceScope() {
+	if((P != nullptr) && P->tracing) {
+		P->traceEvent(name, start, std::chrono::high_resolution_clock::now());
+	}
+}
+
+void Profiler::TraceScope::next(const char *_name) {
+	auto now = std::chrono::high_resolution_clock::now();
+	if((P != nullptr) && P->tracing) {
+		P->traceEvent(name, start, now);
+	}
+	name = _name;
+	start = now;
+}
+
+// Returns the track with the given name, creating it the first time.
+// Names are usually literals, so they are first compared by address.
+int Profiler::track(const char *name, bool gpu) {
+	for(int i = 0; i < nTracks; i++) {
+		if((T[i].gpu == gpu) && ((T[i].name == name) || (strcmp(T[i].name, name) == 0))) {
+			return i;
+		}
+	}
+	if(nTracks >= ProfilerMaxTracks) {
+		return -1;
+	}
+	ProfilerTrack &Tr = T[nTracks];
+	Tr.name = name;
+	Tr.gpu = gpu;
+	Tr.count = 0;
+	Tr.frameTime = 0.0;
+	Tr.active = false;
+	Tr.p50 = Tr.p99 = 0.0f;
+	return nTracks++;
+}
+
+void Profiler::addSample(int id, float ms) {
+	ProfilerTrack &Tr = T[id];
+	Tr.samples[Tr.count % ProfilerHistory] = ms;
+	Tr.count++;
+}
+
+void Profiler::beginFrame() {
+	if(frameTrack < 0) {
+		frameTrack = track("Frame");
+	}
+	frameStart = std::chrono::high_resolution_clock::now();
+}
+
+// Stores the time spent in every CPU track during the frame; the tracks
+// not entered in this frame do not get a sample
+void Profiler::endFrame() {
+	auto end = std::chrono::high_resolution_clock::now();
+	T[frameTrack].frameTime = std::chrono::duration<double, std::milli>(end - frameStart).count();
+	T[frameTrack].active = true;
+	if(tracing) {
+		traceEvent(T[frameTrack].name, frameStart, end);
+		tracedFrames++;
+		if((traceFrames > 0) && (tracedFrames >= traceFrames)) {
+			stopTrace();
+		}
+	}
+	for(int i = 0; i < nTracks; i++) {
+		if(T[i].active) {
+			addSample(i, (float)T[i].frameTime);
+			T[i].frameTime = 0.0;
+			T[i].active = false;
+		}
+	}
+	frames++;
+	if((frames % 16) == 0) {
+		computeStats();
+	}
+}
+
+void Profiler::computeStats() {
+	float sorted[ProfilerHistory];
+	for(int i = 0; i < nTracks; i++) {
+		ProfilerTrack &Tr = T[i];
+		int n = (int)std::min<uint64_t>(Tr.count, ProfilerHistory);
+		if(n == 0) continue;
+		memcpy(sorted, Tr.samples, n * sizeof(float));
+		int k50 = n / 2;
+		int k99 = std::min(n - 1, (n * 99) / 100);
+		std::nth_element(sorted, sorted + k50, sorted + n);
+		Tr.p50 = sorted[k50];
+		std::nth_element(sorted + k50, sorted + k99, sorted + n);
+		Tr.p99 = sorted[k99];
+	}
+	statsVersion++;
+}
+
+// Creates the timestamp queries: every image has its own range, with a
+// begin and end query per track. Returns false if timestamps are not supported.
+bool Profiler::initGPU(VkDevice _device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, int images) {
+	if((queryPool != VK_NULL_HANDLE) && (queryImages == images)) {
+		return true;
+	}
+	cleanupGPU();
+	device = _device;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+	uint32_t validBits = families[queueFamily].timestampValidBits;
+	if((validBits == 0) || (properties.limits.timestampPeriod == 0.0f)) {
+		std::cout << "Profiler: timestamps not supported, GPU scopes disabled\n";
+		return false;
+	}
+	timestampPeriod = properties.limits.timestampPeriod;
+	timestampMask = (validBits >= 64) ? ~0ull : ((1ull << validBits) - 1);
+
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount = images * ProfilerMaxTracks * 2;
+	VkResult result = vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool);
+	if (result != VK_SUCCESS) {
+		PrintVkError(result);
+		throw std::runtime_error("failed to create timestamp query pool!");
+	}
+	queryImages = images;
+	pending.assign(images, false);
+	results.resize(ProfilerMaxTracks * 2 * 2);
+	return true;
+}
+
+void Profiler::cleanupGPU() {
+	if(queryPool != VK_NULL_HANDLE) {
+		vkDestroyQueryPool(device, queryPool, nullptr);
+		queryPool = VK_NULL_HANDLE;
+	}
+	queryImages = 0;
+}
+
+// Filler of the "profiler" command buffer, submitted before all the others
+void Profiler::populateResetAccess(VkCommandBuffer commandBuffer, int currentImage, void *Params) {
+	Profiler *P = (Profiler *)Params;
+	if(P->queryPool != VK_NULL_HANDLE) {
+		vkCmdResetQueryPool(commandBuffer, P->queryPool, currentImage * ProfilerMaxTracks * 2,
+							ProfilerMaxTracks * 2);
+	}
+}
+
+int Profiler::gpuBegin(VkCommandBuffer commandBuffer, int currentImage, const char *name) {
+	if((queryPool == VK_NULL_HANDLE) || (currentImage >= queryImages)) {
+		return -1;
+	}
+	int id = track(name, true);
+	if(id >= 0) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool,
+							(currentImage * ProfilerMaxTracks + id) * 2);
+	}
+	return id;
+}
+
+void Profiler::gpuEnd(VkCommandBuffer commandBuffer, int currentImage, int id) {
+	if(id >= 0) {
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool,
+							(currentImage * ProfilerMaxTracks + id) * 2 + 1);
+	}
+}
+
+void Profiler::submittedGPU(int currentImage) {
+	if(currentImage < queryImages) {
+		pending[currentImage] = true;
+	}
+}
+
+// Reads the timestamps of the last frame drawn on the image, which must be complete.
+// Only the scopes that were recorded in the command buffers have both queries available.
+void Profiler::collectGPU(int currentImage) {
+	if((currentImage >= queryImages) || !pending[currentImage]) {
+		return;
+	}
+	pending[currentImage] = false;
+	vkGetQueryPoolResults(device, queryPool, currentImage * ProfilerMaxTracks * 2, ProfilerMaxTracks * 2,
+						  results.size() * sizeof(uint64_t), results.data(), 2 * sizeof(uint64_t),
+						  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+	for(int i = 0; i < nTracks; i++) {
+		if(!T[i].gpu) continue;
+		const uint64_t *b = &results[i * 4];
+		if((b[1] != 0) && (b[3] != 0)) {
+			uint64_t ticks = (b[2] - b[0]) & timestampMask;
+			addSample(i, (float)(ticks * timestampPeriod * 1.0e-6));
+		}
+	}
+}
+
+// Writes a line with the rolling median and 99th percentile of each track.
+// Returns the number of characters written.
+int Profiler::report(char *buf, int size) {
+	int len = snprintf(buf, size, "p50 / p99 ms\n");
+	for(int pass = 0; pass < 2; pass++) {
+		for(int i = 0; i < nTracks; i++) {
+			if((T[i].gpu != (pass == 1)) || (T[i].count == 0) || (len >= size)) continue;
+			len += snprintf(buf + len, size - len, "%s %s: %.2f / %.2f\n",
+							T[i].gpu ? "GPU" : "CPU", T[i].name, T[i].p50, T[i].p99);
+		}
+	}
+	return std::min(len, size - 1);
+}
+
+void Profiler::startTrace(std::string file, int frames) {
+	if(tracing) {
+		return;
+	}
+	std::lock_guard<std::mutex> lk(traceLock);
+	traceFile = file;
+	traceFrames = frames;
+	tracedFrames = 0;
+	events.clear();
+	events.reserve(65536);
+	// the thread starting the trace is shown as the main one
+	threads.assign(1, std::this_thread::get_id());
+	traceStart = std::chrono::high_resolution_clock::now();
+	tracing = true;
+	std::cout << "Profiler: recording a trace to " << file << "\n";
+}
+
+void Profiler::traceEvent(const char *name, std::chrono::high_resolution_clock::time_point start,
+						  std::chrono::high_resolution_clock::time_point end) {
+	std::thread::id me = std::this_thread::get_id();
+	std::lock_guard<std::mutex> lk(traceLock);
+	if(!tracing) {
+		return;
+	}
+	int tid = 0;
+	while((tid < threads.size()) && (threads[tid] != me)) tid++;
+	if(tid == threads.size()) {
+		threads.push_back(me);
+	}
+	ProfilerEvent E;
+	E.name = name;
+	E.tid = tid;
+	E.start = std::chrono::duration<double, std::micro>(start - traceStart).count();
+	E.duration = std::chrono::duration<double, std::micro>(end - start).count();
+	events.push_back(E);
+}
+
+// Writes the trace in the JSON Object Format of the Chrome trace events
+void Profiler::stopTrace() {
+	std::lock_guard<std::mutex> lk(traceLock);
+	if(!tracing) {
+		return;
+	}
+	tracing = false;
+
+	FILE *f = fopen(traceFile.c_str(), "w");
+	if(f == nullptr) {
+		std::cout << "Profiler: cannot write the trace to " << traceFile << "\n";
+		events.clear();
+		return;
+	}
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Main\"}}");
+	for(int i = 1; i < threads.size(); i++) {
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"Worker %d\"}}", i, i);
+	}
+	for(int i = 0; i < events.size(); i++) {
+		const ProfilerEvent &E = events[i];
+		fprintf(f, ",\n{\"name\":\"");
+		for(const char *c = E.name; *c; c++) {
+			if((*c == '"') || (*c == '\\')) fputc('\\', f);
+			if((unsigned char)*c >= ' ') fputc(*c, f);
+		}
+		fprintf(f, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				E.tid, E.start, E.duration);
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	std::cout << "Profiler: " << events.size() << " events of " << tracedFrames << " frames written to " << traceFile << "\n";
+	events.clear();
+}
+
+void BaseProject::RebuildPipeline() {
+	framebufferResized = true;
+}
+
+void BaseProject::handleGamePad(int id,  glm::vec3 &m, glm::vec3 &r, bool &fire) {
+	const float deadZone = 0.1f;
+	
+	if(glfwJoystickIsGamepad(id)) {
+		GLFWgamepadstate state;
+		if (glfwGetGamepadState(id, &state)) {
+			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_LEFT_X]) > deadZone) {
+				m.x += state.axes[GLFW_GAMEPAD_AXIS_LEFT_X];
+			}
+			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_LEFT_Y]) > deadZone) {
+				m.z += state.axes[GLFW_GAMEPAD_AXIS_LEFT_Y];
+			}
+			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_LEFT_TRIGGER]) > deadZone) {
+				m.y -= state.axes[GLFW_GAMEPAD_AXIS_LEFT_TRIGGER];
+			}
+			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_RIGHT_TRIGGER]) > deadZone) {
+				m.y += state.axes[GLFW_GAMEPAD_AXIS_RIGHT_TRIGGER];
+			}
+
+			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_RIGHT_X]) > deadZone) {
+				r.y += state.axes[GLFW_GAMEPAD_AXIS_RIGHT_X];
+			}
+			if(fabs(state.axes[GLFW_GAMEPAD_AXIS_RIGHT_Y]) > deadZone) {
+				r.x += state.axes[GLFW_GAMEPAD_AXIS_RIGHT_Y];
+			}
+			r.z += state.buttons[GLFW_GAMEPAD_BUTTON_LEFT_BUMPER] ? 1.0f : 0.0f;
+			r.z -= state.buttons[GLFW_GAMEPAD_BUTTON_RIGHT_BUMPER] ? 1.0f : 0.0f;
+			fire = fire | (bool)state.buttons[GLFW_GAMEPAD_BUTTON_A] | (bool)state.buttons[GLFW_GAMEPAD_BUTTON_B];
+		}
+	}
+}
+	
+void BaseProject::getSixAxis(float &deltaT,
+				glm::vec3 &m,
+				glm::vec3 &r,
+				bool &fire) {
+					
+	static auto startTime = std::chrono::high_resolution_clock::now();
+	static float lastTime = 0.0f;
 	
 	auto currentTime = std::chrono::high_resolution_clock::now();
 	float time = std::chrono::duration<float, std::chrono::seconds::period>
@@ -2150,63 +3398,71 @@ void BaseProject::getSixAxis(float &deltaT,
 	deltaT = time - lastTime;
 	lastTime = time;
 
-	static double old_xpos = 0, old_ypos = 0;
-	double xpos, ypos;
-	glfwGetCursorPos(window, &xpos, &ypos);
-	double m_dx = xpos - old_xpos;
-	double m_dy = ypos - old_ypos;
-	old_xpos = xpos; old_ypos = ypos;
-
-	const float MOUSE_RES = 10.0f;				
-	glfwSetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS, GLFW_TRUE);
-	if(glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
-		r.y = -m_dx / MOUSE_RES;
-		r.x = -m_dy / MOUSE_RES;
+	// a headless run is replayed at a fixed rate, with the keys of its script only
+	if(headless) {
+		deltaT = HeadlessDeltaT;
+	} else {
+		static double old_xpos = 0, old_ypos = 0;
+		double xpos, ypos;
+		glfwGetCursorPos(window, &xpos, &ypos);
+		double m_dx = xpos - old_xpos;
+		double m_dy = ypos - old_ypos;
+		old_xpos = xpos; old_ypos = ypos;
+
+		const float MOUSE_RES = 10.0f;				
+		glfwSetInputMode(window, GLFW_STICKY_MOUSE_BUTTONS, GLFW_TRUE);
+		if(glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
+			r.y = -m_dx / MOUSE_RES;
+			r.x = -m_dy / MOUSE_RES;
+		}
 	}
 
-	if(glfwGetKey(window, GLFW_KEY_LEFT)) {
+	if(getKey(GLFW_KEY_LEFT)) {
 		r.y = -1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_RIGHT)) {
+	if(getKey(GLFW_KEY_RIGHT)) {
 		r.y = 1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_UP)) {
+	if(getKey(GLFW_KEY_UP)) {
 		r.x = -1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_DOWN)) {
+	if(getKey(GLFW_KEY_DOWN)) {
 		r.x = 1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_Q)) {
+	if(getKey(GLFW_KEY_Q)) {
 		r.z = 1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_E)) {
+	if(getKey(GLFW_KEY_E)) {
 		r.z = -1.0f;
 	}
 
-	if(glfwGetKey(window, GLFW_KEY_A)) {
+	if(getKey(GLFW_KEY_A)) {
 		m.x = -1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_D)) {
+	if(getKey(GLFW_KEY_D)) {
 		m.x = 1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_S)) {
+	if(getKey(GLFW_KEY_S)) {
 		m.z = 1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_W)) {
+	if(getKey(GLFW_KEY_W)) {
 		m.z = -1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_R)) {
+	if(getKey(GLFW_KEY_R)) {
 		m.y = 1.0f;
 	}
-	if(glfwGetKey(window, GLFW_KEY_F)) {
+	if(getKey(GLFW_KEY_F)) {
 		m.y = -1.0f;
 	}
 	
-	fire = glfwGetKey(window, GLFW_KEY_SPACE) | (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS);
-	handleGamePad(GLFW_JOYSTICK_1,m,r,fire);
-	handleGamePad(GLFW_JOYSTICK_2,m,r,fire);
-	handleGamePad(GLFW_JOYSTICK_3,m,r,fire);
-	handleGamePad(GLFW_JOYSTICK_4,m,r,fire);
+	fire = getKey(GLFW_KEY_SPACE);
+	if(!headless) {
+		fire = fire | (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS);
+		handleGamePad(GLFW_JOYSTICK_1,m,r,fire);
+		handleGamePad(GLFW_JOYSTICK_2,m,r,fire);
+		handleGamePad(GLFW_JOYSTICK_3,m,r,fire);
+		handleGamePad(GLFW_JOYSTICK_4,m,r,fire);
+	}
 }
 
 void BaseProject::printFloat(const char *Name, float v) {
@@ -2489,7 +3745,7 @@ void BaseProject::saveScreenshot(const char *filename, int currentBuffer) {
 		srcImage,
 		VK_ACCESS_MEMORY_READ_BIT,
 		VK_ACCESS_TRANSFER_READ_BIT,
-		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		surfaceLayout,
 		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 		VK_PIPELINE_STAGE_TRANSFER_BIT,
 		VK_PIPELINE_STAGE_TRANSFER_BIT,
@@ -2560,7 +3816,7 @@ void BaseProject::saveScreenshot(const char *filename, int currentBuffer) {
 		VK_ACCESS_TRANSFER_READ_BIT,
 		VK_ACCESS_MEMORY_READ_BIT,
 		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		surfaceLayout,
 		VK_PIPELINE_STAGE_TRANSFER_BIT,
 		VK_PIPELINE_STAGE_TRANSFER_BIT,
 		VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
@@ -2632,23 +3888,24 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 	Bindings = B;
 	Layout = E;
 	
-	Position.hasIt = false; Position.offset = 0;
-	Pos2D.hasIt = false; Position.offset = 0;
-	Normal.hasIt = false; Normal.offset = 0;
-	UV.hasIt = false; UV.offset = 0;
-	Color.hasIt = false; Color.offset = 0;
-	Tangent.hasIt = false; Tangent.offset = 0;
-	JointWeight.hasIt = false; JointWeight.offset = 0;
-	JointIndex.hasIt = false; JointIndex.offset = 0;
+	Position.hasIt = false; Position.offset = 0; Position.format = VK_FORMAT_UNDEFINED;
+	Pos2D.hasIt = false; Pos2D.offset = 0; Pos2D.format = VK_FORMAT_UNDEFINED;
+	Normal.hasIt = false; Normal.offset = 0; Normal.format = VK_FORMAT_UNDEFINED;
+	UV.hasIt = false; UV.offset = 0; UV.format = VK_FORMAT_UNDEFINED;
+	Color.hasIt = false; Color.offset = 0; Color.format = VK_FORMAT_UNDEFINED;
+	Tangent.hasIt = false; Tangent.offset = 0; Tangent.format = VK_FORMAT_UNDEFINED;
+	JointWeight.hasIt = false; JointWeight.offset = 0; JointWeight.format = VK_FORMAT_UNDEFINED;
+	JointIndex.hasIt = false; JointIndex.offset = 0; JointIndex.format = VK_FORMAT_UNDEFINED;
 	
 	if(B.size() <= 1) {	// for now, read models only with every vertex information in a single binding
 		for(int i = 0; i < E.size(); i++) {
 			switch(E[i].usage) {
 			  case VertexDescriptorElementUsage::POSITION:
-			    if(E[i].format == VK_FORMAT_R32G32B32_SFLOAT) {
-				  if(E[i].size == sizeof(glm::vec3)) {
+			    if((E[i].format == VK_FORMAT_R32G32B32_SFLOAT) || (E[i].format == VK_FORMAT_R16G16B16A16_SNORM)) {
+				  if(E[i].size == ((E[i].format == VK_FORMAT_R32G32B32_SFLOAT) ? sizeof(glm::vec3) : 4 * sizeof(int16_t))) {
 					Position.hasIt = true;
 					Position.offset = E[i].offset;
+					Position.format = E[i].format;
 				  } else {
 					std::cout << "Vertex Position - wrong size\n";
 				  }
@@ -2661,6 +3918,7 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  if(E[i].size == sizeof(glm::vec2)) {
 					Pos2D.hasIt = true;
 					Pos2D.offset = E[i].offset;
+					Pos2D.format = E[i].format;
 				  } else {
 					std::cout << "Vertex Position 2D - wrong size\n";
 				  }
@@ -2669,10 +3927,11 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				}
 			    break;
 			  case VertexDescriptorElementUsage::NORMAL:
-			    if(E[i].format == VK_FORMAT_R32G32B32_SFLOAT) {
-				  if(E[i].size == sizeof(glm::vec3)) {
+			    if((E[i].format == VK_FORMAT_R32G32B32_SFLOAT) || (E[i].format == VK_FORMAT_R16G16_SNORM)) {
+				  if(E[i].size == ((E[i].format == VK_FORMAT_R32G32B32_SFLOAT) ? sizeof(glm::vec3) : 2 * sizeof(int16_t))) {
 					Normal.hasIt = true;
 					Normal.offset = E[i].offset;
+					Normal.format = E[i].format;
 				  } else {
 					std::cout << "Vertex Normal - wrong size\n";
 				  }
@@ -2681,10 +3940,11 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				}
 			    break;
 			  case VertexDescriptorElementUsage::UV:
-			    if(E[i].format == VK_FORMAT_R32G32_SFLOAT) {
-				  if(E[i].size == sizeof(glm::vec2)) {
+			    if((E[i].format == VK_FORMAT_R32G32_SFLOAT) || (E[i].format == VK_FORMAT_R16G16_UNORM)) {
+				  if(E[i].size == ((E[i].format == VK_FORMAT_R32G32_SFLOAT) ? sizeof(glm::vec2) : 2 * sizeof(uint16_t))) {
 					UV.hasIt = true;
 					UV.offset = E[i].offset;
+					UV.format = E[i].format;
 				  } else {
 					std::cout << "Vertex UV - wrong size\n";
 				  }
@@ -2697,6 +3957,7 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				  if(E[i].size == sizeof(glm::vec3)) {
 					Color.hasIt = true;
 					Color.offset = E[i].offset;
+					Color.format = E[i].format;
 				  } else {
 					std::cout << "Vertex Color - wrong size\n";
 				  }
@@ -2705,10 +3966,11 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				}
 			    break;
 			  case VertexDescriptorElementUsage::TANGENT:
-			    if(E[i].format == VK_FORMAT_R32G32B32A32_SFLOAT) {
-				  if(E[i].size == sizeof(glm::vec4)) {
+			    if((E[i].format == VK_FORMAT_R32G32B32A32_SFLOAT) || (E[i].format == VK_FORMAT_R16G16B16A16_SNORM)) {
+				  if(E[i].size == ((E[i].format == VK_FORMAT_R32G32B32A32_SFLOAT) ? sizeof(glm::vec4) : 4 * sizeof(int16_t))) {
 					Tangent.hasIt = true;
 					Tangent.offset = E[i].offset;
+					Tangent.format = E[i].format;
 				  } else {
 					std::cout << "Vertex Tangent - wrong size\n";
 				  }
@@ -2717,10 +3979,11 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 				}
 			    break;
 				case VertexDescriptorElementUsage::JOINTWEIGHT:
-					if(E[i].format == VK_FORMAT_R32G32B32A32_SFLOAT) {
-						if(E[i].size == sizeof(glm::vec4)) {
+					if((E[i].format == VK_FORMAT_R32G32B32A32_SFLOAT) || (E[i].format == VK_FORMAT_R8G8B8A8_UNORM)) {
+						if(E[i].size == ((E[i].format == VK_FORMAT_R32G32B32A32_SFLOAT) ? sizeof(glm::vec4) : 4 * sizeof(uint8_t))) {
 							JointWeight.hasIt = true;
 							JointWeight.offset = E[i].offset;
+							JointWeight.format = E[i].format;
 						} else {
 							std::cout << "Vertex Joint Weight - wrong size\n";
 						}
@@ -2729,10 +3992,11 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 					}
 				break;
 				case VertexDescriptorElementUsage::JOINTINDEX:
-					if(E[i].format == VK_FORMAT_R32G32B32A32_UINT) {
-						if(E[i].size == sizeof(glm::uvec4)) {
+					if((E[i].format == VK_FORMAT_R32G32B32A32_UINT) || (E[i].format == VK_FORMAT_R8G8B8A8_UINT)) {
+						if(E[i].size == ((E[i].format == VK_FORMAT_R32G32B32A32_UINT) ? sizeof(glm::uvec4) : 4 * sizeof(uint8_t))) {
 							JointIndex.hasIt = true;
 							JointIndex.offset = E[i].offset;
+							JointIndex.format = E[i].format;
 						} else {
 							std::cout << "Vertex Joint Index - wrong size\n";
 						}
@@ -2752,6 +4016,11 @@ void VertexDescriptor::init(BaseProject *bp, std::vector<VertexBindingDescriptor
 void VertexDescriptor::cleanup() {
 }
 
+bool VertexDescriptor::isQuantized() {
+	return (Position.hasIt && (Position.format == VK_FORMAT_R16G16B16A16_SNORM)) ||
+		   (UV.hasIt && (UV.format == VK_FORMAT_R16G16_UNORM));
+}
+
 std::vector<VkVertexInputBindingDescription> VertexDescriptor::getBindingDescription() {
 	std::vector<VkVertexInputBindingDescription>bindingDescription{};
 	bindingDescription.resize(Bindings.size());
@@ -2834,17 +4103,73 @@ void AssetFile::initOBJ(std::string file) {
 	}
 }
 
-void AssetFile::initGLTF(std::string file) {
-	// GLTF assets stuff
+// Loads a GLTF file, memory mapping its external .bin buffers instead of
+// reading them: tinygltf receives a copy of the JSON where each external
+// buffer is replaced by a one byte placeholder
+void AssetFile::loadGLTF(tinygltf::Model *M, std::string file, std::vector<MappedFile> &MF, std::vector<const unsigned char *> &BD) {
 	tinygltf::TinyGLTF loader;
 	std::string warn, err;
+	std::string baseDir = tinygltf::GetBaseDir(file);
 
-	std::cout << "Loading Asset File: " << file << "[GLTF]\n";	
-	if (!loader.LoadASCIIFromFile(&model, &warn, &err, 
-					file.c_str())) {
+	std::vector<char> text = readFile(file);
+	nlohmann::json js = nlohmann::json::parse(text.begin(), text.end());
+	std::vector<char>().swap(text);
+
+	bool hasEmbeddedImages = false;
+	if(js.contains("images")) {
+		for(auto &img : js["images"]) {
+			hasEmbeddedImages |= img.contains("bufferView");
+		}
+	}
+
+	std::vector<std::string> external;
+	std::vector<size_t> externalLength;
+	if(js.contains("buffers") && !hasEmbeddedImages) {
+		for(auto &buf : js["buffers"]) {
+			std::string uri = buf.value("uri", "");
+			if((uri != "") && (uri.rfind("data:", 0) != 0)) {
+				external.push_back(uri);
+				externalLength.push_back(buf.value("byteLength", (size_t)0));
+				buf["uri"] = "data:application/octet-stream;base64,AA==";
+				buf["byteLength"] = 1;
+			} else {
+				external.push_back("");
+				externalLength.push_back(0);
+			}
+		}
+	}
+	std::string patched = js.dump();
+	js = nlohmann::json();
+
+	if (!loader.LoadASCIIFromString(M, &warn, &err, patched.c_str(), 
+				(unsigned int)patched.size(), baseDir)) {
 		throw std::runtime_error(warn + err);
 	}
 
+	MF.resize(M->buffers.size());
+	BD.resize(M->buffers.size());
+	for(int i = 0; i < M->buffers.size(); i++) {
+		if((i < external.size()) && (external[i] != "")) {
+			std::string path = baseDir.empty() ? external[i] : (baseDir + "/" + external[i]);
+			if(!MF[i].map(path) || (MF[i].size < externalLength[i])) {
+				std::cout << "Failed to map: " << path << "\n";
+				throw std::runtime_error("failed to map GLTF buffer!");
+			}
+			M->buffers[i].uri = external[i];
+			M->buffers[i].data.clear();
+			M->buffers[i].data.shrink_to_fit();
+			BD[i] = MF[i].data;
+		} else {
+			BD[i] = M->buffers[i].data.data();
+		}
+	}
+}
+
+void AssetFile::initGLTF(std::string file) {
+	// GLTF assets stuff
+	std::cout << "Loading Asset File: " << file << "[GLTF]\n";	
+	loadGLTF(&model, file, GLTFmapped, GLTFbufferData);
+
 
 	for (const auto& mesh :  model.meshes) {
 		std::cout << " Name:" << mesh.name << " Primitives: " << mesh.primitives.size() << "\n";
@@ -2869,25 +4194,415 @@ void AssetFile::initGLTF(std::string file) {
 }
 
 void AssetFile::cleanup() {
+	for(auto &MF : GLTFmapped) {
+		MF.unmap();
+	}
+	GLTFmapped.clear();
+	GLTFbufferData.clear();
 }
 	
 
 
 
 
+static inline int16_t packSnorm16(float v) {
+	return (int16_t)roundf(std::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+static inline uint16_t packUnorm16(float v) {
+	return (uint16_t)roundf(std::clamp(v, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Octahedral normal encoding: the unit sphere is projected on the octahedron
+// |x|+|y|+|z|=1, whose lower half is then folded over the upper one
+static inline void packOctNormal(glm::vec3 n, int16_t *o) {
+	n /= (fabsf(n.x) + fabsf(n.y) + fabsf(n.z) + 1e-20f);
+	if(n.z < 0.0f) {
+		float x = n.x;
+		n.x = (1.0f - fabsf(n.y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		n.y = (1.0f - fabsf(x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	o[0] = packSnorm16(n.x);
+	o[1] = packSnorm16(n.y);
+}
+
+void Model::resetBounds() {
+	AABBmin = glm::vec3( std::numeric_limits<float>::max());
+	AABBmax = glm::vec3(-std::numeric_limits<float>::max());
+	UVmin = glm::vec2( std::numeric_limits<float>::max());
+	UVmax = glm::vec2(-std::numeric_limits<float>::max());
+}
+
+void Model::growOBJBounds(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
+	for (const auto& index : M->mesh.indices) {
+		glm::vec3 pos = {
+			A->vertices[3 * index.vertex_index + 0],
+			A->vertices[3 * index.vertex_index + 1],
+			A->vertices[3 * index.vertex_index + 2]
+		};
+		AABBmin = glm::min(AABBmin, pos);
+		AABBmax = glm::max(AABBmax, pos);
+		if(index.texcoord_index >= 0) {
+			glm::vec2 texCoord = {
+				A->texcoords[2 * index.texcoord_index + 0],
+				1 - A->texcoords[2 * index.texcoord_index + 1] 
+			};
+			UVmin = glm::min(UVmin, texCoord);
+			UVmax = glm::max(UVmax, texCoord);
+		}
+	}
+}
+
+void Model::growGLTFBounds(tinygltf::Model *M, const tinygltf::Primitive *Prm, const std::vector<const unsigned char *> &BD) {
+	auto pIt = Prm->attributes.find("POSITION");
+	if(pIt != Prm->attributes.end()) {
+		const tinygltf::Accessor &posAccessor = M->accessors[pIt->second];
+		const float *bufferPos = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, pIt->second));
+		for(int i = 0; i < posAccessor.count; i++) {
+			glm::vec3 pos = {bufferPos[3 * i + 0], bufferPos[3 * i + 1], bufferPos[3 * i + 2]};
+			AABBmin = glm::min(AABBmin, pos);
+			AABBmax = glm::max(AABBmax, pos);
+		}
+	}
+	auto uIt = Prm->attributes.find("TEXCOORD_0");
+	if(uIt != Prm->attributes.end()) {
+		const tinygltf::Accessor &uvAccessor = M->accessors[uIt->second];
+		const float *bufferTexCoords = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, uIt->second));
+		for(int i = 0; i < uvAccessor.count; i++) {
+			glm::vec2 texCoord = {bufferTexCoords[2 * i + 0], bufferTexCoords[2 * i + 1]};
+			UVmin = glm::min(UVmin, texCoord);
+			UVmax = glm::max(UVmax, texCoord);
+		}
+	}
+}
+
+// Packed positions map the bounding box to [-1,1]^3, and packed UVs map the
+// UV range to [0,1]^2: PosDequant and UVDequant perform the inverse mapping
+void Model::computeDequant() {
+	if(AABBmin.x > AABBmax.x) {
+		AABBmin = AABBmax = glm::vec3(0.0f);
+	}
+	if(UVmin.x > UVmax.x) {
+		UVmin = UVmax = glm::vec2(0.0f);
+	}
+	glm::vec3 halfSize = glm::max((AABBmax - AABBmin) * 0.5f, glm::vec3(1e-6f));
+	QPosOffset = (AABBmax + AABBmin) * 0.5f;
+	QPosScale = 1.0f / halfSize;
+	glm::vec2 uvSize = glm::max(UVmax - UVmin, glm::vec2(1e-6f));
+	QUVOffset = UVmin;
+	QUVScale = 1.0f / uvSize;
+
+	PosDequant = glm::translate(glm::mat4(1), QPosOffset) * glm::scale(glm::mat4(1), halfSize);
+	UVDequant = glm::vec4(UVmin, uvSize);
+}
+
+void Model::writePosition(unsigned char *vertex, glm::vec3 pos) {
+	if(VD->Position.format == VK_FORMAT_R16G16B16A16_SNORM) {
+		glm::vec3 q = (pos - QPosOffset) * QPosScale;
+		int16_t *o = (int16_t *)(vertex + VD->Position.offset);
+		o[0] = packSnorm16(q.x);
+		o[1] = packSnorm16(q.y);
+		o[2] = packSnorm16(q.z);
+		o[3] = 32767;
+	} else {
+		glm::vec3 *o = (glm::vec3 *)(vertex + VD->Position.offset);
+		*o = pos;
+	}
+}
+
+void Model::writeNormal(unsigned char *vertex, glm::vec3 norm) {
+	if(VD->Normal.format == VK_FORMAT_R16G16_SNORM) {
+		packOctNormal(norm, (int16_t *)(vertex + VD->Normal.offset));
+	} else {
+		glm::vec3 *o = (glm::vec3 *)(vertex + VD->Normal.offset);
+		*o = norm;
+	}
+}
+
+void Model::writeUV(unsigned char *vertex, glm::vec2 uv) {
+	if(VD->UV.format == VK_FORMAT_R16G16_UNORM) {
+		glm::vec2 q = (uv - QUVOffset) * QUVScale;
+		uint16_t *o = (uint16_t *)(vertex + VD->UV.offset);
+		o[0] = packUnorm16(q.x);
+		o[1] = packUnorm16(q.y);
+	} else {
+		glm::vec2 *o = (glm::vec2 *)(vertex + VD->UV.offset);
+		*o = uv;
+	}
+}
+
+void Model::writeTangent(unsigned char *vertex, glm::vec4 tan) {
+	if(VD->Tangent.format == VK_FORMAT_R16G16B16A16_SNORM) {
+		int16_t *o = (int16_t *)(vertex + VD->Tangent.offset);
+		o[0] = packSnorm16(tan.x);
+		o[1] = packSnorm16(tan.y);
+		o[2] = packSnorm16(tan.z);
+		o[3] = (tan.w < 0.0f) ? -32767 : 32767;
+	} else {
+		glm::vec4 *o = (glm::vec4 *)(vertex + VD->Tangent.offset);
+		*o = tan;
+	}
+}
+
+void Model::writeJointIndex(unsigned char *vertex, glm::uvec4 joints) {
+	if(VD->JointIndex.format == VK_FORMAT_R8G8B8A8_UINT) {
+		uint8_t *o = (uint8_t *)(vertex + VD->JointIndex.offset);
+		for(int k = 0; k < 4; k++) {
+			if(joints[k] > 255) {
+				std::cout << "Warning: joint index " << joints[k] << " does not fit in 8 bits\n";
+			}
+			o[k] = (uint8_t)joints[k];
+		}
+	} else {
+		glm::uvec4 *o = (glm::uvec4 *)(vertex + VD->JointIndex.offset);
+		*o = joints;
+	}
+}
+
+void Model::writeJointWeight(unsigned char *vertex, glm::vec4 weights) {
+	if(VD->JointWeight.format == VK_FORMAT_R8G8B8A8_UNORM) {
+		// weights are renormalized so that the quantized values still add up to one
+		float sum = weights.x + weights.y + weights.z + weights.w;
+		if(sum > 0.0f) {
+			weights /= sum;
+		}
+		uint8_t *o = (uint8_t *)(vertex + VD->JointWeight.offset);
+		int total = 0, largest = 0;
+		for(int k = 0; k < 4; k++) {
+			o[k] = (uint8_t)roundf(std::clamp(weights[k], 0.0f, 1.0f) * 255.0f);
+			total += o[k];
+			if(o[k] > o[largest]) largest = k;
+		}
+		if(sum > 0.0f) {
+			o[largest] = (uint8_t)(o[largest] + 255 - total);
+		}
+	} else {
+		glm::vec4 *o = (glm::vec4 *)(vertex + VD->JointWeight.offset);
+		*o = weights;
+	}
+}
+
+void Model::pushDequant(VkCommandBuffer commandBuffer, Pipeline &P) {
+	VertexDequantPushConstant PKv;
+	PKv.PosDequant = PosDequant;
+	PKv.UVDequant = UVDequant;
+	vkCmdPushConstants(commandBuffer, P.pipelineLayout,
+					   VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PKv), &PKv);
+}
+
+// Vertex cache optimization: reorders the triangles of an indexed mesh
+// following Tom Forsyth's "Linear-Speed Vertex Cache Optimisation",
+// simulating an LRU post-transform cache of VCACHE_OPT_SIZE entries.
+// ACMR (average cache miss ratio: transformed vertices per triangle) is
+// measured on a FIFO cache of VCACHE_SIM_SIZE entries, closer to real hardware.
+static const int VCACHE_OPT_SIZE = 32;
+static const int VCACHE_SIM_SIZE = 16;
+
+static float forsythVertexScore(int cachePos, int remainingTris) {
+	if(remainingTris == 0) {
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if(cachePos >= 0) {
+		if(cachePos < 3) {
+			// vertices of the last triangle get a fixed score, to avoid
+			// favouring the triangle that has just been emitted
+			score = 0.75f;
+		} else {
+			float scaler = 1.0f / (VCACHE_OPT_SIZE - 3);
+			score = powf(1.0f - (cachePos - 3) * scaler, 1.5f);
+		}
+	}
+	// bonus for vertices with few triangles left, to get rid of them quickly
+	score += 2.0f * powf((float)remainingTris, -0.5f);
+	return score;
+}
+
+void Model::optimizeVertexCache(uint32_t *idx, size_t indexCount, size_t vertexCount) {
+	size_t triCount = indexCount / 3;
+	if(triCount == 0) return;
+
+	std::vector<int> remaining(vertexCount, 0);
+	for(size_t i = 0; i < indexCount; i++) {
+		remaining[idx[i]]++;
+	}
+	std::vector<uint32_t> adjOffset(vertexCount + 1, 0);
+	for(size_t v = 0; v < vertexCount; v++) {
+		adjOffset[v + 1] = adjOffset[v] + remaining[v];
+	}
+	std::vector<uint32_t> adjacency(indexCount);
+	std::vector<uint32_t> fill(adjOffset.begin(), adjOffset.end() - 1);
+	for(size_t t = 0; t < triCount; t++) {
+		for(int k = 0; k < 3; k++) {
+			adjacency[fill[idx[3 * t + k]]++] = t;
+		}
+	}
+
+	std::vector<float> vScore(vertexCount);
+	for(size_t v = 0; v < vertexCount; v++) {
+		vScore[v] = forsythVertexScore(-1, remaining[v]);
+	}
+	std::vector<float> tScore(triCount);
+	std::vector<bool> emitted(triCount, false);
+	for(size_t t = 0; t < triCount; t++) {
+		tScore[t] = vScore[idx[3 * t]] + vScore[idx[3 * t + 1]] + vScore[idx[3 * t + 2]];
+	}
+
+	std::vector<uint32_t> out;
+	out.reserve(indexCount);
+	int cache[VCACHE_OPT_SIZE + 3];
+	int cacheSize = 0;
+	size_t scanPos = 0;
+	long bestTri = -1;
+
+	for(size_t emittedCount = 0; emittedCount < triCount; emittedCount++) {
+		if(bestTri < 0) {
+			// no candidate among the cached vertices: take the best remaining triangle
+			float best = -1.0f;
+			while((scanPos < triCount) && emitted[scanPos]) scanPos++;
+			for(size_t t = scanPos; t < triCount; t++) {
+				if(!emitted[t] && (tScore[t] > best)) {
+					best = tScore[t];
+					bestTri = t;
+				}
+			}
+		}
+		emitted[bestTri] = true;
+
+		// emit it, and move its vertices to the front of the LRU cache
+		int newCache[VCACHE_OPT_SIZE + 3];
+		int newSize = 0;
+		for(int k = 0; k < 3; k++) {
+			uint32_t v = idx[3 * bestTri + k];
+			out.push_back(v);
+			newCache[newSize++] = v;
+			// remove the triangle from the vertex adjacency
+			uint32_t *a = &adjacency[adjOffset[v]];
+			int n = remaining[v];
+			for(int j = 0; j < n; j++) {
+				if(a[j] == bestTri) {
+					a[j] = a[n - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+		for(int c = 0; c < cacheSize; c++) {
+			int v = cache[c];
+			if((v != newCache[0]) && (v != newCache[1]) && (v != newCache[2])) {
+				newCache[newSize++] = v;
+			}
+		}
+		// vertices pushed out of the cache lose their cache bonus
+		for(int c = VCACHE_OPT_SIZE; c < newSize; c++) {
+			vScore[newCache[c]] = forsythVertexScore(-1, remaining[newCache[c]]);
+		}
+		cacheSize = std::min(newSize, VCACHE_OPT_SIZE);
+		memcpy(cache, newCache, cacheSize * sizeof(int));
+
+		// update the scores of the cached vertices, and of their triangles
+		for(int c = 0; c < cacheSize; c++) {
+			vScore[cache[c]] = forsythVertexScore(c, remaining[cache[c]]);
+		}
+		bestTri = -1;
+		float best = -1.0f;
+		for(int c = 0; c < cacheSize; c++) {
+			int v = cache[c];
+			const uint32_t *a = &adjacency[adjOffset[v]];
+			for(int j = 0; j < remaining[v]; j++) {
+				uint32_t t = a[j];
+				tScore[t] = vScore[idx[3 * t]] + vScore[idx[3 * t + 1]] + vScore[idx[3 * t + 2]];
+				if(tScore[t] > best) {
+					best = tScore[t];
+					bestTri = t;
+				}
+			}
+		}
+	}
+	memcpy(idx, out.data(), indexCount * sizeof(uint32_t));
+}
+
+float Model::computeACMR(const uint32_t *idx, size_t indexCount, int cacheSize) {
+	if(indexCount < 3) return 0.0f;
+	std::vector<uint32_t> fifo(cacheSize, 0xffffffff);
+	int head = 0;
+	size_t misses = 0;
+	for(size_t i = 0; i < indexCount; i++) {
+		bool hit = false;
+		for(int c = 0; c < cacheSize; c++) {
+			if(fifo[c] == idx[i]) {hit = true; break;}
+		}
+		if(!hit) {
+			fifo[head] = idx[i];
+			head = (head + 1) % cacheSize;
+			misses++;
+		}
+	}
+	return (float)misses / (float)(indexCount / 3);
+}
+
+// Renumbers the vertices in the order they are first referenced by the
+// index buffer, so that vertex fetches walk the buffer mostly sequentially
+void Model::optimizeVertexFetch(uint32_t *idx, size_t indexCount, unsigned char *vert, size_t vertexCount, int stride) {
+	std::vector<uint32_t> remap(vertexCount, 0xffffffff);
+	std::vector<unsigned char> sorted(vertexCount * stride);
+	uint32_t next = 0;
+	for(size_t i = 0; i < indexCount; i++) {
+		uint32_t v = idx[i];
+		if(remap[v] == 0xffffffff) {
+			remap[v] = next;
+			memcpy(&sorted[(size_t)next * stride], &vert[(size_t)v * stride], stride);
+			next++;
+		}
+		idx[i] = remap[v];
+	}
+	memcpy(vert, sorted.data(), (size_t)next * stride);
+}
+
+struct OBJIndexKey {
+	int v, n, t;
+	bool operator==(const OBJIndexKey &o) const {
+		return (v == o.v) && (n == o.n) && (t == o.t);
+	}
+};
+
+struct OBJIndexKeyHash {
+	size_t operator()(const OBJIndexKey &k) const {
+		return ((size_t)k.v * 73856093u) ^ ((size_t)k.n * 19349663u) ^ ((size_t)k.t * 83492791u);
+	}
+};
+
 void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 	int mainStride = VD->Bindings[0].stride;
-	int newId = 0;
+	uint32_t firstVertex = vertices.size() / mainStride;
+
+	// Vertices are shared among the corners referencing the same
+	// position / normal / UV triple of the OBJ file
+	std::unordered_map<OBJIndexKey, uint32_t, OBJIndexKeyHash> uniqueVertices;
+	uniqueVertices.reserve(M->mesh.indices.size());
+	std::vector<unsigned char> meshVertices;
+	std::vector<uint32_t> meshIndices;
+	meshIndices.reserve(M->mesh.indices.size());
+	
 	for (const auto& index : M->mesh.indices) {
-		std::vector<unsigned char> vertex(mainStride, 0);
+		OBJIndexKey key = {index.vertex_index, index.normal_index, index.texcoord_index};
+		auto found = uniqueVertices.find(key);
+		if(found != uniqueVertices.end()) {
+			meshIndices.push_back(found->second);
+			continue;
+		}
+		uint32_t newId = uniqueVertices.size();
+		uniqueVertices[key] = newId;
+		meshVertices.resize(meshVertices.size() + mainStride, 0);
+		unsigned char *vertex = &meshVertices[(size_t)newId * mainStride];
+		
 		glm::vec3 pos = {
 			A->vertices[3 * index.vertex_index + 0],
 			A->vertices[3 * index.vertex_index + 1],
 			A->vertices[3 * index.vertex_index + 2]
 		};
 		if(VD->Position.hasIt) {
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Position.offset);
-			*o = pos;
+			writePosition(vertex, pos);
 		}
 		
 		glm::vec3 color = {
@@ -2896,7 +4611,7 @@ void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 			A->colors[3 * index.vertex_index + 2]
 		};
 		if(VD->Color.hasIt) {
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Color.offset);
+			glm::vec3 *o = (glm::vec3 *)((char*)vertex + VD->Color.offset);
 			*o = color;
 		}
 		
@@ -2905,8 +4620,7 @@ void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 			1 - A->texcoords[2 * index.texcoord_index + 1] 
 		};
 		if(VD->UV.hasIt) {
-			glm::vec2 *o = (glm::vec2 *)((char*)(&vertex[0]) + VD->UV.offset);
-			*o = texCoord;
+			writeUV(vertex, texCoord);
 		}
 
 		glm::vec3 norm = {
@@ -2915,13 +4629,29 @@ void Model::makeOBJMesh(const tinyobj::shape_t *M, const tinyobj::attrib_t *A) {
 			A->normals[3 * index.normal_index + 2]
 		};
 		if(VD->Normal.hasIt) {
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Normal.offset);
-			*o = norm;
+			writeNormal(vertex, norm);
 		}
 		
-		vertices.insert(vertices.end(), vertex.begin(), vertex.end());
-//			indices.push_back((vertices.size()/mainStride)-1);
-		indices.push_back(newId++);
+		meshIndices.push_back(newId);
+	}
+
+	size_t vertexCount = uniqueVertices.size();
+#ifdef STARTER_LOAD_STATS
+	float acmrIndexed = computeACMR(meshIndices.data(), meshIndices.size(), VCACHE_SIM_SIZE);
+#endif
+	optimizeVertexCache(meshIndices.data(), meshIndices.size(), vertexCount);
+	optimizeVertexFetch(meshIndices.data(), meshIndices.size(), meshVertices.data(), vertexCount, mainStride);
+#ifdef STARTER_LOAD_STATS
+	float acmrOptimized = computeACMR(meshIndices.data(), meshIndices.size(), VCACHE_SIM_SIZE);
+
+	// Without deduplication every corner was a separate vertex (ACMR = 3)
+	std::cout << "[OBJ] " << M->name << ": Vertices " << M->mesh.indices.size() << " -> " << vertexCount;
+	std::cout << ", ACMR 3.000 -> " << acmrIndexed << " (indexed) -> " << acmrOptimized << " (optimized)\n";
+#endif
+
+	vertices.insert(vertices.end(), meshVertices.begin(), meshVertices.end());
+	for(uint32_t i : meshIndices) {
+		indices.push_back(firstVertex + i);
 	}
 }
 
@@ -2941,6 +4671,11 @@ void Model::loadModelOBJ(std::string file) {
 //	std::cout << "Position " << VD->Position.hasIt << "," << VD->Position.offset << "\n";	
 //	std::cout << "UV " << VD->UV.hasIt << "," << VD->UV.offset << "\n";	
 //	std::cout << "Normal " << VD->Normal.hasIt << "," << VD->Normal.offset << "\n";
+	resetBounds();
+	for (const auto& shape : shapes) {
+		growOBJBounds(&shape, &attrib);
+	}
+	computeDequant();
 	for (const auto& shape : shapes) {
 		makeOBJMesh(&shape, &attrib);
 	}
@@ -2949,7 +4684,7 @@ void Model::loadModelOBJ(std::string file) {
 	
 }
 
-void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
+void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm, const std::vector<const unsigned char *> &BD) {
 	int mainStride = VD->Bindings[0].stride;
 
 	const float *bufferPos = nullptr;
@@ -2976,11 +4711,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 
 	auto pIt = Prm->attributes.find("POSITION");
 	if(pIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &posAccessor = M->accessors[pIt->second];
-		const tinygltf::BufferView &posView = M->bufferViews[posAccessor.bufferView];
-		bufferPos = reinterpret_cast<const float *>(&(M->buffers[posView.buffer].data[posAccessor.byteOffset + posView.byteOffset]));
+		bufferPos = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, pIt->second));
 		meshHasPos = true;
-		cntPos = posAccessor.count;
+		cntPos = M->accessors[pIt->second].count;
 		if(cntPos > cntTot) cntTot = cntPos;
 	} else {
 		if(VD->Position.hasIt) {
@@ -2990,11 +4723,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 	
 	auto nIt = Prm->attributes.find("NORMAL");
 	if(nIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &normAccessor = M->accessors[nIt->second];
-		const tinygltf::BufferView &normView = M->bufferViews[normAccessor.bufferView];
-		bufferNormals = reinterpret_cast<const float *>(&(M->buffers[normView.buffer].data[normAccessor.byteOffset + normView.byteOffset]));
+		bufferNormals = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, nIt->second));
 		meshHasNorm = true;
-		cntNorm = normAccessor.count;
+		cntNorm = M->accessors[nIt->second].count;
 		if(cntNorm > cntTot) cntTot = cntNorm;
 	} else {
 		if(VD->Normal.hasIt) {
@@ -3004,11 +4735,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 
 	auto tIt = Prm->attributes.find("TANGENT");
 	if(tIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &tanAccessor = M->accessors[tIt->second];
-		const tinygltf::BufferView &tanView = M->bufferViews[tanAccessor.bufferView];
-		bufferTangents = reinterpret_cast<const float *>(&(M->buffers[tanView.buffer].data[tanAccessor.byteOffset + tanView.byteOffset]));
+		bufferTangents = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, tIt->second));
 		meshHasTan = true;
-		cntTan = tanAccessor.count;
+		cntTan = M->accessors[tIt->second].count;
 		if(cntTan > cntTot) cntTot = cntTan;
 	} else {
 		if(VD->Tangent.hasIt) {
@@ -3018,11 +4747,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 
 	auto uIt = Prm->attributes.find("TEXCOORD_0");
 	if(uIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &uvAccessor = M->accessors[uIt->second];
-		const tinygltf::BufferView &uvView = M->bufferViews[uvAccessor.bufferView];
-		bufferTexCoords = reinterpret_cast<const float *>(&(M->buffers[uvView.buffer].data[uvAccessor.byteOffset + uvView.byteOffset]));
+		bufferTexCoords = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, uIt->second));
 		meshHasUV = true;
-		cntUV = uvAccessor.count;
+		cntUV = M->accessors[uIt->second].count;
 		if(cntUV > cntTot) cntTot = cntUV;
 	} else {
 		if(VD->UV.hasIt) {
@@ -3032,11 +4759,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 
 	auto iIt = Prm->attributes.find("JOINTS_0");
 	if(iIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &jointAccessor = M->accessors[iIt->second];
-		const tinygltf::BufferView &jointView = M->bufferViews[jointAccessor.bufferView];
-		bufferJointIndex = reinterpret_cast<const glm::u8 *>(&(M->buffers[jointView.buffer].data[jointAccessor.byteOffset + jointView.byteOffset]));
+		bufferJointIndex = reinterpret_cast<const glm::u8 *>(AssetFile::GLTFaccessorData(M, BD, iIt->second));
 		meshHasJointIndex = true;
-		cntJointIndex = jointAccessor.count;
+		cntJointIndex = M->accessors[iIt->second].count;
 		if(cntJointIndex > cntTot) cntTot = cntJointIndex;
 	} else {
 		if(VD->JointIndex.hasIt) {
@@ -3045,11 +4770,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 	}
 	auto wIt = Prm->attributes.find("WEIGHTS_0");
 	if(wIt != Prm->attributes.end()) {
-		const tinygltf::Accessor &weightsAccessor = M->accessors[wIt->second];
-		const tinygltf::BufferView &weightsView = M->bufferViews[weightsAccessor.bufferView];
-		bufferJointWeight = reinterpret_cast<const float *>(&(M->buffers[weightsView.buffer].data[weightsAccessor.byteOffset + weightsView.byteOffset]));
+		bufferJointWeight = reinterpret_cast<const float *>(AssetFile::GLTFaccessorData(M, BD, wIt->second));
 		meshHasJointWeight = true;
-		cntJointWeight = weightsAccessor.count;
+		cntJointWeight = M->accessors[wIt->second].count;
 		if(cntJointWeight > cntTot) cntTot = cntJointWeight;
 	} else {
 		if(VD->JointWeight.hasIt) {
@@ -3057,13 +4780,12 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 		}
 	}
 
-//std::cout << "making vertex array. Stride:" << mainStride << "\n";
-//	std::unordered_map<int, bool> usedIndices;
+	// vertices are written in place, straight from the (mapped) buffers
+	uint32_t firstVertex = vertices.size() / mainStride;
+	vertices.resize(vertices.size() + (size_t)cntTot * mainStride, 0);
 
 	for(int i = 0; i < cntTot; i++) {
-		std::vector<unsigned char> vertex(mainStride, 0);
-//std::cout << vertices.size() << "," << vertex.size() << "," << &vertex << " " << &vertex[0] << " ";
-//std::cout << i << "\n";
+		unsigned char *vertex = &vertices[((size_t)firstVertex + i) * mainStride];
 		
 		if((i < cntPos) && meshHasPos && VD->Position.hasIt) {
 			glm::vec3 pos = {
@@ -3071,11 +4793,7 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 				bufferPos[3 * i + 1],
 				bufferPos[3 * i + 2]
 			};
-//std::cout << "Pos: " <<	VD->Position.offset << "\n";
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Position.offset);
-//std::cout << "at: " << o << "\n";
-			*o = pos;
-//std::cout << "Copied: " << o->x << "\n";
+			writePosition(vertex, pos);
 		}
 		if((i < cntNorm) && meshHasNorm && VD->Normal.hasIt) {
 			glm::vec3 normal = {
@@ -3083,9 +4801,7 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 				bufferNormals[3 * i + 1],
 				bufferNormals[3 * i + 2]
 			};
-//std::cout << "Nor: " <<	VD->Normal.offset << "\n";
-			glm::vec3 *o = (glm::vec3 *)((char*)(&vertex[0]) + VD->Normal.offset);
-			*o = normal;
+			writeNormal(vertex, normal);
 		}
 
 		if((i < cntTan) && meshHasTan && VD->Tangent.hasIt) {
@@ -3095,9 +4811,7 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 				bufferTangents[4 * i + 2],
 				bufferTangents[4 * i + 3]
 			};
-//std::cout << "Tan: " <<	VD->Tangent.offset << "\n";
-			glm::vec4 *o = (glm::vec4 *)((char*)(&vertex[0]) + VD->Tangent.offset);
-			*o = tangent;
+			writeTangent(vertex, tangent);
 		}
 		
 		if((i < cntUV) && meshHasUV && VD->UV.hasIt) {
@@ -3105,12 +4819,9 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 				bufferTexCoords[2 * i + 0],
 				bufferTexCoords[2 * i + 1] 
 			};
-//std::cout << "UV : " <<	VD->UV.offset << "\n";
-			glm::vec2 *o = (glm::vec2 *)((char*)(&vertex[0]) + VD->UV.offset);
-			*o = texCoord;
+			writeUV(vertex, texCoord);
 		}
 
-
 		if((i < cntJointIndex) && meshHasJointIndex && VD->JointIndex.hasIt) {
 			glm::uvec4 jointIndex = {
 				(glm::uint)bufferJointIndex[4 * i + 0],
@@ -3118,15 +4829,7 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 				(glm::uint)bufferJointIndex[4 * i + 2],
 				(glm::uint)bufferJointIndex[4 * i + 3]
 			};
-//std::cout << jointIndex.x << " " << jointIndex.y << " " << jointIndex.z << " " << jointIndex.w << "\t\t";
-
-//usedIndices[jointIndex.x] = true;
-//usedIndices[jointIndex.y] = true;
-//usedIndices[jointIndex.z] = true;
-//usedIndices[jointIndex.w] = true;
-
-			glm::uvec4 *o = (glm::uvec4 *)((char*)(&vertex[0]) + VD->JointIndex.offset);
-			*o = jointIndex;
+			writeJointIndex(vertex, jointIndex);
 		}
 
 		if((i < cntJointWeight) && meshHasJointWeight && VD->JointWeight.hasIt) {
@@ -3136,42 +4839,29 @@ void Model::makeGLTFMesh(tinygltf::Model *M, const tinygltf::Primitive *Prm) {
 				bufferJointWeight[4 * i + 2],
 				bufferJointWeight[4 * i + 3]
 			};
-//std::cout << bufferJointWeight[4 * i + 0] << " " << bufferJointWeight[4 * i + 1] << " " << bufferJointWeight[4 * i + 2] << " " << 
-//				bufferJointWeight[4 * i + 3] << "\n";
-
-			glm::vec4 *o = (glm::vec4 *)((char*)(&vertex[0]) + VD->JointWeight.offset);
-			*o = jointWeight;
+			writeJointWeight(vertex, jointWeight);
 		}
-
-//std::cout << vertices.size() << "," << vertex.size() << " Inserting\n";
-		vertices.insert(vertices.end(), vertex.begin(), vertex.end());
-//std::cout << vertices.size() << " Inserted\n";
 	} 
 
-//std::cout << "Used indices: " << usedIndices.size() << "\n";
-//for(auto kkk: usedIndices) {
-//	std::cout << kkk.first << ", ";
-//}
-//std::cout << "\n";
-
 	const tinygltf::Accessor &accessor = M->accessors[Prm->indices];
-	const tinygltf::BufferView &bufferView = M->bufferViews[accessor.bufferView];
-	const tinygltf::Buffer &buffer = M->buffers[bufferView.buffer];
+	const unsigned char *indexData = AssetFile::GLTFaccessorData(M, BD, Prm->indices);
+	size_t firstIndex = indices.size();
+	indices.resize(firstIndex + accessor.count);
 	
 	switch(accessor.componentType) {
 		case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT:
 			{
-				const uint16_t *bufferIndex = reinterpret_cast<const uint16_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
+				const uint16_t *bufferIndex = reinterpret_cast<const uint16_t *>(indexData);
 				for(int i = 0; i < accessor.count; i++) {
-					indices.push_back(bufferIndex[i]);
+					indices[firstIndex + i] = firstVertex + bufferIndex[i];
 				}
 			}
 			break;
 		case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT:
 			{
-				const uint32_t *bufferIndex = reinterpret_cast<const uint32_t *>(&(buffer.data[accessor.byteOffset + bufferView.byteOffset]));
+				const uint32_t *bufferIndex = reinterpret_cast<const uint32_t *>(indexData);
 				for(int i = 0; i < accessor.count; i++) {
-					indices.push_back(bufferIndex[i]);
+					indices[firstIndex + i] = firstVertex + bufferIndex[i];
 				}
 			}
 			break;
@@ -3229,45 +4919,33 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 	tinygltf::Model model;
 	tinygltf::TinyGLTF loader;
 	std::string warn, err;
+	std::vector<MappedFile> MF;
+	std::vector<const unsigned char *> BD;
 	
 	std::cout << "Loading : " << file << (encoded ? "[MGCG]" : "[GLTF]") << "\n";	
 	if(encoded) {
-		auto modelString = readFile(file);
-		
-		const std::vector<unsigned char> key = plusaes::key_from_string(&"CG2023SkelKey128"); // 16-char = 128-bit
-		const unsigned char iv[16] = {
-			0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-			0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
-		};
-
-		// decrypt
-		unsigned long padded_size = 0;
-		std::vector<unsigned char> decrypted(modelString.size());
-
-		plusaes::decrypt_cbc((unsigned char*)modelString.data(), modelString.size(), &key[0], key.size(), &iv, &decrypted[0], decrypted.size(), &padded_size);
-
-		int size = 0;
-		void *decomp;
-		
-		sscanf(reinterpret_cast<char *const>(&decrypted[0]), "%d", &size);
-//std::cout << decrypted.size() << ", decomp: " << size << "\n";
-//for(int i=0;i<32;i++) {
-//	std::cout << (int)decrypted[i] << "\n";
-//}
-
-		decomp = calloc(size, 1);
-		int n = sinflate(decomp, (int)size, &decrypted[16], decrypted.size()-16);
+		std::vector<char> decomp = readMGCGFile(file);
 		
 		if (!loader.LoadASCIIFromString(&model, &warn, &err, 
-						reinterpret_cast<const char *>(decomp), size, "/")) {
+						decomp.data(), (unsigned int)decomp.size(), "/")) {
 			throw std::runtime_error(warn + err);
 		}
+		for(auto &buf : model.buffers) {
+			BD.push_back(buf.data.data());
+		}
 	} else {
-		if (!loader.LoadASCIIFromFile(&model, &warn, &err, 
-						file.c_str())) {
-			throw std::runtime_error(warn + err);
+		AssetFile::loadGLTF(&model, file, MF, BD);
+	}
+
+	resetBounds();
+	for (const auto& mesh :  model.meshes) {
+		for (const auto& primitive :  mesh.primitives) {
+			if (primitive.indices >= 0) {
+				growGLTFBounds(&model, &primitive, BD);
+			}
 		}
 	}
+	computeDequant();
 
 	for (const auto& mesh :  model.meshes) {
 		std::cout << "Primitives: " << mesh.primitives.size() << "\n";
@@ -3276,7 +4954,7 @@ void Model::loadModelGLTF(std::string file, bool encoded) {
 				continue;
 			}
 
-			makeGLTFMesh(&model, &primitive);
+			makeGLTFMesh(&model, &primitive, BD);
 		}
 	}
 
@@ -3288,11 +4966,16 @@ std::cout << model.nodes[0].rotation.size() << "\n";
 std::cout << model.nodes[0].scale.size() << "\n";
 */
 	makeGLTFwm(&model.nodes[0]);
+	
+	for(auto &F : MF) {
+		F.unmap();
+	}
 }
 
 void Model::createVertexBuffer() {
 //	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-	VkDeviceSize bufferSize = vertices.size();
+	vertexBytes = vertices.size();
+	VkDeviceSize bufferSize = vertexBytes;
 
 	BP->createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
 						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
@@ -3322,6 +5005,8 @@ void Model::createIndexBuffer() {
 void Model::initMesh(BaseProject *bp, VertexDescriptor *vd, bool printDebug) {
 	BP = bp;
 	VD = vd;
+	// manually built meshes have no known bounds, and are never culled
+	resetBounds();
 	int mainStride = VD->Bindings[0].stride;
 	if(printDebug) {
 		std::cout << "[Manual] Vertices: " << (vertices.size()/mainStride)
@@ -3347,6 +5032,8 @@ void Model::init(BaseProject *bp, VertexDescriptor *vd, std::string file, ModelT
 	
 	createVertexBuffer();
 	createIndexBuffer();
+	// the CPU copy of the vertices is no longer needed once uploaded
+	std::vector<unsigned char>().swap(vertices);
 }
 
 void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF, std::string AN, int Mid, std::string NN) {
@@ -3362,7 +5049,10 @@ void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF,
    		  if(el != AF->GLTFmeshes.end()) {
    		  	std::vector<const tinygltf::Primitive *> P = el->second;
    		  	if((Mid >= 0) && (Mid < P.size())) {
-   		  		makeGLTFMesh(&AF->model, P[Mid]);
+   		  		resetBounds();
+   		  		growGLTFBounds(&AF->model, P[Mid], AF->GLTFbufferData);
+   		  		computeDequant();
+   		  		makeGLTFMesh(&AF->model, P[Mid], AF->GLTFbufferData);
    		  	} else {
    		  		std::cout << "Asset >" << AN << "< does not have component: " << Mid << "\n";
    		  	}
@@ -3388,6 +5078,9 @@ void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF,
    		  	if(Mid != 0) {
    		  		std::cout << "OBJ assets can only be single material\n";
    		  	} else {
+   		  		resetBounds();
+   		  		growOBJBounds(Prm, &AF->attrib);
+   		  		computeDequant();
    		  		makeOBJMesh(Prm, &AF->attrib);
    		  	}
    		  } else {
@@ -3402,13 +5095,27 @@ void Model::initFromAsset(BaseProject *bp, VertexDescriptor *vd, AssetFile *AF,
 
 	createVertexBuffer();
 	createIndexBuffer();
+	std::vector<unsigned char>().swap(vertices);
+}
+
+// The vertex buffer is host visible and coherent: the returned pointer stays valid
+// until cleanup(), and vertices written through it need no flush
+unsigned char *Model::mapVertices() {
+	if(vertexMap == nullptr) {
+		vkMapMemory(BP->device, vertexBufferMemory, 0, vertexBytes, 0, &vertexMap);
+	}
+	return (unsigned char *)vertexMap;
 }
 
 void Model::cleanup() {
+	if(vertexMap != nullptr) {
+		vkUnmapMemory(BP->device, vertexBufferMemory);
+		vertexMap = nullptr;
+	}
    	vkDestroyBuffer(BP->device, indexBuffer, nullptr);
-   	vkFreeMemory(BP->device, indexBufferMemory, nullptr);
+   	BP->freeDeviceMemory(indexBufferMemory);
 	vkDestroyBuffer(BP->device, vertexBuffer, nullptr);
-   	vkFreeMemory(BP->device, vertexBufferMemory, nullptr);
+   	BP->freeDeviceMemory(vertexBufferMemory);
 }
 
 void Model::bind(VkCommandBuffer commandBuffer) {
@@ -3421,6 +5128,13 @@ void Model::bind(VkCommandBuffer commandBuffer) {
 							VK_INDEX_TYPE_UINT32);
 }
 
+void Model::bind(VkCommandBuffer commandBuffer, VkBuffer vertices) {
+	VkDeviceSize offsets[] = {0};
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertices, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0,
+							VK_INDEX_TYPE_UINT32);
+}
+
 
 
 
@@ -3454,8 +5168,18 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt) {
 		}
 	}
 	
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	VkDeviceSize totalImageSize = texWidth * texHeight * 4 * imgs;
+	createTextureImage(std::vector<const unsigned char *>(pixels, pixels + imgs),
+					   texWidth, texHeight, 4, Fmt);
+	for(int i = 0; i < imgs; i++) {
+		stbi_image_free(pixels[i]);
+	}
+}
+
+// Uploads imgs layers of texWidth x texHeight pixels already in memory, and builds their mipmaps
+void Texture::createTextureImage(std::vector<const unsigned char *>pixels, int texWidth, int texHeight,
+								 int bytesPerPixel, VkFormat Fmt) {
+	VkDeviceSize imageSize = texWidth * texHeight * bytesPerPixel;
+	VkDeviceSize totalImageSize = imageSize * imgs;
 	mipLevels = static_cast<uint32_t>(std::floor(
 					std::log2(std::max(texWidth, texHeight)))) + 1;
 	
@@ -3470,7 +5194,6 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt) {
 	vkMapMemory(BP->device, stagingBufferMemory, 0, totalImageSize, 0, &data);
 	for(int i = 0; i < imgs; i++) {
 		memcpy(static_cast<char *>(data) + imageSize * i, pixels[i], static_cast<size_t>(imageSize));
-		stbi_image_free(pixels[i]);
 	}
 	vkUnmapMemory(BP->device, stagingBufferMemory);
 	
@@ -3491,7 +5214,7 @@ void Texture::createTextureImage(std::vector<std::string>files, VkFormat Fmt) {
 					texWidth, texHeight, mipLevels, imgs);
 
 	vkDestroyBuffer(BP->device, stagingBuffer, nullptr);
-	vkFreeMemory(BP->device, stagingBufferMemory, nullptr);
+	BP->freeDeviceMemory(stagingBufferMemory);
 }
 
 void Texture::createTextureImageView(VkFormat Fmt) {
@@ -3550,6 +5273,17 @@ void Texture::init(BaseProject *bp, std::string file, VkFormat Fmt, bool initSam
 }
 
 
+void Texture::init(BaseProject *bp, const unsigned char *pixels, int texWidth, int texHeight,
+				   int bytesPerPixel, VkFormat Fmt, bool initSampler) {
+	BP = bp;
+	imgs = 1;
+	createTextureImage(std::vector<const unsigned char *>{pixels}, texWidth, texHeight, bytesPerPixel, Fmt);
+	createTextureImageView(Fmt);
+	if(initSampler) {
+		createTextureSampler();
+	}
+}
+
 void Texture::initCubic(BaseProject *bp, std::vector<std::string>files, VkFormat Fmt) {
 	if(files.size() != 6) {
 		std::cout << "\nError! Cube map without 6 files - " << files.size() << "\n";
@@ -3570,7 +5304,7 @@ void Texture::cleanup() {
    	vkDestroySampler(BP->device, textureSampler, nullptr);
    	vkDestroyImageView(BP->device, textureImageView, nullptr);
 	vkDestroyImage(BP->device, textureImage, nullptr);
-	vkFreeMemory(BP->device, textureImageMemory, nullptr);
+	BP->freeDeviceMemory(textureImageMemory);
 }
 
 
@@ -3687,7 +5421,7 @@ void FrameBufferAttachment::cleanup() {
 	if(!properties->swapChain) {
 		vkDestroyImageView(BP->device, view, nullptr);
 		vkDestroyImage(BP->device, image, nullptr);
-		vkFreeMemory(BP->device, mem, nullptr);
+		BP->freeDeviceMemory(mem);
 	}
 }
 
@@ -3947,7 +5681,7 @@ std::vector <AttachmentProperties> *RenderPass::getStandardAttchmentsProperties(
 			VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 			VK_ATTACHMENT_STORE_OP_DONT_CARE,
 			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			BP->surfaceLayout,
 			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}	
 	};
 
@@ -3962,7 +5696,7 @@ std::vector <AttachmentProperties> *RenderPass::getStandardAttchmentsProperties(
 			VK_ATTACHMENT_LOAD_OP_DONT_CARE,
 			VK_ATTACHMENT_STORE_OP_DONT_CARE,
 			VK_IMAGE_LAYOUT_UNDEFINED,
-			VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+			BP->surfaceLayout,
 			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL},
 		{DEPTH_AT, BP->findDepthFormat(),
 			VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, 
@@ -4341,6 +6075,90 @@ void Pipeline::cleanup() {
 		vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
 }
 
+void ComputePipeline::init(BaseProject *bp, const std::string& CompShader,
+					std::vector<DescriptorSetLayout *> d,
+					std::vector<VkPushConstantRange> pk) {
+	BP = bp;
+	
+	auto compShaderCode = readFile(CompShader);
+	std::cout << "Compute shader <" << CompShader << "> len: " << 
+				compShaderCode.size() << "\n";
+	
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = compShaderCode.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(compShaderCode.data());
+	
+	VkResult result = vkCreateShaderModule(BP->device, &createInfo, nullptr,
+					&compShaderModule);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create shader module!");
+	}
+
+	D = d;
+	PK = pk;
+}
+
+void ComputePipeline::create() {	
+	VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+    compShaderStageInfo.sType =
+    		VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compShaderStageInfo.module = compShaderModule;
+    compShaderStageInfo.pName = "main";
+
+	std::vector<VkDescriptorSetLayout> DSL(D.size());
+	for(int i = 0; i < D.size(); i++) {
+		DSL[i] = D[i]->descriptorSetLayout;
+	}
+	
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType =
+		VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = DSL.size();
+	pipelineLayoutInfo.pSetLayouts = DSL.data();
+	pipelineLayoutInfo.pushConstantRangeCount = PK.size();
+	pipelineLayoutInfo.pPushConstantRanges = PK.data();
+	
+	VkResult result = vkCreatePipelineLayout(BP->device, &pipelineLayoutInfo, nullptr,
+				&pipelineLayout);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType =
+			VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = compShaderStageInfo;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+	pipelineInfo.basePipelineIndex = -1; // Optional
+	
+	result = vkCreateComputePipelines(BP->device, VK_NULL_HANDLE, 1,
+			&pipelineInfo, nullptr, &computePipeline);
+	if (result != VK_SUCCESS) {
+	 	PrintVkError(result);
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+}
+
+void ComputePipeline::destroy() {
+	vkDestroyShaderModule(BP->device, compShaderModule, nullptr);
+}	
+
+void ComputePipeline::bind(VkCommandBuffer commandBuffer) {
+	vkCmdBindPipeline(commandBuffer,
+					  VK_PIPELINE_BIND_POINT_COMPUTE,
+					  computePipeline);
+}
+
+void ComputePipeline::cleanup() {
+		vkDestroyPipeline(BP->device, computePipeline, nullptr);
+		vkDestroyPipelineLayout(BP->device, pipelineLayout, nullptr);
+}
+
 void DescriptorSetLayout::init(BaseProject *bp, std::vector<DescriptorSetLayoutBinding> B) {
 	BP = bp;
 	Bindings = B;
@@ -4403,6 +6221,19 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
 			}
 			toFree[j] = true;
+		} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+			// storage buffers can also be the source of indirect commands, or
+			// of vertices written by a compute shader
+			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
+				VkDeviceSize bufferSize = DSL->Bindings[j].linkSize;
+				BP->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+											 VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+											 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+									 	 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+									 	 VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+									 	 uniformBuffers[j][i], uniformBuffersMemory[j][i]);
+			}
+			toFree[j] = true;
 		} else {
 			toFree[j] = false;
 		}
@@ -4446,6 +6277,18 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 				descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
 				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
+			} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER) {
+				bufferInfo[j].buffer = uniformBuffers[j][i];
+				bufferInfo[j].offset = 0;
+				bufferInfo[j].range = DSL->Bindings[j].linkSize;
+				
+				descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				descriptorWrites[j].dstSet = descriptorSets[i];
+				descriptorWrites[j].dstBinding = DSL->Bindings[j].binding;
+				descriptorWrites[j].dstArrayElement = 0;
+				descriptorWrites[j].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				descriptorWrites[j].descriptorCount = DSL->Bindings[j].count;
+				descriptorWrites[j].pBufferInfo = &bufferInfo[j];
 			} else if(DSL->Bindings[j].type == VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER) {
 //std::cout << "Writing combined image sampler " << j << ", count " << DSL->Bindings[j].count << ", link " << DSL->Bindings[j].linkSize << "\n";
 				for(int k = 0; k < DSL->Bindings[j].count; k++) {
@@ -4477,11 +6320,19 @@ void DescriptorSet::init(BaseProject *bp, DescriptorSetLayout *DSL,
 }
 
 void DescriptorSet::cleanup() {
+	for(int j = 0; j < persistentMaps.size(); j++) {
+		for(int i = 0; i < persistentMaps[j].size(); i++) {
+			if(persistentMaps[j][i] != nullptr) {
+				vkUnmapMemory(BP->device, uniformBuffersMemory[j][i]);
+			}
+		}
+	}
+	persistentMaps.clear();
 	for(int j = 0; j < uniformBuffers.size(); j++) {
 		if(toFree[j]) {
 			for (size_t i = 0; i < BP->swapChainImages.size(); i++) {
 				vkDestroyBuffer(BP->device, uniformBuffers[j][i], nullptr);
-				vkFreeMemory(BP->device, uniformBuffersMemory[j][i], nullptr);
+				BP->freeDeviceMemory(uniformBuffersMemory[j][i]);
 			}
 		}
 	}
@@ -4496,6 +6347,14 @@ void DescriptorSet::bind(VkCommandBuffer commandBuffer, Pipeline &P, int setId,
 					0, nullptr);
 }
 
+void DescriptorSet::bind(VkCommandBuffer commandBuffer, ComputePipeline &P, int setId,
+						 int currentImage) {
+	vkCmdBindDescriptorSets(commandBuffer,
+					VK_PIPELINE_BIND_POINT_COMPUTE,
+					P.pipelineLayout, setId, 1, &descriptorSets[currentImage],
+					0, nullptr);
+}
+
 void DescriptorSet::map(int currentImage, void *src, int slot) {
 	void* data;
 
@@ -4507,4 +6366,32 @@ void DescriptorSet::map(int currentImage, void *src, int slot) {
 	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);	
 }
 
+void *DescriptorSet::mapped(int currentImage, int slot) {
+	if(persistentMaps.size() <= slot) {
+		persistentMaps.resize(slot + 1);
+	}
+	if(persistentMaps[slot].size() <= currentImage) {
+		persistentMaps[slot].resize(BP->swapChainImages.size(), nullptr);
+	}
+	void *&data = persistentMaps[slot][currentImage];
+	if(data == nullptr) {
+		vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
+							Layout->Bindings[slot].linkSize, 0, &data);
+	}
+	return data;
+}
+
+// Reads back a buffer written by the GPU: the frame that last used
+// currentImage must have completed
+void DescriptorSet::read(int currentImage, void *dst, int slot) {
+	void* data;
+
+	int size = Layout->Bindings[slot].linkSize;
+
+	vkMapMemory(BP->device, uniformBuffersMemory[slot][currentImage], 0,
+						size, 0, &data);
+	memcpy(dst, data, size);
+	vkUnmapMemory(BP->device, uniformBuffersMemory[slot][currentImage]);	
+}
+
 #endif
\ No newline at end of file
@@ -1,8 +1,11 @@
+#include <cstdarg>
+#include <cstdio>
+
 
 struct CharData {
-	int x;
+	int x;		// position in the atlas, in texels
 	int y;
-	int width;
+	int width;	// size of the glyph quad, in pixels of the face
 	int height;
 	int xoffset;
 	int yoffset;
@@ -14,12 +17,16 @@ struct FontDef {
 	std::vector<CharData> P;
 };
 
+// Signed distance field font, generated offline by tools/FontSDF.cpp: the atlas
+// stores 0.5 + d / (2 spread), where d is the distance in pixels of the face
+// from the edge of the glyph, at scale texels per pixel of the face
 struct Font {
 	int minChar;
 	int maxChar;
 	int texW;
 	int texH;
-	std::string textureFile;
+	float scale;
+	float spread;
 	
 	std::vector<FontDef> faces;	
 };
@@ -64,6 +71,36 @@ struct TextBlock {
 	int start, len; // start index, and len of the block
 };
 
+// HUD text: a block with a fixed number of glyph slots in a persistent mesh,
+// rewritten in place by TextMaker::hudPrintf() without heap allocations
+const int HudMaxChars = 1024;
+
+struct HudBlock {
+	// Layout, fixed when the block is created
+	float x, y;
+	float sx, sy;
+	int fontId;
+	TextAlignment Alignment;
+	TextRegistrationH RegH;
+	TextRegistrationV RegV;
+	glm::vec4 Fill;
+	glm::vec4 Stroke;
+	glm::vec4 Shadow;
+	int first, capacity;	// glyph slots in the HUD mesh, one per character
+	bool visible;			// hidden blocks are neither written nor drawn
+	
+	// Current text, and its layout in pixels of the face
+	char text[HudMaxChars + 1];
+	int len;
+	int w, nlines;
+	std::vector<int> penX;	// start of each character on its line
+	std::vector<int> line;	// line of each character
+	std::vector<int> linew;	// width of each line
+	
+	// Range of slots still to be written in the copy of the mesh of each swapchain image
+	std::vector<int> dirtyFrom, dirtyTo;
+};
+
 struct TextVertex {
 	glm::vec2 pos;
 	glm::vec2 texCoord;
@@ -80,2414 +117,9 @@ struct TextColorPushConstant {
 	alignas(16) glm::vec4 Fill;
 	alignas(16) glm::vec4 Stroke;
 	alignas(16) glm::vec4 Shadow;
+	alignas(16) glm::vec4 Edges;	// fill edge, outline edge, shadow offset in UV
 };
 
-#ifdef TEXTMAKER_IMPLEMENTATION
-extern const Font mainFont = {
-	32, 126, 2048, 2048,
-	"assets/textures/Fonts.png",
-{
-{48,{
-{0,0,0,0,0,0,26},
-{327,102,19,42,5,7,26},
-{486,0,25,26,2,7,26},
-{266,191,34,41,-3,8,26},
-{214,0,32,49,-2,4,26},
-{67,0,33,49,-2,4,26},
-{440,55,35,43,-3,7,26},
-{0,271,17,26,6,7,26},
-{103,0,25,49,4,4,26},
-{131,0,25,49,0,4,26},
-{402,235,31,33,-1,12,26},
-{436,235,33,33,-2,12,26},
-{20,271,21,25,4,31,26},
-{195,271,29,15,0,25,26},
-{103,271,19,18,5,31,26},
-{159,0,32,49,-2,4,26},
-{77,55,33,43,-2,7,26},
-{0,102,28,42,1,7,26},
-{31,102,33,42,-2,7,26},
-{113,55,33,43,-2,7,26},
-{67,102,35,42,-3,7,26},
-{105,102,33,42,-2,8,26},
-{149,55,33,43,-2,7,26},
-{185,55,33,43,-2,7,26},
-{221,55,33,43,-2,7,26},
-{257,55,33,43,-2,7,26},
-{380,235,19,33,5,16,26},
-{484,147,21,40,4,16,26},
-{339,191,32,35,-2,11,26},
-{472,235,34,22,-3,17,26},
-{374,191,32,35,-2,11,26},
-{349,102,31,42,-1,7,26},
-{383,102,33,42,-2,7,26},
-{175,102,35,42,-3,7,26},
-{478,55,34,41,-3,8,26},
-{293,55,34,43,-2,7,26},
-{147,147,34,41,-3,8,26},
-{184,147,35,41,-3,8,26},
-{222,147,35,41,-3,8,26},
-{330,55,35,43,-3,7,26},
-{260,147,35,41,-3,8,26},
-{298,147,30,41,-1,8,26},
-{213,102,32,42,-1,8,26},
-{331,147,35,41,-3,8,26},
-{369,147,35,41,-3,8,26},
-{407,147,36,41,-4,8,26},
-{446,147,35,41,-3,8,26},
-{368,55,33,43,-2,7,26},
-{0,191,34,41,-3,8,26},
-{31,0,33,49,-2,7,26},
-{248,102,36,42,-3,8,26},
-{404,55,33,43,-2,7,26},
-{37,191,35,41,-3,8,26},
-{287,102,37,42,-4,8,26},
-{75,191,36,41,-4,8,26},
-{114,191,37,41,-4,8,26},
-{154,191,35,41,-3,8,26},
-{192,191,35,41,-3,8,26},
-{230,191,33,41,-2,8,26},
-{319,0,25,49,6,4,26},
-{375,0,32,49,-2,4,26},
-{347,0,25,49,-2,4,26},
-{44,271,31,19,-1,10,26},
-{159,271,33,16,-2,38,26},
-{78,271,22,19,1,6,26},
-{409,191,35,33,-2,16,26},
-{419,102,35,41,-4,8,26},
-{447,191,31,33,-1,16,26},
-{457,102,36,41,-3,8,26},
-{0,235,32,33,-2,16,26},
-{141,102,31,42,-2,7,26},
-{410,0,35,44,-3,16,26},
-{0,147,37,41,-4,8,26},
-{40,147,31,41,-1,8,26},
-{0,0,28,52,-2,8,26},
-{74,147,35,41,-3,8,26},
-{112,147,32,41,-2,8,26},
-{35,235,38,33,-5,16,26},
-{76,235,37,33,-4,16,26},
-{116,235,32,33,-2,16,26},
-{448,0,35,44,-4,16,26},
-{0,55,36,44,-2,16,26},
-{151,235,34,33,-3,16,26},
-{481,191,31,33,-1,16,26},
-{303,191,33,39,-3,10,26},
-{188,235,37,33,-4,16,26},
-{228,235,35,33,-3,16,26},
-{266,235,36,33,-4,16,26},
-{305,235,35,33,-3,16,26},
-{39,55,35,44,-3,16,26},
-{343,235,34,33,-3,16,26},
-{249,0,32,49,-2,4,26},
-{194,0,17,49,6,4,26},
-{284,0,32,49,-2,4,26},
-{125,271,31,17,-1,8,26}}},
-
-
-
-
-{48,{
-{512,0,0,0,0,0,26},
-{876,108,25,42,6,7,26},
-{997,154,27,26,7,7,26},
-{860,198,34,41,1,8,26},
-{832,0,33,49,2,4,26},
-{661,0,36,49,0,4,26},
-{587,108,38,43,0,7,26},
-{545,278,19,26,11,7,26},
-{700,0,29,49,7,4,26},
-{732,0,29,49,0,4,26},
-{985,242,30,33,3,12,26},
-{512,278,30,33,3,12,26},
-{567,278,22,25,3,31,26},
-{721,278,26,15,4,25,26},
-{1003,130,18,18,6,31,26},
-{764,0,38,49,-1,4,26},
-{685,56,32,43,2,7,26},
-{628,108,28,42,2,7,26},
-{720,56,34,43,0,7,26},
-{757,56,33,43,1,7,26},
-{512,0,32,53,-1,7,26},
-{659,108,34,42,1,8,26},
-{793,56,33,43,2,7,26},
-{829,56,36,43,2,7,26},
-{868,56,34,43,1,7,26},
-{905,56,32,43,2,7,26},
-{960,242,22,33,6,16,26},
-{897,198,25,40,3,16,26},
-{925,198,31,35,4,11,26},
-{592,278,32,22,2,17,26},
-{959,198,32,35,1,11,26},
-{904,108,28,42,6,7,26},
-{935,108,32,42,2,7,26},
-{728,108,31,42,-1,7,26},
-{686,154,35,41,-1,8,26},
-{940,56,35,43,2,7,26},
-{724,154,35,41,-1,8,26},
-{762,154,37,41,-1,8,26},
-{802,154,38,41,-1,8,26},
-{978,56,33,43,2,7,26},
-{843,154,38,41,-1,8,26},
-{884,154,34,41,1,8,26},
-{762,108,35,42,1,8,26},
-{921,154,38,41,-1,8,26},
-{962,154,32,41,-1,8,26},
-{512,198,40,41,-2,8,26},
-{555,198,38,41,-1,8,26},
-{512,108,34,43,1,7,26},
-{596,198,36,41,-1,8,26},
-{624,0,34,49,1,7,26},
-{800,108,34,42,-1,8,26},
-{549,108,35,43,0,7,26},
-{635,198,34,41,3,8,26},
-{837,108,36,42,2,8,26},
-{672,198,32,41,5,8,26},
-{707,198,35,41,3,8,26},
-{745,198,37,41,-1,8,26},
-{785,198,33,41,4,8,26},
-{821,198,36,41,0,8,26},
-{941,0,31,49,6,4,26},
-{512,56,20,49,8,4,26},
-{975,0,31,49,-1,4,26},
-{627,278,28,19,6,10,26},
-{689,278,29,16,-1,38,26},
-{1003,108,21,19,9,6,26},
-{512,242,33,33,2,16,26},
-{970,108,30,41,2,8,26},
-{548,242,31,33,2,16,26},
-{512,154,33,41,2,8,26},
-{582,242,31,33,2,16,26},
-{547,0,37,53,-2,7,26},
-{535,56,35,44,-1,16,26},
-{548,154,35,41,0,8,26},
-{586,154,30,41,2,8,26},
-{587,0,34,52,0,8,26},
-{619,154,35,41,0,8,26},
-{657,154,26,41,5,8,26},
-{616,242,37,33,-2,16,26},
-{656,242,36,33,-1,16,26},
-{994,198,30,33,2,16,26},
-{573,56,36,44,-4,16,26},
-{612,56,32,44,2,16,26},
-{695,242,36,33,0,16,26},
-{734,242,32,33,0,16,26},
-{696,108,29,42,3,7,26},
-{769,242,36,33,-1,16,26},
-{808,242,35,33,-1,16,26},
-{846,242,36,33,0,16,26},
-{885,242,36,33,-1,16,26},
-{647,56,35,44,-1,16,26},
-{924,242,33,33,0,16,26},
-{868,0,33,49,4,4,26},
-{805,0,24,49,6,4,26},
-{904,0,34,49,-1,4,26},
-{658,278,28,17,7,8,26}}},
-
-
-
-
-{48,{
-{1024,0,0,0,0,0,26},
-{1516,0,19,42,5,9,26},
-{1511,236,25,25,2,10,26},
-{1293,192,35,41,-3,10,26},
-{1240,0,33,49,-2,6,26},
-{1091,0,35,49,-3,6,26},
-{1205,103,35,42,-3,9,26},
-{1519,148,17,25,6,10,26},
-{1129,0,25,49,4,6,26},
-{1157,0,25,49,0,6,26},
-{1440,236,31,33,-1,14,26},
-{1474,236,34,33,-3,14,26},
-{1024,273,21,26,4,32,26},
-{1236,273,29,15,0,27,26},
-{1085,273,19,19,5,32,26},
-{1185,0,32,49,-2,6,26},
-{1102,55,33,42,-2,9,26},
-{1138,55,30,42,0,9,26},
-{1171,55,33,42,-2,9,26},
-{1207,55,33,42,-2,9,26},
-{1243,55,35,42,-3,9,26},
-{1243,103,33,41,-2,10,26},
-{1281,55,33,42,-2,9,26},
-{1317,55,33,42,-2,9,26},
-{1353,55,33,42,-2,9,26},
-{1389,55,33,42,-2,9,26},
-{1510,192,19,33,5,18,26},
-{1506,103,21,40,4,18,26},
-{1367,192,33,37,-2,12,26},
-{1048,273,34,23,-3,19,26},
-{1403,192,32,37,-2,12,26},
-{1134,103,32,42,-2,9,26},
-{1169,103,33,42,-2,9,26},
-{1460,55,35,42,-3,9,26},
-{1024,148,35,41,-4,10,26},
-{1498,55,34,42,-2,9,26},
-{1062,148,36,41,-4,10,26},
-{1101,148,37,41,-4,10,26},
-{1141,148,35,41,-3,10,26},
-{1024,103,35,42,-3,9,26},
-{1179,148,36,41,-4,10,26},
-{1218,148,31,41,-1,10,26},
-{1252,148,32,41,-1,10,26},
-{1287,148,35,41,-3,10,26},
-{1325,148,35,41,-3,10,26},
-{1363,148,37,41,-4,10,26},
-{1403,148,35,41,-3,10,26},
-{1062,103,33,42,-2,9,26},
-{1441,148,35,41,-4,10,26},
-{1055,0,33,49,-2,9,26},
-{1479,148,37,41,-4,10,26},
-{1098,103,33,42,-2,9,26},
-{1024,192,35,41,-3,10,26},
-{1062,192,37,41,-4,10,26},
-{1102,192,36,41,-4,10,26},
-{1141,192,37,41,-4,10,26},
-{1181,192,35,41,-3,10,26},
-{1219,192,35,41,-3,10,26},
-{1257,192,33,41,-2,10,26},
-{1348,0,25,49,6,6,26},
-{1404,0,32,49,-2,6,26},
-{1376,0,25,49,-2,6,26},
-{1107,273,31,19,-1,12,26},
-{1201,273,32,16,-2,40,26},
-{1175,273,23,18,1,8,26},
-{1438,192,35,34,-2,17,26},
-{1279,103,36,41,-4,10,26},
-{1476,192,31,34,-1,17,26},
-{1318,103,36,41,-3,10,26},
-{1024,236,32,34,-2,17,26},
-{1425,55,32,42,-3,9,26},
-{1439,0,35,45,-3,17,26},
-{1357,103,37,41,-4,10,26},
-{1397,103,31,41,-1,10,26},
-{1024,0,28,52,-2,10,26},
-{1431,103,36,41,-4,10,26},
-{1470,103,33,41,-2,10,26},
-{1059,236,39,34,-5,17,26},
-{1101,236,37,34,-4,17,26},
-{1141,236,33,34,-2,17,26},
-{1477,0,36,45,-4,17,26},
-{1024,55,37,45,-3,17,26},
-{1177,236,34,34,-3,17,26},
-{1214,236,31,34,-1,17,26},
-{1331,192,33,39,-3,12,26},
-{1248,236,37,33,-4,18,26},
-{1288,236,35,33,-3,18,26},
-{1326,236,36,33,-4,18,26},
-{1365,236,35,33,-3,18,26},
-{1064,55,35,44,-3,18,26},
-{1403,236,34,33,-3,18,26},
-{1276,0,33,49,-2,6,26},
-{1220,0,17,49,6,6,26},
-{1312,0,33,49,-2,6,26},
-{1141,273,31,19,-1,10,26}}},
-
-
-
-
-{48,{
-{1536,0,0,0,0,0,26},
-{1720,108,25,42,6,9,26},
-{1595,278,27,25,7,10,26},
-{1876,197,34,41,1,10,26},
-{1856,0,32,49,2,6,26},
-{1685,0,36,49,0,6,26},
-{1814,108,38,42,0,9,26},
-{1625,278,18,25,11,10,26},
-{1724,0,29,49,7,6,26},
-{1756,0,29,49,0,6,26},
-{2009,241,30,33,3,14,26},
-{1536,278,30,33,3,14,26},
-{1569,278,23,26,3,32,26},
-{1821,278,27,15,4,27,26},
-{1681,278,19,19,6,32,26},
-{1788,0,37,49,0,6,26},
-{1710,56,32,42,2,9,26},
-{1745,56,28,42,2,9,26},
-{1776,56,35,42,-1,9,26},
-{1814,56,33,42,1,9,26},
-{1536,0,32,53,-1,9,26},
-{1855,108,34,41,1,10,26},
-{1850,56,33,42,2,9,26},
-{1886,56,37,42,2,9,26},
-{1926,56,34,42,1,9,26},
-{1963,56,33,42,2,9,26},
-{1983,241,23,33,6,18,26},
-{1913,197,26,40,3,18,26},
-{1942,197,31,37,4,12,26},
-{1646,278,32,23,2,19,26},
-{1976,197,32,37,1,12,26},
-{1748,108,28,42,6,9,26},
-{1779,108,32,42,2,9,26},
-{1536,108,32,42,-1,9,26},
-{1604,153,36,41,-1,10,26},
-{1571,108,35,42,2,9,26},
-{1643,153,35,41,-1,10,26},
-{1681,153,37,41,-1,10,26},
-{1721,153,38,41,-1,10,26},
-{1609,108,33,42,2,9,26},
-{1762,153,38,41,-1,10,26},
-{1803,153,35,41,1,10,26},
-{1841,153,35,41,1,10,26},
-{1879,153,38,41,-1,10,26},
-{1920,153,33,41,-1,10,26},
-{1956,153,40,41,-2,10,26},
-{1999,153,38,41,-1,10,26},
-{1645,108,34,42,1,9,26},
-{1536,197,36,41,-1,10,26},
-{1648,0,34,49,1,9,26},
-{1575,197,34,41,-1,10,26},
-{1682,108,35,42,0,9,26},
-{1612,197,34,41,3,10,26},
-{1649,197,36,41,2,10,26},
-{1688,197,32,41,5,10,26},
-{1723,197,35,41,3,10,26},
-{1761,197,37,41,-1,10,26},
-{1801,197,33,41,4,10,26},
-{1837,197,36,41,0,10,26},
-{1965,0,32,49,5,6,26},
-{1536,56,20,49,8,6,26},
-{2000,0,32,49,-1,6,26},
-{1703,278,28,19,6,12,26},
-{1789,278,29,16,-1,40,26},
-{1734,278,21,18,9,8,26},
-{1536,241,34,34,1,17,26},
-{1892,108,31,41,1,10,26},
-{1573,241,31,34,2,17,26},
-{1926,108,34,41,1,10,26},
-{1607,241,31,34,2,17,26},
-{1571,0,37,53,-2,9,26},
-{1559,56,35,45,-1,17,26},
-{1963,108,35,41,0,10,26},
-{2001,108,30,41,2,10,26},
-{1611,0,34,52,0,10,26},
-{1536,153,35,41,0,10,26},
-{1574,153,27,41,4,10,26},
-{1641,241,38,34,-2,17,26},
-{2011,197,36,34,-1,17,26},
-{1682,241,32,34,1,17,26},
-{1597,56,37,45,-4,17,26},
-{1637,56,32,45,2,17,26},
-{1717,241,36,34,0,17,26},
-{1756,241,32,34,0,17,26},
-{1999,56,29,42,3,9,26},
-{1791,241,36,34,-1,17,26},
-{1830,241,35,34,-1,17,26},
-{1868,241,36,34,0,17,26},
-{1907,241,36,34,-1,17,26},
-{1672,56,35,45,-1,17,26},
-{1946,241,34,34,0,17,26},
-{1891,0,34,49,3,6,26},
-{1828,0,25,49,6,6,26},
-{1928,0,34,49,-1,6,26},
-{1758,278,28,18,7,10,26}}},
-
-
-
-
-{32,{
-{0,320,0,0,0,0,17},
-{494,320,17,32,2,4,17},
-{408,467,21,22,0,4,17},
-{275,432,27,32,-3,4,17},
-{151,320,26,37,-3,2,17},
-{26,320,27,37,-3,2,17},
-{305,432,28,32,-4,4,17},
-{432,467,16,22,2,4,17},
-{56,320,21,37,1,2,17},
-{80,320,21,37,-2,2,17},
-{350,467,25,26,-2,7,17},
-{378,467,27,26,-3,7,17},
-{451,467,18,20,1,20,17},
-{124,496,23,14,-1,16,17},
-{27,496,16,16,2,20,17},
-{104,320,26,37,-3,2,17},
-{465,320,26,32,-3,4,17},
-{0,362,23,32,-1,4,17},
-{26,360,26,32,-3,4,17},
-{55,360,26,32,-3,4,17},
-{84,360,27,32,-3,4,17},
-{114,360,26,32,-3,4,17},
-{143,360,26,32,-3,4,17},
-{172,360,26,32,-3,4,17},
-{201,360,26,32,-3,4,17},
-{230,360,26,32,-3,4,17},
-{331,467,16,26,2,10,17},
-{364,432,18,30,1,10,17},
-{385,432,26,28,-3,6,17},
-{472,467,27,19,-3,11,17},
-{414,432,26,28,-3,6,17},
-{217,432,25,32,-2,4,17},
-{245,432,27,32,-3,4,17},
-{466,360,28,32,-4,4,17},
-{0,397,27,32,-4,4,17},
-{30,397,27,32,-3,4,17},
-{60,397,28,32,-4,4,17},
-{91,397,27,32,-3,4,17},
-{121,397,27,32,-3,4,17},
-{151,397,27,32,-3,4,17},
-{181,397,28,32,-4,4,17},
-{212,397,24,32,-2,4,17},
-{239,397,25,32,-2,4,17},
-{267,397,27,32,-3,4,17},
-{297,397,27,32,-3,4,17},
-{327,397,28,32,-4,4,17},
-{358,397,28,32,-4,4,17},
-{389,397,26,32,-3,4,17},
-{418,397,26,32,-3,4,17},
-{314,320,26,36,-3,4,17},
-{447,397,29,32,-4,4,17},
-{479,397,26,32,-3,4,17},
-{0,432,28,32,-4,4,17},
-{31,432,29,32,-4,4,17},
-{63,432,28,32,-4,4,17},
-{94,432,28,32,-4,4,17},
-{125,432,28,32,-4,4,17},
-{156,432,28,32,-4,4,17},
-{187,432,27,32,-3,4,17},
-{238,320,20,37,3,2,17},
-{285,320,26,37,-3,2,17},
-{261,320,21,37,-3,2,17},
-{0,496,24,17,-2,6,17},
-{95,496,26,14,-3,25,17},
-{46,496,19,16,-1,4,17},
-{443,432,28,26,-3,10,17},
-{259,360,28,32,-4,4,17},
-{474,432,25,26,-2,10,17},
-{290,360,27,32,-3,4,17},
-{0,467,26,26,-3,10,17},
-{320,360,25,32,-3,4,17},
-{343,320,27,33,-3,10,17},
-{348,360,28,32,-4,4,17},
-{379,360,25,32,-2,4,17},
-{0,320,23,39,-3,4,17},
-{407,360,28,32,-4,4,17},
-{438,360,25,32,-2,4,17},
-{29,467,30,26,-5,10,17},
-{62,467,28,26,-4,10,17},
-{93,467,25,26,-2,10,17},
-{373,320,28,33,-4,10,17},
-{404,320,28,33,-3,10,17},
-{121,467,27,26,-3,10,17},
-{151,467,25,26,-2,10,17},
-{336,432,25,30,-3,6,17},
-{179,467,28,26,-4,10,17},
-{210,467,27,26,-3,10,17},
-{240,467,28,26,-4,10,17},
-{271,467,27,26,-3,10,17},
-{435,320,27,33,-3,10,17},
-{301,467,27,26,-3,10,17},
-{180,320,26,37,-3,2,17},
-{133,320,15,37,3,2,17},
-{209,320,26,37,-3,2,17},
-{68,496,24,16,-2,4,17}}},
-
-
-
-
-{32,{
-{512,320,0,0,0,0,17},
-{755,433,21,32,2,4,17},
-{925,468,22,22,3,4,17},
-{834,433,26,32,0,4,17},
-{741,320,26,37,0,2,17},
-{602,320,28,37,-1,2,17},
-{863,433,29,32,-1,4,17},
-{950,468,16,22,6,4,17},
-{633,320,23,37,3,2,17},
-{659,320,23,37,-1,2,17},
-{869,468,25,26,0,7,17},
-{897,468,25,26,0,7,17},
-{969,468,18,20,1,20,17},
-{611,497,22,14,1,16,17},
-{1007,397,17,16,2,20,17},
-{685,320,29,37,-2,2,17},
-{540,362,25,32,0,4,17},
-{568,362,23,32,0,4,17},
-{594,362,28,32,-2,4,17},
-{625,362,27,32,-1,4,17},
-{512,320,25,39,-2,4,17},
-{655,362,27,32,-1,4,17},
-{685,362,26,32,0,4,17},
-{714,362,28,32,0,4,17},
-{745,362,27,32,-1,4,17},
-{775,362,26,32,-1,4,17},
-{1003,433,19,26,2,10,17},
-{895,433,20,30,1,10,17},
-{918,433,25,28,1,6,17},
-{990,468,25,19,0,11,17},
-{946,433,25,28,-1,6,17},
-{779,433,23,32,2,4,17},
-{805,433,26,32,0,4,17},
-{512,398,25,32,-2,4,17},
-{540,397,28,32,-2,4,17},
-{571,397,27,32,0,4,17},
-{601,397,27,32,-2,4,17},
-{631,397,29,32,-2,4,17},
-{663,397,29,32,-2,4,17},
-{998,362,26,32,0,4,17},
-{695,397,30,32,-2,4,17},
-{728,397,27,32,-1,4,17},
-{758,397,28,32,-1,4,17},
-{789,397,29,32,-2,4,17},
-{821,397,26,32,-2,4,17},
-{850,397,30,32,-2,4,17},
-{883,397,30,32,-2,4,17},
-{916,397,27,32,-1,4,17},
-{946,397,28,32,-2,4,17},
-{906,320,27,36,-1,4,17},
-{977,397,27,32,-2,4,17},
-{512,433,27,32,-1,4,17},
-{542,433,26,32,1,4,17},
-{571,433,28,32,0,4,17},
-{602,433,26,32,2,4,17},
-{631,433,28,32,0,4,17},
-{662,433,29,32,-2,4,17},
-{694,433,26,32,2,4,17},
-{723,433,29,32,-2,4,17},
-{829,320,26,37,2,2,17},
-{886,320,17,37,4,2,17},
-{858,320,25,37,-2,2,17},
-{512,497,23,17,2,6,17},
-{585,497,23,14,-2,25,17},
-{538,497,18,16,5,4,17},
-{974,433,26,26,0,10,17},
-{804,362,24,32,0,4,17},
-{512,468,25,26,0,10,17},
-{831,362,26,32,0,4,17},
-{540,468,25,26,0,10,17},
-{540,320,29,39,-3,4,17},
-{936,320,27,33,-2,10,17},
-{860,362,28,32,-2,4,17},
-{891,362,24,32,0,4,17},
-{572,320,27,39,-2,4,17},
-{918,362,27,32,-1,4,17},
-{948,362,21,32,2,4,17},
-{568,468,29,26,-3,10,17},
-{600,468,28,26,-2,10,17},
-{631,468,24,26,0,10,17},
-{966,320,28,33,-4,10,17},
-{512,362,25,33,0,10,17},
-{658,468,28,26,-1,10,17},
-{689,468,25,26,-1,10,17},
-{972,362,23,32,1,4,17},
-{717,468,28,26,-2,10,17},
-{748,468,27,26,-2,10,17},
-{778,468,28,26,-1,10,17},
-{809,468,28,26,-2,10,17},
-{997,320,27,33,-2,10,17},
-{840,468,26,26,-1,10,17},
-{770,320,26,37,1,2,17},
-{717,320,21,37,2,2,17},
-{799,320,27,37,-2,2,17},
-{559,497,23,16,3,4,17}}},
-
-
-
-
-{32,{
-{1024,320,0,0,0,0,17},
-{1240,432,17,32,2,5,17},
-{1468,467,21,21,0,5,17},
-{1318,432,27,32,-3,5,17},
-{1176,320,26,37,-3,3,17},
-{1050,320,27,37,-3,3,17},
-{1348,432,28,32,-4,5,17},
-{1492,467,15,21,3,5,17},
-{1080,320,21,37,1,3,17},
-{1104,320,22,37,-2,3,17},
-{1388,467,25,26,-2,8,17},
-{1416,467,27,26,-3,8,17},
-{1446,467,19,21,1,20,17},
-{1150,496,23,14,-1,17,17},
-{1054,496,17,17,2,20,17},
-{1129,320,26,37,-3,3,17},
-{1493,320,27,32,-3,5,17},
-{1024,362,23,32,-1,5,17},
-{1050,360,26,32,-3,5,17},
-{1079,360,26,32,-3,5,17},
-{1108,360,28,32,-4,5,17},
-{1139,360,26,32,-3,5,17},
-{1168,360,26,32,-3,5,17},
-{1197,360,26,32,-3,5,17},
-{1226,360,26,32,-3,5,17},
-{1255,360,27,32,-3,5,17},
-{1517,432,17,26,2,11,17},
-{1407,432,19,30,1,11,17},
-{1429,432,25,29,-2,7,17},
-{1024,496,27,19,-3,12,17},
-{1457,432,26,29,-3,7,17},
-{1260,432,25,32,-2,5,17},
-{1288,432,27,32,-3,5,17},
-{1495,360,27,32,-3,5,17},
-{1024,397,28,32,-4,5,17},
-{1055,397,27,32,-3,5,17},
-{1085,397,28,32,-4,5,17},
-{1116,397,28,32,-4,5,17},
-{1147,397,28,32,-4,5,17},
-{1178,397,27,32,-3,5,17},
-{1208,397,28,32,-4,5,17},
-{1239,397,24,32,-2,5,17},
-{1266,397,25,32,-2,5,17},
-{1294,397,28,32,-4,5,17},
-{1325,397,28,32,-4,5,17},
-{1356,397,28,32,-4,5,17},
-{1387,397,28,32,-4,5,17},
-{1418,397,26,32,-3,5,17},
-{1447,397,28,32,-4,5,17},
-{1341,320,26,36,-3,5,17},
-{1478,397,29,32,-4,5,17},
-{1510,397,26,32,-3,5,17},
-{1024,432,28,32,-4,5,17},
-{1055,432,29,32,-4,5,17},
-{1087,432,28,32,-4,5,17},
-{1118,432,28,32,-4,5,17},
-{1149,432,27,32,-3,5,17},
-{1179,432,28,32,-4,5,17},
-{1210,432,27,32,-3,5,17},
-{1263,320,22,37,2,3,17},
-{1312,320,26,37,-3,3,17},
-{1288,320,21,37,-3,3,17},
-{1101,496,24,16,-2,7,17},
-{1510,467,26,15,-3,26,17},
-{1128,496,19,16,-1,4,17},
-{1486,432,28,26,-3,11,17},
-{1285,360,28,32,-4,5,17},
-{1024,467,25,26,-2,11,17},
-{1316,360,28,32,-3,5,17},
-{1052,467,26,26,-3,11,17},
-{1347,360,25,32,-3,5,17},
-{1370,320,27,33,-3,11,17},
-{1375,360,29,32,-4,5,17},
-{1407,360,25,32,-2,5,17},
-{1024,320,23,39,-3,5,17},
-{1435,360,28,32,-4,5,17},
-{1466,360,26,32,-3,5,17},
-{1081,467,30,26,-5,11,17},
-{1114,467,29,26,-4,11,17},
-{1146,467,26,26,-3,11,17},
-{1400,320,28,33,-4,11,17},
-{1431,320,28,33,-3,11,17},
-{1175,467,28,26,-4,11,17},
-{1206,467,25,26,-2,11,17},
-{1379,432,25,30,-3,7,17},
-{1234,467,29,26,-4,11,17},
-{1266,467,28,26,-4,11,17},
-{1297,467,28,26,-4,11,17},
-{1328,467,27,26,-3,11,17},
-{1462,320,28,33,-4,11,17},
-{1358,467,27,26,-3,11,17},
-{1205,320,26,37,-3,3,17},
-{1158,320,15,37,3,3,17},
-{1234,320,26,37,-3,3,17},
-{1074,496,24,17,-2,5,17}}},
-
-
-
-
-{32,{
-{1536,320,0,0,0,0,17},
-{2027,398,21,32,2,5,17},
-{2026,320,22,21,3,5,17},
-{1896,433,26,32,0,5,17},
-{1766,320,26,37,0,3,17},
-{1627,320,28,37,-1,3,17},
-{1925,433,30,32,-2,5,17},
-{2030,468,16,21,6,5,17},
-{1658,320,23,37,3,3,17},
-{1684,320,23,37,-1,3,17},
-{1952,468,25,26,0,8,17},
-{1980,468,25,26,0,8,17},
-{2008,468,19,21,1,20,17},
-{1685,497,22,14,1,17,17},
-{1565,497,17,17,2,20,17},
-{1710,320,29,37,-2,3,17},
-{1595,362,26,32,0,5,17},
-{1624,362,23,32,0,5,17},
-{1650,362,28,32,-2,5,17},
-{1681,362,27,32,-1,5,17},
-{1536,320,25,39,-2,5,17},
-{1711,362,27,32,-1,5,17},
-{1741,362,26,32,0,5,17},
-{1770,362,28,32,0,5,17},
-{1801,362,27,32,-1,5,17},
-{1831,362,27,32,-1,5,17},
-{1929,468,20,26,2,11,17},
-{1958,433,21,30,1,11,17},
-{1982,433,25,29,1,7,17},
-{1536,497,26,19,0,12,17},
-{2010,433,25,29,-1,7,17},
-{1841,433,23,32,2,5,17},
-{1867,433,26,32,0,5,17},
-{1562,398,25,32,-2,5,17},
-{1590,398,28,32,-2,5,17},
-{1621,398,27,32,0,5,17},
-{1651,398,28,32,-2,5,17},
-{1682,398,29,32,-2,5,17},
-{1714,398,29,32,-2,5,17},
-{1746,398,26,32,0,5,17},
-{1775,398,30,32,-2,5,17},
-{1808,398,27,32,-1,5,17},
-{1838,398,28,32,-1,5,17},
-{1869,398,29,32,-2,5,17},
-{1901,398,26,32,-2,5,17},
-{1930,398,31,32,-3,5,17},
-{1964,398,30,32,-2,5,17},
-{1997,398,27,32,-1,5,17},
-{1536,433,28,32,-2,5,17},
-{1934,320,27,36,-1,5,17},
-{1567,433,27,32,-2,5,17},
-{1597,433,27,32,-1,5,17},
-{1627,433,26,32,1,5,17},
-{1656,433,28,32,0,5,17},
-{1687,433,26,32,2,5,17},
-{1716,433,28,32,0,5,17},
-{1747,433,29,32,-2,5,17},
-{1779,433,27,32,1,5,17},
-{1809,433,29,32,-2,5,17},
-{1856,320,26,37,2,3,17},
-{1913,320,18,37,4,3,17},
-{1885,320,25,37,-2,3,17},
-{1611,497,24,16,2,7,17},
-{1659,497,23,15,-2,26,17},
-{1638,497,18,16,5,4,17},
-{1536,468,27,26,-1,11,17},
-{1861,362,25,32,-1,5,17},
-{1566,468,25,26,0,11,17},
-{1889,362,27,32,-1,5,17},
-{1594,468,25,26,0,11,17},
-{1564,320,29,39,-3,5,17},
-{1964,320,27,33,-2,11,17},
-{1919,362,28,32,-2,5,17},
-{1950,362,24,32,0,5,17},
-{1596,320,28,39,-2,5,17},
-{1977,362,28,32,-2,5,17},
-{2008,362,23,32,1,5,17},
-{1622,468,30,26,-3,11,17},
-{1655,468,28,26,-2,11,17},
-{1686,468,26,26,-1,11,17},
-{1994,320,29,33,-4,11,17},
-{1536,362,25,33,0,11,17},
-{1715,468,29,26,-2,11,17},
-{1747,468,25,26,-1,11,17},
-{1536,398,23,32,1,5,17},
-{1775,468,28,26,-2,11,17},
-{1806,468,27,26,-2,11,17},
-{1836,468,29,26,-2,11,17},
-{1868,468,28,26,-2,11,17},
-{1564,362,28,33,-2,11,17},
-{1899,468,27,26,-2,11,17},
-{1795,320,28,37,0,3,17},
-{1742,320,21,37,2,3,17},
-{1826,320,27,37,-2,3,17},
-{1585,497,23,17,3,5,17}}},
-
-
-
-
-{48,{
-{0,540,0,0,0,0,16},
-{396,603,17,47,1,5,16},
-{0,841,24,30,2,5,24},
-{259,540,46,58,-1,5,40},
-{431,540,31,49,-2,4,24},
-{381,540,47,49,-2,4,40},
-{465,540,45,49,-3,4,37},
-{27,841,17,30,0,5,14},
-{0,540,25,60,-1,4,19},
-{28,540,25,60,-2,4,19},
-{470,799,30,33,-1,4,24},
-{196,751,45,44,-2,12,38},
-{95,841,17,22,0,36,14},
-{229,841,26,15,-4,28,16},
-{209,841,17,16,0,36,14},
-{56,540,31,60,-2,4,24},
-{449,603,33,46,-3,7,24},
-{212,654,29,45,0,7,24},
-{244,654,32,45,-2,7,24},
-{0,654,32,46,-2,7,24},
-{244,751,34,43,-3,9,24},
-{87,751,33,44,-3,9,24},
-{35,654,32,46,-2,7,24},
-{123,751,33,44,-3,9,24},
-{70,654,32,46,-2,7,24},
-{105,654,32,46,-2,7,24},
-{450,799,17,33,0,19,14},
-{0,799,17,39,0,19,14},
-{387,751,41,42,0,13,38},
-{47,841,45,24,-2,22,38},
-{431,751,41,42,0,13,38},
-{416,603,30,47,-2,5,23},
-{70,603,40,48,-2,5,33},
-{279,654,42,45,-3,7,33},
-{324,654,37,45,0,7,33},
-{232,603,37,47,-1,6,31},
-{364,654,40,45,0,7,35},
-{407,654,35,45,0,7,29},
-{445,654,34,45,0,7,28},
-{272,603,38,47,-1,6,33},
-{0,703,38,45,0,7,34},
-{482,654,17,45,0,7,14},
-{140,654,29,46,-2,7,23},
-{41,703,39,45,0,7,34},
-{83,703,32,45,0,7,27},
-{118,703,46,45,0,7,42},
-{167,703,38,45,0,7,34},
-{313,603,43,47,-2,6,36},
-{208,703,36,45,0,7,31},
-{335,540,43,52,-2,6,36},
-{247,703,38,45,0,7,32},
-{359,603,34,47,-2,6,27},
-{288,703,42,45,-3,7,33},
-{172,654,37,46,0,7,33},
-{333,703,42,45,-3,7,33},
-{378,703,56,45,-3,7,46},
-{437,703,42,45,-3,7,33},
-{0,751,44,45,-4,7,33},
-{47,751,37,45,-2,7,30},
-{178,540,21,60,0,4,14},
-{225,540,31,60,-2,4,24},
-{202,540,20,60,-3,4,14},
-{115,841,29,21,2,10,30},
-{258,841,41,14,0,50,38},
-{147,841,23,19,0,9,24},
-{482,703,30,35,-2,18,24},
-{0,603,32,48,-1,5,25},
-{20,799,31,35,-3,18,22},
-{35,603,32,48,-3,5,25},
-{54,799,31,35,-3,18,22},
-{113,603,28,47,-3,5,15},
-{159,751,34,44,-3,18,24},
-{144,603,30,47,-1,5,25},
-{485,603,17,45,-1,7,12},
-{308,540,24,55,-7,7,13},
-{177,603,32,47,-1,5,24},
-{212,603,17,47,-1,5,12},
-{156,799,44,34,-1,18,39},
-{203,799,30,34,-1,18,25},
-{88,799,34,35,-3,18,24},
-{281,751,32,43,-1,18,25},
-{316,751,32,43,-3,18,25},
-{236,799,25,34,-1,18,17},
-{125,799,28,35,-3,18,19},
-{475,751,28,40,-4,13,18},
-{264,799,30,34,-1,19,25},
-{297,799,33,33,-4,19,23},
-{333,799,43,33,-3,19,33},
-{379,799,34,33,-4,19,23},
-{351,751,33,43,-4,19,23},
-{416,799,31,33,-3,19,21},
-{108,540,32,60,-2,4,24},
-{90,540,15,60,1,4,14},
-{143,540,32,60,-2,4,24},
-{173,841,33,17,0,8,30}}},
-
-
-
-
-{48,{
-{512,540,0,0,0,0,16},
-{989,603,24,47,1,5,16},
-{777,847,27,30,6,5,24},
-{820,540,49,58,0,5,40},
-{512,603,36,49,-1,4,24},
-{955,540,43,49,4,4,40},
-{551,603,45,49,-1,4,37},
-{807,847,20,30,4,5,14},
-{512,540,31,60,1,4,19},
-{546,540,31,60,-4,4,19},
-{742,847,32,33,3,4,24},
-{929,753,44,44,1,12,38},
-{879,847,19,22,-1,36,14},
-{512,884,26,15,-2,28,16},
-{994,847,17,16,0,36,14},
-{580,540,41,60,-4,4,24},
-{586,655,34,46,0,7,24},
-{858,655,29,45,0,7,24},
-{890,655,37,45,-2,7,24},
-{623,655,35,46,-1,7,24},
-{976,753,34,43,-1,9,24},
-{987,705,37,44,-2,9,24},
-{661,655,35,46,0,7,24},
-{849,753,34,44,3,9,24},
-{699,655,36,46,-1,7,24},
-{738,655,34,46,0,7,24},
-{1002,655,21,33,0,19,14},
-{1001,540,22,39,-1,19,14},
-{629,801,45,42,2,13,38},
-{830,847,46,24,0,22,38},
-{677,801,44,42,0,13,38},
-{553,655,30,47,4,5,23},
-{676,603,40,48,2,5,33},
-{957,655,42,45,-3,7,33},
-{512,705,40,45,1,7,33},
-{854,603,41,47,2,6,31},
-{555,705,43,45,1,7,35},
-{601,705,40,45,1,7,29},
-{644,705,39,45,1,7,28},
-{898,603,41,47,2,6,33},
-{686,705,44,45,1,7,34},
-{733,705,24,45,0,7,14},
-{775,655,36,46,-2,7,23},
-{760,705,45,45,1,7,34},
-{808,705,33,45,0,7,27},
-{844,705,51,45,1,7,42},
-{898,705,43,45,1,7,34},
-{942,603,44,47,1,6,36},
-{944,705,40,45,1,7,31},
-{908,540,44,52,1,6,36},
-{512,753,41,45,1,7,32},
-{512,655,38,47,-1,6,27},
-{556,753,42,45,4,7,33},
-{814,655,41,46,2,7,33},
-{601,753,42,45,4,7,33},
-{646,753,56,45,4,7,46},
-{705,753,47,45,-3,7,33},
-{755,753,44,45,3,7,33},
-{802,753,44,45,-2,7,30},
-{729,540,30,60,-2,4,14},
-{796,540,21,60,6,4,24},
-{762,540,31,60,-6,4,14},
-{901,847,28,21,7,10,30},
-{541,884,41,14,-2,50,38},
-{932,847,21,19,7,9,24},
-{755,801,32,35,-1,18,24},
-{599,603,34,48,0,5,25},
-{790,801,33,35,-1,18,22},
-{636,603,37,48,-1,5,25},
-{826,801,32,35,-1,18,22},
-{719,603,32,47,0,5,15},
-{886,753,40,44,-4,18,24},
-{754,603,33,47,-1,5,25},
-{930,655,24,45,-1,7,12},
-{872,540,33,55,-9,7,13},
-{790,603,34,47,0,5,24},
-{827,603,24,47,-1,5,12},
-{933,801,46,34,0,18,39},
-{982,801,33,34,-1,18,25},
-{861,801,34,35,-1,18,24},
-{512,801,36,43,-2,18,25},
-{551,801,34,43,-1,18,25},
-{512,847,29,34,-1,18,17},
-{898,801,32,35,-3,18,19},
-{724,801,28,40,0,13,18},
-{544,847,33,34,0,19,25},
-{580,847,33,33,1,19,23},
-{616,847,44,33,1,19,33},
-{663,847,38,33,-4,19,23},
-{588,801,38,43,-4,19,23},
-{704,847,35,33,-3,19,21},
-{651,540,36,60,1,4,24},
-{624,540,24,60,-1,4,14},
-{690,540,36,60,-4,4,24},
-{956,847,35,17,5,8,30}}},
-
-
-
-
-{48,{
-{1024,540,0,0,0,0,18},
-{1257,655,19,47,1,7,18},
-{1239,849,28,29,1,7,27},
-{1297,540,50,58,-1,7,44},
-{1486,540,33,49,-2,6,27},
-{1428,540,55,49,-1,6,50},
-{1024,603,47,49,-2,6,40},
-{1270,849,19,29,0,7,15},
-{1024,540,25,60,0,6,21},
-{1052,540,25,60,-1,6,21},
-{1204,849,32,34,-1,6,27},
-{1150,603,47,48,-1,12,42},
-{1342,849,19,23,0,36,15},
-{1024,886,27,16,-4,29,18},
-{1460,849,19,18,0,36,15},
-{1080,540,32,60,-1,6,27},
-{1245,603,35,47,-2,8,27},
-{1314,655,32,46,-1,8,27},
-{1349,655,34,46,-2,8,27},
-{1283,603,34,47,-2,8,27},
-{1120,705,36,45,-3,9,27},
-{1386,655,34,46,-2,9,27},
-{1320,603,34,47,-2,8,27},
-{1423,655,34,46,-2,9,27},
-{1357,603,34,47,-2,8,27},
-{1394,603,34,47,-2,8,27},
-{1182,849,19,34,0,20,15},
-{1169,802,19,39,0,20,15},
-{1024,705,45,46,0,13,42},
-{1292,849,47,26,-1,23,42},
-{1072,705,45,46,0,13,42},
-{1279,655,32,47,-2,7,25},
-{1200,603,42,48,-1,7,36},
-{1199,705,43,45,-2,9,36},
-{1245,705,40,45,0,9,36},
-{1083,655,40,47,-1,8,34},
-{1288,705,43,45,0,9,39},
-{1334,705,37,45,0,9,31},
-{1374,705,35,45,0,9,30},
-{1126,655,41,47,-1,8,36},
-{1412,705,42,45,0,9,39},
-{1457,705,20,45,0,9,16},
-{1460,655,31,46,-2,9,25},
-{1480,705,42,45,0,9,37},
-{1024,754,34,45,0,9,28},
-{1061,754,51,45,0,9,47},
-{1115,754,42,45,0,9,39},
-{1170,655,44,47,-1,8,39},
-{1160,754,39,45,0,9,34},
-{1380,540,45,51,-2,8,39},
-{1202,754,39,45,0,9,34},
-{1217,655,37,47,-2,8,30},
-{1244,754,44,45,-3,9,36},
-{1494,655,41,46,0,9,37},
-{1291,754,45,45,-3,9,36},
-{1339,754,60,45,-3,9,50},
-{1402,754,43,45,-2,9,36},
-{1448,754,45,45,-3,9,36},
-{1496,754,40,45,-2,9,33},
-{1209,540,23,60,0,6,17},
-{1262,540,32,60,-1,6,27},
-{1235,540,24,60,-3,6,17},
-{1364,849,28,20,4,12,33},
-{1482,849,45,16,0,54,42},
-{1395,849,23,20,1,9,27},
-{1191,802,34,36,-3,19,26},
-{1074,603,35,48,-2,7,27},
-{1228,802,33,36,-3,19,24},
-{1112,603,35,48,-3,7,27},
-{1264,802,34,36,-3,19,25},
-{1431,603,30,47,-3,7,17},
-{1159,705,37,45,-3,19,27},
-{1464,603,34,47,-2,7,27},
-{1501,603,20,47,-2,7,13},
-{1350,540,27,57,-8,7,14},
-{1024,655,33,47,-1,7,26},
-{1060,655,20,47,-2,7,13},
-{1373,802,49,35,-2,19,42},
-{1425,802,34,35,-2,19,27},
-{1301,802,36,36,-3,19,27},
-{1024,802,35,44,-2,19,27},
-{1062,802,35,44,-3,19,27},
-{1462,802,27,35,-2,19,18},
-{1340,802,30,36,-3,19,21},
-{1137,802,29,41,-3,14,20},
-{1492,802,34,35,-2,20,27},
-{1024,849,34,34,-3,20,24},
-{1061,849,46,34,-3,20,36},
-{1110,849,34,34,-3,20,24},
-{1100,802,34,44,-3,20,24},
-{1147,849,32,34,-3,20,23},
-{1135,540,34,60,-2,6,27},
-{1115,540,17,60,1,6,15},
-{1172,540,34,60,-2,6,27},
-{1421,849,36,19,0,7,33}}},
-
-
-
-
-{48,{
-{1536,540,0,0,0,0,18},
-{1907,655,25,47,2,7,18},
-{1536,889,29,29,7,7,27},
-{1859,540,53,58,0,7,44},
-{1592,603,38,49,-1,6,27},
-{1536,603,53,49,4,6,50},
-{1633,603,48,49,-1,6,40},
-{1568,889,21,29,5,7,15},
-{1536,540,32,60,1,6,21},
-{1571,540,31,60,-3,6,21},
-{1970,850,34,34,3,6,27},
-{1767,603,48,48,1,12,42},
-{1645,889,21,23,-1,36,15},
-{1748,889,27,16,-2,29,18},
-{2026,728,20,18,0,36,15},
-{1605,540,42,60,-3,6,27},
-{1864,603,37,47,0,8,27},
-{1970,655,32,46,0,8,27},
-{2005,655,38,46,-1,8,27},
-{1904,603,37,47,-1,8,27},
-{1756,705,36,45,-1,9,27},
-{1536,705,39,46,-2,9,27},
-{1944,603,36,47,0,8,27},
-{1578,705,36,46,3,9,27},
-{1983,603,37,47,0,8,27},
-{1536,655,37,47,0,8,27},
-{1944,850,23,34,0,20,15},
-{1897,802,24,39,-1,20,15},
-{1656,705,47,46,3,13,42},
-{1592,889,50,26,0,23,42},
-{1706,705,47,46,0,13,42},
-{1935,655,32,47,4,7,25},
-{1818,603,43,48,2,7,36},
-{1840,705,43,45,-2,9,36},
-{1886,705,43,45,1,9,36},
-{1721,655,43,47,2,8,34},
-{1932,705,46,45,1,9,39},
-{1981,705,42,45,1,9,31},
-{1536,754,42,45,0,9,30},
-{1767,655,44,47,2,8,36},
-{1581,754,49,45,0,9,39},
-{1633,754,26,45,0,9,16},
-{1617,705,36,46,-1,9,25},
-{1662,754,47,45,1,9,37},
-{1712,754,34,45,0,9,28},
-{1749,754,57,45,0,9,47},
-{1809,754,47,45,1,9,39},
-{1814,655,47,47,1,8,39},
-{1859,754,44,45,0,9,34},
-{1953,540,47,51,1,8,39},
-{1906,754,44,45,0,9,34},
-{1864,655,40,47,-1,8,30},
-{1953,754,44,45,4,9,36},
-{2003,540,45,46,2,9,37},
-{1536,802,45,45,4,9,36},
-{1584,802,59,45,4,9,50},
-{2000,754,48,45,-2,9,36},
-{1646,802,45,45,4,9,36},
-{1694,802,45,45,-1,9,33},
-{1761,540,33,60,-2,6,17},
-{1833,540,23,60,6,6,27},
-{1797,540,33,60,-5,6,17},
-{1669,889,28,20,9,12,33},
-{1700,889,45,16,-3,54,42},
-{2026,705,22,20,8,9,27},
-{1924,802,36,36,-2,19,26},
-{1684,603,37,48,-1,7,27},
-{1963,802,35,36,-1,19,24},
-{1724,603,40,48,-1,7,27},
-{2001,802,35,36,-1,19,25},
-{1576,655,33,47,0,7,17},
-{1795,705,42,45,-4,19,27},
-{1612,655,37,47,-1,7,27},
-{1652,655,26,47,-1,7,13},
-{1915,540,35,57,-9,7,14},
-{1681,655,37,47,-1,7,26},
-{2023,603,25,47,-1,7,13},
-{1611,850,52,35,-1,19,42},
-{1666,850,37,35,-1,19,27},
-{1536,850,37,36,-1,19,27},
-{1742,802,39,44,-3,19,27},
-{1784,802,37,44,-1,19,27},
-{1706,850,31,35,-1,19,18},
-{1576,850,32,36,-2,19,21},
-{1866,802,28,41,1,14,20},
-{1740,850,37,35,-1,20,27},
-{1780,850,34,34,1,20,24},
-{1817,850,46,34,1,20,36},
-{1866,850,37,34,-3,20,24},
-{1824,802,39,44,-4,20,24},
-{1906,850,35,34,-2,20,23},
-{1679,540,38,60,1,6,27},
-{1650,540,26,60,-1,6,15},
-{1720,540,38,60,-4,6,27},
-{2007,850,37,19,6,7,33}}},
-
-
-
-
-{32,{
-{0,920,0,0,0,0,11},
-{397,967,16,35,-1,3,11},
-{402,1080,20,23,0,3,16},
-{221,920,36,42,-3,3,27},
-{358,920,25,37,-3,2,16},
-{319,920,36,37,-3,2,27},
-{386,920,34,37,-3,2,25},
-{425,1080,15,23,-1,3,9},
-{0,920,21,44,-2,2,13},
-{24,920,21,44,-3,2,13},
-{375,1080,24,26,-2,2,16},
-{220,1043,34,34,-3,7,25},
-{0,1110,15,19,-1,23,9},
-{114,1110,21,14,-4,18,11},
-{96,1110,15,15,-1,23,9},
-{48,920,25,44,-3,2,16},
-{66,967,26,35,-3,4,16},
-{0,1006,24,34,-2,4,16},
-{27,1006,26,34,-3,4,16},
-{95,967,26,35,-3,4,16},
-{257,1043,27,33,-4,5,16},
-{56,1006,25,34,-3,5,16},
-{124,967,26,35,-3,4,16},
-{287,1043,26,33,-3,5,16},
-{153,967,26,35,-3,4,16},
-{182,967,26,35,-3,4,16},
-{497,1039,15,26,-1,12,9},
-{497,1006,15,30,-1,12,9},
-{401,1043,32,32,-2,8,25},
-{443,1080,34,20,-3,14,25},
-{436,1043,32,32,-2,8,25},
-{416,967,25,35,-3,3,16},
-{444,967,31,35,-3,3,22},
-{133,1006,31,34,-3,4,22},
-{167,1006,29,34,-1,4,22},
-{423,920,29,36,-2,3,21},
-{199,1006,30,34,-1,4,24},
-{232,1006,27,34,-1,4,20},
-{262,1006,26,34,-1,4,19},
-{455,920,30,36,-2,3,22},
-{291,1006,29,34,-1,4,23},
-{323,1006,15,34,-1,4,9},
-{339,967,24,35,-3,4,16},
-{341,1006,30,34,-1,4,23},
-{374,1006,25,34,-1,4,18},
-{478,967,34,34,-1,4,28},
-{402,1006,29,34,-1,4,23},
-{0,967,33,36,-3,3,24},
-{434,1006,28,34,-1,4,21},
-{283,920,33,39,-3,3,24},
-{465,1006,29,34,-1,4,21},
-{36,967,27,36,-3,3,18},
-{0,1043,32,34,-3,4,22},
-{366,967,28,35,-1,4,22},
-{35,1043,33,34,-4,4,22},
-{71,1043,42,34,-4,4,31},
-{116,1043,33,34,-4,4,22},
-{152,1043,33,34,-4,4,22},
-{188,1043,29,34,-3,4,20},
-{151,920,18,44,-1,2,10},
-{193,920,25,44,-3,2,16},
-{172,920,18,44,-4,2,10},
-{18,1110,23,18,0,6,20},
-{480,1080,32,13,-2,33,25},
-{44,1110,19,16,-1,6,16},
-{0,1080,24,27,-3,11,16},
-{211,967,25,35,-2,3,17},
-{27,1080,24,27,-3,11,15},
-{239,967,25,35,-3,3,17},
-{54,1080,25,27,-3,11,15},
-{267,967,23,35,-4,3,10},
-{84,1006,27,34,-3,11,16},
-{488,920,24,35,-2,3,17},
-{114,1006,16,34,-2,4,8},
-{260,920,20,41,-6,4,9},
-{293,967,25,35,-2,3,16},
-{321,967,15,35,-2,3,8},
-{82,1080,33,27,-2,11,26},
-{118,1080,24,27,-2,11,17},
-{145,1080,26,27,-3,11,16},
-{316,1043,25,33,-2,11,17},
-{344,1043,25,33,-3,11,17},
-{174,1080,21,27,-2,11,11},
-{198,1080,24,27,-4,11,13},
-{471,1043,23,30,-4,8,12},
-{225,1080,24,26,-2,12,17},
-{252,1080,26,26,-4,12,15},
-{281,1080,33,26,-4,12,22},
-{317,1080,27,26,-4,12,15},
-{372,1043,26,33,-4,12,15},
-{347,1080,25,26,-4,12,14},
-{93,920,26,44,-3,2,16},
-{76,920,14,44,-1,2,9},
-{122,920,26,44,-3,2,16},
-{66,1110,27,16,-2,4,20}}},
-
-
-
-
-{32,{
-{512,920,0,0,0,0,11},
-{512,1006,20,35,-1,3,11},
-{639,1117,22,23,3,3,16},
-{763,920,36,42,-1,3,27},
-{904,920,28,37,-2,2,16},
-{868,920,33,37,1,2,27},
-{935,920,34,37,-2,2,25},
-{664,1117,17,23,2,3,9},
-{512,920,25,44,-1,2,13},
-{540,920,24,44,-4,2,13},
-{611,1117,25,26,1,2,16},
-{913,1044,34,34,-1,7,25},
-{722,1117,16,19,-2,23,9},
-{797,1117,22,14,-3,18,11},
-{1006,986,15,15,-1,23,9},
-{567,920,31,44,-4,2,16},
-{615,967,28,35,-2,4,16},
-{596,1006,23,34,-1,4,16},
-{622,1006,29,34,-3,4,16},
-{646,967,27,35,-2,4,16},
-{950,1044,27,33,-2,5,16},
-{654,1006,29,34,-3,5,16},
-{676,967,27,35,-1,4,16},
-{980,1044,27,33,0,5,16},
-{706,967,28,35,-2,4,16},
-{737,967,28,35,-2,4,16},
-{1006,920,18,26,-1,12,9},
-{704,1081,19,30,-2,12,9},
-{605,1081,34,32,0,8,25},
-{684,1117,35,20,-2,14,25},
-{642,1081,34,32,-2,8,25},
-{535,1006,24,35,1,3,16},
-{562,1006,31,35,0,3,22},
-{743,1006,32,34,-4,4,22},
-{778,1006,31,34,-1,4,22},
-{972,920,31,36,0,3,21},
-{812,1006,33,34,-1,4,24},
-{848,1006,31,34,-1,4,20},
-{882,1006,31,34,-1,4,19},
-{512,967,31,36,0,3,22},
-{916,1006,33,34,-1,4,23},
-{952,1006,20,34,-1,4,9},
-{940,967,28,35,-3,4,16},
-{975,1006,34,34,-1,4,23},
-{512,1044,25,34,-1,4,18},
-{540,1044,39,34,-1,4,28},
-{582,1044,33,34,-1,4,23},
-{546,967,33,36,-1,3,24},
-{618,1044,31,34,-1,4,21},
-{832,920,33,39,-1,3,24},
-{652,1044,31,34,-1,4,21},
-{582,967,30,36,-3,3,18},
-{686,1044,32,34,1,4,22},
-{971,967,32,35,0,4,22},
-{721,1044,33,34,1,4,22},
-{757,1044,41,34,1,4,31},
-{801,1044,36,34,-4,4,22},
-{840,1044,34,34,0,4,22},
-{877,1044,33,34,-3,4,20},
-{686,920,25,44,-3,2,10},
-{741,920,19,44,2,2,16},
-{714,920,24,44,-5,2,10},
-{741,1117,23,18,3,6,20},
-{822,1117,32,13,-3,33,25},
-{1006,967,18,16,3,6,16},
-{726,1081,25,27,-2,11,16},
-{768,967,27,35,-2,3,17},
-{754,1081,26,27,-2,11,15},
-{798,967,29,35,-2,3,17},
-{783,1081,25,27,-2,11,15},
-{830,967,25,35,-1,3,10},
-{686,1006,31,34,-4,11,16},
-{858,967,26,35,-2,3,17},
-{720,1006,20,34,-2,4,8},
-{802,920,27,41,-8,4,9},
-{887,967,27,35,-2,3,16},
-{917,967,20,35,-2,3,8},
-{811,1081,35,27,-2,11,26},
-{849,1081,26,27,-2,11,17},
-{878,1081,27,27,-2,11,16},
-{512,1081,28,33,-3,11,17},
-{543,1081,27,33,-2,11,17},
-{908,1081,24,27,-2,11,11},
-{935,1081,25,27,-3,11,13},
-{679,1081,22,30,-1,8,12},
-{963,1081,26,26,-1,12,17},
-{992,1081,26,26,-1,12,15},
-{512,1117,33,26,-1,12,22},
-{548,1117,29,26,-4,12,15},
-{573,1081,29,33,-4,12,15},
-{580,1117,28,26,-4,12,14},
-{624,920,28,44,-1,2,16},
-{601,920,20,44,-2,2,9},
-{655,920,28,44,-4,2,16},
-{767,1117,27,16,2,4,20}}},
-
-
-
-
-{32,{
-{1024,920,0,0,0,0,12},
-{1116,1006,17,35,-1,4,12},
-{1101,1118,23,23,-1,4,18},
-{1282,920,37,42,-2,4,30},
-{1403,920,27,37,-3,3,18},
-{1359,920,41,37,-2,3,33},
-{1433,920,36,37,-3,3,27},
-{1127,1118,17,23,-2,4,10},
-{1024,920,22,44,-2,3,14},
-{1049,920,21,44,-2,3,14},
-{1072,1118,26,27,-2,3,18},
-{1251,967,35,36,-2,7,28},
-{1185,1118,17,19,-2,23,10},
-{1341,1118,22,14,-4,19,12},
-{1254,1118,17,16,-2,23,10},
-{1073,920,26,44,-2,3,18},
-{1472,920,28,36,-3,4,18},
-{1289,967,25,35,-2,4,18},
-{1317,967,27,35,-3,4,18},
-{1503,920,27,36,-3,4,18},
-{1199,1006,29,34,-4,5,18},
-{1347,967,27,35,-3,5,18},
-{1024,967,27,36,-3,4,18},
-{1231,1006,27,34,-3,5,18},
-{1054,967,27,36,-3,4,18},
-{1084,967,27,36,-3,4,18},
-{1052,1118,17,27,-2,12,10},
-{1148,1081,17,30,-2,12,10},
-{1484,1044,35,34,-2,8,28},
-{1147,1118,35,22,-2,14,28},
-{1024,1081,33,34,-1,8,28},
-{1136,1006,25,35,-2,4,17},
-{1164,1006,32,35,-2,4,24},
-{1322,1006,33,34,-3,5,24},
-{1358,1006,31,34,-2,5,24},
-{1114,967,31,36,-2,4,23},
-{1392,1006,34,34,-2,5,26},
-{1429,1006,29,34,-2,5,21},
-{1461,1006,28,34,-2,5,20},
-{1148,967,31,36,-2,4,24},
-{1492,1006,33,34,-2,5,26},
-{1024,1044,18,34,-2,5,11},
-{1053,1006,25,35,-3,5,17},
-{1045,1044,32,34,-2,5,25},
-{1080,1044,27,34,-2,5,19},
-{1110,1044,39,34,-2,5,32},
-{1152,1044,33,34,-2,5,26},
-{1182,967,34,36,-2,4,26},
-{1188,1044,31,34,-2,5,23},
-{1322,920,34,38,-2,4,26},
-{1222,1044,31,34,-2,5,23},
-{1219,967,29,36,-3,4,20},
-{1256,1044,33,34,-3,5,24},
-{1081,1006,32,35,-2,5,25},
-{1292,1044,35,34,-4,5,24},
-{1330,1044,43,34,-3,5,34},
-{1376,1044,33,34,-3,5,24},
-{1412,1044,35,34,-4,5,24},
-{1450,1044,31,34,-3,5,22},
-{1181,920,20,44,-2,3,11},
-{1227,920,26,44,-2,3,18},
-{1204,920,20,44,-3,3,11},
-{1205,1118,23,17,1,7,22},
-{1305,1118,33,15,-1,35,28},
-{1231,1118,20,17,-1,5,18},
-{1168,1081,26,27,-3,12,17},
-{1377,967,28,35,-3,4,18},
-{1197,1081,26,27,-3,12,16},
-{1408,967,27,35,-3,4,18},
-{1226,1081,27,27,-3,12,17},
-{1438,967,24,35,-3,4,11},
-{1261,1006,29,34,-4,12,18},
-{1465,967,27,35,-3,4,18},
-{1495,967,18,35,-3,4,9},
-{1256,920,23,42,-7,4,10},
-{1024,1006,26,35,-2,4,17},
-{1516,967,18,35,-3,4,9},
-{1256,1081,37,27,-3,12,28},
-{1296,1081,27,27,-3,12,18},
-{1326,1081,28,27,-3,12,18},
-{1060,1081,28,33,-3,12,18},
-{1091,1081,27,33,-3,12,18},
-{1357,1081,23,27,-3,12,12},
-{1383,1081,24,27,-3,12,14},
-{1121,1081,24,31,-4,8,13},
-{1410,1081,27,27,-3,12,18},
-{1440,1081,27,27,-4,12,16},
-{1470,1081,35,27,-4,12,24},
-{1508,1081,27,27,-4,12,16},
-{1293,1006,26,34,-3,12,16},
-{1024,1118,25,27,-3,12,16},
-{1121,920,27,44,-3,3,18},
-{1102,920,16,44,-1,3,10},
-{1151,920,27,44,-3,3,18},
-{1274,1118,28,16,-1,4,22}}},
-
-
-
-
-{32,{
-{1536,920,0,0,0,0,12},
-{1745,1006,21,35,0,4,12},
-{1777,1118,24,23,3,4,18},
-{1831,920,39,42,-1,4,30},
-{1953,920,30,37,-2,3,18},
-{1911,920,39,37,1,3,33},
-{1986,920,36,37,-2,3,27},
-{1804,1118,18,23,2,4,10},
-{1536,920,26,44,-1,3,14},
-{1565,920,25,44,-4,3,14},
-{1747,1118,27,27,1,3,18},
-{1842,967,36,36,-1,7,28},
-{1865,1118,18,19,-2,23,10},
-{2022,1118,21,15,-2,18,12},
-{1934,1118,18,16,-2,23,10},
-{1593,920,33,44,-4,3,18},
-{1536,967,30,36,-2,4,18},
-{1881,967,25,35,-1,4,18},
-{1909,967,29,35,-2,4,18},
-{1569,967,29,36,-2,4,18},
-{1833,1006,28,34,-2,5,18},
-{1941,967,30,35,-3,5,18},
-{1601,967,28,36,-1,4,18},
-{1864,1006,29,34,0,5,18},
-{1632,967,29,36,-2,4,18},
-{1664,967,28,36,-1,4,18},
-{1724,1118,20,27,-2,12,10},
-{1801,1081,20,30,-2,12,10},
-{1657,1081,36,34,0,8,28},
-{1825,1118,37,22,-1,14,28},
-{1696,1081,36,34,-2,8,28},
-{1769,1006,25,35,2,4,17},
-{1797,1006,33,35,0,4,24},
-{1964,1006,33,34,-3,5,24},
-{2000,1006,33,34,-1,5,24},
-{1695,967,34,36,-1,4,23},
-{1536,1044,35,34,-1,5,26},
-{1574,1044,32,34,-1,5,21},
-{1609,1044,32,34,-1,5,20},
-{1732,967,34,36,-1,4,24},
-{1644,1044,36,34,-1,5,26},
-{1683,1044,21,34,-1,5,11},
-{1676,1006,29,35,-3,5,17},
-{1707,1044,36,34,-1,5,25},
-{1746,1044,27,34,-1,5,19},
-{1776,1044,42,34,-1,5,32},
-{1821,1044,36,34,-1,5,26},
-{1769,967,36,36,-1,4,26},
-{1860,1044,33,34,-1,5,23},
-{1873,920,35,38,-1,4,26},
-{1896,1044,33,34,-1,5,23},
-{1808,967,31,36,-2,4,20},
-{1932,1044,34,34,1,5,24},
-{1708,1006,34,35,0,5,25},
-{1969,1044,34,34,1,5,24},
-{1536,1081,44,34,1,5,34},
-{2006,1044,36,34,-3,5,24},
-{1583,1081,34,34,1,5,24},
-{1620,1081,34,34,-2,5,22},
-{1719,920,26,44,-3,3,11},
-{1777,920,20,44,2,3,18},
-{1748,920,26,44,-5,3,11},
-{1886,1118,23,17,4,7,22},
-{1986,1118,33,15,-3,35,28},
-{1912,1118,19,17,4,5,18},
-{1824,1081,28,27,-3,12,17},
-{1974,967,29,35,-2,4,18},
-{1855,1081,27,27,-2,12,16},
-{2006,967,31,35,-2,4,18},
-{1885,1081,27,27,-2,12,17},
-{1536,1006,26,35,-1,4,11},
-{1896,1006,32,34,-4,12,18},
-{1565,1006,29,35,-2,4,18},
-{1597,1006,21,35,-2,4,9},
-{1800,920,28,42,-8,4,10},
-{1621,1006,28,35,-2,4,17},
-{1652,1006,21,35,-2,4,9},
-{1915,1081,38,27,-2,12,28},
-{1956,1081,28,27,-2,12,18},
-{1987,1081,29,27,-2,12,18},
-{1735,1081,31,33,-4,12,18},
-{1769,1081,29,33,-2,12,18},
-{1536,1118,25,27,-2,12,12},
-{1564,1118,26,27,-3,12,14},
-{2025,920,23,31,-1,8,13},
-{2019,1081,29,27,-2,12,18},
-{1593,1118,27,27,-1,12,16},
-{1623,1118,35,27,-1,12,24},
-{1661,1118,29,27,-3,12,16},
-{1931,1006,30,34,-4,12,16},
-{1693,1118,28,27,-3,12,16},
-{1653,920,30,44,-1,3,18},
-{1629,920,21,44,-2,3,10},
-{1686,920,30,44,-4,3,18},
-{1955,1118,28,16,3,4,22}}},
-
-
-
-
-{48,{
-{0,1160,0,0,0,0,16},
-{337,1160,17,46,0,7,14},
-{277,1631,25,29,1,7,24},
-{0,1390,46,54,-1,8,40},
-{242,1399,31,51,-2,5,24},
-{0,1447,46,51,-1,5,40},
-{64,1597,45,47,-2,7,38},
-{337,1245,17,29,0,7,14},
-{310,1160,24,60,0,5,19},
-{310,1223,24,60,-2,5,19},
-{277,1223,30,33,-1,5,24},
-{113,1208,44,44,-1,13,38},
-{310,1631,18,26,0,36,14},
-{277,1613,26,15,-4,29,16},
-{337,1277,17,17,0,36,14},
-{242,1552,30,60,-1,5,24},
-{203,1475,33,45,-3,9,24},
-{277,1434,28,44,0,9,24},
-{242,1352,32,44,-2,9,24},
-{203,1590,32,45,-2,9,24},
-{203,1255,34,45,-3,8,24},
-{242,1160,32,45,-2,9,24},
-{242,1208,32,45,-2,9,24},
-{203,1523,33,45,-2,9,24},
-{242,1256,32,45,-2,9,24},
-{242,1304,32,45,-2,9,24},
-{337,1209,17,33,0,20,14},
-{310,1586,18,42,0,20,14},
-{113,1496,41,38,0,16,38},
-{0,1648,44,22,-1,24,38},
-{113,1537,41,38,0,16,38},
-{242,1615,30,46,-2,7,23},
-{64,1547,45,47,-2,7,38},
-{0,1501,46,46,-3,7,36},
-{113,1352,42,45,-3,8,34},
-{113,1302,42,47,-2,7,35},
-{113,1160,45,45,-3,8,37},
-{113,1400,42,45,-3,8,33},
-{113,1578,40,45,-3,8,32},
-{64,1447,45,47,-2,7,38},
-{64,1160,46,45,-3,8,36},
-{277,1565,27,45,-3,8,18},
-{203,1426,33,46,-2,8,25},
-{64,1208,46,45,-3,8,38},
-{161,1160,39,45,-3,8,30},
-{0,1209,54,45,-3,8,44},
-{64,1256,46,45,-3,8,36},
-{64,1497,45,47,-2,7,38},
-{113,1448,41,45,-3,8,33},
-{64,1389,45,55,-2,7,38},
-{0,1550,46,46,-3,8,36},
-{203,1205,34,47,-2,7,27},
-{113,1255,43,44,-2,9,35},
-{0,1599,46,46,-3,8,36},
-{0,1341,47,46,-4,8,36},
-{0,1160,61,46,-4,8,50},
-{64,1304,46,45,-3,8,36},
-{0,1293,48,45,-4,8,36},
-{160,1256,37,45,-2,8,30},
-{310,1460,20,60,0,5,14},
-{277,1160,30,60,-1,5,24},
-{310,1523,20,60,-3,5,14},
-{242,1529,31,20,1,11,30},
-{64,1647,41,14,0,50,38},
-{310,1438,22,19,0,10,24},
-{203,1350,34,35,-2,19,24},
-{113,1626,36,46,-3,8,27},
-{242,1453,31,35,-3,19,22},
-{160,1496,36,46,-3,8,27},
-{242,1491,31,35,-3,19,22},
-{277,1385,28,46,-3,7,15},
-{203,1303,34,44,-3,19,24},
-{160,1208,37,45,-3,8,27},
-{310,1391,23,44,-3,9,14},
-{310,1286,24,54,-6,9,15},
-{160,1545,36,45,-3,8,26},
-{310,1343,23,45,-3,8,14},
-{0,1257,50,33,-3,20,40},
-{160,1424,37,33,-3,20,27},
-{203,1388,34,35,-3,19,24},
-{160,1593,36,42,-3,20,27},
-{203,1160,36,42,-3,20,26},
-{160,1638,28,33,-3,20,19},
-{277,1527,28,35,-3,19,19},
-{277,1481,28,43,-4,11,19},
-{160,1350,37,34,-3,20,27},
-{160,1387,37,34,-4,20,26},
-{64,1352,46,34,-4,20,35},
-{160,1460,37,33,-4,20,26},
-{160,1304,37,43,-4,20,26},
-{203,1638,30,33,-3,20,22},
-{277,1259,29,60,-1,5,24},
-{337,1297,15,60,1,5,14},
-{277,1322,29,60,-1,5,24},
-{203,1571,33,16,0,9,30}}},
-
-
-
-
-{48,{
-{512,1160,0,0,0,0,18},
-{824,1277,25,46,1,7,15},
-{827,1468,26,30,8,7,25},
-{895,1160,46,54,2,8,40},
-{561,1223,34,51,1,5,25},
-{512,1223,46,51,3,5,40},
-{826,1223,45,47,2,7,37},
-{1006,1374,18,30,7,7,15},
-{512,1160,30,60,3,5,20},
-{545,1160,29,60,-3,5,20},
-{793,1468,31,33,5,5,25},
-{649,1422,41,42,3,14,37},
-{856,1468,20,26,-1,36,15},
-{547,1505,24,15,0,29,18},
-{980,1468,18,17,1,36,15},
-{577,1160,41,60,-3,5,25},
-{885,1277,34,45,1,9,25},
-{865,1374,29,44,1,9,25},
-{922,1277,35,45,0,9,25},
-{960,1277,35,45,0,9,25},
-{944,1160,33,53,-2,9,25},
-{512,1326,34,45,1,9,25},
-{549,1326,34,45,1,9,25},
-{586,1326,35,45,3,9,25},
-{624,1326,35,45,0,9,25},
-{662,1326,34,45,1,9,25},
-{768,1468,22,33,1,20,15},
-{622,1422,24,42,-1,20,15},
-{693,1422,42,38,4,16,37},
-{879,1468,43,22,2,24,37},
-{738,1422,42,38,1,16,37},
-{852,1277,30,46,5,7,25},
-{780,1223,43,47,3,7,37},
-{538,1277,42,46,-1,7,36},
-{699,1326,44,45,-1,8,34},
-{598,1223,44,47,3,7,35},
-{746,1326,46,45,-1,8,37},
-{795,1326,45,45,-1,8,33},
-{843,1326,44,45,-1,8,32},
-{645,1223,44,47,3,7,38},
-{890,1326,50,45,-1,8,36},
-{943,1326,34,45,-2,8,19},
-{583,1277,38,46,0,8,26},
-{512,1374,50,45,-1,8,37},
-{565,1374,39,45,-1,8,31},
-{607,1374,57,45,-1,8,44},
-{667,1374,50,45,-1,8,36},
-{692,1223,43,47,3,7,37},
-{980,1326,44,45,-1,8,33},
-{849,1160,43,55,3,7,37},
-{624,1277,44,46,-1,8,35},
-{738,1223,39,47,-1,7,27},
-{924,1374,43,44,4,9,35},
-{671,1277,44,46,5,8,36},
-{718,1277,44,46,6,8,36},
-{765,1277,56,46,6,8,48},
-{720,1374,50,45,-2,8,36},
-{773,1374,44,45,6,8,36},
-{820,1374,42,45,0,8,30},
-{723,1160,30,60,-1,5,15},
-{790,1160,18,60,8,5,25},
-{756,1160,31,60,-5,5,15},
-{925,1468,30,20,7,11,30},
-{574,1505,39,14,-2,50,37},
-{958,1468,19,19,9,10,25},
-{783,1422,33,34,1,20,25},
-{874,1223,29,46,1,8,23},
-{819,1422,30,34,1,20,23},
-{906,1223,34,46,1,8,25},
-{852,1422,29,34,1,20,23},
-{811,1160,35,56,-5,7,15},
-{970,1374,33,43,-2,20,23},
-{943,1223,35,46,-1,8,25},
-{897,1374,24,44,0,10,15},
-{980,1160,31,53,-6,10,15},
-{981,1223,33,46,-1,8,23},
-{512,1277,23,46,0,8,13},
-{884,1422,48,34,0,20,40},
-{935,1422,36,34,0,20,27},
-{974,1422,31,34,1,20,25},
-{548,1422,37,42,-4,20,25},
-{588,1422,31,42,1,20,23},
-{512,1468,31,34,0,20,21},
-{546,1468,29,34,-1,20,20},
-{998,1277,26,43,0,11,16},
-{578,1468,35,34,0,20,26},
-{616,1468,32,34,0,20,23},
-{651,1468,42,34,0,20,32},
-{696,1468,35,34,-2,20,23},
-{512,1422,33,43,0,20,24},
-{734,1468,31,34,-1,20,20},
-{650,1160,34,60,3,5,25},
-{621,1160,26,60,-1,5,15},
-{687,1160,33,60,-2,5,25},
-{512,1505,32,17,8,9,30}}},
-
-
-
-
-{48,{
-{1024,1160,0,0,0,0,19},
-{1363,1583,20,46,0,7,17},
-{1363,1160,28,29,2,7,28},
-{1024,1389,52,54,-1,8,46},
-{1246,1621,34,51,-1,5,28},
-{1024,1446,52,51,-1,5,46},
-{1088,1354,50,47,-2,7,43},
-{1394,1241,19,29,0,7,16},
-{1363,1212,25,60,1,5,22},
-{1363,1275,25,60,-1,5,22},
-{1327,1196,33,33,-1,5,28},
-{1088,1537,49,48,-1,11,43},
-{1363,1632,20,28,0,34,16},
-{1363,1192,28,17,-4,28,19},
-{1394,1273,19,19,0,34,16},
-{1288,1578,33,60,-1,5,28},
-{1246,1574,36,44,-2,10,28},
-{1327,1407,32,43,0,10,28},
-{1288,1395,35,43,-2,10,28},
-{1288,1207,35,44,-2,10,28},
-{1246,1423,37,43,-3,10,28},
-{1288,1254,35,44,-2,10,28},
-{1288,1301,35,44,-2,10,28},
-{1246,1526,36,45,-1,9,28},
-{1288,1348,35,44,-2,10,28},
-{1288,1160,36,44,-2,10,28},
-{1394,1205,19,33,0,20,16},
-{1394,1160,20,42,0,20,16},
-{1149,1506,45,43,1,14,43},
-{1024,1645,49,24,-1,23,43},
-{1149,1552,45,43,1,14,43},
-{1327,1358,32,46,-1,7,27},
-{1088,1588,49,46,-1,7,43},
-{1088,1208,51,46,-3,7,42},
-{1149,1266,47,45,-3,8,40},
-{1149,1314,46,46,-1,8,40},
-{1088,1453,50,45,-3,8,43},
-{1149,1363,46,45,-3,8,37},
-{1200,1160,43,45,-3,8,35},
-{1088,1404,50,46,-1,8,44},
-{1024,1293,53,45,-3,8,44},
-{1327,1539,31,45,-3,8,21},
-{1246,1325,37,46,-3,8,29},
-{1024,1549,52,45,-3,8,44},
-{1200,1208,42,45,-3,8,34},
-{1024,1208,61,45,-2,8,53},
-{1024,1597,52,45,-2,8,44},
-{1149,1217,47,46,-1,8,42},
-{1149,1411,46,45,-3,8,38},
-{1149,1160,48,54,-1,8,42},
-{1088,1257,51,46,-2,8,42},
-{1246,1374,37,46,-1,8,31},
-{1149,1459,46,44,-2,9,39},
-{1024,1500,52,46,-3,8,43},
-{1094,1160,52,45,-3,8,42},
-{1024,1160,67,45,-3,8,58},
-{1088,1306,51,45,-3,8,42},
-{1024,1341,53,45,-4,8,42},
-{1200,1400,40,45,-1,8,34},
-{1363,1520,21,60,1,5,16},
-{1288,1478,34,60,-1,5,28},
-{1363,1457,22,60,-3,5,16},
-{1288,1641,33,20,2,11,34},
-{1149,1598,45,15,1,53,43},
-{1363,1434,23,20,1,9,28},
-{1088,1637,38,34,-3,19,27},
-{1200,1256,40,45,-3,8,31},
-{1288,1541,34,34,-3,19,25},
-{1200,1568,39,45,-2,8,31},
-{1288,1441,35,34,-3,19,26},
-{1327,1490,31,46,-2,7,17},
-{1246,1278,38,44,-3,19,28},
-{1200,1304,40,45,-2,8,31},
-{1363,1338,24,45,-2,8,16},
-{1149,1616,28,55,-7,8,17},
-{1200,1352,40,45,-3,8,30},
-{1363,1386,24,45,-2,8,16},
-{1024,1256,55,34,-2,19,46},
-{1200,1494,40,34,-2,19,31},
-{1246,1469,37,34,-3,19,28},
-{1200,1448,40,43,-3,19,31},
-{1200,1616,39,43,-2,19,30},
-{1327,1453,32,34,-3,19,23},
-{1327,1587,31,34,-3,19,22},
-{1327,1624,30,42,-3,11,22},
-{1200,1531,40,34,-2,19,31},
-{1246,1206,39,33,-3,20,30},
-{1088,1501,50,33,-3,20,40},
-{1246,1242,39,33,-3,20,30},
-{1246,1160,39,43,-3,20,30},
-{1327,1160,33,33,-3,20,25},
-{1327,1232,32,60,0,5,28},
-{1394,1295,15,60,2,5,16},
-{1327,1295,32,60,0,5,28},
-{1246,1506,37,17,0,8,34}}},
-
-
-
-
-{48,{
-{1536,1160,0,0,0,0,20},
-{1876,1529,27,46,2,7,19},
-{1536,1641,28,30,9,7,29},
-{1536,1535,51,54,2,8,46},
-{1755,1438,37,51,2,5,29},
-{1604,1160,49,51,4,5,46},
-{1604,1214,49,47,2,7,43},
-{1567,1641,19,30,8,7,18},
-{1797,1612,31,60,4,5,23},
-{1876,1223,31,60,-2,5,23},
-{1837,1320,34,33,5,5,29},
-{1656,1524,46,46,3,12,43},
-{1876,1643,21,28,0,34,18},
-{1876,1578,27,17,0,28,20},
-{1911,1330,19,19,2,34,18},
-{1707,1255,44,60,-3,5,29},
-{1755,1257,38,45,1,9,29},
-{1876,1335,31,43,2,10,29},
-{1755,1305,38,45,0,9,29},
-{1755,1541,37,45,1,9,29},
-{1656,1619,36,53,-2,9,29},
-{1755,1589,37,45,1,9,29},
-{1797,1431,36,45,2,9,29},
-{1755,1209,39,45,3,9,29},
-{1797,1160,37,45,1,9,29},
-{1797,1479,36,45,2,9,29},
-{1911,1209,23,33,2,20,18},
-{1876,1598,25,42,0,20,18},
-{1656,1573,46,43,5,14,43},
-{1656,1208,48,24,2,23,43},
-{1656,1440,47,43,1,14,43},
-{1876,1286,31,46,6,7,29},
-{1604,1606,48,47,3,7,43},
-{1656,1343,47,46,-1,7,42},
-{1604,1362,49,45,-1,8,40},
-{1604,1506,48,47,4,7,40},
-{1536,1487,52,45,-1,8,42},
-{1656,1160,48,45,-1,8,37},
-{1656,1392,47,45,-1,8,35},
-{1604,1556,48,47,4,7,43},
-{1536,1257,57,45,-1,8,44},
-{1797,1208,37,45,-1,8,23},
-{1707,1368,42,46,-1,8,30},
-{1536,1353,56,45,-1,8,43},
-{1707,1417,42,45,-1,8,34},
-{1536,1160,65,45,-1,8,52},
-{1536,1305,57,45,-1,8,44},
-{1656,1293,47,47,3,7,42},
-{1604,1410,49,45,-1,8,38},
-{1656,1235,47,55,3,7,42},
-{1536,1592,50,46,-1,8,42},
-{1707,1318,42,47,0,7,32},
-{1707,1208,45,44,5,9,39},
-{1604,1264,49,46,6,8,43},
-{1604,1313,49,46,6,8,42},
-{1536,1208,63,46,6,8,56},
-{1536,1439,53,45,-1,8,42},
-{1604,1458,49,45,6,8,42},
-{1707,1160,45,45,1,8,35},
-{1837,1562,32,60,-1,5,18},
-{1911,1267,20,60,9,5,29},
-{1876,1160,32,60,-4,5,18},
-{1837,1539,33,20,8,11,35},
-{1604,1656,43,15,-2,53,43},
-{1911,1245,21,19,10,9,29},
-{1755,1637,37,35,1,19,29},
-{1837,1414,33,46,1,8,26},
-{1837,1463,33,35,1,19,26},
-{1755,1492,37,46,1,8,29},
-{1837,1501,33,35,1,19,26},
-{1707,1587,39,56,-5,7,20},
-{1797,1527,36,44,-1,19,26},
-{1755,1160,39,46,-1,8,29},
-{1837,1625,28,46,-1,8,18},
-{1837,1356,33,55,-5,8,18},
-{1797,1382,36,46,-1,8,26},
-{1911,1160,24,46,0,8,15},
-{1536,1401,56,35,-1,19,46},
-{1707,1465,42,35,-1,19,32},
-{1797,1574,36,35,1,19,29},
-{1707,1503,40,43,-3,19,29},
-{1837,1236,35,43,1,19,26},
-{1837,1160,36,35,-1,19,25},
-{1876,1381,31,35,0,19,24},
-{1876,1419,28,44,0,10,19},
-{1707,1549,40,35,-1,19,30},
-{1837,1198,36,35,-1,19,26},
-{1656,1486,47,35,-1,19,37},
-{1755,1400,38,35,-1,19,27},
-{1755,1353,38,44,-1,19,27},
-{1837,1282,35,35,-1,19,24},
-{1797,1256,36,60,4,5,29},
-{1876,1466,27,60,0,5,18},
-{1797,1319,36,60,-2,5,29},
-{1707,1646,36,17,8,8,35}}},
-
-
-
-
-{32,{
-{0,1680,0,0,0,0,11},
-{348,1727,16,35,-2,3,9},
-{491,1680,21,24,-1,3,16},
-{275,1680,35,40,-2,4,27},
-{352,1680,25,38,-3,2,16},
-{313,1680,36,38,-3,2,27},
-{30,1727,34,36,-3,3,25},
-{78,1875,16,24,-2,3,9},
-{0,1680,20,44,-1,2,13},
-{23,1680,20,44,-3,2,13},
-{51,1875,24,26,-2,2,16},
-{291,1803,33,34,-2,7,25},
-{97,1875,17,21,-2,23,9},
-{251,1875,21,14,-4,18,11},
-{202,1875,16,15,-2,23,9},
-{46,1680,25,44,-3,2,16},
-{431,1727,26,34,-3,5,16},
-{327,1803,24,33,-2,5,16},
-{354,1803,26,33,-3,5,16},
-{460,1727,26,34,-3,5,16},
-{0,1766,27,34,-4,4,16},
-{30,1766,25,34,-3,5,16},
-{58,1766,26,34,-3,5,16},
-{67,1727,27,35,-3,4,16},
-{87,1766,26,34,-3,5,16},
-{116,1766,26,34,-3,5,16},
-{32,1875,16,26,-2,12,9},
-{57,1840,17,32,-2,12,9},
-{77,1840,32,30,-2,9,25},
-{117,1875,33,19,-2,15,25},
-{112,1840,32,30,-2,9,25},
-{367,1727,24,35,-3,3,16},
-{394,1727,34,35,-3,3,25},
-{123,1727,34,35,-3,3,24},
-{292,1766,32,34,-3,4,23},
-{380,1680,33,36,-3,3,24},
-{327,1766,34,34,-3,4,25},
-{364,1766,32,34,-3,4,22},
-{399,1766,31,34,-3,4,21},
-{416,1680,35,36,-3,3,26},
-{433,1766,34,34,-3,4,24},
-{489,1727,23,34,-4,4,12},
-{160,1727,26,35,-3,4,17},
-{470,1766,35,34,-3,4,25},
-{0,1803,30,34,-3,4,20},
-{33,1803,39,34,-3,4,30},
-{75,1803,34,34,-3,4,24},
-{454,1680,34,36,-3,3,25},
-{112,1803,31,34,-3,4,22},
-{214,1680,34,41,-3,3,25},
-{189,1727,34,35,-3,4,24},
-{0,1727,27,36,-3,3,18},
-{146,1803,33,34,-3,4,24},
-{226,1727,34,35,-3,4,24},
-{263,1727,35,35,-4,4,24},
-{301,1727,44,35,-4,4,33},
-{182,1803,35,34,-4,4,24},
-{220,1803,36,34,-4,4,24},
-{259,1803,29,34,-3,4,20},
-{145,1680,17,44,-1,2,9},
-{186,1680,25,44,-3,2,16},
-{165,1680,18,44,-4,2,9},
-{153,1875,25,17,-1,6,20},
-{275,1875,32,13,-2,32,25},
-{181,1875,18,17,-1,5,16},
-{147,1840,27,26,-3,12,16},
-{145,1766,29,34,-4,4,18},
-{177,1840,24,26,-3,12,15},
-{177,1766,28,34,-3,4,18},
-{204,1840,24,26,-3,12,15},
-{97,1727,23,35,-3,3,10},
-{383,1803,27,33,-3,12,16},
-{208,1766,28,34,-3,4,18},
-{413,1803,19,33,-3,5,9},
-{251,1680,21,40,-6,5,10},
-{239,1766,28,34,-4,4,17},
-{270,1766,19,34,-3,4,9},
-{231,1840,37,26,-3,12,27},
-{271,1840,28,26,-3,12,18},
-{302,1840,26,26,-3,12,16},
-{466,1803,29,32,-4,12,18},
-{0,1840,28,32,-3,12,17},
-{331,1840,24,26,-4,12,13},
-{358,1840,23,26,-3,12,13},
-{31,1840,23,32,-4,6,13},
-{384,1840,28,26,-3,12,18},
-{415,1840,28,26,-4,12,17},
-{446,1840,35,26,-4,12,24},
-{0,1875,29,26,-4,12,17},
-{435,1803,28,33,-4,12,17},
-{484,1840,25,26,-4,12,15},
-{91,1680,24,44,-2,2,16},
-{74,1680,14,44,-1,2,9},
-{118,1680,24,44,-2,2,16},
-{221,1875,27,15,-2,5,20}}},
-
-
-
-
-{32,{
-{512,1680,0,0,0,0,12},
-{912,1725,21,35,-1,3,10},
-{626,1875,21,24,4,3,17},
-{852,1680,34,40,0,4,27},
-{956,1680,27,38,-1,2,17},
-{918,1680,35,38,0,2,27},
-{654,1727,34,36,0,3,25},
-{650,1875,17,24,3,3,10},
-{512,1680,25,44,0,2,14},
-{540,1680,24,44,-4,2,14},
-{598,1875,25,26,2,2,17},
-{590,1840,32,32,0,8,25},
-{670,1875,17,21,-2,23,10},
-{801,1875,21,14,-2,18,12},
-{1008,1803,16,15,-1,23,10},
-{567,1680,32,44,-4,2,17},
-{512,1766,27,34,-1,5,17},
-{921,1803,24,33,-1,5,17},
-{542,1766,28,34,-2,5,17},
-{573,1766,27,34,-1,5,17},
-{889,1680,26,39,-3,5,17},
-{603,1766,27,34,-1,5,17},
-{633,1766,27,34,-1,5,17},
-{663,1766,28,34,0,5,17},
-{694,1766,27,34,-1,5,17},
-{724,1766,27,34,-1,5,17},
-{576,1875,19,26,-1,12,10},
-{567,1840,20,32,-2,12,10},
-{625,1840,32,30,1,9,25},
-{690,1875,33,18,0,15,25},
-{660,1840,32,30,-1,9,25},
-{936,1725,24,35,2,3,17},
-{963,1725,33,35,0,3,25},
-{691,1727,32,35,-2,3,24},
-{892,1766,33,34,-2,4,23},
-{512,1727,34,36,0,3,23},
-{928,1766,35,34,-2,4,25},
-{966,1766,34,34,-2,4,22},
-{512,1803,33,34,-2,4,21},
-{549,1727,34,36,0,3,25},
-{548,1803,37,34,-2,4,24},
-{588,1803,27,34,-3,4,13},
-{726,1727,29,35,-1,4,17},
-{986,1680,38,34,-2,4,25},
-{618,1803,30,34,-2,4,21},
-{651,1803,42,34,-2,4,29},
-{696,1803,37,34,-2,4,24},
-{586,1727,32,36,1,3,25},
-{736,1803,33,34,-2,4,22},
-{789,1680,32,41,1,3,25},
-{758,1725,33,35,-2,4,24},
-{621,1727,30,36,-2,3,18},
-{772,1803,33,34,1,4,23},
-{794,1725,33,35,2,4,24},
-{830,1725,34,35,2,4,24},
-{867,1725,42,35,2,4,32},
-{808,1803,37,34,-3,4,24},
-{848,1803,34,34,2,4,24},
-{885,1803,33,34,-2,4,20},
-{684,1680,24,44,-2,2,10},
-{739,1680,16,44,4,2,17},
-{711,1680,25,44,-5,2,10},
-{726,1875,23,17,4,6,20},
-{825,1875,30,13,-3,32,25},
-{752,1875,17,17,4,5,17},
-{695,1840,26,26,-1,12,17},
-{754,1766,24,34,-1,4,15},
-{724,1840,24,26,-1,12,15},
-{781,1766,27,34,-1,4,17},
-{751,1840,24,26,-1,12,15},
-{758,1680,28,42,-5,3,10},
-{948,1803,27,33,-3,12,15},
-{811,1766,27,34,-2,4,17},
-{1003,1766,21,33,-2,5,10},
-{824,1680,25,40,-6,5,10},
-{841,1766,26,34,-2,4,15},
-{870,1766,19,34,-1,4,9},
-{778,1840,37,26,-2,12,27},
-{818,1840,29,26,-2,12,18},
-{850,1840,25,26,-1,12,17},
-{512,1840,28,32,-4,12,17},
-{999,1725,25,32,-1,12,15},
-{878,1840,26,26,-2,12,14},
-{907,1840,23,26,-2,12,14},
-{543,1840,21,32,-1,6,11},
-{933,1840,28,26,-2,12,18},
-{964,1840,26,26,-2,12,15},
-{512,1875,33,26,-2,12,22},
-{993,1840,28,26,-3,12,15},
-{978,1803,27,33,-2,12,16},
-{548,1875,25,26,-2,12,14},
-{626,1680,26,44,1,2,17},
-{602,1680,21,44,-2,2,10},
-{655,1680,26,44,-3,2,17},
-{772,1875,26,15,4,5,20}}},
-
-
-
-
-{32,{
-{1024,1680,0,0,0,0,13},
-{1468,1680,17,35,-1,3,12},
-{1303,1874,22,24,0,3,19},
-{1314,1680,39,40,-2,4,31},
-{1398,1680,27,38,-2,2,19},
-{1356,1680,39,38,-2,2,31},
-{1488,1680,38,35,-3,3,29},
-{1519,1764,16,24,-1,3,11},
-{1024,1680,21,44,-1,2,15},
-{1048,1680,21,44,-2,2,15},
-{1274,1874,26,26,-2,2,19},
-{1428,1680,37,36,-2,6,29},
-{1328,1874,18,23,-2,21,11},
-{1462,1874,23,15,-4,17,13},
-{1389,1874,18,17,-2,21,11},
-{1072,1680,26,44,-2,2,19},
-{1305,1801,28,33,-3,5,19},
-{1336,1801,26,33,-2,5,19},
-{1365,1801,28,33,-3,5,19},
-{1396,1801,28,33,-3,5,19},
-{1427,1801,28,33,-3,5,19},
-{1458,1801,28,33,-3,5,19},
-{1489,1801,28,33,-3,5,19},
-{1024,1727,28,34,-2,4,19},
-{1024,1838,28,33,-3,5,19},
-{1055,1838,28,33,-3,5,19},
-{1253,1874,18,26,-2,12,11},
-{1246,1838,18,32,-2,12,11},
-{1267,1838,34,32,-1,8,29},
-{1349,1874,37,20,-2,14,29},
-{1304,1838,34,32,-1,8,29},
-{1237,1801,25,34,-2,4,18},
-{1265,1801,37,34,-2,4,29},
-{1262,1727,38,34,-3,4,28},
-{1303,1727,35,34,-3,4,27},
-{1341,1727,35,34,-2,4,27},
-{1379,1727,37,34,-3,4,29},
-{1419,1727,34,34,-3,4,25},
-{1456,1727,33,34,-3,4,24},
-{1492,1727,37,34,-2,4,29},
-{1024,1764,39,34,-3,4,29},
-{1066,1764,24,34,-3,4,14},
-{1093,1764,29,34,-4,4,19},
-{1125,1764,38,34,-3,4,29},
-{1166,1764,32,34,-3,4,23},
-{1201,1764,45,34,-3,4,35},
-{1249,1764,39,34,-3,4,29},
-{1291,1764,36,34,-2,4,28},
-{1330,1764,34,34,-3,4,26},
-{1275,1680,36,40,-2,4,28},
-{1367,1764,39,34,-3,4,28},
-{1409,1764,28,34,-2,4,21},
-{1440,1764,35,34,-3,4,26},
-{1478,1764,38,34,-3,4,29},
-{1024,1801,39,34,-4,4,28},
-{1066,1801,50,34,-4,4,39},
-{1119,1801,38,34,-3,4,28},
-{1160,1801,40,34,-4,4,28},
-{1203,1801,31,34,-2,4,23},
-{1176,1680,19,44,-1,2,11},
-{1220,1680,26,44,-2,2,19},
-{1198,1680,19,44,-4,2,11},
-{1410,1874,26,17,0,6,23},
-{1024,1903,34,14,-1,34,29},
-{1439,1874,20,17,-1,5,19},
-{1341,1838,29,26,-3,12,18},
-{1055,1727,30,34,-3,4,21},
-{1373,1838,26,26,-3,12,17},
-{1088,1727,30,34,-3,4,21},
-{1402,1838,27,26,-3,12,17},
-{1121,1727,25,34,-3,4,12},
-{1086,1838,29,33,-3,11,19},
-{1149,1727,31,34,-3,4,21},
-{1183,1727,20,34,-3,4,11},
-{1249,1680,23,40,-6,4,12},
-{1206,1727,30,34,-3,4,20},
-{1239,1727,20,34,-3,4,11},
-{1432,1838,41,26,-3,12,31},
-{1476,1838,31,26,-3,12,21},
-{1024,1874,28,26,-3,12,19},
-{1118,1838,30,32,-3,12,21},
-{1151,1838,30,32,-3,12,20},
-{1055,1874,25,26,-3,12,16},
-{1083,1874,24,26,-3,12,15},
-{1184,1838,25,32,-4,6,15},
-{1110,1874,31,26,-3,12,21},
-{1144,1874,31,26,-4,12,20},
-{1178,1874,38,26,-4,12,27},
-{1219,1874,31,26,-4,12,20},
-{1212,1838,31,32,-4,12,20},
-{1510,1838,26,26,-3,12,17},
-{1118,1680,26,44,-2,2,19},
-{1101,1680,14,44,0,2,11},
-{1147,1680,26,44,-2,2,19},
-{1488,1874,29,15,-2,4,23}}},
-
-
-
-
-{32,{
-{1536,1680,0,0,0,0,14},
-{1882,1727,22,35,0,3,13},
-{1857,1877,23,24,4,3,19},
-{1893,1680,38,40,0,4,31},
-{2005,1680,28,38,0,2,19},
-{1965,1680,37,38,1,2,31},
-{1687,1727,37,36,0,3,29},
-{1883,1877,17,24,4,3,12},
-{1536,1680,25,44,1,2,16},
-{1564,1680,25,44,-3,2,16},
-{1827,1877,27,26,2,2,19},
-{1655,1840,34,34,1,7,29},
-{1903,1877,19,23,-2,21,12},
-{1567,1907,22,15,-2,17,14},
-{1985,1877,18,17,-1,21,12},
-{1592,1680,33,44,-3,2,19},
-{1975,1727,29,34,-1,5,19},
-{1692,1840,24,33,0,5,19},
-{1536,1766,30,34,-2,5,19},
-{1569,1766,29,34,-1,5,19},
-{1934,1680,28,39,-3,5,19},
-{1601,1766,29,34,-1,5,19},
-{1633,1766,28,34,0,5,19},
-{1664,1766,31,34,0,5,19},
-{1698,1766,29,34,-1,5,19},
-{1730,1766,28,34,0,5,19},
-{2028,1803,20,26,-1,12,12},
-{1807,1840,21,32,-2,12,12},
-{1831,1840,36,32,1,8,29},
-{1925,1877,36,20,0,14,29},
-{1870,1840,35,32,-1,8,29},
-{1907,1727,26,35,2,3,19},
-{1936,1727,36,35,1,3,29},
-{1727,1727,36,35,-2,3,28},
-{1998,1766,37,34,-2,4,27},
-{1536,1727,36,36,1,3,27},
-{1536,1803,39,34,-2,4,28},
-{1578,1803,36,34,-2,4,25},
-{1617,1803,35,34,-2,4,24},
-{1575,1727,36,36,1,3,29},
-{1655,1803,42,34,-2,4,29},
-{1700,1803,29,34,-2,4,16},
-{1766,1727,32,35,-2,4,20},
-{2007,1727,41,34,-2,4,29},
-{1732,1803,32,34,-2,4,23},
-{1767,1803,48,34,-2,4,35},
-{1818,1803,42,34,-2,4,29},
-{1614,1727,35,36,1,3,28},
-{1863,1803,37,34,-2,4,26},
-{1855,1680,35,41,1,3,28},
-{1801,1727,37,35,-2,4,28},
-{1652,1727,32,36,-2,3,21},
-{1903,1803,34,34,2,4,26},
-{1841,1727,38,35,2,4,29},
-{1940,1803,36,34,3,4,28},
-{1979,1803,46,34,3,4,38},
-{1536,1840,40,34,-2,4,28},
-{1579,1840,36,34,3,4,28},
-{1618,1840,34,34,-1,4,23},
-{1716,1680,25,44,-2,2,12},
-{1772,1680,18,44,4,2,19},
-{1744,1680,25,44,-4,2,12},
-{2006,1877,26,17,4,6,23},
-{1592,1907,33,14,-3,34,29},
-{1964,1877,18,18,5,4,19},
-{1908,1840,29,27,-1,11,19},
-{1761,1766,26,34,-1,4,18},
-{1940,1840,26,27,-1,11,18},
-{1790,1766,29,34,-1,4,19},
-{1969,1840,26,27,-1,11,18},
-{1793,1680,30,42,-5,3,13},
-{1822,1766,28,34,-2,11,18},
-{1853,1766,30,34,-2,4,19},
-{1886,1766,22,34,-2,4,12},
-{1826,1680,26,41,-5,4,12},
-{1911,1766,28,34,-2,4,18},
-{1942,1766,21,34,-2,4,10},
-{1998,1840,41,27,-2,11,31},
-{1536,1877,32,27,-2,11,21},
-{1571,1877,28,27,-1,11,19},
-{1719,1840,30,33,-3,11,19},
-{1752,1840,27,33,-1,11,18},
-{1602,1877,28,27,-2,11,17},
-{1633,1877,26,27,-2,11,16},
-{1782,1840,22,33,-1,5,13},
-{1662,1877,31,27,-2,11,20},
-{1696,1877,28,27,-2,11,18},
-{1727,1877,35,27,-2,11,25},
-{1765,1877,29,27,-2,11,18},
-{1966,1766,29,34,-2,11,18},
-{1797,1877,27,27,-2,11,16},
-{1653,1680,28,44,1,2,19},
-{1628,1680,22,44,-1,2,12},
-{1684,1680,29,44,-3,2,19},
-{1536,1907,28,16,4,4,23}}}
-}
-};
-#else
-extern const Font mainFont;
-#endif
 
 struct TextMaker {
 	VertexDescriptor VD;	
@@ -2499,17 +131,39 @@ struct TextMaker {
 	DescriptorSetLayout DSL;
 	RenderPass RP;
 	Pipeline P;
-	Model *M, *oldM = nullptr;
+	Model *M = nullptr, *oldM = nullptr;
 	Texture T;
 	DescriptorSet DS;
 	
 	std::unordered_map<int, TextBlock> Blocks = {};
 	int maxTextId = 0;
 	
-	Font fnt = mainFont;
+	Font fnt;
+	std::string fontFile = "assets/textures/FontsSDF.bin";
+	float outlineWidth = 2.0f;					// in pixels of the face
+	glm::vec2 shadowOffset = glm::vec2(3.0f);	// in pixels of the face
+	float smallScale = 2.0f / 3.0f;				// size of Small text
 	
 	bool commandBufferMustUpdate = false;
 	
+	// When hostRP is set, the text has no render pass and command buffer of its own:
+	// the owner of hostRP draws it calling populateInline() before ending the pass,
+	// and records its command buffer again whenever updateCommandBuffer() returns true.
+	// Replaced meshes wait in retired until the frames that used them are complete.
+	RenderPass *hostRP = nullptr;
+	std::vector<std::pair<Model *, uint64_t>> retired;
+	
+	// The HUD mesh has a copy of the glyph slots for each swapchain image: the
+	// copy of an image is written only when that image is about to be drawn
+	std::vector<HudBlock> Hud;
+	Model *H = nullptr;
+	unsigned char *hudMap = nullptr;
+	int hudSlots = 0;
+	int hudImages = 0;
+	bool hudMustRebuild = false;
+	bool hudMustRecord = false;	// a block was shown or hidden
+	
+	static void loadFont(std::string file, Font &Fnt, std::vector<unsigned char> &pixels);
 	void measureText(std::string Text, int &fontId, int &w, int &h, int &nlines, int &totChars, std::vector<int> &linew, std::vector<std::string> &lines);
 	int print(float x, float y, std::string Text, int id = -1,
 			  std::string FontFace = "SS",
@@ -2520,14 +174,30 @@ struct TextMaker {
 			  glm::vec4 Stroke = {0.0f,0.0f,0.0f,1.0f},
 			  glm::vec4 Shadow = {0.0f,0.0f,0.0f,0.0f},
 			  float sx = 1.0f, float sy = 1.0f);
+	int hudBlock(float x, float y, int capacity,
+			  std::string FontFace = "SS",
+			  bool Italic = false, bool Bold = false, bool Small = false,
+			  TextAlignment Alignment = TAL_LEFT,
+			  TextRegistrationH RegH = TRH_LEFT, TextRegistrationV RegV = TRV_TOP,
+			  glm::vec4 Fill = {1.0f,1.0f,1.0f,1.0f},
+			  glm::vec4 Stroke = {0.0f,0.0f,0.0f,1.0f},
+			  glm::vec4 Shadow = {0.0f,0.0f,0.0f,0.0f},
+			  float sx = 1.0f, float sy = 1.0f);
+	void hudPrintf(int id, const char *fmt, ...);
+	void hudShow(int id, bool show);
+	void hudLayout(HudBlock &B, int from);
+	void createHudMesh();
+	void writeHudSlots(HudBlock &B, int img, int from, int to);
+	void updateHud(int currentImage);
 	void removeText(int id);
 	void removeAllText();
-	void init(BaseProject *_BP, int sW, int sH, int so = 10000);
+	void init(BaseProject *_BP, int sW, int sH, int so = 10000, RenderPass *_hostRP = nullptr);
 	void resizeScreen(int sW, int sH);
 	void createTextDescriptorSetAndVertexLayout();
  	void createTextPipeline();
 	void pixelToScr(float x, float y, float &sx, float &sy);
-	void atlasToUV(int x, int y, Font &Fnt, float &u, float &v);void makeVertex(TextVertex *V, Font &Fnt, int px, int py, int tx, int ty);
+	void atlasToUV(float x, float y, Font &Fnt, float &u, float &v);
+	void makeVertex(TextVertex *V, Font &Fnt, float px, float py, float tx, float ty);
 	void createTextMesh();
 	void createTextDescriptorSets();
 	void pipelinesAndDescriptorSetsInit();
@@ -2536,14 +206,72 @@ struct TextMaker {
 	static void populateCommandBufferAccess(VkCommandBuffer commandBuffer, int currentImage, void *Params);
 	// This is the real place where the Command Buffer is written
     void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage);
+	void populateInline(VkCommandBuffer commandBuffer, int currentImage);
+	TextColorPushConstant pushConstants(glm::vec4 Fill, glm::vec4 Stroke, glm::vec4 Shadow);
 	static void freeCommandBuffer(void *Params);
-	void updateCommandBuffer();
+	void releaseRetired(bool all = false);
+	bool updateCommandBuffer();
 };
 
 
 
 #ifdef TEXTMAKER_IMPLEMENTATION 
 
+// Reads the glyph metrics and the inflated distance field of a font written by tools/FontSDF.cpp
+void TextMaker::loadFont(std::string file, Font &Fnt, std::vector<unsigned char> &pixels) {
+	std::vector<char> data = readFile(file);
+	size_t size = data.size();
+	// sinflate() reads the compressed stream 8 bytes at a time, up to 16 bytes past its end
+	data.resize(size + 16, 0);
+	const char *cur = data.data();
+	const char *end = cur + size;
+	auto get = [&](void *dst, size_t n) {
+		if((size_t)(end - cur) < n) {
+			throw std::runtime_error("truncated font file " + file);
+		}
+		memcpy(dst, cur, n);
+		cur += n;
+	};
+	
+	char magic[4];
+	int32_t hdr[6];
+	get(magic, sizeof(magic));
+	get(hdr, sizeof(hdr));
+	if((memcmp(magic, "BSDF", 4) != 0) || (hdr[0] != 1)) {
+		throw std::runtime_error("unsupported font file " + file);
+	}
+	Fnt.minChar = hdr[1];
+	Fnt.maxChar = hdr[2];
+	Fnt.texW = hdr[3];
+	Fnt.texH = hdr[4];
+	get(&Fnt.scale, sizeof(float));
+	get(&Fnt.spread, sizeof(float));
+	
+	int nChars = Fnt.maxChar - Fnt.minChar + 1;
+	Fnt.faces.resize(hdr[5]);
+	for(auto &F : Fnt.faces) {
+		int32_t lineHeight;
+		get(&lineHeight, sizeof(lineHeight));
+		F.lineHeight = lineHeight;
+		F.P.resize(nChars);
+		for(auto &d : F.P) {
+			int16_t v[7];
+			get(v, sizeof(v));
+			d = {v[0], v[1], v[2], v[3], v[4], v[5], v[6]};
+		}
+	}
+	
+	int32_t packedSize;
+	get(&packedSize, sizeof(packedSize));
+	if((packedSize < 0) || (end - cur < packedSize)) {
+		throw std::runtime_error("truncated font file " + file);
+	}
+	pixels.resize(Fnt.texW * Fnt.texH);
+	if(sinflate(pixels.data(), (int)pixels.size(), cur, packedSize) != (int)pixels.size()) {
+		throw std::runtime_error("corrupted font file " + file);
+	}
+}
+
 void TextMaker::measureText(std::string Text, int &fontId, int &w, int &h, int &nlines, int &totChars, std::vector<int> &linew, std::vector<std::string> &lines) {
 	int curWidth = 0;
 	std::string curStr = "";
@@ -2555,7 +283,7 @@ void TextMaker::measureText(std::string Text, int &fontId, int &w, int &h, int &
 	for(int j = 0; j < Text.length(); j++) {
 		int c = ((int)Text[j]) - fnt.minChar;
 //std::cout << "Considering char: " << c << "(" << (int)Text[j] << ")\n";
-		if((c >= 0) && (c <= fnt.maxChar)) {
+		if((c >= 0) && (c <= fnt.maxChar - fnt.minChar)) {
 			CharData d = fnt.faces[fontId].P[c];
 			curWidth += d.xadvance;
 			curStr = curStr + Text[j];
@@ -2605,8 +333,26 @@ int TextMaker::print(float x, float y, std::string Text, int id,
 		maxTextId = id;
 	}
 	
-	fontId = (FontFace == "SS" ? 8 : (FontFace == "SR" ? 16 : 0)) +
-			 (Bold   ? 2 : 0) + (Italic ? 1 : 0) +(Small  ? 4 : 0);
+	// Printing the same text again leaves the mesh and the command buffers as they are
+	auto found = Blocks.find(id);
+	if(found != Blocks.end()) {
+		TextBlock &O = found->second;
+		if((O.Text == Text) && (O.FontFace == FontFace) && (O.Italic == Italic) &&
+		   (O.Bold == Bold) && (O.Small == Small) && (O.x == x) && (O.y == y) &&
+		   (O.sx == (Small ? sx * smallScale : sx)) && (O.sy == (Small ? sy * smallScale : sy)) &&
+		   (O.Fill == Fill) && (O.Stroke == Stroke) && (O.Shadow == Shadow) &&
+		   (O.Alignment == Alignment) && (O.RegH == RegH) && (O.RegV == RegV)) {
+			return id;
+		}
+	}
+	
+	// Small text is drawn scaling the distance field of the regular size
+	fontId = (FontFace == "SS" ? 4 : (FontFace == "SR" ? 8 : 0)) +
+			 (Bold   ? 2 : 0) + (Italic ? 1 : 0);
+	if(Small) {
+		sx *= smallScale;
+		sy *= smallScale;
+	}
 
 	measureText(Text, fontId, w, h, nlines, totChars, linew, lines);
 //std::cout << id << "\n";
@@ -2620,6 +366,232 @@ int TextMaker::print(float x, float y, std::string Text, int id,
 	return id;
 }
 
+// Creates a HUD block for up to capacity characters, with the same parameters of print()
+int TextMaker::hudBlock(float x, float y, int capacity,
+		  std::string FontFace,
+		  bool Italic, bool Bold, bool Small,
+		  TextAlignment Alignment,
+		  TextRegistrationH RegH, TextRegistrationV RegV,
+		  glm::vec4 Fill,
+		  glm::vec4 Stroke,
+		  glm::vec4 Shadow,
+		  float sx, float sy) {
+	if(Small) {
+		sx *= smallScale;
+		sy *= smallScale;
+	}
+	capacity = std::min(std::max(capacity, 1), HudMaxChars);
+	
+	HudBlock B;
+	B.x = x;
+	B.y = y;
+	B.sx = sx;
+	B.sy = sy;
+	B.fontId = (FontFace == "SS" ? 4 : (FontFace == "SR" ? 8 : 0)) +
+			   (Bold   ? 2 : 0) + (Italic ? 1 : 0);
+	B.Alignment = Alignment;
+	B.RegH = RegH;
+	B.RegV = RegV;
+	B.Fill = Fill;
+	B.Stroke = Stroke;
+	B.Shadow = Shadow;
+	B.first = hudSlots;
+	B.capacity = capacity;
+	B.visible = true;
+	B.text[0] = 0;
+	B.len = 0;
+	B.w = 0;
+	B.nlines = 0;
+	B.penX.assign(capacity, 0);
+	B.line.assign(capacity, 0);
+	B.linew.assign(capacity + 1, 0);
+	Hud.push_back(B);
+	
+	hudSlots += capacity;
+	hudMustRebuild = true;
+	commandBufferMustUpdate = true;
+	return Hud.size() - 1;
+}
+
+// Formats the text of a HUD block. Only the characters from the first one that
+// differs are measured again, and only the slots whose quads moved are rewritten.
+void TextMaker::hudPrintf(int id, const char *fmt, ...) {
+	HudBlock &B = Hud[id];
+	char buf[HudMaxChars + 1];
+	
+	va_list args;
+	va_start(args, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	n = std::min(std::max(n, 0), B.capacity);
+	buf[n] = 0;
+	
+	int k = 0;
+	while((k < n) && (k < B.len) && (buf[k] == B.text[k])) {
+		k++;
+	}
+	if((k == n) && (n == B.len)) {
+		return;
+	}
+	
+	int oldLen = B.len, oldW = B.w, oldLines = B.nlines;
+	memcpy(B.text, buf, n + 1);
+	B.len = n;
+	hudLayout(B, k);
+	
+	// A change of the block size moves every line that depends on it, and a change
+	// of a line width moves the characters before k of that line
+	int from = k;
+	if((((B.RegH != TRH_LEFT) || (B.Alignment != TAL_LEFT)) && (B.w != oldW)) ||
+	   ((B.RegV != TRV_TOP) && (B.nlines != oldLines))) {
+		from = 0;
+	} else if(B.Alignment != TAL_LEFT) {
+		while((from > 0) && (B.text[from - 1] != '\n')) {
+			from--;
+		}
+	}
+	int to = std::max(oldLen, n);
+	for(int i = 0; i < (int)B.dirtyFrom.size(); i++) {
+		B.dirtyFrom[i] = std::min(B.dirtyFrom[i], from);
+		B.dirtyTo[i] = std::max(B.dirtyTo[i], to);
+	}
+}
+
+// Shows or hides a HUD block. The text of a hidden block can still be changed:
+// its slots are written when it is shown again.
+void TextMaker::hudShow(int id, bool show) {
+	if(Hud[id].visible != show) {
+		Hud[id].visible = show;
+		hudMustRecord = true;
+	}
+}
+
+// Measures the text from character from, and updates the line widths
+void TextMaker::hudLayout(HudBlock &B, int from) {
+	FontDef &F = fnt.faces[B.fontId];
+	auto advance = [&](char ch) {
+		int c = ((int)ch) - fnt.minChar;
+		return ((c >= 0) && (c <= fnt.maxChar - fnt.minChar)) ? F.P[c].xadvance : 0;
+	};
+	
+	int pen = 0, ln = 0;
+	if(from > 0) {
+		if(B.text[from - 1] == '\n') {
+			ln = B.line[from - 1] + 1;
+		} else {
+			pen = B.penX[from - 1] + advance(B.text[from - 1]);
+			ln = B.line[from - 1];
+		}
+	}
+	for(int k = from; k < B.len; k++) {
+		B.penX[k] = pen;
+		B.line[k] = ln;
+		if(B.text[k] == '\n') {
+			pen = 0;
+			ln++;
+		} else {
+			pen += advance(B.text[k]);
+		}
+	}
+	
+	// as in measureText(), a last line without characters is not counted
+	int cur = 0;
+	B.w = 0;
+	B.nlines = 0;
+	for(int k = 0; k < B.len; k++) {
+		if(B.text[k] == '\n') {
+			B.linew[B.nlines++] = cur;
+			B.w = std::max(B.w, cur);
+			cur = 0;
+		} else {
+			cur = B.penX[k] + advance(B.text[k]);
+		}
+	}
+	if(cur > 0) {
+		B.linew[B.nlines++] = cur;
+		B.w = std::max(B.w, cur);
+	}
+}
+
+// Creates the HUD mesh with all the slots empty: each image rewrites its copy when drawn
+void TextMaker::createHudMesh() {
+	hudImages = BP->getSwapChainImageCount();
+	int mainStride = VD.Bindings[0].stride;
+	
+	H = new Model();
+	H->vertices.assign(hudImages * hudSlots * 4 * mainStride, 0);
+	H->indices.resize(hudSlots * 6);
+	for(int k = 0; k < hudSlots; k++) {
+		H->indices[6 * k + 0] = 4 * k + 0;
+		H->indices[6 * k + 1] = 4 * k + 1;
+		H->indices[6 * k + 2] = 4 * k + 2;
+		H->indices[6 * k + 3] = 4 * k + 1;
+		H->indices[6 * k + 4] = 4 * k + 2;
+		H->indices[6 * k + 5] = 4 * k + 3;
+	}
+	H->initMesh(BP, &VD, false);
+	hudMap = H->mapVertices();
+	
+	for(auto &B : Hud) {
+		B.dirtyFrom.assign(hudImages, 0);
+		B.dirtyTo.assign(hudImages, B.capacity);
+	}
+}
+
+// Writes the quads of slots [from, to) of a block in the copy of image img; the
+// slots past the end of the text, and of new lines, get degenerate quads
+void TextMaker::writeHudSlots(HudBlock &B, int img, int from, int to) {
+	FontDef &F = fnt.faces[B.fontId];
+	TextVertex *V = (TextVertex *)hudMap + (img * hudSlots + B.first + from) * 4;
+	
+	float h = (float)(B.nlines * F.lineHeight);
+	float btpx = (B.x + 1.0f)/2.0f * screenW - B.sx * (
+			(B.RegH == TRH_RIGHT  ? (float)B.w      : 0.0f) +
+			(B.RegH == TRH_CENTER ? (float)B.w/2.0f : 0.0f));
+	float btpy = (B.y + 1.0f)/2.0f * screenH - B.sy * (
+			(B.RegV == TRV_BOTTOM ? h      : 0.0f) +
+			(B.RegV == TRV_MIDDLE ? h/2.0f : 0.0f));
+	float alignF = (B.Alignment == TAL_LEFT ? 0.0f :
+				   (B.Alignment == TAL_CENTER ? 0.5f : 1.0f));
+	
+	for(int k = from; k < to; k++, V += 4) {
+		int c = (k < B.len) ? ((int)B.text[k]) - fnt.minChar : -1;
+		if((c < 0) || (c > fnt.maxChar - fnt.minChar)) {
+			memset(V, 0, 4 * sizeof(TextVertex));
+			continue;
+		}
+		const CharData &d = F.P[c];
+		float tw = (float)d.width * fnt.scale;
+		float th = (float)d.height * fnt.scale;
+		float tpx = btpx + ((float)(B.w - B.linew[B.line[k]]) * alignF + (float)B.penX[k]) * B.sx;
+		float tpy = btpy + (float)(B.line[k] * F.lineHeight) * B.sy;
+		
+		makeVertex(V + 0, fnt, tpx + (float)d.xoffset * B.sx,
+							   tpy + (float)d.yoffset * B.sy, d.x, d.y);
+		makeVertex(V + 1, fnt, tpx + (float)(d.xoffset + d.width) * B.sx,
+							   tpy + (float)d.yoffset * B.sy, d.x + tw, d.y);
+		makeVertex(V + 2, fnt, tpx + (float)d.xoffset * B.sx,
+							   tpy + (float)(d.yoffset + d.height) * B.sy, d.x, d.y + th);
+		makeVertex(V + 3, fnt, tpx + (float)(d.xoffset + d.width) * B.sx,
+							   tpy + (float)(d.yoffset + d.height) * B.sy, d.x + tw, d.y + th);
+	}
+}
+
+// Brings the HUD copy of currentImage up to date: call it every frame, after
+// updateCommandBuffer(), from where the uniform buffers of the image are written
+void TextMaker::updateHud(int currentImage) {
+	if(hudMap == nullptr) {
+		return;
+	}
+	for(auto &B : Hud) {
+		if(B.visible && (B.dirtyFrom[currentImage] < B.dirtyTo[currentImage])) {
+			writeHudSlots(B, currentImage, B.dirtyFrom[currentImage], B.dirtyTo[currentImage]);
+			B.dirtyFrom[currentImage] = B.capacity;
+			B.dirtyTo[currentImage] = 0;
+		}
+	}
+}
+
 void TextMaker::removeText(int id) {
 	Blocks.erase(id);
 	commandBufferMustUpdate = true;
@@ -2630,22 +602,27 @@ void TextMaker::removeAllText() {
 	commandBufferMustUpdate = true;
 }
 
-void TextMaker::init(BaseProject *_BP, int sW, int sH, int so) {
+void TextMaker::init(BaseProject *_BP, int sW, int sH, int so, RenderPass *_hostRP) {
 	BP = _BP;
 	screenW = sW;
 	screenH = sH;
 	submitOrder = so;
+	hostRP = _hostRP;
 
 	createTextDescriptorSetAndVertexLayout();
 	createTextPipeline();
 
 //		RP.init(BP);
-	RP.init(BP, sW, sH, -1,
-				RenderPass::getStandardAttchmentsProperties(AT_SURFACE_NOAA_DEPTH, BP));
-	RP.properties[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	RP.properties[1].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	if(hostRP == nullptr) {
+		RP.init(BP, sW, sH, -1,
+					RenderPass::getStandardAttchmentsProperties(AT_SURFACE_NOAA_DEPTH, BP));
+		RP.properties[0].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		RP.properties[1].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	}
 
-	T.init(BP, fnt.textureFile);
+	std::vector<unsigned char> pixels;
+	loadFont(fontFile, fnt, pixels);
+	T.init(BP, pixels.data(), fnt.texW, fnt.texH, 1, VK_FORMAT_R8_UNORM);
 	
 	BP->DPSZs.texturesInPool += 2;	// Since text can be written before the old is released
 	BP->DPSZs.setsInPool += 2;		// we need twice the descriptors (old + new)
@@ -2654,8 +631,14 @@ void TextMaker::init(BaseProject *_BP, int sW, int sH, int so) {
 void TextMaker::resizeScreen(int sW, int sH) {
 	screenW = sW;
 	screenH = sH;
-	RP.width = sW;
-	RP.height = sH;
+	if(hostRP == nullptr) {
+		RP.width = sW;
+		RP.height = sH;
+	}
+	for(auto &B : Hud) {
+		B.dirtyFrom.assign(B.dirtyFrom.size(), 0);
+		B.dirtyTo.assign(B.dirtyTo.size(), B.capacity);
+	}
 	commandBufferMustUpdate = true;
 }
 
@@ -2686,25 +669,29 @@ void TextMaker::pixelToScr(float x, float y, float &sx, float &sy) {
 	sy = (y + 0.5f) / (float)screenH * 2.0f - 1.0f;
 }
 
-void TextMaker::atlasToUV(int x, int y, Font &Fnt, float &u, float &v) {
-	u = ((float)x + 0.5f) / (float)Fnt.texW;
-	v = ((float)y + 0.5f) / (float)Fnt.texH;
+void TextMaker::atlasToUV(float x, float y, Font &Fnt, float &u, float &v) {
+	u = x / (float)Fnt.texW;
+	v = y / (float)Fnt.texH;
 }
 
-void TextMaker::makeVertex(TextVertex *V, Font &Fnt, int px, int py, int tx, int ty) {
+void TextMaker::makeVertex(TextVertex *V, Font &Fnt, float px, float py, float tx, float ty) {
 	pixelToScr(px, py, V->pos.x, V->pos.y);
 	atlasToUV(tx, ty, Fnt, V->texCoord.x, V->texCoord.y);
 }
 
 void TextMaker::createTextMesh() {
-	M = new Model();
-	Font fnt = mainFont;
 	int totLen = 0;
 	
 	for(auto& Blk : Blocks) {
 		totLen += Blk.second.totChars;
 //std::cout << Blk.first << ", characters: " << Blk.second.totChars << ", lines:" << Blk.second.nlines << ", w: " << Blk.second.w << ", h:" << Blk.second.h << "\n";
 	}
+	// buffers cannot be empty: with no characters to show, there is no mesh
+	if(totLen == 0) {
+		M = nullptr;
+		return;
+	}
+	M = new Model();
 	int mainStride = VD.Bindings[0].stride;
 	
 //std::cout << "Total characters: " << totLen << "\n";
@@ -2739,6 +726,8 @@ void TextMaker::createTextMesh() {
 //std::cout << "]>" << Blk.lines[i][j] << "<[ (" << ((int)Blk.lines[i][j]) << ") - c: " << c << " (< " << (fnt.maxChar - fnt.minChar) << ")\n";
 				if((c >= 0) && (c <= fnt.maxChar - fnt.minChar)) {
 					CharData d = fnt.faces[Blk.fontId].P[c];
+					float tw = (float)d.width * fnt.scale;
+					float th = (float)d.height * fnt.scale;
 					
 					makeVertex(V_vertex, fnt,
 							   tpx + (float)d.xoffset * Blk.sx,
@@ -2749,19 +738,19 @@ void TextMaker::createTextMesh() {
 					makeVertex(V_vertex, fnt,
 							   tpx + (float)(d.xoffset + d.width) * Blk.sx,
 							   tpy + (float) d.yoffset * Blk.sy,
-							   d.x + d.width, d.y);
+							   d.x + tw, d.y);
 					V_vertex++;
 					
 					makeVertex(V_vertex, fnt,
 							   tpx + (float) d.xoffset * Blk.sx,
 							   tpy + (float)(d.yoffset + d.height) * Blk.sy,
-							   d.x, d.y + d.height);
+							   d.x, d.y + th);
 					V_vertex++;
 
 					makeVertex(V_vertex, fnt,
 							   tpx + (float)(d.xoffset + d.width)  * Blk.sx,
 							   tpy + (float)(d.yoffset + d.height) * Blk.sy,
-							   d.x + d.width, d.y + d.height);
+							   d.x + tw, d.y + th);
 					V_vertex++;
 					
 					M->indices[ib + 0] = 4 * k + 0;
@@ -2791,14 +780,21 @@ void TextMaker::createTextDescriptorSets() {
 }
 
 void TextMaker::pipelinesAndDescriptorSetsInit() {
-	RP.create();
-	P.create(&RP);
+	// the host render pass must have already been created
+	if(hostRP == nullptr) {
+		RP.create();
+		P.create(&RP);
+	} else {
+		P.create(hostRP);
+	}
 	createTextDescriptorSets();
 }
 
 void TextMaker::pipelinesAndDescriptorSetsCleanup() {
 	P.cleanup();
-	RP.cleanup();
+	if(hostRP == nullptr) {
+		RP.cleanup();
+	}
 	DS.cleanup();
 }
 
@@ -2807,11 +803,24 @@ void TextMaker::localCleanup() {
 	
 	if(M != nullptr) {
 		M->cleanup();
+		// drawn inline, the mesh is not owned by a command buffer
+		if(hostRP != nullptr) {
+			delete M;
+			M = nullptr;
+		}
 	}
+	if(H != nullptr) {
+		H->cleanup();
+		delete H;
+		H = nullptr;
+	}
+	releaseRetired(true);
 	DSL.cleanup();
 	
 	P.destroy();
-	RP.destroy();
+	if(hostRP == nullptr) {
+		RP.destroy();
+	}
 }
 
 void TextMaker::populateCommandBufferAccess(VkCommandBuffer commandBuffer, int currentImage, void *Params) {
@@ -2823,41 +832,127 @@ void TextMaker::populateCommandBufferAccess(VkCommandBuffer commandBuffer, int c
 void TextMaker::populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
 //std::cout << "Populating for image: " << currentImage << "\n";
 	RP.begin(commandBuffer, currentImage);
+	populateInline(commandBuffer, currentImage);
+	RP.end(commandBuffer);			
+}
+
+// Records the text draws in the render pass already begun on commandBuffer
+void TextMaker::populateInline(VkCommandBuffer commandBuffer, int currentImage) {
+	if((M == nullptr) && (H == nullptr)) {
+		return;
+	}
 	P.bind(commandBuffer);
-	M->bind(commandBuffer);
 	DS.bind(commandBuffer, P, 0, currentImage);
 	
-	for(auto& Blk : Blocks) {
+	if(M != nullptr) {
+		M->bind(commandBuffer);
+		for(auto& Blk : Blocks) {
 //std::cout << Blk.second.start << " " << Blk.second.len << "\n";
-		// Sends the Push-Constant with the colors
-		TextColorPushConstant PKv;
-		PKv.Fill   = Blk.second.Fill;
-		PKv.Stroke = Blk.second.Stroke;
-		PKv.Shadow = Blk.second.Shadow;
-		vkCmdPushConstants(
-			commandBuffer,
-			P.pipelineLayout,
-			VK_SHADER_STAGE_FRAGMENT_BIT,
-			0,
-			sizeof(PKv),
-			&PKv);
-				
-		vkCmdDrawIndexed(commandBuffer,
-						static_cast<uint32_t>(Blk.second.len), 1,
-						static_cast<uint32_t>(Blk.second.start), 0, 0);
+			// Sends the Push-Constant with the colors
+			TextColorPushConstant PKv = pushConstants(Blk.second.Fill, Blk.second.Stroke, Blk.second.Shadow);
+			vkCmdPushConstants(
+				commandBuffer,
+				P.pipelineLayout,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				0,
+				sizeof(PKv),
+				&PKv);
+					
+			vkCmdDrawIndexed(commandBuffer,
+							static_cast<uint32_t>(Blk.second.len), 1,
+							static_cast<uint32_t>(Blk.second.start), 0, 0);
+			BP->recordedDraws++;
+		}
+	}
+	
+	if(H != nullptr) {
+		// all the slots of the visible blocks are drawn, from the copy of the current image
+		H->bind(commandBuffer);
+		for(auto& B : Hud) {
+			if(!B.visible) {
+				continue;
+			}
+			TextColorPushConstant PKv = pushConstants(B.Fill, B.Stroke, B.Shadow);
+			vkCmdPushConstants(
+				commandBuffer,
+				P.pipelineLayout,
+				VK_SHADER_STAGE_FRAGMENT_BIT,
+				0,
+				sizeof(PKv),
+				&PKv);
+			
+			vkCmdDrawIndexed(commandBuffer,
+							static_cast<uint32_t>(6 * B.capacity), 1,
+							static_cast<uint32_t>(6 * B.first),
+							currentImage * hudSlots * 4, 0);
+			BP->recordedDraws++;
+		}
 	}
-	RP.end(commandBuffer);			
+}
+
+TextColorPushConstant TextMaker::pushConstants(glm::vec4 Fill, glm::vec4 Stroke, glm::vec4 Shadow) {
+	TextColorPushConstant PKv;
+	PKv.Fill   = Fill;
+	PKv.Stroke = Stroke;
+	PKv.Shadow = Shadow;
+	// Outline and shadow are given in pixels of the face, and scale with the text
+	PKv.Edges = glm::vec4(0.5f, 0.5f - outlineWidth / (2.0f * fnt.spread),
+						  shadowOffset.x * fnt.scale / (float)fnt.texW,
+						  shadowOffset.y * fnt.scale / (float)fnt.texH);
+	return PKv;
 }
 
 void TextMaker::freeCommandBuffer(void *Params) {
 	Model *M = ((TextMakerAndModel *)Params)->M;
-	M->cleanup();
+	if(M != nullptr) {
+		M->cleanup();
+	}
 	
 	free(Params);
 }	
 
-void TextMaker::updateCommandBuffer() {
-	if(commandBufferMustUpdate) {
+// Frees the meshes replaced at least MAX_FRAMES_IN_FLIGHT frames ago (all of them at cleanup)
+void TextMaker::releaseRetired(bool all) {
+	int j = 0;
+	for(auto &r : retired) {
+		if(all || (BP->frameCount >= r.second + MAX_FRAMES_IN_FLIGHT)) {
+			r.first->cleanup();
+			delete r.first;
+		} else {
+			retired[j++] = r;
+		}
+	}
+	retired.resize(j);
+}
+
+// Returns true if the text has changed, or a HUD block was shown or hidden. When
+// drawn inline, the host command buffer must then be recorded again before the next frame.
+bool TextMaker::updateCommandBuffer() {
+	releaseRetired();
+	if(commandBufferMustUpdate && hudMustRebuild) {
+		if(H != nullptr) {
+			retired.push_back({H, BP->frameCount});
+		}
+		createHudMesh();
+		hudMustRebuild = false;
+	}
+	
+	if(hostRP != nullptr) {
+		if(!commandBufferMustUpdate) {
+			bool record = hudMustRecord;
+			hudMustRecord = false;
+			return record;
+		}
+		if(M != nullptr) {
+			retired.push_back({M, BP->frameCount});
+		}
+		createTextMesh();
+		commandBufferMustUpdate = false;
+		hudMustRecord = false;
+		return true;
+	}
+	
+	if(commandBufferMustUpdate || hudMustRecord) {
 //std::cout << "Creating text mesh\n";
 		createTextMesh();	// creates the new mesh
 		
@@ -2870,6 +965,9 @@ void TextMaker::updateCommandBuffer() {
 							TextMaker::freeCommandBuffer);
 //std::cout << "Submitted\n";							
 		commandBufferMustUpdate = false;
+		hudMustRecord = false;
+		return true;
 	}
+	return false;
 }
 #endif    
@@ -3,14 +3,17 @@
 
 layout(binding = 0, set = 1) uniform UniformBufferObject {
 	vec4 debug1;
-	mat4 mvpMat[65];
-	mat4 mMat[65];
-	mat4 nMat[65];
+	mat4 vpMat;
 } ubo;
 
+// skinning palette: one row-major 3x4 matrix per joint (world * joint), the
+// number of joints is only limited by the size of the buffer
+layout(std430, binding = 2, set = 1) readonly buffer JointPalette {
+	vec4 rows[];
+} palette;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNorm;
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNorm;
 layout(location = 2) in vec2 inUV;
 layout(location = 3) in uvec4 inJointIndex;
 layout(location = 4) in vec4 inJointWeight;
@@ -20,45 +23,45 @@ layout(location = 1) out vec3 fragNorm;
 layout(location = 2) out vec2 fragUV;
 layout(location = 3) out vec2 debug2;
 
+layout(push_constant) uniform VertexDequant {
+	mat4 posMat;
+	vec4 uvOffsetScale;
+} dq;
+
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 void main() {
+	vec4 pos = dq.posMat * inPosition;
+	vec3 norm = octDecode(inNorm);
+
+	// blends the joint matrices first, then transforms the vertex once
+	vec4 r0, r1, r2;
 	if(ubo.debug1.x == 1.0f) {
-		gl_Position = ubo.mvpMat[0] * vec4(inPosition, 1.0);
-		fragPos = (ubo.mMat[0] * vec4(inPosition, 1.0)).xyz;
-		fragNorm = (ubo.nMat[0] * vec4(inNorm, 0.0)).xyz;
+		r0 = palette.rows[0];
+		r1 = palette.rows[1];
+		r2 = palette.rows[2];
 	} else {
-		gl_Position = inJointWeight.x * 
-					  ubo.mvpMat[inJointIndex.x] * vec4(inPosition, 1.0);
-		fragPos = inJointWeight.x * 
-				  (ubo.mMat[inJointIndex.x] * vec4(inPosition, 1.0)).xyz;
-		fragNorm = inJointWeight.x * 
-				   (ubo.nMat[inJointIndex.x] * vec4(inNorm, 0.0)).xyz;
-		
-		gl_Position += inJointWeight.y * 
-					  ubo.mvpMat[inJointIndex.y] * vec4(inPosition, 1.0);
-		fragPos += inJointWeight.y * 
-				  (ubo.mMat[inJointIndex.y] * vec4(inPosition, 1.0)).xyz;
-		fragNorm += inJointWeight.y * 
-				   (ubo.nMat[inJointIndex.y] * vec4(inNorm, 0.0)).xyz;
-		
-		gl_Position += inJointWeight.z * 
-					  ubo.mvpMat[inJointIndex.z] * vec4(inPosition, 1.0);
-		fragPos += inJointWeight.z * 
-				  (ubo.mMat[inJointIndex.z] * vec4(inPosition, 1.0)).xyz;
-		fragNorm += inJointWeight.z * 
-				   (ubo.nMat[inJointIndex.z] * vec4(inNorm, 0.0)).xyz;
-		
-		gl_Position += inJointWeight.w * 
-					  ubo.mvpMat[inJointIndex.w] * vec4(inPosition, 1.0);
-		fragPos += inJointWeight.w * 
-				  (ubo.mMat[inJointIndex.w] * vec4(inPosition, 1.0)).xyz;
-		fragNorm += inJointWeight.w * 
-				   (ubo.nMat[inJointIndex.w] * vec4(inNorm, 0.0)).xyz;
+		uvec4 j = inJointIndex * 3;
+		vec4 w = inJointWeight;
+		r0 = w.x * palette.rows[j.x]     + w.y * palette.rows[j.y]     + w.z * palette.rows[j.z]     + w.w * palette.rows[j.w];
+		r1 = w.x * palette.rows[j.x + 1] + w.y * palette.rows[j.y + 1] + w.z * palette.rows[j.z + 1] + w.w * palette.rows[j.w + 1];
+		r2 = w.x * palette.rows[j.x + 2] + w.y * palette.rows[j.y + 2] + w.z * palette.rows[j.z + 2] + w.w * palette.rows[j.w + 2];
 	}
-	fragUV = inUV;
+	fragPos = vec3(dot(r0, pos), dot(r1, pos), dot(r2, pos));
+	// the joints have no shear, so the blended matrix also transforms the normals
+	fragNorm = vec3(dot(r0.xyz, norm), dot(r1.xyz, norm), dot(r2.xyz, norm));
+	gl_Position = ubo.vpMat * vec4(fragPos, 1.0);
+
+	fragUV = dq.uvOffsetScale.xy + inUV * dq.uvOffsetScale.zw;
 	debug2 = vec2(ubo.debug1.y, 
 		 ((int(ubo.debug1.z) == inJointIndex.x) ? inJointWeight.x : 0.0f) +
 		 ((int(ubo.debug1.z) == inJointIndex.y) ? inJointWeight.y : 0.0f) +
 		 ((int(ubo.debug1.z) == inJointIndex.z) ? inJointWeight.z : 0.0f) +
 		 ((int(ubo.debug1.z) == inJointIndex.w) ? inJointWeight.w : 0.0f) 
 		);
-}
\ No newline at end of file
+}
@@ -0,0 +1,25 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Characters skinned by PreSkin.comp: the vertices are already in world space
+layout(binding = 0, set = 1) uniform UniformBufferObject {
+	vec4 debug1;
+	mat4 vpMat;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNorm;
+layout(location = 2) in vec2 inUV;
+
+layout(location = 0) out vec3 fragPos;
+layout(location = 1) out vec3 fragNorm;
+layout(location = 2) out vec2 fragUV;
+layout(location = 3) out vec2 debug2;
+
+void main() {
+	gl_Position = ubo.vpMat * vec4(inPosition, 1.0);
+	fragPos = inPosition;
+	fragNorm = inNorm;
+	fragUV = inUV;
+	debug2 = vec2(ubo.debug1.y, 0.0);
+}
@@ -7,8 +7,8 @@ layout(binding = 0, set = 1) uniform UniformBufferObject {
 	mat4 nMat;
 } ubo;
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNorm;
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNorm;
 layout(location = 2) in vec2 inUV;
 layout(location = 3) in vec4 inTangent;
 
@@ -17,10 +17,23 @@ layout(location = 1) out vec3 fragNorm;
 layout(location = 2) out vec2 fragUV;
 layout(location = 3) out vec4 fragTan;
 
+layout(push_constant) uniform VertexDequant {
+	mat4 posMat;
+	vec4 uvOffsetScale;
+} dq;
+
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 void main() {
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
-	fragPos = (ubo.mMat * vec4(inPosition, 1.0)).xyz;
-	fragNorm = normalize((ubo.nMat * vec4(inNorm, 0.0)).xyz);
-	fragUV = inUV;
+	vec4 pos = dq.posMat * inPosition;
+	gl_Position = ubo.mvpMat * pos;
+	fragPos = (ubo.mMat * pos).xyz;
+	fragNorm = normalize((ubo.nMat * vec4(octDecode(inNorm), 0.0)).xyz);
+	fragUV = dq.uvOffsetScale.xy + inUV * dq.uvOffsetScale.zw;
 	fragTan = vec4(normalize(mat3(ubo.mMat) * inTangent.xyz), inTangent.w);
 }
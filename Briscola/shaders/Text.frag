@@ -1,16 +1,31 @@
-#version 450#extension GL_ARB_separate_shader_objects : enable
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
 
 layout(location = 0) in vec2 fragTexCoord;
 
 layout(location = 0) out vec4 outColor;
 
+// signed distance field of the glyphs: 0.5 on the edge, growing inside
 layout(binding = 0) uniform sampler2D texSampler;
 
-layout(push_constant) uniform PushConsts {	vec4 FGcolor;
+layout(push_constant) uniform PushConsts {
+	vec4 FGcolor;
 	vec4 BGcolor;
-	vec4 SHcolor;} pushConsts;
+	vec4 SHcolor;
+	vec4 Edges;		// fill edge, outline edge, shadow offset in UV
+} pushConsts;
 
 void main() {
-	vec4 Tx = texture(texSampler, fragTexCoord);
-	outColor = Tx.r * pushConsts.FGcolor +			   Tx.g * pushConsts.BGcolor +			   Tx.b * pushConsts.SHcolor;
-}
\ No newline at end of file
+	float d = texture(texSampler, fragTexCoord).r;
+	// half a screen pixel in distance units, so the edges stay sharp at any scale
+	float aa = max(0.5 * fwidth(d), 1.0e-4);
+
+	float fill = smoothstep(pushConsts.Edges.x - aa, pushConsts.Edges.x + aa, d);
+	float outline = smoothstep(pushConsts.Edges.y - aa, pushConsts.Edges.y + aa, d);
+	float ds = texture(texSampler, fragTexCoord - pushConsts.Edges.zw).r;
+	float shadow = smoothstep(pushConsts.Edges.y - 4.0 * aa, pushConsts.Edges.y + aa, ds);
+
+	outColor = fill * pushConsts.FGcolor +
+			   (outline - fill) * pushConsts.BGcolor +
+			   shadow * (1.0 - outline) * pushConsts.SHcolor;
+}
@@ -10,8 +10,8 @@ layout(binding = 0, set = 1) uniform UniformBufferObject {
 } ubo;
 
 
-layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inNorm;
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec2 inNorm;
 layout(location = 2) in vec2 inUV;
 
 layout(location = 0) out vec3 fragPos;
@@ -20,18 +20,31 @@ layout(location = 2) out vec2 fragUV;
 layout(location = 3) flat out int vCardIndex;
 layout(location = 4) flat out int hCardIndex;
 
+layout(push_constant) uniform VertexDequant {
+	mat4 posMat;
+	vec4 uvOffsetScale;
+} dq;
+
+vec3 octDecode(vec2 e) {
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
 void main() {
 	// vertex shader
-	gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
-	vec4 wp     = ubo.mMat * vec4(inPosition, 1.0);
+	vec4 pos    = dq.posMat * inPosition;
+	gl_Position = ubo.mvpMat * pos;
+	vec4 wp     = ubo.mMat * pos;
 	fragPos     = wp.xyz;
-	fragNorm    = mat3(ubo.nMat) * inNorm;  // then normalize in FS
+	fragNorm    = mat3(ubo.nMat) * octDecode(inNorm);  // then normalize in FS
 	
 
 	//gl_Position = ubo.mvpMat * vec4(inPosition, 1.0);
 	//fragPos = (ubo.mMat * vec4(inPosition, 1.0)).xyz;
 	//fragNorm = (ubo.nMat * vec4(inNorm, 0.0)).xyz;
-	fragUV = inUV;
+	fragUV = dq.uvOffsetScale.xy + inUV * dq.uvOffsetScale.zw;
     vCardIndex = ubo.cardIndex;
 	hCardIndex = ubo.hCardIndex;
 }
\ No newline at end of file
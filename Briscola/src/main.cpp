@@ -1,7 +1,7 @@
 // This has been adapted from the Vulkan tutorial
-#include <sstream>
 
 #include <json.hpp>
+#include <cctype>
 
 #include "modules/Starter.hpp"
 #include "modules/TextMaker.hpp"
@@ -12,18 +12,27 @@
 #include "modules/CardAnimator.hpp"
 
 // The uniform buffer object used in this example
+// Packed vertex formats: positions and UVs are normalized in the model bounds
+// (restored with Model::pushDequant()), normals are octahedral encoded
 struct VertexChar {
-	glm::vec3 pos;
-	glm::vec3 norm;
-	glm::vec2 UV;
-	glm::uvec4 jointIndices;
-	glm::vec4 weights;
+	int16_t pos[4];
+	int16_t norm[2];
+	uint16_t UV[2];
+	uint8_t jointIndices[4];
+	uint8_t weights[4];
 };
 
 struct VertexSimp {
-	glm::vec3 pos;
-	glm::vec3 norm;
-	glm::vec2 UV;
+	int16_t pos[4];
+	int16_t norm[2];
+	uint16_t UV[2];
+};
+
+// written by the pre-skinning compute shader (PreSkinnedVertex in Scene.hpp)
+struct VertexSkinned {
+	float pos[3];
+	float norm[3];
+	float UV[2];
 };
 
 struct skyBoxVertex {
@@ -31,10 +40,10 @@ struct skyBoxVertex {
 };
 
 struct VertexTan {
-	glm::vec3 pos;
-	glm::vec3 norm;
-	glm::vec2 UV;
-	glm::vec4 tan;
+	int16_t pos[4];
+	int16_t norm[2];
+	uint16_t UV[2];
+	int16_t tan[4];
 };
 
 struct GlobalUniformBufferObject {
@@ -43,13 +52,17 @@ struct GlobalUniformBufferObject {
 	alignas(16) glm::vec3 eyePos;
 };
 
+// the joints are skinned with the palette in the storage buffer at binding 2,
+// filled by AnimCrowd::updatePalette()
 struct UniformBufferObjectChar {
 	alignas(16) glm::vec4 debug1;
-	alignas(16) glm::mat4 mvpMat[65];
-	alignas(16) glm::mat4 mMat[65];
-	alignas(16) glm::mat4 nMat[65];
+	alignas(16) glm::mat4 vpMat;
 };
 
+// size of the palette of each character: three vec4 rows per joint, for the
+// 65 joints of the uomo rig
+const int CharPaletteJoints = 65;
+
 struct UniformBufferObjectSimp {
 	alignas(16) glm::mat4 mvpMat;
 	alignas(16) glm::mat4 mMat;
@@ -88,9 +101,10 @@ class BRISCOLA : public BaseProject {
 	VertexDescriptor VDsimp;
 	VertexDescriptor VDskyBox;
 	VertexDescriptor VDtan;
+	VertexDescriptor VDskinned;
 
 	RenderPass RP;
-	Pipeline Pcard, Pchar, PsimpObj, PskyBox, P_PBR;
+	Pipeline Pcard, Pchar, PcharSkinned, PsimpObj, PskyBox, P_PBR;
 
 	//*DBG*/Pipeline PDebug;
 
@@ -109,6 +123,13 @@ class BRISCOLA : public BaseProject {
 	std::vector<Card> playerPile;
 	std::vector<Card> cpuPile;
 	std::unique_ptr<CardAnimator> ca;
+	std::map<std::string, Timeline> timelines; // deal, draw, play and collect sequences
+
+	// the opponent across the table: its clips come from the asset files of the
+	// scene, and an AnimCrowd poses it into the palette of its two meshes
+	Animations charAnims[3];
+	AnimCrowd crowd;
+	std::vector<glm::vec4> charPalette;
 	int cpuChoice;
 	int cpuCardId;
 	int menuIndex; // 0 = Play, 1 = Exit
@@ -118,9 +139,15 @@ class BRISCOLA : public BaseProject {
 	bool newGame;
 	bool gameOver;
 	bool isDone;
+	bool turnReady; // false while the animations of a turn are running
 
 	// to provide textual feedback
 	TextMaker txt;
+	int hudFPS, hudPlayer, hudCPU;	// HUD blocks updated every frame
+	int hudProf;					// profiler overlay
+	int hudTurn, hudGameOver;		// messages shown only for a while, or at the end
+	bool showProfiler = false;		// toggle with key 'P'
+	int profVersion = -1;			// statistics shown in the overlay
 
 	// Other application parameters
 	float Ar{};	// Aspect ratio
@@ -175,7 +202,8 @@ class BRISCOLA : public BaseProject {
 					// second element : the type of element (buffer or texture)
 					// third  element : the pipeline stage where it will be used
 					{0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, sizeof(UniformBufferObjectChar), 1},
-					{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1}
+					{1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0, 1},
+					{2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, (int)(CharPaletteJoints * 3 * sizeof(glm::vec4)), 1}
 				  });
 
 		DSLlocalSimp.init(this, {
@@ -216,24 +244,24 @@ class BRISCOLA : public BaseProject {
 		VDchar.init(this, {
 				  {0, sizeof(VertexChar), VK_VERTEX_INPUT_RATE_VERTEX}
 				}, {
-				  {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexChar, pos),
-				         sizeof(glm::vec3), POSITION},
-				  {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexChar, norm),
-				         sizeof(glm::vec3), NORMAL},
-				  {0, 2, VK_FORMAT_R32G32_SFLOAT, offsetof(VertexChar, UV),
-				         sizeof(glm::vec2), UV},
-					{0, 3, VK_FORMAT_R32G32B32A32_UINT, offsetof(VertexChar, jointIndices),
-				         sizeof(glm::uvec4), JOINTINDEX},
-					{0, 4, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(VertexChar, weights),
-				         sizeof(glm::vec4), JOINTWEIGHT}
+				  {0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(VertexChar, pos),
+				         sizeof(VertexChar::pos), POSITION},
+				  {0, 1, VK_FORMAT_R16G16_SNORM, offsetof(VertexChar, norm),
+				         sizeof(VertexChar::norm), NORMAL},
+				  {0, 2, VK_FORMAT_R16G16_UNORM, offsetof(VertexChar, UV),
+				         sizeof(VertexChar::UV), UV},
+					{0, 3, VK_FORMAT_R8G8B8A8_UINT, offsetof(VertexChar, jointIndices),
+				         sizeof(VertexChar::jointIndices), JOINTINDEX},
+					{0, 4, VK_FORMAT_R8G8B8A8_UNORM, offsetof(VertexChar, weights),
+				         sizeof(VertexChar::weights), JOINTWEIGHT}
 				});
 
 		VDsimp.init(this, {
 				  {0, sizeof(VertexSimp), VK_VERTEX_INPUT_RATE_VERTEX}
 				}, {
-				  {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexSimp, pos), sizeof(glm::vec3), POSITION},
-				  {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexSimp, norm), sizeof(glm::vec3), NORMAL},
-				  {0, 2, VK_FORMAT_R32G32_SFLOAT, offsetof(VertexSimp, UV), sizeof(glm::vec2), UV}
+				  {0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(VertexSimp, pos), sizeof(VertexSimp::pos), POSITION},
+				  {0, 1, VK_FORMAT_R16G16_SNORM, offsetof(VertexSimp, norm), sizeof(VertexSimp::norm), NORMAL},
+				  {0, 2, VK_FORMAT_R16G16_UNORM, offsetof(VertexSimp, UV), sizeof(VertexSimp::UV), UV}
 				});
 
 		VDskyBox.init(this, {
@@ -246,17 +274,25 @@ class BRISCOLA : public BaseProject {
 		VDtan.init(this, {
 				  {0, sizeof(VertexTan), VK_VERTEX_INPUT_RATE_VERTEX}
 				}, {
-				  {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexTan, pos),
-				         sizeof(glm::vec3), POSITION},
-				  {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexTan, norm),
-				         sizeof(glm::vec3), NORMAL},
-				  {0, 2, VK_FORMAT_R32G32_SFLOAT, offsetof(VertexTan, UV),
-				         sizeof(glm::vec2), UV},
-				  {0, 3, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof(VertexTan, tan),
-				         sizeof(glm::vec4), TANGENT}
+				  {0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(VertexTan, pos),
+				         sizeof(VertexTan::pos), POSITION},
+				  {0, 1, VK_FORMAT_R16G16_SNORM, offsetof(VertexTan, norm),
+				         sizeof(VertexTan::norm), NORMAL},
+				  {0, 2, VK_FORMAT_R16G16_UNORM, offsetof(VertexTan, UV),
+				         sizeof(VertexTan::UV), UV},
+				  {0, 3, VK_FORMAT_R16G16B16A16_SNORM, offsetof(VertexTan, tan),
+				         sizeof(VertexTan::tan), TANGENT}
 				});
 
 
+		VDskinned.init(this, {
+				  {0, sizeof(VertexSkinned), VK_VERTEX_INPUT_RATE_VERTEX}
+				}, {
+				  {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexSkinned, pos), sizeof(VertexSkinned::pos), POSITION},
+				  {0, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(VertexSkinned, norm), sizeof(VertexSkinned::norm), NORMAL},
+				  {0, 2, VK_FORMAT_R32G32_SFLOAT, offsetof(VertexSkinned, UV), sizeof(VertexSkinned::UV), UV}
+				});
+
 		VDRs.resize(4);
 		VDRs[0].init("VDchar",   &VDchar);
 		VDRs[1].init("VDsimp",   &VDsimp);
@@ -275,17 +311,24 @@ class BRISCOLA : public BaseProject {
 
 
 
-		Pchar.init(this, &VDchar, "shaders/PosNormUvTanWeights.vert.spv", "shaders/CookTorranceForCharacter.frag.spv", {&DSLglobal, &DSLlocalChar});
+		Pchar.init(this, &VDchar, "shaders/PosNormUvTanWeights.vert.spv", "shaders/CookTorranceForCharacter.frag.spv", {&DSLglobal, &DSLlocalChar},
+				   {{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexDequantPushConstant)}});
 
-		PsimpObj.init(this, &VDsimp, "shaders/SimplePosNormUV.vert.spv", "shaders/CookTorrance.frag.spv", {&DSLglobal, &DSLlocalSimp});
+		// draws the characters skinned in advance by the compute pass
+		PcharSkinned.init(this, &VDskinned, "shaders/PreSkinnedPosNormUv.vert.spv", "shaders/CookTorranceForCharacter.frag.spv", {&DSLglobal, &DSLlocalChar});
+
+		PsimpObj.init(this, &VDsimp, "shaders/SimplePosNormUV.vert.spv", "shaders/CookTorrance.frag.spv", {&DSLglobal, &DSLlocalSimp},
+				   {{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexDequantPushConstant)}});
 
 		PskyBox.init(this, &VDskyBox, "shaders/SkyBoxShader.vert.spv", "shaders/SkyBoxShader.frag.spv", {&DSLskyBox});
 		PskyBox.setCompareOp(VK_COMPARE_OP_LESS_OR_EQUAL);
 		PskyBox.setCullMode(VK_CULL_MODE_BACK_BIT);
 		PskyBox.setPolygonMode(VK_POLYGON_MODE_FILL);
 
-		P_PBR.init(this, &VDtan, "shaders/SimplePosNormUvTan.vert.spv", "shaders/PBR.frag.spv", {&DSLglobal, &DSLlocalPBR});
-		Pcard.init(this, &VDsimp, "shaders/card.vert.spv", "shaders/card.frag.spv", {&DSLglobal, &DSLlocalCard});
+		P_PBR.init(this, &VDtan, "shaders/SimplePosNormUvTan.vert.spv", "shaders/PBR.frag.spv", {&DSLglobal, &DSLlocalPBR},
+				   {{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexDequantPushConstant)}});
+		Pcard.init(this, &VDsimp, "shaders/card.vert.spv", "shaders/card.frag.spv", {&DSLglobal, &DSLlocalCard},
+				   {{VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(VertexDequantPushConstant)}});
 		Pcard.setCullMode(VK_CULL_MODE_NONE);
 		//Pcard.setCompareOp(VK_COMPARE_OP_ALWAYS);
 		//Pcard.setFrontFace(VK_FRONT_FACE_CLOCKWISE);
@@ -314,7 +357,7 @@ class BRISCOLA : public BaseProject {
 										/*t0*/{true,  0, {}}// index 0 of the "texture" field in the json file
 									 }
 									}}
-							  }, /*TotalNtextures*/1, &VDskyBox);
+							  }, /*TotalNtextures*/1, &VDskyBox, /*cull*/false); // drawn around the camera
 		PRs[3].init("PBR", {
 							 {&P_PBR, {//Pipeline and DSL for the first pass
 								 /*DSLglobal*/{},
@@ -348,26 +391,59 @@ class BRISCOLA : public BaseProject {
 			std::cout << "ERROR LOADING THE SCENE\n";
 			exit(0);
 		}
-		// initializes animations
+		// prepares the optional GPU culling path (toggle with key '8')
+		SC.initGPUCulling("shaders/Cull.comp.spv");
+		// prepares the compute skinning of the characters, on by default (toggle
+		// with key '7', check against the vertex shader skinning with key '6')
+		SC.initPreSkinning("shaders/PreSkin.comp.spv", "CookTorranceChar", &PcharSkinned, CharPaletteJoints);
+		SC.PreSkinning = SC.PreSkinningReady;
+		// initializes animations: the opponent plays idle, pointing and waving
+		const char *charClips[3] = {"a2", "a3", "a4"};
+		for(int k = 0; k < 3; k++) {
+			charAnims[k].init(*SC.As[SC.AsIds[charClips[k]]]);
+		}
+		crowd.init(charAnims, 3, "Armature|mixamo.com|Layer0");
+		crowd.setProfiler(&Prof);	// its jobs are shown in the traces
+		// seen from afar (with the free camera), the pose is sampled less often
+		crowd.setLOD({{4.0f, 2, true}, {8.0f, 4, true}, {12.0f, 8, false}});
+		if(SC.TI[0].InstanceCount > 0) {
+			crowd.add({{0, -1, 0, 0}, {0, -1, 0, 1}, {0, -1, 0, 2}}, SC.TI[0].I[0].Wm);
+		}
+		charPalette.resize(CharPaletteJoints * 3);
 
-		// initializes the textual output
+		// initializes the textual output, drawn in its own render pass
 		txt.init(this, windowWidth, windowHeight);
 
 		// submits the main command buffer
 		submitCommandBuffer("main", 0, populateCommandBufferAccess, this);
 
-		// Prepares for showing the FPS count
-		txt.print(1.0f, 1.0f, "FPS:",1,"CO",false,false,true,TAL_RIGHT,TRH_RIGHT,TRV_BOTTOM,{1.0f,0.0f,0.0f,1.0f},{0.8f,0.8f,0.0f,1.0f});
+		// Prepares for showing the FPS count and the scores
+		hudFPS = txt.hudBlock(1.0f, 1.0f, 48, "CO", false, false, true, TAL_RIGHT, TRH_RIGHT, TRV_BOTTOM,
+							  {1.0f,0.0f,0.0f,1.0f}, {0.8f,0.8f,0.0f,1.0f});
+		hudPlayer = txt.hudBlock(-0.9f, 0.80f, 16, "CO", false, false, true, TAL_LEFT, TRH_LEFT, TRV_TOP,
+								 {1,1,1,1}, {0,0,0,1});
+		hudCPU = txt.hudBlock(0.9f, -0.80f, 16, "CO", false, false, true, TAL_RIGHT, TRH_RIGHT, TRV_TOP,
+							  {1,1,1,1}, {0,0,0,1});
+		hudProf = txt.hudBlock(-0.98f, -0.98f, 768, "CO", false, false, true, TAL_LEFT, TRH_LEFT, TRV_TOP,
+							   {1,1,1,1}, {0,0,0,1});
+		hudTurn = txt.hudBlock(0.5f, 0.10f, 16, "CO", false, false, true, TAL_CENTER, TRH_CENTER, TRV_BOTTOM,
+							   {1,1,1,1}, {0,0,0,1});
+		hudGameOver = txt.hudBlock(0.0f, 0.0f, 24, "CO", false, false, false, TAL_CENTER, TRH_CENTER, TRV_MIDDLE,
+								   {1,1,1,1}, {0,0,0,1});
+		txt.hudShow(hudProf, showProfiler);
+		txt.hudShow(hudTurn, false);
+		txt.hudShow(hudGameOver, false);
+		txt.hudPrintf(hudFPS, "FPS:");
 
 		gameState = GameState::MENU;
 		camSnapped = true;
 		isDone = false;
+		turnReady = true;
 		menuIndex = 1;
 		selectedCardIndex = -1;
-		ca = std::make_unique<CardAnimator>(
-			[this](int idx, const glm::mat4& M){ SC.TI[4].I[idx].Wm = M; },
-			[this](int idx){ return SC.TI[4].I[idx].Wm; }
-		);
+		// the animator reads and writes the Wm fields of the card instances in place
+		ca = std::make_unique<CardAnimator>(&SC.TI[4].I[0].Wm, sizeof(Instance), SC.TI[4].InstanceCount);
+		timelines = CardAnimator::loadTimelines("assets/models/cardTimelines.json");
 	}
 
 	// Here you create your pipelines and Descriptor Sets!
@@ -377,6 +453,7 @@ class BRISCOLA : public BaseProject {
 
 		// This creates a new pipeline (with the current surface), using its shaders for the provided render pass
 		Pchar.create(&RP);
+		PcharSkinned.create(&RP);
 		PsimpObj.create(&RP);
 		PskyBox.create(&RP);
 		P_PBR.create(&RP);
@@ -389,6 +466,7 @@ class BRISCOLA : public BaseProject {
 	// Here you destroy your pipelines and Descriptor Sets!
 	void pipelinesAndDescriptorSetsCleanup() {
 		Pchar.cleanup();
+		PcharSkinned.cleanup();
 		PsimpObj.cleanup();
 		PskyBox.cleanup();
 		P_PBR.cleanup();
@@ -410,6 +488,7 @@ class BRISCOLA : public BaseProject {
 		DSLlocalCard.cleanup();
 
 		Pchar.destroy();
+		PcharSkinned.destroy();
 		PsimpObj.destroy();
 		PskyBox.destroy();
 		P_PBR.destroy();
@@ -417,6 +496,10 @@ class BRISCOLA : public BaseProject {
 
 		RP.destroy();
 
+		crowd.cleanup();
+		for(int k = 0; k < 3; k++) {
+			charAnims[k].cleanup();
+		}
 		SC.localCleanup();
 		txt.localCleanup();
 
@@ -435,7 +518,18 @@ class BRISCOLA : public BaseProject {
 	// This is the real place where the Command Buffer is written
 	void populateCommandBuffer(VkCommandBuffer commandBuffer, int currentImage) {
 
+		// culling and skinning must run outside the render pass
+		{
+			Profiler::GpuScope gs(Prof, commandBuffer, currentImage, "Culling");
+			SC.populateCullingCommandBuffer(commandBuffer, currentImage);
+		}
+		{
+			Profiler::GpuScope gs(Prof, commandBuffer, currentImage, "Skinning");
+			SC.populatePreSkinningCommandBuffer(commandBuffer, currentImage);
+		}
+
 		// begin standard pass
+		Profiler::GpuScope gs(Prof, commandBuffer, currentImage, "Main pass");
 		RP.begin(commandBuffer, currentImage);
 
 		SC.populateCommandBuffer(commandBuffer, 0, currentImage);
@@ -505,36 +599,15 @@ class BRISCOLA : public BaseProject {
 		);
 	}
 
-	void moveToCenterBoth(bool isPlayer, int id1, const glm::mat4& cur1, int id2, const glm::mat4& cur2){
-		float p = isPlayer ? 1.0f : -1.0f;
-		//glm::vec3 tableCenter(0.0f, 0.563f, 0.0f);
-
-		ca->addMoveAndRotate(
-			id1,
-			cur1,
-			glm::vec3(-0.03f, 0.563f, 0.0f) ,
-			0.8f,
-			-90.0f*p, glm::vec3(1,0,0),
-			0.8f,
-			false
-		);
-		ca->addRotate(id2, cur2, 180.0f, glm::vec3(0,0,1), 0.0f, false);
-		ca->addMoveAndRotate(
-			id2,
-			cur2,
-			glm::vec3(0.03f, 0.56325f, 0.0f),
-			0.8f,
-			90.0f*p, glm::vec3(1,0,0),
-			0.8f,
-			false
-		);
+	// The player card goes to the left of the table center, the CPU card to the right
+	void moveToCenterBoth(int playerId, int cpuId){
+		ca->play(timelines.at("to_center"), {playerId, cpuId});
 	}
 
-	void moveToPile(std::vector<Card> pile, glm::vec3 pilePos, int id1, const glm::mat4& cur1, int id2, const glm::mat4& cur2){
+	void moveToPile(const std::vector<Card> &pile, glm::vec3 pilePos, int id1, int id2){
 		float pileSize = 0.00025f;
 		float pileTop = pile.size()*pileSize;
-		ca->addMove(id1, cur1, pilePos + glm::vec3(0.0f, pileTop, 0.0f), 0.8f);
-		ca->addMove(id2, cur2, pilePos + glm::vec3(0.0f, pileTop + pileSize, 0.0f), 0.8f);
+		ca->play(timelines.at("collect"), {id1, id2}, 0.0f, 1.0f, pilePos + glm::vec3(0.0f, pileTop, 0.0f));
 	}
 
 	void sortHand(bool isPlayer, int choice) {
@@ -579,176 +652,55 @@ class BRISCOLA : public BaseProject {
 		hand.erase(hand.begin());
 	}
 
-	void drawCardToHand(bool isPlayer, int cardIndex) {
+	// Moves a card from the deck to the hand. Returns its id, or -1 if the deck is empty:
+	// the animation is queued separately by animateDraw()
+	int drawCardToHand(bool isPlayer, int cardIndex, bool &lastOfDeck) {
 		//std::cout << (isPlayer ? "Player" : "CPU") << " draws a card\n";
 
-		float p = -1.0f;
-		if (isPlayer) p = 1.0f;
-		float offset = 0.06325f;
 		std::vector<Card> cards = gc.getDeck();
-		if(cards.size() == 0) return;
+		if(cards.size() == 0) return -1;
 		Card c = cards.at(cardIndex);
 		if(isPlayer){
 			playerCards.push_back(c);
 		}else{
 			cpuCards.push_back(c);
 		}
-		int id = c.id;
-		glm::mat4 cur =  SC.TI[4].I[id].Wm;
-		ca->addWait(id, cur, 1.8f);
-		if(c.id != cards.back().id){
-			if(isPlayer){
-				ca->addMoveAndRotate(
-					id,
-					cur,
-					glm::vec3(0.0f, 0.563f, 0.2f*p),
-					0.8f,
-					180.0f, glm::vec3(0,1, 0),
-					0.8f,
-					false
-				);
-			}else{
-				ca->addMoveAndRotate(
-					id,
-					cur,
-					glm::vec3(0.0f, 0.563f, 0.2f*p),
-					0.8f,
-					0.0f, glm::vec3(0,1, 0),
-					0.8f,
-					false
-				);
-			}
-				ca->addMoveAndRotate(
-					id,
-					cur,
-					glm::vec3(offset*p, 0.75f, 0.5f*p),
-					0.8f,
-					-90.0f*p, glm::vec3(1,0, 0),
-					0.8f,
-					false
-				);
-		}else{
-			ca->addMoveAndRotate(
-					id,
-					cur,
-					glm::vec3(0.0f, 0.563f, 0.2f*p),
-					0.8f,
-					90.0f*p, glm::vec3(0,1, 0),
-					0.8f,
-					false
-			);
-			ca->addMoveAndRotate(
-				id,
-				cur,
-				glm::vec3(offset*p, 0.75f, 0.5f*p),
-				0.8f,
-				90.0f*p, glm::vec3(1,0, 0),
-				0.8f,
-				false
-			);
-		}
-
+		lastOfDeck = (c.id == cards.back().id);
+		return c.id;
+	}
 
+	void animateDraw(bool isPlayer, int id, bool lastOfDeck) {
+		// the briscola is face up, so it is flipped the other way
+		const char *name = lastOfDeck ? (isPlayer ? "draw_briscola_player" : "draw_briscola_cpu")
+		                              : (isPlayer ? "draw_player" : "draw_cpu");
+		ca->play(timelines.at(name), {id});
 	}
 
 	void drawNewRound(){
-		float animDur = 0.8f; //usually 0.8f
-		float animWait = 0.5f; // usually 0.5f
-		glm::vec3 basePos(-0.177f, 0.563f, 0.0f);
 		float g = gameOver? 0.0f : 1.0f;
 		std::vector<Card> cards = gc.getDeck();
 
-		//Deck
-		float i = 0.0f;
-		for(int j = cards.size() - 1; j >= 0; --j) {
-			int id = cards[j].id;
-			float yOffset = 0.00025f * i;
-			glm::vec3 pos = basePos + glm::vec3(0.0f, yOffset, 0.0f);
-			glm::mat4 cur = SC.TI[4].I[id].Wm;
-			ca->addMoveAndRotate(
-				id,
-				cur,
-				pos,
-				animDur*g,
-				180.0f, glm::vec3(0,0,1),
-				animDur*g,
-				false
-			);
-			i=i+1.0f;
-		}
-
-		//Briscola
-		int id = cards.back().id;
-		glm::mat4 cur = SC.TI[4].I[id].Wm;
-		ca->addMove  (id, cur, glm::vec3(0.0f, 0.563f, 0.0f), 0.8f);
-		ca->addMoveAndRotate(
-			id,
-			cur,
-			glm::vec3(0.0f, 0.593f, 0.0f),
-			animDur/2,
-			180.0f, glm::vec3(0,0,1),
-			animDur ,
-			false
-		);
-		ca->addWait(id, cur, animWait*2);
-		ca->addMoveAndRotate(
-			id,
-			cur,
-			glm::vec3(-0.16f, 0.563f, 0.0f),
-			animDur,
-			-90.0f, glm::vec3(0,1, 0),
-			animDur ,
-			false
-		);
-		ca->addGlobalWait(animWait*7);
+		// the timeline slots are the positions in the full deck: the last card is
+		// the briscola, and the first six are dealt alternately to player and CPU.
+		// After a finished game the deck is gathered instantly.
+		std::vector<int> ids;
+		for(const Card &c : cards) ids.push_back(c.id);
+		const Timeline &gather = timelines.at("gather");
+		ca->play(gather, ids, 0.0f, g);
+		ca->play(timelines.at("deal"), ids, gather.duration * g);
 
 		//Hands
 		playerCards.clear();
 		cpuCards.clear();
-		i=0.0f;
-		float offset = 0.06325f;
 		for (int j=0; j<6; j=j+2) {
-			id = cards.at(j).id;
-			cur = SC.TI[4].I[id].Wm;
-			ca->addMoveAndRotate(
-				id,
-				cur,
-				glm::vec3(0.0f, 0.563f, 0.2f),
-				animDur ,
-				180.0f, glm::vec3(0,1, 0),
-				animDur ,
-				false
-			);
-			ca->addMoveAndRotate(
-				id,
-				cur,
-				glm::vec3(-offset+i, 0.75f, 0.5f),
-				animDur ,
-				-90.0f, glm::vec3(1,0, 0),
-				animDur ,
-				false
-			);
-			ca->addGlobalWait(animWait);
-			id = cards.at(j+1).id;
-			cur = SC.TI[4].I[id].Wm;
-			ca->addMove  (id, cur, glm::vec3(0.0f, 0.563f, -0.2f), 0.8f);
-			ca->addMoveAndRotate(
-				id,
-				cur,
-				glm::vec3(offset-i, 0.75f, -0.5f),
-				animDur ,
-				90.0f, glm::vec3(1,0, 0),
-				animDur ,
-				false
-			);
-			ca->addGlobalWait(animWait);
-			i+=offset;
-			//std::cout << "ello " << j << " x " << i << "\n";
 			playerCards.push_back(cards.at(j));
 			cpuCards.push_back(cards.at(j + 1));
 		}
 	}
 
+	// Plays a turn: the game state is updated right away, while the animations are
+	// chained on the completion of the previous ones. turnReady is set back once
+	// they have all finished (including the CPU leading the next turn).
 	void play(int playerChoice){
 		glm::vec3 playerPilePos(0.18f, 0.563f, 0.18f);
 		glm::vec3 cpuPilePos(-0.18f, 0.563f, -0.18f);
@@ -758,90 +710,81 @@ class BRISCOLA : public BaseProject {
 		int cId = cpuCard.id;
 		cpuCardId = cId;
 		glm::mat4 pCur =  SC.TI[4].I[pId].Wm;
-		glm::mat4 cCur = SC.TI[4].I[cId].Wm;
-
+		turnReady = false;
 
 		if(playerFirst){
-			moveToCenterBoth(true, pId, pCur, cId, cCur);
+			moveToCenterBoth(pId, cId);
 		}else{
-			ca->addWait(cId, cCur, 0.8f);
+			// the CPU card is already on the table
 			moveToCenter(true, pId, pCur);
 		}
 		sortHand(true, playerChoice);
 		sortHand(false, cpuChoice);
 
-		ca->addWait(pId, pCur, 1.0f);
-		ca->addWait(cId, cCur, 1.0f);
-
-		// 1.8 sec for the previous animations to complete
-
 		//std::cout << "I exist sadasdasdasdasdasd\n";
 		//std::cout << "Player plays card index " << playerChoice << " (id=" << playerCard.id << ")\n";
 		bool playerWins = gc.playTurn(playerChoice, cpuChoice);
 		//std::cout << (playerWins ? "Player wins the turn\n" : "CPU wins the turn\n");
-		if(playerWins) {
-			if(playerFirst){
-				playerPile.push_back(playerCard);
-				playerPile.push_back(cpuCard);
-				moveToPile(playerPile, playerPilePos, pId, pCur, cId, cCur);
-			}else{
-				playerPile.push_back(cpuCard);
-				playerPile.push_back(playerCard);
-				moveToPile(playerPile, playerPilePos, cId, cCur, pId, pCur);
-			}
-
-
-			playerFirst = true;
-			if(gc.getDeck().size() > 0) {
-				drawCardToHand(true, 0);
-				drawCardToHand(false, 1);
-				gc.drawCards(playerWins);
-			}
-
-		} else {
-			if(playerFirst){
-				cpuPile.push_back(playerCard);
-				cpuPile.push_back(cpuCard);
-				moveToPile(cpuPile, cpuPilePos, pId, pCur, cId, cCur);
-			}else{
-				cpuPile.push_back(cpuCard);
-				cpuPile.push_back(playerCard);
-				moveToPile(cpuPile, cpuPilePos, cId, cCur, pId, pCur);
-			}
 
-			playerFirst = false;
-			if(gc.getDeck().size() > 0) {
-				drawCardToHand(false, 0);
-				drawCardToHand(true, 1);
-				gc.drawCards(playerWins);
-			}
+		// the winner's pile receives first the card of who played first
+		int firstId  = playerFirst ? pId : cId;
+		int secondId = playerFirst ? cId : pId;
+		std::vector<Card> &pile = playerWins ? playerPile : cpuPile;
+		pile.push_back(playerFirst ? playerCard : cpuCard);
+		pile.push_back(playerFirst ? cpuCard : playerCard);
+		std::vector<Card> pileCards(pile.begin(), pile.end());
+		glm::vec3 pilePos = playerWins ? playerPilePos : cpuPilePos;
+
+		// the winner draws first
+		playerFirst = playerWins;
+		struct Draw { bool isPlayer; int id; bool lastOfDeck; };
+		std::vector<Draw> draws;
+		if(gc.getDeck().size() > 0) {
+			Draw d1{playerWins, -1, false}, d2{!playerWins, -1, false};
+			d1.id = drawCardToHand(d1.isPlayer, 0, d1.lastOfDeck);
+			d2.id = drawCardToHand(d2.isPlayer, 1, d2.lastOfDeck);
+			draws.push_back(d1);
+			draws.push_back(d2);
+			gc.drawCards(playerWins);
 		}
 
-		if(gc.getDeck().size() == 0 && gc.getPlayerHandSize() == 0) {
+		bool ended = (gc.getDeck().size() == 0 && gc.getPlayerHandSize() == 0);
+		if(ended) {
 			gameOver = true;
 			gc.displayFinalResult();
-			return;
+		} else {
+			cpuChoice = std::rand() % gc.getCpuHandSize();
 		}
 
-		// takes 1.8 + 1.6 = 3.4 sec to complete prev animations
-
-
-		cpuChoice = std::rand() % gc.getCpuHandSize();
-		if (!playerFirst) {
-			cpuCard = cpuCards.at(cpuChoice);
-			cId = cpuCard.id;
-			cpuCardId = cId;
-			cCur = SC.TI[4].I[cId].Wm;
-			// 1.8 + 1.6 = 3.4 to finish all prev anims
-			// 3.4 - 1.6 = 1.8 for when the card is the one from draw
-			// 3.8 - 0.8 = 2.6 for when the card is sorted in hand
-			if(cpuChoice == 2){
-				ca->addWait(cId, cCur, 1.8f);
-			}else{
-				ca->addWait(cId, cCur, 2.6f);
-			}
-			moveToCenter(false, cId, cCur);
-		}
+		// once both cards are on the table they stay there for a second, then they
+		// go to the pile while the new cards are drawn
+		ca->join({pId, cId}, [this, pId, cId, firstId, secondId, pileCards, pilePos, draws, ended]() {
+			ca->addWait(pId, SC.TI[4].I[pId].Wm, 1.0f);
+			ca->addWait(cId, SC.TI[4].I[cId].Wm, 1.0f);
+			ca->join({pId, cId}, [this, firstId, secondId, pileCards, pilePos, draws, ended]() {
+				moveToPile(pileCards, pilePos, firstId, secondId);
+				for(const Draw &d : draws) {
+					if(d.id >= 0) animateDraw(d.isPlayer, d.id, d.lastOfDeck);
+				}
+				if(ended) {
+					turnReady = true;
+					return;
+				}
+				// the CPU leads the next turn as soon as every card has settled
+				std::vector<int> moving = {firstId, secondId};
+				for(const Card &c : playerCards) moving.push_back(c.id);
+				for(const Card &c : cpuCards) moving.push_back(c.id);
+				ca->join(moving, [this]() {
+					if(playerFirst) {
+						turnReady = true;
+						return;
+					}
+					cpuCardId = cpuCards.at(cpuChoice).id;
+					moveToCenter(false, cpuCardId, SC.TI[4].I[cpuCardId].Wm);
+					ca->join({cpuCardId}, [this]() { turnReady = true; });
+				});
+			});
+		});
 	}
 
 	// Here is where you update the uniforms.
@@ -854,7 +797,19 @@ class BRISCOLA : public BaseProject {
 		float deltaT = CameraLogic();
 
 		// Progress card animations by delta time
-		if (ca) ca->tick(deltaT);
+		{
+			Profiler::Scope ps(Prof, "CardAnimator::tick");
+			if (ca) ca->tick(deltaT);
+		}
+
+		// Culls the scene against the view frustum. On the GPU path the recorded
+		// commands never change; on the CPU path the main command buffer is
+		// recorded again only when the set of visible instances changes
+		if(SC.GPUCulling) {
+			SC.updateGPUCulling(ViewPrj, currentImage);
+		} else if(SC.updateCulling(ViewPrj)) {
+			submitCommandBuffer("main", 0, populateCommandBufferAccess, this);
+		}
 		
 		// defines the global parameters for the uniform
 		const glm::mat4 lightView = glm::rotate(glm::mat4(1), glm::radians(-30.0f), glm::vec3(0.0f,1.0f,0.0f)) * glm::rotate(glm::mat4(1), glm::radians(-45.0f), glm::vec3(1.0f,0.0f,0.0f));
@@ -872,6 +827,25 @@ class BRISCOLA : public BaseProject {
 		SC.TI[2].I[0].DS[0][0]->map(currentImage, &sbubo, 0);
 		int id;
 
+		// the opponent: both its meshes are skinned with the same palette
+		if(crowd.size() > 0) {
+			Profiler::Scope ps(Prof, "AnimCrowd::updatePalette");
+			void *dst = charPalette.data();
+			crowd.setEye(cameraPos);
+			crowd.updatePalette(deltaT, &dst);
+		}
+		UniformBufferObjectChar uboc{};
+		uboc.debug1 = glm::vec4(0.0f);
+		uboc.vpMat = ViewPrj;
+		for(id = 0; id < SC.TI[0].InstanceCount; id++) {
+			SC.TI[0].I[id].DS[0][0]->map(currentImage, &gubo, 0); // Set 0
+			SC.TI[0].I[id].DS[0][1]->map(currentImage, &uboc, 0);  // Set 1
+			SC.TI[0].I[id].DS[0][1]->map(currentImage, charPalette.data(), 2);
+			if(SC.PreSkinningReady) {
+				SC.updatePreSkinning(id, charPalette.data(), currentImage);
+			}
+		}
+
 		if (gameState == GameState::MENU) {
 			UniformBufferObjectCard ubos2{};
 			id = 40;
@@ -899,21 +873,21 @@ class BRISCOLA : public BaseProject {
 			SC.TI[4].I[id].DS[0][0]->map(currentImage, &gubo, 0); // Set 0
 			SC.TI[4].I[id].DS[0][1]->map(currentImage, &ubos2, 0);  // Set 1
 
-			if (glfwGetKey(window, GLFW_KEY_UP) && !debounce) {
+			if (getKey(GLFW_KEY_UP) && !debounce) {
 				debounce = true; curDebounce = GLFW_KEY_UP;
 				menuIndex = (menuIndex + 1) % 2; // toggle between 0 and 1
 			} else if ((curDebounce == GLFW_KEY_UP) && debounce) {
 				debounce = false; curDebounce = 0;
 			}
 
-			if (glfwGetKey(window, GLFW_KEY_DOWN) && !debounce) {
+			if (getKey(GLFW_KEY_DOWN) && !debounce) {
 				debounce = true; curDebounce = GLFW_KEY_DOWN;
 				menuIndex = (menuIndex + 1) % 2;
 			} else if ((curDebounce == GLFW_KEY_DOWN) && debounce) {
 				debounce = false; curDebounce = 0;
 			}
 
-			if (glfwGetKey(window, GLFW_KEY_SPACE) && !debounce) {
+			if (getKey(GLFW_KEY_SPACE) && !debounce) {
 				debounce = true; curDebounce = GLFW_KEY_SPACE;
 
 				if (menuIndex == 1) {
@@ -928,7 +902,7 @@ class BRISCOLA : public BaseProject {
 					ca->addMove(id, cur,  glm::vec3(-1, -1, -1));
 				} else {
 					// Exit
-					glfwSetWindowShouldClose(window, GL_TRUE);
+					closeWindow();
 				}
 			} else if ((curDebounce == GLFW_KEY_SPACE) && debounce) {
 				debounce = false; curDebounce = 0;
@@ -946,6 +920,7 @@ class BRISCOLA : public BaseProject {
 					  {0, 0, 0, 1});
 
 			txt.updateCommandBuffer();  // Render the menu
+			txt.updateHud(currentImage);
 			return;  // Skip the rest of the game logic while in MENU state
 		}
 
@@ -966,14 +941,14 @@ class BRISCOLA : public BaseProject {
 					  {0, 0, 0, 1});
 
 			// handle the ESC key to exit the app
-			if(glfwGetKey(window, GLFW_KEY_ESCAPE)) {
-				glfwSetWindowShouldClose(window, GL_TRUE);
+			if(getKey(GLFW_KEY_ESCAPE)) {
+				closeWindow();
 			}
 
 			// ==========================
 			// CARD SELECTION WITH ARROWS
 			// ==========================
-			if (glfwGetKey(window, GLFW_KEY_LEFT)) {
+			if (getKey(GLFW_KEY_LEFT)) {
 				if (!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_LEFT;
@@ -991,7 +966,7 @@ class BRISCOLA : public BaseProject {
 				curDebounce = 0;
 			}
 
-			if (glfwGetKey(window, GLFW_KEY_RIGHT)) {
+			if (getKey(GLFW_KEY_RIGHT)) {
 				if (!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_RIGHT;
@@ -1010,12 +985,12 @@ class BRISCOLA : public BaseProject {
 			}
 
 			//spacebar to confirm
-			if (glfwGetKey(window, GLFW_KEY_SPACE)) {
+			if (getKey(GLFW_KEY_SPACE)) {
 				if (!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_SPACE;
 
-					if (!gameOver && !playerCards.empty()) {
+					if (!gameOver && turnReady && !playerCards.empty()) {
 						// Confirm play of the selected card
 						int idx = selectedCardIndex;
 						play(idx);
@@ -1029,15 +1004,13 @@ class BRISCOLA : public BaseProject {
 
 
 			//INPUT WITH NUMBERS FOR DEBUG
-			if(glfwGetKey(window, GLFW_KEY_1)) {
+			if(getKey(GLFW_KEY_1)) {
 				if(!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_1;
 
 					if(!gameOver){
-						if(gc.IsPlayerTurn() and ca->isFinished(cpuCardId)){
-							play(0);
-						}else if(ca->isFinished(cpuCardId)){
+						if(turnReady){
 							play(0);
 						}
 					}
@@ -1049,15 +1022,13 @@ class BRISCOLA : public BaseProject {
 				}
 			}
 
-			if(glfwGetKey(window, GLFW_KEY_2)) {
+			if(getKey(GLFW_KEY_2)) {
 				if(!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_2;
 
 					if(!gameOver and gc.getPlayerHandSize() > 1){
-						if(gc.IsPlayerTurn() or ca->isFinished(cpuCardId)){
-							play(1);
-						}else if(ca->isFinished(cpuCardId)){
+						if(turnReady){
 							play(1);
 						}
 					}
@@ -1069,15 +1040,13 @@ class BRISCOLA : public BaseProject {
 				}
 			}
 
-			if(glfwGetKey(window, GLFW_KEY_3)) {
+			if(getKey(GLFW_KEY_3)) {
 				if(!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_3;
 
 					if(!gameOver and gc.getPlayerHandSize() > 2){
-						if(gc.IsPlayerTurn()or ca->isFinished(cpuCardId)){
-							play(2);
-						}else if(ca->isFinished(cpuCardId)){
+						if(turnReady){
 							play(2);
 						}
 					}
@@ -1089,7 +1058,7 @@ class BRISCOLA : public BaseProject {
 				}
 			}
 
-			if(glfwGetKey(window, GLFW_KEY_R)) {
+			if(getKey(GLFW_KEY_R)) {
 				if(!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_R;
@@ -1109,7 +1078,7 @@ class BRISCOLA : public BaseProject {
 				}
 			}
 
-			if (glfwGetKey(window, GLFW_KEY_9)) {
+			if (getKey(GLFW_KEY_9)) {
 				if (!debounce) {
 					debounce = true;
 					curDebounce = GLFW_KEY_9;
@@ -1124,14 +1093,107 @@ class BRISCOLA : public BaseProject {
 				}
 			}
 
+			if (getKey(GLFW_KEY_7)) {
+				if (!debounce && SC.PreSkinningReady) {
+					debounce = true;
+					curDebounce = GLFW_KEY_7;
+
+					SC.PreSkinning = !SC.PreSkinning;   // toggle compute skinning
+					std::cout << (SC.PreSkinning ? "Compute skinning ON\n" : "Compute skinning OFF\n");
+					submitCommandBuffer("main", 0, populateCommandBufferAccess, this);
+				}
+			} else {
+				if ((curDebounce == GLFW_KEY_7) && debounce) {
+					debounce = false;
+					curDebounce = 0;
+				}
+			}
+
+			if (getKey(GLFW_KEY_6)) {
+				if (!debounce && SC.PreSkinning) {
+					debounce = true;
+					curDebounce = GLFW_KEY_6;
+
+					// the last frame drawn on this image is complete: its skinned
+					// vertices are compared with the vertex shader skinning
+					for(int i = 0; i < SC.TI[0].InstanceCount; i++) {
+						float diff = SC.checkPreSkinning(i, currentImage);
+						std::cout << "Compute skinning check, instance " << i << ": ";
+						if(diff < 0.0f) std::cout << "not skinned yet\n";
+						else std::cout << "max difference " << diff << ((diff <= 1e-4f) ? " ok\n" : " FAILED\n");
+					}
+				}
+			} else {
+				if ((curDebounce == GLFW_KEY_6) && debounce) {
+					debounce = false;
+					curDebounce = 0;
+				}
+			}
+
+			if (getKey(GLFW_KEY_8)) {
+				if (!debounce && SC.GPUCullingReady) {
+					debounce = true;
+					curDebounce = GLFW_KEY_8;
+
+					SC.GPUCulling = !SC.GPUCulling;   // toggle GPU culling
+					std::cout << (SC.GPUCulling ? "GPU culling ON\n" : "GPU culling OFF\n");
+					submitCommandBuffer("main", 0, populateCommandBufferAccess, this);
+				}
+			} else {
+				if ((curDebounce == GLFW_KEY_8) && debounce) {
+					debounce = false;
+					curDebounce = 0;
+				}
+			}
+
+			if (getKey(GLFW_KEY_P)) {
+				if (!debounce) {
+					debounce = true;
+					curDebounce = GLFW_KEY_P;
+
+					showProfiler = !showProfiler;   // toggle the profiler overlay
+					txt.hudShow(hudProf, showProfiler);
+					profVersion = -1;
+				}
+			} else {
+				if ((curDebounce == GLFW_KEY_P) && debounce) {
+					debounce = false;
+					curDebounce = 0;
+				}
+			}
+
+			if (getKey(GLFW_KEY_T)) {
+				if (!debounce) {
+					debounce = true;
+					curDebounce = GLFW_KEY_T;
+
+					Prof.startTrace("trace.json", 300);   // records the next 300 frames
+				}
+			} else {
+				if ((curDebounce == GLFW_KEY_T) && debounce) {
+					debounce = false;
+					curDebounce = 0;
+				}
+			}
+
 			
 
 			if(newGame) {
+				// the animations of the last turn may still be running, with their
+				// moves to the piles chained on them: the new deal replaces them
+				ca->reset();
 				drawNewRound();
 				newGame = false;
 				gameOver = false;
 				gc.dealInitialCards();
 				cpuChoice = cpuCards.empty() ? -1 : std::rand() % static_cast<int>(cpuCards.size());
+
+				// the first turn can be played once the hands have been dealt
+				std::vector<int> dealt;
+				for(const Card &c : playerCards) dealt.push_back(c.id);
+				for(const Card &c : cpuCards) dealt.push_back(c.id);
+				turnReady = false;
+				ca->join(dealt, [this]() { turnReady = true; });
 			}
 
 			
@@ -1187,67 +1249,52 @@ class BRISCOLA : public BaseProject {
 			if(elapsedT > 1.0f) {
 				float Fps = (float)countedFrames / elapsedT;
 
-				std::ostringstream oss;
-				oss << "FPS: " << Fps << "\n";
-
-				txt.print(1.0f, 1.0f, oss.str(), 1, "CO", false, false, true,TAL_RIGHT,TRH_RIGHT,TRV_BOTTOM,{1.0f,0.0f,0.0f,1.0f},{0.8f,0.8f,0.0f,1.0f});
+				txt.hudPrintf(hudFPS, "FPS: %g\nCulled: %d/%d\n", Fps, SC.CulledCount, SC.InstanceCount);
 
 				elapsedT = 0.0f;
 				countedFrames = 0;
 			}
-			// Player score
-			txt.print(-0.9f, 0.80f, "Player: " + std::to_string(gc.getPlayerPoints()), 2, "CO", false, false, true,
-					  TAL_LEFT, TRH_LEFT, TRV_TOP,
-					  {1,1,1,1}, {0,0,0,1});
-
-			// CPU score
-			txt.print(0.9f, -0.80f, "CPU: " + std::to_string(gc.getCpuPoints()), 3, "CO", false, false, true,
-					  TAL_RIGHT, TRH_RIGHT, TRV_TOP,
-					  {1,1,1,1}, {0,0,0,1});
+			// Player and CPU scores
+			txt.hudPrintf(hudPlayer, "Player: %d", gc.getPlayerPoints());
+			txt.hudPrintf(hudCPU, "CPU: %d", gc.getCpuPoints());
+
+			// rolling percentiles of the profiler, refreshed when they are recomputed
+			if(showProfiler && (profVersion != Prof.statsVersion)) {
+				profVersion = Prof.statsVersion;
+				char report[HudMaxChars + 1];
+				Prof.report(report, sizeof(report));
+				txt.hudPrintf(hudProf, "%s", report);
+			}
 
 
 			// === Turn text handling ===
 			static bool lastTurn = !playerFirst;   // initialize opposite so it triggers once
 			static double turnMsgTimer = 0.0;
-			static std::string turnMsg = "";
 
 			bool currentTurn = playerFirst;
 
 			// Detect turn change
 			if (currentTurn != lastTurn) {
 				lastTurn = currentTurn;
-				turnMsgTimer = glfwGetTime();
-				turnMsg = currentTurn ? "Your turn" : "CPU's turn";
+				turnMsgTimer = getTime();
+				txt.hudPrintf(hudTurn, "%s", currentTurn ? "Your turn" : "CPU's turn");
 			}
 
 			// Show message only for 2 seconds
-			double elapsed = glfwGetTime() - turnMsgTimer;
-			if (elapsed < 2.0) {
-				txt.print(0.5f, 0.10f, turnMsg,
-						  4, "CO", false, false, true,
-						  TAL_CENTER, TRH_CENTER, TRV_BOTTOM,
-						  {1,1,1,1}, {0,0,0,1});
-			} else {
-				// Explicitly clear the slot so it disappears
-				txt.print(0.5f, 0.10f, "",
-						  4, "CO", false, false, true,
-						  TAL_CENTER, TRH_CENTER, TRV_BOTTOM,
-						  {0,0,0,0}, {0,0,0,0});  // fully transparent
-			}
+			txt.hudShow(hudTurn, getTime() - turnMsgTimer < 2.0);
 
 			// --- GAME OVER MESSAGE ---
 			if (gameOver) {
-				std::string msg = "DRAW";
+				const char *msg = "DRAW";
 				if (gc.getPlayerPoints()>60) msg = "YOU WON";
 				else if (gc.getCpuPoints()>60) msg = "CPU WON";
 
-				txt.print(0.0f, 0.0f, "GAME OVER - " + msg,
-						  5, "CO", false, false, false,
-						  TAL_CENTER, TRH_CENTER, TRV_MIDDLE,
-						  {1,1,1,1}, {0,0,0,1});
+				txt.hudPrintf(hudGameOver, "GAME OVER - %s", msg);
 			}
+			txt.hudShow(hudGameOver, gameOver);
 
 			txt.updateCommandBuffer();
+			txt.updateHud(currentImage);
 		}
 	}
 
@@ -1391,9 +1438,34 @@ class BRISCOLA : public BaseProject {
 
 
 // This is the main: probably you do not need to touch this!
-int main() {
+int main(int argc, char **argv) {
     BRISCOLA app;
 
+    // --trace <file> [frames] records the loading and the first frames (300 by default)
+    // --headless [frames] [--script <file>] [--report <file>] runs a benchmark with no window
+    bool headless = false;
+    int headlessFrames = 0;
+    std::string script, report;
+    for(int i = 1; i < argc; i++) {
+        bool hasArg = (i + 1 < argc);
+        if((strcmp(argv[i], "--trace") == 0) && hasArg) {
+            int frames = ((i + 2 < argc) && isdigit(argv[i + 2][0])) ? atoi(argv[i + 2]) : 300;
+            app.Prof.startTrace(argv[i + 1], frames);
+        } else if(strcmp(argv[i], "--headless") == 0) {
+            headless = true;
+            if(hasArg && isdigit(argv[i + 1][0])) {
+                headlessFrames = atoi(argv[++i]);
+            }
+        } else if((strcmp(argv[i], "--script") == 0) && hasArg) {
+            script = argv[++i];
+        } else if((strcmp(argv[i], "--report") == 0) && hasArg) {
+            report = argv[++i];
+        }
+    }
+    if(headless) {
+        app.setHeadless(headlessFrames, script, report);
+    }
+
     try {
         app.run();
     } catch (const std::exception& e) {
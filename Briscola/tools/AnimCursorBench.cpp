@@ -0,0 +1,102 @@
+// Benchmark of the keyframe cursors of AnimBlender against the binary search.
+//
+// Loads the idle, running and waving clips of the character, takes the tracks
+// of the joints animated by all three, and samples them for many frames at
+// 60 Hz twice: without a track index, so every lookup is a binary search, and
+// with it, so the cached cursors are used. single plays the first clip only,
+// switching blends to the next clip every 300 frames. The time per frame of
+// both lookups is reported, with the largest difference between their matrices:
+// the two lookups interpolate from the same keyframes, so it is a rounding
+// difference, below 1e-6. With a tolerance the tracks are packed, and the
+// cursors also keep the kept keyframe of the packed tracks.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/AnimCursorBench.cpp -lvulkan -lglfw -pthread -o AnimCursorBench
+//   ./AnimCursorBench [frames] [tolerance]
+// The exit code is the number of runs with a difference above 1e-5.
+
+#define STARTER_IMPLEMENTATION
+#include "modules/Starter.hpp"
+
+#define ANIMATIONS_IMPLEMENTATION
+#include "modules/Animations.hpp"
+
+int main(int argc, char **argv) {
+	int frames = (argc > 1) ? atoi(argv[1]) : 20000;
+	AnimTolerance tolerance((argc > 2) ? atof(argv[2]) : -1.0f);
+	const char *clips[3] = {"idle", "running", "waving"};
+	const float DeltaT = 1.0f / 60.0f;
+
+	AssetFile AF[3];
+	Animations AN[3];
+	std::streambuf *old = std::cout.rdbuf(nullptr);
+	for(int k = 0; k < 3; k++) {
+		AF[k].init(std::string("assets/models/") + clips[k] + ".gltf", GLTF);
+		AN[k].init(AF[k], tolerance);
+	}
+	std::cout.rdbuf(old);
+
+	std::vector<std::vector<AnimTrack *>> tracks;
+	const tinygltf::Skin &skin = AF[0].getGLTFmodel()->skins[0];
+	for(int j : skin.joints) {
+		std::ostringstream name;
+		name << "Armature|mixamo.com|Layer0#" << j;
+		std::vector<AnimTrack *> t;
+		for(int k = 0; k < 3; k++) {
+			AnimTrack *AT = AN[k].getAnim(name.str());
+			if(AT != nullptr) t.push_back(AT);
+		}
+		if(t.size() == 3) tracks.push_back(t);
+	}
+	if(tracks.empty()) {
+		std::cout << "No track is animated by all the clips\n";
+		return 1;
+	}
+	printf("%zu joints, %zu tracks animated by all the clips, %d keyframes in %s%s\n",
+		   skin.joints.size(), tracks.size(), tracks[0][0]->nKeyFrames, clips[0],
+		   tolerance.packs() ? ", packed" : "");
+
+	std::vector<AnimBlendSegment> segments = {{0, -1, 0, 0}, {0, -1, 0, 1}, {0, -1, 0, 2}};
+	std::vector<glm::mat4> R0(tracks.size()), R1(tracks.size());
+	int failed = 0;
+	for(int mode = 0; mode < 2; mode++) {
+		AnimBlender B0, B1;
+		B0.init(segments);
+		B1.init(segments);
+		double searchT = 0.0, cursorT = 0.0;
+		float maxDiff = 0.0f;
+		for(int f = 0; f < frames; f++) {
+			if((mode == 1) && (f % 300 == 0)) {
+				B0.Start((f / 300) % 3, 0.5f);
+				B1.Start((f / 300) % 3, 0.5f);
+			}
+			B0.Advance(DeltaT);
+			B1.Advance(DeltaT);
+
+			auto a = std::chrono::high_resolution_clock::now();
+			for(size_t i = 0; i < tracks.size(); i++) R0[i] = B0.Sample(&tracks[i]);
+			auto b = std::chrono::high_resolution_clock::now();
+			for(size_t i = 0; i < tracks.size(); i++) R1[i] = B1.Sample(&tracks[i], (int)i);
+			auto c = std::chrono::high_resolution_clock::now();
+			searchT += std::chrono::duration<double>(b - a).count();
+			cursorT += std::chrono::duration<double>(c - b).count();
+
+			for(size_t i = 0; i < tracks.size(); i++) {
+				for(int x = 0; x < 4; x++) {
+					for(int y = 0; y < 4; y++) {
+						maxDiff = std::max(maxDiff, std::fabs(R0[i][x][y] - R1[i][x][y]));
+					}
+				}
+			}
+		}
+		printf("%-10s %d frames: binary search %.2f us/frame, cursors %.2f us/frame (x%.2f), max difference %g\n",
+			   mode ? "switching" : "single", frames, searchT / frames * 1e6, cursorT / frames * 1e6,
+			   searchT / cursorT, maxDiff);
+		failed += !(maxDiff <= 1e-5f);
+	}
+
+	for(int k = 0; k < 3; k++) {
+		AN[k].cleanup();
+	}
+	return failed;
+}
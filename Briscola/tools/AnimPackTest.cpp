@@ -0,0 +1,178 @@
+// Checks of the packed animation tracks and of their files, run as a standalone program.
+//
+// For each character clip, the tracks are loaded as they are and packed with
+// the given tolerances of translation, rotation and scale (1e-3 by default,
+// a single value is used for all three, 0 quantizes only): the memory of both
+// and the largest difference of their matrices, sampled at 4000 times per
+// track, are reported. Then:
+// reload: the packed file written by init() must be loaded back, and sample
+//   exactly as the tracks it was written from;
+// stale: the packed file of a clip, given with another clip, must be rebuilt;
+// corrupt: truncated and altered copies of the file must be rejected, without
+//   reading out of bounds, and the tracks rebuilt.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/AnimPackTest.cpp -lvulkan -lglfw -pthread -o AnimPackTest
+//   ./AnimPackTest [tolerance | tolT tolQ tolS]
+// The exit code is the number of failed checks.
+
+#define STARTER_IMPLEMENTATION
+#include "modules/Starter.hpp"
+
+#define ANIMATIONS_IMPLEMENTATION
+#include "modules/Animations.hpp"
+
+#include <random>
+
+static const char *Clips[4] = {"idle", "running", "waving", "pointing"};
+static const int SampleTimes = 4000;
+
+// Names of the tracks, as given to them by Animations::init()
+static std::vector<std::string> trackNames(AssetFile &AF) {
+	std::vector<std::string> out;
+	for(const auto &anim : AF.getGLTFmodel()->animations) {
+		std::set<int> nodes;
+		for(const auto &chan : anim.channels) nodes.insert(chan.target_node);
+		for(int n : nodes) {
+			std::ostringstream name;
+			name << anim.name;
+			if(nodes.size() > 1) name << "#" << n;
+			out.push_back(name.str());
+		}
+	}
+	return out;
+}
+
+// Runs init() with its messages captured in log
+static void initQuiet(Animations &AN, AssetFile &AF, AnimTolerance tolerance, std::string packedFile, std::string &log) {
+	std::ostringstream sink;
+	std::streambuf *old = std::cout.rdbuf(sink.rdbuf());
+	AN.init(AF, tolerance, packedFile);
+	std::cout.rdbuf(old);
+	log = sink.str();
+}
+
+static bool loadedFromFile(const std::string &log) {
+	return log.find("Animations loaded from") != std::string::npos;
+}
+
+static float sampleDiff(Animations &A, Animations &B, const std::vector<std::string> &names) {
+	float maxDiff = 0.0f;
+	for(const std::string &n : names) {
+		AnimTrack *TA = A.getAnim(n), *TB = B.getAnim(n);
+		if((TA == nullptr) || (TB == nullptr)) return INFINITY;
+		float len = TA->keyTime(TA->nKeyFrames - 1);
+		for(int i = 0; i < SampleTimes; i++) {
+			float t = len * i / (SampleTimes - 1);
+			glm::mat4 MA = TA->Sample(t, 0, -1, false, nullptr), MB = TB->Sample(t, 0, -1, false, nullptr);
+			for(int c = 0; c < 4; c++) {
+				for(int r = 0; r < 4; r++) {
+					maxDiff = std::max(maxDiff, std::fabs(MA[c][r] - MB[c][r]));
+				}
+			}
+		}
+	}
+	return maxDiff;
+}
+
+static size_t memoryBytes(Animations &A, const std::vector<std::string> &names) {
+	size_t bytes = 0;
+	for(const std::string &n : names) bytes += A.getAnim(n)->memoryBytes();
+	return bytes;
+}
+
+static bool writeFile(const std::string &file, const std::vector<char> &data) {
+	std::ofstream ofs(file, std::ios::binary);
+	ofs.write(data.data(), data.size());
+	return (bool)ofs;
+}
+
+int main(int argc, char **argv) {
+	AnimTolerance tolerance(1e-3f);
+	if(argc > 3) {
+		tolerance = AnimTolerance(atof(argv[1]), atof(argv[2]), atof(argv[3]));
+	} else if(argc > 1) {
+		tolerance = AnimTolerance(atof(argv[1]));
+	}
+	int failed = 0;
+	std::string log;
+
+	AssetFile AF[4];
+	std::streambuf *old = std::cout.rdbuf(nullptr);
+	for(int k = 0; k < 4; k++) {
+		AF[k].init(std::string("assets/models/") + Clips[k] + ".gltf", GLTF);
+	}
+	std::cout.rdbuf(old);
+
+	for(int k = 0; k < 4; k++) {
+		std::string packedFile = std::string(Clips[k]) + ".packed.tmp";
+		std::remove(packedFile.c_str());
+		std::vector<std::string> names = trackNames(AF[k]);
+
+		Animations plain, packed, reloaded;
+		initQuiet(plain, AF[k], -1.0f, "", log);
+		initQuiet(packed, AF[k], tolerance, packedFile, log);
+		initQuiet(reloaded, AF[k], tolerance, packedFile, log);
+		bool reloadOk = loadedFromFile(log) && (sampleDiff(packed, reloaded, names) == 0.0f);
+		printf("%-8s %zu tracks: %zu KB -> %zu KB, max difference %g; reload %s\n", Clips[k], names.size(),
+			   memoryBytes(plain, names) / 1024, memoryBytes(packed, names) / 1024,
+			   sampleDiff(plain, packed, names), reloadOk ? "ok" : "FAILED");
+		failed += !reloadOk;
+
+		// a copy of the file of this clip, with the next one: init() rebuilds and overwrites it
+		std::vector<char> good = readFile(packedFile);
+		std::string badFile = packedFile + ".bad";
+		int other = (k + 1) % 4;
+		Animations stale;
+		writeFile(badFile, good);
+		initQuiet(stale, AF[other], tolerance, badFile, log);
+		bool staleOk = !loadedFromFile(log) && (sampleDiff(stale, packed, trackNames(AF[other])) != 0.0f);
+		printf("%-8s stale file with %s: %s\n", Clips[k], Clips[other], staleOk ? "ok" : "FAILED");
+		failed += !staleOk;
+		stale.cleanup();
+
+		std::mt19937 rng(k);
+		int loaded = 0, rebuilt = 0, wrong = 0, n = 0;
+		auto tryLoad = [&](const std::vector<char> &bad) {
+			writeFile(badFile, bad);
+			Animations A;
+			initQuiet(A, AF[k], tolerance, badFile, log);
+			if(loadedFromFile(log)) {
+				loaded++;
+			} else {
+				rebuilt++;
+			}
+			for(const std::string &name : names) {
+				if(A.getAnim(name) == nullptr) {
+					wrong++;
+					break;
+				}
+			}
+			A.cleanup();
+			n++;
+		};
+		for(size_t len : {(size_t)0, (size_t)3, (size_t)8, (size_t)16, good.size() / 3, good.size() / 2,
+						  good.size() - 7, good.size() - 1}) {
+			tryLoad(std::vector<char>(good.begin(), good.begin() + std::min(len, good.size())));
+		}
+		for(int i = 0; i < 300; i++) {
+			std::vector<char> bad = good;
+			int flips = 1 + (int)(rng() % 4);
+			for(int f = 0; f < flips; f++) {
+				bad[rng() % bad.size()] ^= (char)(1 + rng() % 255);
+			}
+			tryLoad(bad);
+		}
+		bool corruptOk = (loaded == 0) && (wrong == 0);
+		printf("%-8s %d damaged files: %d loaded, %d rebuilt, %d with missing tracks: %s\n",
+			   Clips[k], n, loaded, rebuilt, wrong, corruptOk ? "ok" : "FAILED");
+		failed += !corruptOk;
+
+		std::remove(badFile.c_str());
+		std::remove(packedFile.c_str());
+		plain.cleanup();
+		packed.cleanup();
+		reloaded.cleanup();
+	}
+	return failed;
+}
@@ -0,0 +1,322 @@
+// Checks of CardAnimator, run as a standalone program.
+//
+// simd: two animators receive the same random steps (moves, global and local
+// rotations, waits, global waits and timelines) on the same cards, one ticked
+// with the 4-wide tickBatch() and the other with the scalar tickScalar(). The
+// matrices must agree within Epsilon at every tick, and the queues must be
+// in the same state. After each tick the matrices of the scalar animator are
+// reset to the batch ones, so that every step starts from the same pose:
+// otherwise the rounding differences carried from step to step can turn a
+// half turn (quaternion dot ~0) the other way around.
+//
+// soak: plays thousands of games with the timelines of the game (gather, deal,
+// then 17 turns of to_center, waits, collect and draws chained by join()),
+// ticking the animator headless at 60 Hz. The bytes allocated and not freed
+// must not grow after the first games, and neither must the step rings.
+//
+// grow: a card queues far more steps than its ring holds, after its first
+// steps have moved the ring start. All of them must run, in order.
+//
+// reset: a new game is started with reset() while the last turn is still
+// animating, with its move to the pile chained by join(). The pending callbacks
+// must never run, and the gather and deal must end with the cards where an
+// animator that starts from the same poses puts them.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/CardAnimatorTest.cpp -o CardAnimatorTest
+//   ./CardAnimatorTest [games]
+// The exit code is the number of failed checks.
+
+#include "modules/CardAnimator.hpp"
+
+#include <cstdio>
+#include <cmath>
+#include <random>
+#include <new>
+
+// Bytes allocated and not freed yet: a size header is stored before each block
+static long long liveBytes = 0;
+
+void *operator new(size_t n) {
+	size_t *p = (size_t *)malloc(n + sizeof(max_align_t));
+	if(!p) throw std::bad_alloc();
+	*p = n;
+	liveBytes += n;
+	return (char *)p + sizeof(max_align_t);
+}
+
+void operator delete(void *p) noexcept {
+	if(!p) return;
+	size_t *h = (size_t *)((char *)p - sizeof(max_align_t));
+	liveBytes -= *h;
+	free(h);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	operator delete(p);
+}
+
+// the other forms, so that no block goes through the library allocator
+void *operator new[](size_t n) {
+	return operator new(n);
+}
+
+void *operator new(size_t n, const std::nothrow_t &) noexcept {
+	try {
+		return operator new(n);
+	} catch(...) {
+		return nullptr;
+	}
+}
+
+void *operator new[](size_t n, const std::nothrow_t &t) noexcept {
+	return operator new(n, t);
+}
+
+void operator delete[](void *p) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	operator delete(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+	operator delete(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+	operator delete(p);
+}
+
+// tickBatch() replaces slerp with a corrected nlerp, within ~4e-4 per quaternion component
+static const float Epsilon = 2e-3f;
+
+struct Instance {
+	int id;
+	glm::mat4 Wm;
+	float pad[3];
+};
+
+static int testSimd() {
+#ifndef CARDANIM_SIMD
+	printf("simd: no SIMD path on this target, skipped\n");
+	return 0;
+#else
+	const int Cards = 41;
+	const int Ticks = 20000;
+	std::mt19937 rng(5);
+	std::uniform_real_distribution<float> u(0.0f, 1.0f);
+
+	std::vector<Instance> A(Cards), B(Cards);
+	for(int i = 0; i < Cards; i++) {
+		A[i].Wm = glm::translate(glm::mat4(1), glm::vec3(u(rng), u(rng), u(rng))) *
+				  glm::scale(glm::mat4(1), glm::vec3(0.5f + u(rng)));
+		B[i] = A[i];
+	}
+	CardAnimator batch(&A[0].Wm, sizeof(Instance), Cards);
+	CardAnimator scalar(&B[0].Wm, sizeof(Instance), Cards);
+
+	TimelineDesc desc;
+	for(int s = 0; s < 4; s++) {
+		TimelineKeyDesc k;
+		k.slot = s;
+		k.hasAt = true;
+		k.at = 0.1f * s;
+		k.hasMove = true;
+		k.move = glm::vec3(0.1f * s, 0.5f, 0.0f);
+		k.moveTime = 0.4f;
+		k.hasRotate = true;
+		k.angle = 180.0f;
+		k.axis = glm::vec3(0, 0, 1);
+		k.rotTime = 0.3f;
+		desc.keys.push_back(k);
+	}
+	Timeline tl = CardAnimator::compile(desc);
+
+	float maxDiff = 0.0f;
+	int mismatches = 0;
+	for(int f = 0; f < Ticks; f++) {
+		int r = (int)(rng() % 40);
+		int id = (int)(rng() % Cards);
+		glm::vec3 to(u(rng), u(rng), u(rng)), axis(u(rng) + 0.1f, u(rng), u(rng));
+		float angle = u(rng) * 360.0f, s1 = u(rng) * 0.5f, s2 = u(rng) * 0.5f;
+		bool local = rng() % 2;
+		for(CardAnimator *CA : {&batch, &scalar}) {
+			const glm::mat4 &cur = (CA == &batch ? A : B)[id].Wm;
+			switch(r) {
+			  case 0: CA->addMove(id, cur, to, s1); break;
+			  case 1: CA->addRotate(id, cur, angle, axis, s1, local); break;
+			  case 2: CA->addMoveAndRotate(id, cur, to, s1, angle, axis, s2, local); break;
+			  case 3: CA->addWait(id, cur, s1); break;
+			  case 4: if(f % 5 == 0) CA->addGlobalWait(s1); break;
+			  case 5: if(f % 7 == 0) CA->play(tl, {id, (id + 1) % Cards, (id + 2) % Cards, (id + 3) % Cards}, s1); break;
+			}
+		}
+
+		const float DeltaT = 0.016f;
+		batch.tickBatch(DeltaT);
+		scalar.tickScalar(DeltaT);
+
+		for(int i = 0; i < Cards; i++) {
+			for(int c = 0; c < 4; c++) {
+				for(int k = 0; k < 4; k++) {
+					maxDiff = std::max(maxDiff, std::fabs(A[i].Wm[c][k] - B[i].Wm[c][k]));
+				}
+			}
+			if((batch.isFinished(i) != scalar.isFinished(i)) ||
+			   (batch.remainingSteps(i) != scalar.remainingSteps(i))) {
+				mismatches++;
+			}
+			B[i].Wm = A[i].Wm;
+		}
+		if(batch.anyAnimating() != scalar.anyAnimating()) {
+			mismatches++;
+		}
+	}
+	bool ok = (maxDiff <= Epsilon) && (mismatches == 0);
+	printf("simd: %d ticks of %d cards, max matrix difference %g (epsilon %g), %d state mismatches: %s\n",
+		   Ticks, Cards, maxDiff, Epsilon, mismatches, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+#endif
+}
+
+static int testSoak(int games) {
+	const int Cards = 41;
+	std::vector<glm::mat4> W(Cards, glm::mat4(1));
+	CardAnimator CA(W.data(), sizeof(glm::mat4), Cards);
+	std::map<std::string, Timeline> T = CardAnimator::loadTimelines("assets/models/cardTimelines.json");
+
+	const int WarmUp = 50;
+	long long base = 0, peak = 0;
+	long ticks = 0;
+	for(int g = 0; g < games; g++) {
+		std::vector<int> ids;
+		for(int k = 0; k < 40; k++) ids.push_back((k * 7 + g) % 40);
+		CA.play(T.at("gather"), ids, 0.0f, (g % 2) ? 1.0f : 0.0f);
+		CA.play(T.at("deal"), ids, 0.8f);
+
+		int turns = 0;
+		bool busy = true;
+		std::function<void()> turn = [&]() {
+			if(turns++ >= 17) {
+				busy = false;
+				return;
+			}
+			int a = ids[(turns * 2) % 40], b = ids[(turns * 2 + 1) % 40];
+			CA.play(T.at("to_center"), {a, b});
+			CA.join({a, b}, [&, a, b]() {
+				CA.addWait(a, W[a], 1.0f);
+				CA.addWait(b, W[b], 1.0f);
+				CA.addGlobalWait(0.1f);
+				CA.join({a, b}, [&, a, b]() {
+					int p = ids[(turns + 7) % 40], c = ids[(turns + 9) % 40];
+					CA.play(T.at("collect"), {a, b}, 0.0f, 1.0f, glm::vec3(0.18f, 0.563f, 0.18f));
+					CA.play(T.at("draw_player"), {p});
+					CA.play(T.at("draw_cpu"), {c});
+					CA.join({a, b, p, c}, turn);
+				});
+			});
+		};
+		CA.join({ids[0], ids[1]}, turn);
+		while(busy || CA.anyAnimating()) {
+			CA.tick(1.0f / 60.0f);
+			ticks++;
+		}
+		if(g == WarmUp) base = liveBytes;
+		if(g > WarmUp) peak = std::max(peak, liveBytes);
+	}
+	bool ok = (peak <= base) && (CA.queueCapacity() == 16);
+	printf("soak: %d games, %ld ticks, live heap %lld B after %d games, peak %lld B after, %d steps per ring: %s\n",
+		   games, ticks, base, WarmUp, peak, CA.queueCapacity(), ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+static int testGrow() {
+	const int Cards = 5, Steps = 100;
+	std::vector<glm::mat4> W(Cards, glm::mat4(1));
+	CardAnimator CA(W.data(), sizeof(glm::mat4), Cards);
+	std::vector<int> order;
+	auto target = [](int k) { return glm::vec3(0.01f * k, 0.5f, -0.02f * k); };
+	for(int k = 0; k < 6; k++) {
+		CA.addMove(3, W[3], target(k), 0.05f);
+		CA.then(3, [&order, k]() { order.push_back(k); });
+	}
+	CA.addMove(1, W[1], target(1), 1.0f);
+	for(int f = 0; f < 10; f++) CA.tick(1.0f / 60.0f);
+	for(int k = 6; k < Steps; k++) {
+		CA.addMove(3, W[3], target(k), 0.05f);
+		CA.then(3, [&order, k]() { order.push_back(k); });
+	}
+	size_t queued = CA.remainingSteps(3);
+	while(CA.anyAnimating()) CA.tick(1.0f / 60.0f);
+	bool inOrder = ((int)order.size() == Steps);
+	for(int k = 0; inOrder && (k < Steps); k++) inOrder = (order[k] == k);
+	float diff = glm::length(glm::vec3(W[3][3]) - target(Steps - 1)) + glm::length(glm::vec3(W[1][3]) - target(1));
+	bool ok = inOrder && (diff < 1e-5f);
+	printf("grow: %zu steps queued on a card, rings of %d steps, %zu run in order, final error %g: %s\n",
+		   queued, CA.queueCapacity(), order.size(), diff, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+static int testReset() {
+	const int Cards = 41;
+	std::vector<glm::mat4> W(Cards, glm::mat4(1)), F;
+	CardAnimator CA(W.data(), sizeof(glm::mat4), Cards);
+	std::map<std::string, Timeline> T = CardAnimator::loadTimelines("assets/models/cardTimelines.json");
+	std::vector<int> ids;
+	for(int k = 0; k < 40; k++) ids.push_back(k);
+	CA.play(T.at("gather"), ids, 0.0f, 0.0f);
+	CA.play(T.at("deal"), ids);
+	while(CA.anyAnimating()) CA.tick(1.0f / 60.0f);
+
+	// the last turn: to the center, then a wait, then to the pile
+	int a = 0, b = 1, called = 0;
+	CA.play(T.at("to_center"), {a, b});
+	CA.join({a, b}, [&]() {
+		CA.addWait(a, W[a], 1.0f);
+		CA.addWait(b, W[b], 1.0f);
+		CA.join({a, b}, [&]() {
+			called++;
+			CA.play(T.at("collect"), {a, b}, 0.0f, 1.0f, glm::vec3(0.18f, 0.563f, 0.18f));
+		});
+	});
+	for(int f = 0; f < 20; f++) CA.tick(1.0f / 60.0f);
+
+	// the new game, against a fresh animator from the same poses
+	F = W;
+	CardAnimator Ref(F.data(), sizeof(glm::mat4), Cards);
+	CA.reset();
+	for(CardAnimator *A : {&CA, &Ref}) {
+		A->play(T.at("gather"), ids);
+		A->play(T.at("deal"), ids, T.at("gather").duration);
+	}
+	int ticks = 0;
+	while(CA.anyAnimating() || Ref.anyAnimating()) {
+		CA.tick(1.0f / 60.0f);
+		Ref.tick(1.0f / 60.0f);
+		ticks++;
+	}
+	float maxDiff = 0.0f;
+	for(int i = 0; i < Cards; i++) {
+		for(int c = 0; c < 4; c++) {
+			for(int k = 0; k < 4; k++) {
+				maxDiff = std::max(maxDiff, std::fabs(W[i][c][k] - F[i][c][k]));
+			}
+		}
+	}
+	bool ok = (called == 0) && (maxDiff == 0.0f);
+	printf("reset: %d ticks of the new deal, %d dropped callbacks run, max difference %g: %s\n",
+		   ticks, called, maxDiff, ok ? "ok" : "FAILED");
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+	int games = (argc > 1) ? atoi(argv[1]) : 5000;
+	int failed = 0;
+	failed += testSimd();
+	failed += testSoak(games);
+	failed += testGrow();
+	failed += testReset();
+	return failed;
+}
@@ -0,0 +1,214 @@
+// Scaling benchmark of AnimCrowd: the time per frame of updatePalette() with
+// 1 to 64 characters, evaluated on the worker pool and on the calling thread
+// only.
+//
+// Every character plays the idle, running and waving clips, starting from a
+// different one and switching with a 0.5 s blend every 300 frames. The palettes
+// written by the pool must be identical to the ones of the calling thread. The
+// speedup depends on the cores available, which are reported: with one core
+// the pool can only add its overhead.
+//
+// Then 64 characters in rows from 1 to 17 m from the eye are evaluated with the
+// LOD levels of the game and at full rate, each playing one clip. A level with
+// period p shows the pose p - 1 frames late, so on the last frame of every
+// period the characters of the levels with detail must show the full rate pose
+// of p - 1 frames before. The frames are 1/64 s apart, so that the clip times
+// add up exactly at both rates, and the poses only differ by the rounding of
+// the interpolation (within 1e-4).
+//
+// Last, a crowd with 3 worker threads records a trace of 10 frames to the trace
+// file. Every thread drains the characters once per frame, so the trace must
+// have an "AnimCrowd job" event per frame for the main thread and for each
+// worker, and a "Worker n" name for each of them.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/CrowdBench.cpp -lvulkan -lglfw -pthread -o CrowdBench
+//   ./CrowdBench [threads] [frames] [trace file]
+// threads is given to AnimCrowd::init(): -1 (the default) uses one thread per core.
+// The trace is written to CrowdBench.trace.json by default.
+
+#define STARTER_IMPLEMENTATION
+#include "modules/Starter.hpp"
+
+#define ANIMATIONS_IMPLEMENTATION
+#include "modules/Animations.hpp"
+
+int main(int argc, char **argv) {
+	int threads = (argc > 1) ? atoi(argv[1]) : -1;
+	int frames = (argc > 2) ? atoi(argv[2]) : 2000;
+	std::string traceFile = (argc > 3) ? argv[3] : "CrowdBench.trace.json";
+	const char *clips[3] = {"idle", "running", "waving"};
+	const std::string Base = "Armature|mixamo.com|Layer0";
+	const float DeltaT = 1.0f / 60.0f;
+
+	AssetFile AF[3];
+	Animations AN[3];
+	std::streambuf *old = std::cout.rdbuf(nullptr);
+	for(int k = 0; k < 3; k++) {
+		AF[k].init(std::string("assets/models/") + clips[k] + ".gltf", GLTF);
+		AN[k].init(AF[k]);
+	}
+	std::cout.rdbuf(old);
+	printf("%u cores, threads = %d\n", std::thread::hardware_concurrency(), threads);
+
+	int failed = 0;
+	for(int N : {1, 2, 4, 8, 16, 32, 64}) {
+		AnimCrowd pool, single;
+		std::cout.rdbuf(nullptr);
+		pool.init(AN, 3, Base, threads);
+		single.init(AN, 3, Base, 0);
+		for(int i = 0; i < N; i++) {
+			glm::mat4 W = glm::translate(glm::mat4(1), glm::vec3(i, 0, 0));
+			pool.add({{0, -1, 0, 0}, {0, -1, 0, 1}, {0, -1, 0, 2}}, W);
+			single.add({{0, -1, 0, 0}, {0, -1, 0, 1}, {0, -1, 0, 2}}, W);
+			pool.getBlender(i).Start(i % 3, 0.0f);
+			single.getBlender(i).Start(i % 3, 0.0f);
+		}
+		std::cout.rdbuf(old);
+
+		int rows = 3 * pool.getNTMs();
+		std::vector<std::vector<glm::vec4>> P(N, std::vector<glm::vec4>(rows)), S(N, std::vector<glm::vec4>(rows));
+		std::vector<void *> dP(N), dS(N);
+		for(int i = 0; i < N; i++) {
+			dP[i] = P[i].data();
+			dS[i] = S[i].data();
+		}
+
+		double tPool = 0.0, tSingle = 0.0;
+		bool same = true;
+		for(int f = 0; f < frames; f++) {
+			if(f % 300 == 150) {
+				for(int i = 0; i < N; i++) {
+					pool.getBlender(i).Start((i + f / 300) % 3, 0.5f);
+					single.getBlender(i).Start((i + f / 300) % 3, 0.5f);
+				}
+			}
+			auto a = std::chrono::high_resolution_clock::now();
+			pool.updatePalette(DeltaT, dP.data());
+			auto b = std::chrono::high_resolution_clock::now();
+			single.updatePalette(DeltaT, dS.data());
+			auto c = std::chrono::high_resolution_clock::now();
+			tPool += std::chrono::duration<double>(b - a).count();
+			tSingle += std::chrono::duration<double>(c - b).count();
+			for(int i = 0; (i < N) && same; i++) {
+				same = memcmp(P[i].data(), S[i].data(), rows * sizeof(glm::vec4)) == 0;
+			}
+		}
+		printf("%2d characters: pool %8.1f us/frame, calling thread %8.1f us/frame (x%.2f), %s\n", N,
+			   tPool / frames * 1e6, tSingle / frames * 1e6, tSingle / tPool, same ? "identical" : "MISMATCH");
+		failed += !same;
+		pool.cleanup();
+		single.cleanup();
+	}
+
+	// LOD against full rate; the levels of the game
+	const int NLOD = 64, History = 8;
+	std::vector<AnimLODLevel> levels = {{4.0f, 2, true}, {8.0f, 4, true}, {12.0f, 8, false}};
+	AnimCrowd full, lod;
+	std::cout.rdbuf(nullptr);
+	full.init(AN, 3, Base, threads);
+	lod.init(AN, 3, Base, threads);
+	lod.setLOD(levels);
+	std::vector<int> period(NLOD, 1);
+	std::vector<bool> detail(NLOD, true);
+	for(int i = 0; i < NLOD; i++) {
+		glm::vec3 pos = glm::vec3((i % 4) - 1.5f, 0.0f, 1.0f + (i / 4));
+		glm::mat4 W = glm::translate(glm::mat4(1), pos);
+		full.add({{0, -1, 0, i % 3}}, W);
+		lod.add({{0, -1, 0, i % 3}}, W);
+		for(auto &L : levels) {
+			if(glm::length(pos) >= L.distance) {
+				period[i] = L.period;
+				detail[i] = L.detail;
+			}
+		}
+	}
+	std::cout.rdbuf(old);
+
+	int rows = 3 * lod.getNTMs();
+	std::vector<std::vector<glm::vec4>> P(NLOD, std::vector<glm::vec4>(rows));
+	std::vector<std::vector<std::vector<glm::vec4>>> H(History, P);
+	std::vector<void *> dP(NLOD), dH(NLOD);
+	for(int i = 0; i < NLOD; i++) dP[i] = P[i].data();
+
+	const float LODDeltaT = 1.0f / 64.0f;
+	double tFull = 0.0, tLOD = 0.0;
+	float maxDiff = 0.0f;
+	int checks = 0;
+	for(int f = 0; f < frames; f++) {
+		for(int i = 0; i < NLOD; i++) dH[i] = H[f % History][i].data();
+		auto a = std::chrono::high_resolution_clock::now();
+		full.updatePalette(LODDeltaT, dH.data());
+		auto b = std::chrono::high_resolution_clock::now();
+		lod.updatePalette(LODDeltaT, dP.data());
+		auto c = std::chrono::high_resolution_clock::now();
+		tFull += std::chrono::duration<double>(b - a).count();
+		tLOD += std::chrono::duration<double>(c - b).count();
+		for(int i = 0; i < NLOD; i++) {
+			int p = period[i];
+			if(!detail[i] || (f % p != p - 1)) continue;
+			const std::vector<glm::vec4> &R = H[(f - (p - 1)) % History][i];
+			for(int r = 0; r < rows; r++) {
+				for(int k = 0; k < 4; k++) {
+					maxDiff = std::max(maxDiff, std::fabs(P[i][r][k] - R[r][k]));
+				}
+			}
+			checks++;
+		}
+	}
+	bool lodOk = (checks > 0) && (maxDiff <= 1e-4f);
+	printf("LOD %d characters: full rate %8.1f us/frame, LOD %8.1f us/frame (x%.2f), %d late poses checked, max difference %g: %s\n",
+		   NLOD, tFull / frames * 1e6, tLOD / frames * 1e6, tFull / tLOD, checks, maxDiff, lodOk ? "ok" : "FAILED");
+	failed += !lodOk;
+	full.cleanup();
+	lod.cleanup();
+
+	// the jobs of the threads in a trace
+	const int TraceWorkers = 3, TraceFrames = 10;
+	AnimCrowd traced;
+	Profiler Prof;
+	std::cout.rdbuf(nullptr);
+	traced.init(AN, 3, Base, TraceWorkers);
+	for(int i = 0; i < 8; i++) {
+		traced.add({{0, -1, 0, i % 3}}, glm::translate(glm::mat4(1), glm::vec3(i, 0, 0)));
+	}
+	std::cout.rdbuf(old);
+	traced.setProfiler(&Prof);
+	Prof.startTrace(traceFile, 0);
+	for(int f = 0; f < TraceFrames; f++) {
+		traced.updatePalette(DeltaT, dP.data());
+	}
+	Prof.stopTrace();
+	traced.cleanup();
+
+	std::vector<int> jobs(TraceWorkers + 1, 0);
+	int named = 0;
+	std::ifstream traceIn(traceFile);
+	nlohmann::json J = nlohmann::json::parse(traceIn, nullptr, false);
+	if(!J.is_discarded() && J.contains("traceEvents")) {
+		for(auto &E : J["traceEvents"]) {
+			int tid = E["tid"];
+			if((tid < 0) || (tid > TraceWorkers)) {
+				continue;
+			}
+			if(E["ph"] == "M") {
+				named += (tid > 0) && (E["args"]["name"] == "Worker " + std::to_string(tid));
+			} else if(E["name"] == "AnimCrowd job") {
+				jobs[tid]++;
+			}
+		}
+	}
+	bool traceOk = (named == TraceWorkers);
+	printf("trace %d frames: %d of %d workers named, jobs of the threads:", TraceFrames, named, TraceWorkers);
+	for(int t = 0; t <= TraceWorkers; t++) {
+		printf(" %d", jobs[t]);
+		traceOk = traceOk && (jobs[t] == TraceFrames);
+	}
+	printf(": %s\n", traceOk ? "ok" : "FAILED");
+	failed += !traceOk;
+
+	for(int k = 0; k < 3; k++) {
+		AN[k].cleanup();
+	}
+	return failed;
+}
@@ -0,0 +1,267 @@
+// Offline generator of the signed distance field font used by TextMaker.
+//
+// It reads the glyph rectangles listed in Fonts.txt from the bitmap atlas
+// Fonts.png, computes for every glyph the signed distance to the edge of its
+// fill (red) channel, and packs the distances at a reduced resolution into a
+// single channel atlas. The result is written, together with the glyph
+// metrics, to a compact binary file loaded at runtime by TextMaker::loadFont().
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/FontSDF.cpp -o FontSDF
+//   ./FontSDF tools/Fonts.txt tools/Fonts.png assets/textures/FontsSDF.bin
+//
+// File layout (little endian):
+//   char    magic[4] = "BSDF"
+//   int32   version, minChar, maxChar, texW, texH, nFaces
+//   float   scale	(atlas texels per layout pixel)
+//   float   spread	(distance in layout pixels mapped to the [0.5,1] range)
+//   per face: int32 lineHeight, then (maxChar - minChar + 1) glyphs of
+//             int16 x, y (atlas texels), width, height, xoffset, yoffset, xadvance (layout pixels)
+//   int32   size of the deflated pixels, followed by the deflated texW x texH R8 pixels
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+#define SDEFL_IMPLEMENTATION
+#include <sdefl.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+
+static const float Scale = 0.5f;	// atlas texels per source pixel
+static const float Spread = 6.0f;	// source pixels covered by half the distance range
+static const int Padding = 1;		// empty texels around each glyph in the atlas
+static const int AtlasW = 1024;
+
+struct Glyph {
+	int x, y, width, height, xoffset, yoffset, xadvance;
+	int ax, ay;		// position in the SDF atlas
+};
+
+struct Face {
+	std::string name;
+	int lineHeight;
+	std::vector<Glyph> G;
+};
+
+// One dimensional squared distance transform (Felzenszwalb and Huttenlocher)
+static void edt1(const float *f, float *d, int n, int *v, float *z) {
+	int k = 0;
+	v[0] = 0;
+	z[0] = -INFINITY;
+	z[1] = INFINITY;
+	for(int q = 1; q < n; q++) {
+		float s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * (q - v[k]));
+		while(s <= z[k]) {
+			k--;
+			s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0f * (q - v[k]));
+		}
+		k++;
+		v[k] = q;
+		z[k] = s;
+		z[k + 1] = INFINITY;
+	}
+	k = 0;
+	for(int q = 0; q < n; q++) {
+		while(z[k + 1] < q) k++;
+		d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+	}
+}
+
+// Squared distance of every pixel to the nearest pixel where seed is true
+static std::vector<float> edt2(const std::vector<bool> &seed, int w, int h) {
+	const float Far = 1e20f;
+	int n = std::max(w, h);
+	std::vector<float> D(w * h), f(n), d(n), z(n + 1);
+	std::vector<int> v(n);
+	for(int i = 0; i < w * h; i++) {
+		D[i] = seed[i] ? 0.0f : Far;
+	}
+	for(int x = 0; x < w; x++) {
+		for(int y = 0; y < h; y++) f[y] = D[y * w + x];
+		edt1(f.data(), d.data(), h, v.data(), z.data());
+		for(int y = 0; y < h; y++) D[y * w + x] = d[y];
+	}
+	for(int y = 0; y < h; y++) {
+		edt1(&D[y * w], d.data(), w, v.data(), z.data());
+		memcpy(&D[y * w], d.data(), w * sizeof(float));
+	}
+	return D;
+}
+
+// Signed distance in source pixels of a glyph cell (positive inside), taken from
+// the coverage of the red channel. Pixels outside the cell are considered empty.
+static std::vector<float> glyphSDF(const stbi_uc *img, int imgW, const Glyph &g) {
+	int w = g.width, h = g.height;
+	std::vector<bool> in(w * h), out(w * h);
+	std::vector<float> cov(w * h);
+	for(int y = 0; y < h; y++) {
+		for(int x = 0; x < w; x++) {
+			float c = img[((g.y + y) * imgW + g.x + x) * 4] / 255.0f;
+			cov[y * w + x] = c;
+			in[y * w + x] = c >= 0.5f;
+			out[y * w + x] = c < 0.5f;
+		}
+	}
+	std::vector<float> Din = edt2(in, w, h), Dout = edt2(out, w, h);
+	std::vector<float> S(w * h);
+	for(int i = 0; i < w * h; i++) {
+		// distance between pixel centers, corrected by the coverage of the edge pixels
+		float d = in[i] ? sqrtf(Dout[i]) - 0.5f : 0.5f - sqrtf(Din[i]);
+		if(fabsf(d) < 1.0f) {
+			d = cov[i] - 0.5f;
+		}
+		S[i] = d;
+	}
+	return S;
+}
+
+static bool readMetrics(const std::string &file, int &minChar, int &maxChar, std::vector<Face> &faces) {
+	std::ifstream in(file);
+	if(!in) {
+		return false;
+	}
+	std::string line;
+	while(std::getline(in, line)) {
+		if(line.empty() || (line[0] == '#')) continue;
+		std::istringstream ls(line);
+		std::string key;
+		ls >> key;
+		if(key == "chars") {
+			ls >> minChar >> maxChar;
+		} else if(key == "face") {
+			Face F;
+			ls >> F.name >> F.lineHeight;
+			faces.push_back(F);
+		} else if(!faces.empty()) {
+			Glyph g{};
+			g.x = std::stoi(key);
+			ls >> g.y >> g.width >> g.height >> g.xoffset >> g.yoffset >> g.xadvance;
+			faces.back().G.push_back(g);
+		}
+	}
+	for(auto &F : faces) {
+		if((int)F.G.size() != maxChar - minChar + 1) {
+			std::cout << "Face " << F.name << " has " << F.G.size() << " glyphs\n";
+			return false;
+		}
+	}
+	return !faces.empty();
+}
+
+template <class T> static void put(std::vector<unsigned char> &out, T v) {
+	unsigned char *p = (unsigned char *)&v;
+	out.insert(out.end(), p, p + sizeof(T));
+}
+
+int main(int argc, char **argv) {
+	if(argc != 4) {
+		std::cout << "Usage: FontSDF <metrics.txt> <atlas.png> <out.bin>\n";
+		return 1;
+	}
+	int minChar = 0, maxChar = -1;
+	std::vector<Face> faces;
+	if(!readMetrics(argv[1], minChar, maxChar, faces)) {
+		std::cout << "Cannot read the glyph metrics from " << argv[1] << "\n";
+		return 1;
+	}
+	int imgW, imgH, imgC;
+	stbi_uc *img = stbi_load(argv[2], &imgW, &imgH, &imgC, STBI_rgb_alpha);
+	if(!img) {
+		std::cout << "Cannot read " << argv[2] << "\n";
+		return 1;
+	}
+
+	// Shelf packing of the glyphs, tallest first
+	std::vector<Glyph *> order;
+	for(auto &F : faces) {
+		for(auto &g : F.G) {
+			if(g.width > 0 && g.height > 0) order.push_back(&g);
+		}
+	}
+	std::stable_sort(order.begin(), order.end(), [](const Glyph *a, const Glyph *b) {
+		return a->height > b->height;
+	});
+	int px = Padding, py = Padding, shelfH = 0;
+	for(Glyph *g : order) {
+		int gw = (int)ceilf(g->width * Scale), gh = (int)ceilf(g->height * Scale);
+		if(px + gw + Padding > AtlasW) {
+			px = Padding;
+			py += shelfH + Padding;
+			shelfH = 0;
+		}
+		g->ax = px;
+		g->ay = py;
+		px += gw + Padding;
+		shelfH = std::max(shelfH, gh);
+	}
+	int texW = AtlasW, texH = 1;
+	while(texH < py + shelfH + Padding) texH *= 2;
+	std::cout << "Glyphs: " << order.size() << ", used rows: " << py + shelfH << "\n";
+
+	// Distances are resampled with a box filter and encoded as 0.5 + d / (2 Spread)
+	std::vector<unsigned char> pixels(texW * texH, 0);
+	int step = (int)roundf(1.0f / Scale);
+	for(Glyph *g : order) {
+		std::vector<float> S = glyphSDF(img, imgW, *g);
+		int gw = (int)ceilf(g->width * Scale), gh = (int)ceilf(g->height * Scale);
+		for(int y = 0; y < gh; y++) {
+			for(int x = 0; x < gw; x++) {
+				float d = 0.0f;
+				for(int sy = 0; sy < step; sy++) {
+					for(int sx = 0; sx < step; sx++) {
+						int ix = x * step + sx, iy = y * step + sy;
+						// beyond the cell, step away from the last column or row
+						int cx = std::min(ix, g->width - 1), cy = std::min(iy, g->height - 1);
+						d += S[cy * g->width + cx] - (float)((ix - cx) + (iy - cy));
+					}
+				}
+				d /= (float)(step * step);
+				float v = std::clamp(0.5f + d / (2.0f * Spread), 0.0f, 1.0f);
+				pixels[(g->ay + y) * texW + g->ax + x] = (unsigned char)lroundf(v * 255.0f);
+			}
+		}
+	}
+	stbi_image_free(img);
+
+	std::vector<unsigned char> out;
+	out.insert(out.end(), {'B', 'S', 'D', 'F'});
+	put<int32_t>(out, 1);
+	put<int32_t>(out, minChar);
+	put<int32_t>(out, maxChar);
+	put<int32_t>(out, texW);
+	put<int32_t>(out, texH);
+	put<int32_t>(out, (int32_t)faces.size());
+	put<float>(out, Scale);
+	put<float>(out, Spread);
+	for(auto &F : faces) {
+		put<int32_t>(out, F.lineHeight);
+		for(auto &g : F.G) {
+			for(int v : {g.ax, g.ay, g.width, g.height, g.xoffset, g.yoffset, g.xadvance}) {
+				put<int16_t>(out, (int16_t)v);
+			}
+		}
+	}
+	static struct sdefl sdf;
+	std::vector<unsigned char> packed(sdefl_bound(texW * texH));
+	int packedSize = sdeflate(&sdf, packed.data(), pixels.data(), texW * texH, SDEFL_LVL_MAX);
+	put<int32_t>(out, packedSize);
+	out.insert(out.end(), packed.begin(), packed.begin() + packedSize);
+
+	FILE *f = fopen(argv[3], "wb");
+	if(!f || fwrite(out.data(), 1, out.size(), f) != out.size()) {
+		std::cout << "Cannot write " << argv[3] << "\n";
+		return 1;
+	}
+	fclose(f);
+	std::cout << faces.size() << " faces, atlas " << texW << "x" << texH << ", "
+			  << out.size() << " bytes\n";
+	return 0;
+}
@@ -0,0 +1,305 @@
+// Checks that the HUD of TextMaker does not allocate in steady state, run as a
+// standalone program.
+//
+// TextMaker needs the engine only to create its GPU objects: the stand-ins
+// below replace Starter.hpp, keep the HUD mesh in host memory and count the
+// draws, so the HUD path runs without a device. A counting operator new
+// records every allocation. The frames write the text as the PLAYING branch
+// of main.cpp does: the menu labels cleared, the FPS counter once a second,
+// the scores every frame, the turn message shown for 2 seconds at every turn
+// and the game over message at the end. They run through updateCommandBuffer()
+// and updateHud() on three swapchain images in turn, with the text in its own
+// command buffer as in the game, then drawn inline in a host render pass.
+// After a warm up:
+// alloc: no allocation may happen in the frames that record no command buffer,
+//   and a command buffer is recorded only when a message is shown or hidden;
+// copies: the copies of the mesh written incrementally for each image must be
+//   equal to a full rewrite of all the slots;
+// hidden: hiding and showing a block must record the command buffer again,
+//   with one draw less while the block is hidden.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/HudAllocTest.cpp -o HudAllocTest
+//   ./HudAllocTest [frames]
+// The exit code is the number of failed checks.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <new>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+#include <glm/glm.hpp>
+
+#define SINFL_IMPLEMENTATION
+#include <sinfl.h>
+
+// Stand-ins of the engine, with only what TextMaker uses
+typedef void *VkCommandBuffer;
+typedef int VkFormat;
+enum {
+	VK_VERTEX_INPUT_RATE_VERTEX, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R8_UNORM,
+	VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT,
+	VK_COMPARE_OP_LESS_OR_EQUAL, VK_CULL_MODE_NONE, VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	AT_SURFACE_NOAA_DEPTH, OTHER, UV
+};
+const int MAX_FRAMES_IN_FLIGHT = 2;
+
+struct PoolSizes {
+	int texturesInPool = 0;
+	int setsInPool = 0;
+};
+
+// a submitted command buffer is recorded at once for image 0, to count its draws
+struct BaseProject {
+	PoolSizes DPSZs;
+	uint64_t frameCount = 0;
+	int recordedDraws = 0;
+	void *params = nullptr;
+	void (*onErase)(void *) = nullptr;
+	int getSwapChainImageCount() { return 3; }
+	void submitCommandBuffer(const char *, int, void (*populate)(VkCommandBuffer, int, void *),
+							 void *_params, void (*_onErase)(void *) = nullptr) {
+		if(onErase != nullptr) {
+			onErase(params);
+		}
+		params = _params;
+		onErase = _onErase;
+		recordedDraws = 0;
+		populate(nullptr, 0, params);
+	}
+};
+
+struct VertexBinding {
+	int stride;
+};
+
+struct VertexDescriptor {
+	std::vector<VertexBinding> Bindings;
+	void init(BaseProject *, std::vector<std::vector<long>>, std::vector<std::vector<long>>) {
+		Bindings = {{(int)sizeof(float) * 4}};
+	}
+	void cleanup() {}
+};
+
+struct DescriptorSetLayout {
+	void init(BaseProject *, std::vector<std::vector<long>>) {}
+	void cleanup() {}
+};
+
+struct AttachmentProperties {
+	int loadOp;
+};
+
+struct RenderPass {
+	int width, height;
+	AttachmentProperties properties[2];
+	template<class... A> void init(A...) {}
+	template<class... A> static int getStandardAttchmentsProperties(A...) { return 0; }
+	void create() {}
+	void cleanup() {}
+	void destroy() {}
+	void begin(VkCommandBuffer, int) {}
+	void end(VkCommandBuffer) {}
+};
+
+struct Pipeline {
+	int pipelineLayout = 0;
+	void init(BaseProject *, VertexDescriptor *, const char *, const char *,
+			  std::vector<DescriptorSetLayout *>, std::vector<std::vector<long>>) {}
+	void setCompareOp(int) {}
+	void setCullMode(int) {}
+	void setTransparency(bool) {}
+	void create(RenderPass *) {}
+	void cleanup() {}
+	void destroy() {}
+	void bind(VkCommandBuffer) {}
+};
+
+// the vertex buffer is a host copy, written through mapVertices()
+struct Model {
+	std::vector<unsigned char> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<unsigned char> buffer;
+	void initMesh(BaseProject *, VertexDescriptor *, bool printDebug = true) { buffer = vertices; }
+	unsigned char *mapVertices() { return buffer.data(); }
+	void bind(VkCommandBuffer) {}
+	void cleanup() {}
+};
+
+struct Texture {
+	void init(BaseProject *, const unsigned char *, int, int, int, VkFormat, bool = true) {}
+	int getViewAndSampler() { return 0; }
+	void cleanup() {}
+};
+
+struct DescriptorSet {
+	void init(BaseProject *, DescriptorSetLayout *, std::vector<int>) {}
+	template<class... A> void bind(A...) {}
+	void cleanup() {}
+};
+
+template<class... A> void vkCmdPushConstants(A...) {}
+template<class... A> void vkCmdDrawIndexed(A...) {}
+
+std::vector<char> readFile(const std::string &filename) {
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);
+	if(!file.is_open()) {
+		std::cout << "Failed to open: " << filename << "\n";
+		throw std::runtime_error("failed to open file!");
+	}
+	size_t fileSize = (size_t)file.tellg();
+	std::vector<char> buffer(fileSize);
+	file.seekg(0);
+	file.read(buffer.data(), fileSize);
+	return buffer;
+}
+
+#define TEXTMAKER_IMPLEMENTATION
+#include "modules/TextMaker.hpp"
+
+static long allocations = 0;
+
+void *operator new(size_t n) {
+	allocations++;
+	void *p = malloc(n ? n : 1);
+	if(!p) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t n) {
+	return operator new(n);
+}
+
+void operator delete(void *p) noexcept {
+	free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p) noexcept {
+	free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+	free(p);
+}
+
+// Writes the text of frame f, as main.cpp does while playing. Returns true if a
+// message was shown or hidden.
+static bool playFrame(TextMaker &txt, int f, int frames, int fps, int player, int cpu, int turn, int over) {
+	const int TurnFrames = 150, MessageFrames = 120;
+	
+	txt.print(0.0f, 0.2f, "", 10, "CO", false, false, true, TAL_CENTER, TRH_CENTER, TRV_MIDDLE);
+	txt.print(0.0f, -0.2f, "", 11, "CO", false, false, true, TAL_CENTER, TRH_CENTER, TRV_MIDDLE);
+	if(f % 60 == 0) {
+		txt.hudPrintf(fps, "FPS: %.1f\nCulled: %d/%d", 60.0f + (f % 7) * 0.37f, f % 11, 42);
+	}
+	txt.hudPrintf(player, "Player: %d", f / 200);
+	txt.hudPrintf(cpu, "CPU: %d", f / 130);
+	
+	if(f % TurnFrames == 0) {
+		txt.hudPrintf(turn, "%s", (f / TurnFrames) % 2 ? "CPU's turn" : "Your turn");
+	}
+	bool gameOver = (f >= frames * 3 / 4);
+	if(gameOver) {
+		txt.hudPrintf(over, "GAME OVER - %s", (f / 200 > f / 130) ? "YOU WON" : "CPU WON");
+	}
+	
+	bool wasShown = txt.Hud[turn].visible, wasOver = txt.Hud[over].visible;
+	txt.hudShow(turn, f % TurnFrames < MessageFrames);
+	txt.hudShow(over, gameOver);
+	return (txt.Hud[turn].visible != wasShown) || (txt.Hud[over].visible != wasOver);
+}
+
+// Runs the game frames with the text in its own command buffer, or inline in host
+static int run(int frames, RenderPass *host) {
+	const int WarmUp = 100;
+	const char *mode = (host == nullptr) ? "own pass" : "inline";
+	int failed = 0;
+
+	BaseProject BP;
+	TextMaker txt;
+	txt.init(&BP, 800, 600, 10000, host);
+	txt.print(0.0f, 0.2f, "EXIT", 10, "CO", false, false, true, TAL_CENTER, TRH_CENTER, TRV_MIDDLE);
+	txt.print(0.0f, -0.2f, "PLAY", 11, "CO", false, false, true, TAL_CENTER, TRH_CENTER, TRV_MIDDLE);
+	int fps = txt.hudBlock(1.0f, 1.0f, 48, "CO", false, false, true, TAL_RIGHT, TRH_RIGHT, TRV_BOTTOM);
+	int player = txt.hudBlock(-0.9f, 0.8f, 16, "CO", false, false, true);
+	int cpu = txt.hudBlock(0.9f, -0.8f, 16, "CO", false, false, true, TAL_RIGHT, TRH_RIGHT, TRV_TOP);
+	int turn = txt.hudBlock(0.5f, 0.1f, 16, "CO", false, false, true, TAL_CENTER, TRH_CENTER, TRV_BOTTOM);
+	int over = txt.hudBlock(0.0f, 0.0f, 24, "CO", false, false, false, TAL_CENTER, TRH_CENTER, TRV_MIDDLE);
+	txt.hudShow(turn, false);
+	txt.hudShow(over, false);
+
+	long steady = 0;
+	int recorded = 0, changes = 0;
+	for(int f = 0; f < frames; f++) {
+		int img = f % BP.getSwapChainImageCount();
+		long before = allocations;
+		bool changed = playFrame(txt, f, frames, fps, player, cpu, turn, over);
+		bool record = txt.updateCommandBuffer();
+		if(record && (host != nullptr)) {
+			txt.populateInline(nullptr, img);
+		}
+		txt.updateHud(img);
+		BP.frameCount++;
+		if(f >= WarmUp) {
+			if(!record) {
+				steady += allocations - before;
+			}
+			recorded += record;
+			changes += changed;
+		}
+	}
+	// playFrame() itself is counted too: a frame that records nothing must not allocate anywhere
+	bool allocOk = (steady == 0) && (recorded == changes);
+	printf("alloc (%s): %ld allocations in %d frames after the warm up, %d command buffers recorded for %d messages shown or hidden: %s\n",
+		   mode, steady, frames - WarmUp, recorded, changes, allocOk ? "ok" : "FAILED");
+	failed += !allocOk;
+
+	std::vector<unsigned char> incremental = txt.H->buffer;
+	for(int img = 0; img < BP.getSwapChainImageCount(); img++) {
+		for(HudBlock &B : txt.Hud) {
+			txt.writeHudSlots(B, img, 0, B.capacity);
+		}
+	}
+	size_t differ = 0;
+	for(size_t i = 0; i < incremental.size(); i++) {
+		differ += (incremental[i] != txt.H->buffer[i]);
+	}
+	printf("copies (%s): %zu of %zu bytes differ from a full rewrite: %s\n",
+		   mode, differ, incremental.size(), differ == 0 ? "ok" : "FAILED");
+	failed += (differ != 0);
+
+	int draws[2];
+	for(int show = 0; show < 2; show++) {
+		txt.hudShow(cpu, show);
+		bool record = txt.updateCommandBuffer();
+		if(host != nullptr) {
+			BP.recordedDraws = 0;
+			txt.populateInline(nullptr, 0);
+		}
+		draws[show] = record ? BP.recordedDraws : -1;
+	}
+	bool hiddenOk = (draws[0] >= 0) && (draws[1] == draws[0] + 1);
+	printf("hidden (%s): %d draws with a block hidden, %d when shown again: %s\n",
+		   mode, draws[0], draws[1], hiddenOk ? "ok" : "FAILED");
+	failed += !hiddenOk;
+
+	txt.localCleanup();
+	return failed;
+}
+
+int main(int argc, char **argv) {
+	int frames = (argc > 1) ? atoi(argv[1]) : 3000;
+	RenderPass host;
+	return run(frames, nullptr) + run(frames, &host);
+}
@@ -0,0 +1,90 @@
+// Benchmark of SkeletalAnimation::Sample() on the rig of the character, and
+// check of its 4x4 product kernel.
+//
+// kernel: multiplies random transforms with the SSE2/NEON kernel used by
+// Sample() and with glm's operator*, and reports how many results differ and
+// by how much (none, unless the compiler contracts the products and sums of
+// one of them into FMAs).
+// sample: plays the idle, running and waving clips, switching clip with a
+// 0.5 s blend every 300 frames, and reports the time per frame of Sample()
+// for the whole skeleton.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/JointBench.cpp -lvulkan -lglfw -pthread -o JointBench
+//   ./JointBench [frames]
+
+#define STARTER_IMPLEMENTATION
+#include "modules/Starter.hpp"
+
+#define ANIMATIONS_IMPLEMENTATION
+#include "modules/Animations.hpp"
+
+#include <random>
+
+static void kernel() {
+	const int Pairs = 100000;
+	std::mt19937 rng(3);
+	std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+	auto transform = [&]() {
+		glm::quat q = glm::normalize(glm::quat(u(rng), u(rng), u(rng), u(rng)));
+		return glm::translate(glm::mat4(1), glm::vec3(u(rng), u(rng), u(rng)) * 50.0f) *
+			   glm::mat4_cast(q) * glm::scale(glm::mat4(1), glm::vec3(1.0f + 0.5f * u(rng)));
+	};
+	int differ = 0;
+	float maxDiff = 0.0f;
+	for(int i = 0; i < Pairs; i++) {
+		glm::mat4 A = transform(), B = transform(), R;
+		mulJointMat(A, B, R);
+		glm::mat4 G = A * B;
+		float d = 0.0f;
+		for(int c = 0; c < 4; c++) {
+			for(int r = 0; r < 4; r++) {
+				d = std::max(d, std::fabs(R[c][r] - G[c][r]) / std::max(1.0f, std::fabs(G[c][r])));
+			}
+		}
+		differ += (d > 0.0f);
+		maxDiff = std::max(maxDiff, d);
+	}
+	printf("kernel: %d products, %d differ from glm, max relative difference %g\n", Pairs, differ, maxDiff);
+}
+
+int main(int argc, char **argv) {
+	int frames = (argc > 1) ? atoi(argv[1]) : 20000;
+	const char *clips[3] = {"idle", "running", "waving"};
+	const float DeltaT = 1.0f / 60.0f;
+
+	kernel();
+
+	AssetFile AF[3];
+	Animations AN[3];
+	SkeletalAnimation SA;
+	std::streambuf *old = std::cout.rdbuf(nullptr);
+	for(int k = 0; k < 3; k++) {
+		AF[k].init(std::string("assets/models/") + clips[k] + ".gltf", GLTF);
+		AN[k].init(AF[k]);
+	}
+	SA.init(AN, 3, "Armature|mixamo.com|Layer0");
+	std::cout.rdbuf(old);
+
+	AnimBlender AB;
+	AB.init({{0, -1, 0, 0}, {0, -1, 0, 1}, {0, -1, 0, 2}});
+	double t = 0.0, check = 0.0;
+	for(int f = 0; f < frames; f++) {
+		if(f % 300 == 0) {
+			AB.Start((f / 300) % 3, 0.5f);
+		}
+		AB.Advance(DeltaT);
+		auto a = std::chrono::high_resolution_clock::now();
+		SA.Sample(AB);
+		std::vector<glm::mat4> *TMs = SA.getTransformMatrices();
+		t += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - a).count();
+		check += (*TMs)[f % TMs->size()][3].x;
+	}
+	printf("sample: %d joints, %d frames: %.2f us/frame, check %g\n", SA.getNTMs(), frames, t / frames * 1e6, check);
+
+	SA.cleanup();
+	for(int k = 0; k < 3; k++) {
+		AN[k].cleanup();
+	}
+	return 0;
+}
@@ -0,0 +1,195 @@
+// Benchmark and robustness check of the streaming MGCG reader of Starter.hpp.
+//
+// make writes a synthetic MGCG file of the given size: a GLTF-like mix of JSON
+// text, smooth float attributes and noise, deflated and AES-CBC encrypted with
+// the key of the assets. read loads a file with readMGCGFile(), or with the
+// previous whole-file path (read, decrypt_cbc, sinflate) when --whole is given,
+// and reports the throughput and the peak resident memory of the process: run
+// each read in its own process, so the peak belongs to that path only.
+// corrupt truncates and alters a file in many ways, and checks that every
+// damaged copy is either rejected with an exception or read back in full.
+//
+// Build and run from the Briscola directory:
+//   c++ -O2 -std=c++17 -Iinclude tools/MGCGBench.cpp -lvulkan -lglfw -pthread -o MGCGBench
+//   ./MGCGBench make big.mgcg 64
+//   ./MGCGBench read big.mgcg
+//   ./MGCGBench read big.mgcg --whole
+//   ./MGCGBench corrupt big.mgcg
+
+#define STARTER_IMPLEMENTATION
+#include "modules/Starter.hpp"
+
+#define SDEFL_IMPLEMENTATION
+#include <sdefl.h>
+
+#include <sys/resource.h>
+#include <random>
+
+static const unsigned char IV[16] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+};
+
+static std::vector<unsigned char> mgcgKey() {
+	return plusaes::key_from_string(&"CG2023SkelKey128");
+}
+
+static long peakRSSKB() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return usage.ru_maxrss / 1024;
+#else
+	return usage.ru_maxrss;
+#endif
+}
+
+static bool writeFile(const std::string &file, const std::vector<unsigned char> &data) {
+	std::ofstream ofs(file, std::ios::binary);
+	ofs.write((const char *)data.data(), data.size());
+	return (bool)ofs;
+}
+
+// Encrypts a 16 bytes size header followed by the deflated data
+static std::vector<unsigned char> encodeMGCG(const std::vector<unsigned char> &plain) {
+	static struct sdefl sdf;
+	std::vector<unsigned char> text(16 + sdefl_bound((int)plain.size()), 0);
+	snprintf((char *)text.data(), 16, "%d", (int)plain.size());
+	int packed = sdeflate(&sdf, text.data() + 16, plain.data(), (int)plain.size(), SDEFL_LVL_DEF);
+	text.resize(16 + packed);
+
+	std::vector<unsigned char> key = mgcgKey();
+	unsigned long size = plusaes::get_padded_encrypted_size(text.size());
+	std::vector<unsigned char> enc(size);
+	plusaes::encrypt_cbc(text.data(), text.size(), &key[0], key.size(), &IV, &enc[0], size, true);
+	return enc;
+}
+
+static int make(const std::string &file, int MB) {
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+	std::vector<unsigned char> plain;
+	size_t target = (size_t)MB * 1024 * 1024;
+	plain.reserve(target + 65536);
+	int part = 0;
+	while(plain.size() < target) {
+		switch(part++ % 3) {
+		  case 0: {		// accessor and node descriptions
+			for(int i = 0; i < 256; i++) {
+				char line[160];
+				int n = snprintf(line, sizeof(line), "{\"bufferView\":%d,\"componentType\":5126,\"count\":%d,"
+							"\"type\":\"VEC3\",\"name\":\"mesh_%d\"},\n", i, 1000 + i * 7, part * 256 + i);
+				plain.insert(plain.end(), line, line + n);
+			}
+			break;
+		  }
+		  case 1: {		// smooth positions and normals
+			for(int i = 0; i < 16384; i++) {
+				float v = sinf(i * 0.01f) * 0.5f + (i % 97) * 0.001f;
+				unsigned char *b = (unsigned char *)&v;
+				plain.insert(plain.end(), b, b + 4);
+			}
+			break;
+		  }
+		  default: {	// animation samples with noise
+			for(int i = 0; i < 4096; i++) {
+				float v = noise(rng);
+				unsigned char *b = (unsigned char *)&v;
+				plain.insert(plain.end(), b, b + 4);
+			}
+			break;
+		  }
+		}
+	}
+	plain.resize(target);
+	std::vector<unsigned char> enc = encodeMGCG(plain);
+	if(!writeFile(file, enc)) {
+		std::cout << "Cannot write " << file << "\n";
+		return 1;
+	}
+	std::cout << file << ": " << target << " B, " << enc.size() << " B encoded\n";
+	return 0;
+}
+
+// The loader before the streaming reader: the whole file, the whole decrypted text
+// and the inflated data are in memory at the same time
+static std::vector<char> readWhole(const std::string &file) {
+	std::vector<char> enc = readFile(file);
+	std::vector<unsigned char> key = mgcgKey();
+	unsigned long padded = 0;
+	std::vector<unsigned char> dec(enc.size());
+	plusaes::decrypt_cbc((unsigned char *)enc.data(), enc.size(), &key[0], key.size(), &IV,
+						 &dec[0], dec.size(), &padded);
+	int size = 0;
+	sscanf((char *)&dec[0], "%d", &size);
+	std::vector<char> out(size);
+	sinflate(out.data(), size, &dec[16], (int)dec.size() - 16);
+	return out;
+}
+
+static int read(const std::string &file, bool whole) {
+	long rss0 = peakRSSKB();
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<char> data = whole ? readWhole(file) : readMGCGFile(file);
+	double dt = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	long rss1 = peakRSSKB();
+	unsigned sum = 0;
+	for(size_t i = 0; i < data.size(); i += 4096) sum += (unsigned char)data[i];
+	printf("%s: %zu B in %.1f ms, %.1f MB/s, peak RSS %ld KB (+%ld KB over %zu KB of output), check %u\n",
+		   whole ? "whole file" : "streaming", data.size(), dt * 1000.0, data.size() / (1024.0 * 1024.0) / dt,
+		   rss1, rss1 - rss0, data.size() / 1024, sum);
+	return 0;
+}
+
+static int corrupt(const std::string &file) {
+	std::vector<char> good = readFile(file);
+	std::vector<char> ref = readMGCGFile(file);
+	std::string tmp = file + ".corrupt";
+	std::mt19937 rng(42);
+	int rejected = 0, accepted = 0, wrong = 0, n = 0;
+	auto tryRead = [&](const std::vector<char> &bad) {
+		writeFile(tmp, std::vector<unsigned char>(bad.begin(), bad.end()));
+		std::streambuf *old = std::cout.rdbuf(nullptr);
+		try {
+			std::vector<char> d = readMGCGFile(tmp);
+			accepted++;
+			wrong += (d.size() != ref.size());
+		} catch(const std::exception &e) {
+			rejected++;
+		}
+		std::cout.rdbuf(old);
+		n++;
+	};
+	// truncations, at block boundaries and inside blocks
+	for(size_t len : {(size_t)0, (size_t)15, (size_t)16, (size_t)17, (size_t)32, good.size() / 3,
+					  good.size() / 2, good.size() - 17, good.size() - 16, good.size() - 1}) {
+		tryRead(std::vector<char>(good.begin(), good.begin() + std::min(len, good.size())));
+	}
+	// flipped bytes: the AES-CBC decryption turns each into 17 damaged bytes of the deflate stream
+	for(int i = 0; i < 200; i++) {
+		std::vector<char> bad = good;
+		int flips = 1 + (int)(rng() % 4);
+		for(int k = 0; k < flips; k++) {
+			bad[rng() % bad.size()] ^= (char)(1 + rng() % 255);
+		}
+		tryRead(bad);
+	}
+	remove(tmp.c_str());
+	printf("%d damaged files: %d rejected, %d read (%d with a wrong size)\n", n, rejected, accepted, wrong);
+	return wrong ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+	std::string mode = (argc > 2) ? argv[1] : "";
+	if((mode == "make") && (argc == 4)) {
+		return make(argv[2], atoi(argv[3]));
+	}
+	if(mode == "read") {
+		return read(argv[2], (argc > 3) && (strcmp(argv[3], "--whole") == 0));
+	}
+	if(mode == "corrupt") {
+		return corrupt(argv[2]);
+	}
+	std::cout << "Usage: MGCGBench make <out.mgcg> <MB> | read <file.mgcg> [--whole] | corrupt <file.mgcg>\n";
+	return 1;
+}